@@ -5,17 +5,63 @@
  * Freq B: 151.484996MHz
  * A - B = 16.999kHz
  * RX Filter BW: 6.057kHz
+ *
+ * Host link on the stdio UART, see RPi/bridge/radio.h:
+ *   P <n>  switch both radios to profile n
+ *   Q      RSSI_LEVEL and LQI of the receiver
+ *   T      link telemetry since the last T, one line per radio
+ *   S      scan the band, one line of max-hold RSSI_LEVEL per channel
+ *   F <n>  move both frequencies n scan channels (4.25kHz) from A / B
+ *   M <csma> <rssi_th> <prescaler> <max_bo>
+ *          0: persistent TX (point-to-point), 1: listen before talk;
+ *          ERR with diversity or TDMA on, and for 1 while hopping
+ *   C      listen-before-talk / TDMA counters
+ *   D <slot_us> <nslots> <guard_us> <mask>
+ *          TDMA slots, 'mask' the ones that are ours, nslots 1..32 and the
+ *          guards inside the slot; D 0 0 0 0 turns it off. ERR with
+ *          diversity or while hopping
+ *   Y <age_us>  the current TDMA superframe started age_us ago
+ *   H <dwell_us> <from> <n> <shift>...
+ *          hop the pair over the n shifts (1..12) from dwell 'from' on;
+ *          H 0 stops. ERR with diversity, LBT or TDMA
+ *   J <index> <age_us>  dwell 'index' started age_us ago, no answer
+ *   V <on> receive diversity: the TX radio listens on freq A as well and
+ *          is keyed per frame over RTS/CTS
+ *   A <on> FC_OFFSET tracking of the RX radio, on from the start
+ *   O      FC_OFFSET and its drift history, one line per entry
+ *   G <bps> <pn9>  bit modem on tx_spirit / rx_spirit, timer and DMA
+ *          clocked; pn9 1 sends PN9 on tx_spirit, G 0 stops
+ *   K      bit modem counters, and the clock recovery's on its samples
+ *   Z <hex> <bits> <errors>  sync word the clock recovery counts frames
+ *          by, the bridge's 0x2D 0xD4 on air to start with
+ *   B <bps> PN9 bit error rate test on the RX radio's data out, off the
+ *          bit modem at bps; B 0 stops, every B starts the counts over
+ *   E      bit error counts of the test since the last B
+ *   W      whitening check: a packet of zeros from the TX radio with the
+ *          chip's whitening, as the RX radio receives it, against PN9
+ *   X <n>  AES engine of the TX radio: the FIPS-197 test block, then n
+ *          blocks timed
+ *   U <n>  buffer pools: blocks out, the most out at once, refusals; n > 0
+ *          first takes and gives back blocks n times against an interrupt
  */
 #include "mbed.h"
 #include <cstdint>
 #include <cstdio>
 
+#include "cdr.h"       // with cdr.c, from RPi/bridge
+
 #define SPI_WRITE_OP    0x00
 #define SPI_READ_OP     0x01
 #define SPI_COMMAND_OP  0x80
 
 #define SPI_DUMMY_BYTE  0x00
 
+// MC_STATE[0] STATE field values
+#define STATE_READY     0x03
+#define STATE_LOCK      0x0F
+#define STATE_RX        0x33
+#define STATE_TX        0x5F
+
 // Function prototypes
 static uint16_t spirit_spi_write(uint8_t address, uint8_t data);
 static uint8_t spirit_spi_read(uint8_t address);
@@ -92,6 +138,28 @@ static uint8_t spirit_spi_read(uint8_t address)
     return read_value;
 }
 
+// Writes 'len' consecutive registers in one transaction
+static void spirit_spi_write_burst(uint8_t address, const uint8_t *buf, int len)
+{
+    cs_low();
+    spi.write(SPI_WRITE_OP);
+    spi.write(address);
+    for (int i = 0; i < len; i++)
+        spi.write(buf[i]);
+    cs_high();
+}
+
+// Reads 'len' consecutive registers in one transaction
+static void spirit_spi_read_burst(uint8_t address, uint8_t *buf, int len)
+{
+    cs_low();
+    spi.write(SPI_READ_OP);
+    spi.write(address);
+    for (int i = 0; i < len; i++)
+        buf[i] = spi.write(SPI_DUMMY_BYTE);
+    cs_high();
+}
+
 static uint16_t spirit_spi_command(uint8_t command)
 {
     uint16_t status = 0x00;
@@ -322,63 +390,2496 @@ void configure_freq_b(void)
     ThisThread::sleep_for(200ms);
 }
 
-void configure_tx(void)
+//
+// Radio profiles
+//
+
+// The RPi tty rate is the symbol rate on air, DATARATE stays at ~2.16x it
+// as in the original 9600 baud setting. Same order as rate_profiles[] in
+// RPi/bridge/rate.c, profile 3 is what configure_common_registers() sets.
+typedef struct radio_profile {
+    int     baud;
+    uint8_t mod1;       // DATARATE_M
+    uint8_t mod0;       // GFSK, BT 0.5, DATARATE_E
+    uint8_t fdev0;
+    uint8_t chflt;      // 0x26 --> 12.115kHz ; 0x27 --> 6.057kHz ; 0x28 --> 3.028kHz
+} radio_profile;
+
+static const radio_profile profiles[] = {
+    {  1200, 0xA3, 0x56, 0x02, 0x28 },   //  2.6 kbps, 1.0kHz deviation
+    {  2400, 0xA3, 0x57, 0x02, 0x27 },   //  5.2 kbps, 1.0kHz deviation
+    {  4800, 0xA3, 0x58, 0x10, 0x27 },   // 10.4 kbps, 1.6kHz deviation
+    {  9600, 0xA3, 0x59, 0x12, 0x27 },   // 20.8 kbps, 2.0kHz deviation
+    { 19200, 0xA3, 0x5A, 0x22, 0x26 },   // 41.6 kbps, 4.0kHz deviation, fits the 17kHz duplex spacing
+};
+
+#define PROFILE_COUNT   (int)(sizeof(profiles) / sizeof(profiles[0]))
+
+int current_profile = 3;
+
+// Set by the listen-before-talk MAC: the TX radio idles in READY and is
+// keyed per frame instead of sitting in persistent TX
+bool tx_keyed = false;
+
+// Receive diversity: the keyed TX radio idles in RX on the RX radio's
+// channel instead of in READY
+bool diversity = false;
+
+// Polls MC_STATE instead of sleeping, a transition takes tens of us
+static bool spirit_wait_state(uint8_t state)
+{
+    for (int i = 0; i < 1000; i++) {
+        if ((spirit_spi_read(0xC1) >> 1) == state)
+            return true;
+        wait_us(10);
+    }
+
+    return false;
+}
+
+static void spirit_write_profile(const radio_profile *p)
+{
+    spirit_spi_command(0x62);       // READY
+    spirit_wait_state(STATE_READY);
+
+    spirit_spi_write(0x1A, p->mod1);
+    spirit_spi_write(0x1B, p->mod0);
+    spirit_spi_write(0x1C, p->fdev0);
+    spirit_spi_write(0x1D, p->chflt);
+}
+
+// Both radios retuned and back in RX / TX within a few ms
+bool apply_profile(int n)
 {
+    if (n < 0 || n >= PROFILE_COUNT)
+        return false;
+
+    cs = CS_RX;
+    spirit_write_profile(&profiles[n]);
+    spirit_spi_command(0x65);       // LOCKRX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(0x61);       // RX
+    bool rx_ok = spirit_wait_state(STATE_RX);
+
     cs = CS_TX;
-    configure_common_registers();
+    spirit_write_profile(&profiles[n]);
+    bool tx_ok = true;
+    if (diversity) {
+        spirit_spi_command(0x65);   // LOCKRX
+        spirit_wait_state(STATE_LOCK);
+        spirit_spi_command(0x61);   // RX
+        tx_ok = spirit_wait_state(STATE_RX);
+    }
+    else if (!tx_keyed) {
+        spirit_spi_command(0x66);   // LOCKTX
+        spirit_wait_state(STATE_LOCK);
+        spirit_spi_command(0x60);   // TX
+        tx_ok = spirit_wait_state(STATE_TX);
+    }
 
-    configure_freq_b();
+    current_profile = n;
+    return rx_ok && tx_ok;
+}
 
-    start_tx();
-    printf("\r\n ...TX part configured...");
+//
+// End of block
+//
 
-    uint8_t part_num    = spirit_spi_read(0xF0);
-    uint8_t version_num = spirit_spi_read(0xF1);
+//
+// Link telemetry
+//
 
-    printf("\r\n SPI part_num (=1): %d", part_num);
-    printf("\r\n SPI version_num (=48): %d", version_num);
+#define SAMPLE_PERIOD       100ms
+#define RSSI_HIST_BINS      16          // RSSI_LEVEL / 16, 8dB per bin
+
+// One register run holds it all: MC_STATE[1] at 0xC0 ... RSSI_LEVEL at 0xC8
+#define LINK_REGS_START     0xC0
+#define LINK_REGS_COUNT     9
+
+typedef struct link_window {
+    uint32_t samples;
+    uint8_t  rssi_min, rssi_max;
+    uint32_t rssi_sum;
+    uint8_t  lqi_min, lqi_max;
+    uint32_t lqi_sum;
+    uint32_t pqi_sum;
+    uint32_t sqi_sum;
+    int8_t   afc_min, afc_max;
+    int32_t  afc_sum;
+    uint8_t  state;
+    uint32_t state_errors;              // samples not in the expected RX / TX state
+    uint16_t rssi_hist[RSSI_HIST_BINS];
+} link_window;
+
+// The sampler thread and the host link share the SPI bus and 'cs'
+Mutex radio_lock;
+
+Thread sampler_thread;
+EventQueue sampler_queue;
+
+link_window windows[2];                 // 0 RX radio, 1 TX radio
+
+static void window_reset(link_window *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->rssi_min = 0xFF;
+    w->lqi_min  = 0xFF;
+    w->afc_min  = 127;
+    w->afc_max  = -128;
 }
 
-void configure_rx(void)
+static void window_add(link_window *w, const uint8_t *regs, uint8_t expected_state)
+{
+    uint8_t state = regs[1] >> 1;       // MC_STATE[0]
+    int8_t  afc   = (int8_t)regs[4];    // AFC_CORR
+    uint8_t pqi   = regs[5];            // LINK_QUALIF[2]
+    uint8_t sqi   = regs[6] & 0x7F;     // LINK_QUALIF[1]
+    uint8_t lqi   = regs[7] >> 4;       // LINK_QUALIF[0]
+    uint8_t rssi  = regs[8];            // RSSI_LEVEL
+
+    w->samples++;
+    w->rssi_sum += rssi;
+    w->lqi_sum  += lqi;
+    w->pqi_sum  += pqi;
+    w->sqi_sum  += sqi;
+    w->afc_sum  += afc;
+
+    if (rssi < w->rssi_min) w->rssi_min = rssi;
+    if (rssi > w->rssi_max) w->rssi_max = rssi;
+    if (lqi < w->lqi_min)   w->lqi_min = lqi;
+    if (lqi > w->lqi_max)   w->lqi_max = lqi;
+    if (afc < w->afc_min)   w->afc_min = afc;
+    if (afc > w->afc_max)   w->afc_max = afc;
+
+    w->rssi_hist[rssi / 16]++;
+
+    w->state = state;
+    if (state != expected_state)
+        w->state_errors++;
+}
+
+static void afc_sample(const uint8_t *regs);
+
+// Two 11-byte SPI transactions every SAMPLE_PERIOD
+static void sample_radios(void)
 {
+    uint8_t regs[LINK_REGS_COUNT];
+
+    radio_lock.lock();
+
     cs = CS_RX;
-    configure_common_registers();
+    spirit_spi_read_burst(LINK_REGS_START, regs, LINK_REGS_COUNT);
+    window_add(&windows[0], regs, STATE_RX);
+    afc_sample(regs);
 
-    configure_freq_a();
+    cs = CS_TX;
+    spirit_spi_read_burst(LINK_REGS_START, regs, LINK_REGS_COUNT);
+    window_add(&windows[1], regs, diversity ? STATE_RX : STATE_TX);
 
-    start_rx();
-    printf("\r\n ...RX part configured...");
+    radio_lock.unlock();
+}
 
-    uint8_t part_num    = spirit_spi_read(0xF0);
-    uint8_t version_num = spirit_spi_read(0xF1);
+// Prints the current windows and starts new ones
+void report_telemetry(void)
+{
+    const char *names[2] = { "rx", "tx" };
+    link_window w[2];
+
+    radio_lock.lock();
+    memcpy(w, windows, sizeof(w));
+    window_reset(&windows[0]);
+    window_reset(&windows[1]);
+    radio_lock.unlock();
+
+    for (int r = 0; r < 2; r++) {
+        printf("\r\nT %s %lu %u %lu %u %u %lu %u %lu %lu %d %ld %d %u %lu",
+               names[r], (unsigned long)w[r].samples,
+               w[r].rssi_min, (unsigned long)w[r].rssi_sum, w[r].rssi_max,
+               w[r].lqi_min, (unsigned long)w[r].lqi_sum, w[r].lqi_max,
+               (unsigned long)w[r].pqi_sum, (unsigned long)w[r].sqi_sum,
+               w[r].afc_min, (long)w[r].afc_sum, w[r].afc_max,
+               w[r].state, (unsigned long)w[r].state_errors);
+
+        for (int b = 0; b < RSSI_HIST_BINS; b++)
+            printf(" %u", w[r].rssi_hist[b]);
+    }
+    printf("\r\n");
+}
 
-    printf("\r\n SPI part_num (=1): %d", part_num); 
-    printf("\r\n SPI version_num (=48): %d", version_num); 
+void start_sampler(void)
+{
+    window_reset(&windows[0]);
+    window_reset(&windows[1]);
+
+    sampler_queue.call_every(SAMPLE_PERIOD, sample_radios);
+    sampler_thread.start(callback(&sampler_queue, &EventQueue::dispatch_forever));
 }
 
-int main()
+//
+// End of block
+//
+
+//
+// Spectrum scan
+//
+
+// Channels are SYNT words relative to freq A. One SYNT LSB is ~5.96Hz and
+// freq B sits 2852 LSBs above A; a quarter of that is the scan step, so
+// A and B both fall on the grid, 4 channels apart. The SYNT field is bits
+// 28:3 of SYNT3..SYNT0, BS in bits 2:0 and WCP in 31:29 stay as they are.
+#define SYNT_FREQ_A         0x6C1E108D      // configure_freq_a()
+#define SCAN_STEP           713             // SYNT LSBs, 4.25kHz
+#define SCAN_STEP_HZ        4250
+#define SCAN_CHANNELS       48              // 204kHz around freq A
+#define SCAN_CHANNEL_A      24
+#define SCAN_CHANNEL_B      28
+#define SCAN_PASSES         2
+#define SCAN_READS          4
+#define SCAN_SETTLE_US      1000            // RSSI filter after entering RX
+#define SCAN_READ_US        250
+
+// RX on A, TX on B; swap them together with configure_freq_a/b()
+int rx_channel = SCAN_CHANNEL_A;
+int tx_channel = SCAN_CHANNEL_B;
+
+uint8_t noise_map[SCAN_CHANNELS];
+
+static void spirit_synt_regs(int channel, uint8_t *regs)
 {
-    serial_init(&stdio_uart, PA_9, PA_10);
-    stdio_uart_inited = 1; 
- 
-    cs = INITIAL;
-    cs_tx  = 1;
-    cs_rx = 1;
-    sdn = 0;
+    uint32_t synt = (uint32_t)((int32_t)SYNT_FREQ_A + (channel - SCAN_CHANNEL_A) * (SCAN_STEP << 3));
 
-    spi.frequency(1000000);
-    spi.format(8, 0);
-    
-    printf("\r\n -------------------------------");
-    configure_rx();
-    configure_tx();
-    printf("\r\n Ready!");
-    printf("\r\n -------------------------------");
+    regs[0] = (uint8_t)(synt >> 24);
+    regs[1] = (uint8_t)(synt >> 16);
+    regs[2] = (uint8_t)(synt >> 8);
+    regs[3] = (uint8_t)synt;
+}
+
+static void spirit_write_synt(int channel)
+{
+    uint8_t regs[4];
+
+    spirit_synt_regs(channel, regs);
+    spirit_spi_write_burst(0x08, regs, 4);
+}
+
+// READY, new SYNT, lock and back to RX / TX in well under a ms, where the
+// start-up sequence spends 200ms after every write
+static bool spirit_tune(int channel, bool rx)
+{
+    spirit_spi_command(0x62);                   // READY
+    spirit_wait_state(STATE_READY);
 
-    for (int i = 0; i < 100; i++) {
-        printf("\n.");
-        ThisThread::sleep_for(500ms);
+    spirit_write_synt(channel);
+    if (!rx && tx_keyed)
+        return true;                            // keyed per frame
+
+    spirit_spi_command(rx ? 0x65 : 0x66);       // LOCKRX / LOCKTX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(rx ? 0x61 : 0x60);       // RX / TX
+    return spirit_wait_state(rx ? STATE_RX : STATE_TX);
+}
+
+// The TX radio back to where it idles: its own channel, or listening on
+// the RX radio's for diversity
+static bool spirit_tx_idle(int rx, int tx)
+{
+    cs = CS_TX;
+    return diversity ? spirit_tune(rx, true) : spirit_tune(tx, false);
+}
+
+// Max-hold RSSI_LEVEL of every channel with our own carrier off. About
+// 2.3ms a channel, 0.25s for the band. The caller holds radio_lock.
+void scan_band(void)
+{
+    memset(noise_map, 0, sizeof(noise_map));
+
+    cs = CS_TX;
+    spirit_spi_command(0x62);       // READY, stops the carrier
+    spirit_wait_state(STATE_READY);
+
+    cs = CS_RX;
+    for (int pass = 0; pass < SCAN_PASSES; pass++) {
+        for (int ch = 0; ch < SCAN_CHANNELS; ch++) {
+            spirit_tune(ch, true);
+            wait_us(SCAN_SETTLE_US);
+
+            for (int i = 0; i < SCAN_READS; i++) {
+                uint8_t rssi = spirit_spi_read(0xC8);
+                if (rssi > noise_map[ch])
+                    noise_map[ch] = rssi;
+                wait_us(SCAN_READ_US);
+            }
+        }
     }
-    
+
+    cs = CS_RX;
+    spirit_tune(rx_channel, true);
+    spirit_tx_idle(rx_channel, tx_channel);
+}
+
+// Both frequencies moved by the same number of channels keep the duplex
+// spacing; the other end moves by the same amount
+bool hopping = false;
+
+bool set_channel_shift(int shift)
+{
+    int rx = (rx_channel < tx_channel ? SCAN_CHANNEL_A : SCAN_CHANNEL_B) + shift;
+    int tx = (rx_channel < tx_channel ? SCAN_CHANNEL_B : SCAN_CHANNEL_A) + shift;
+
+    if (rx < 0 || rx >= SCAN_CHANNELS || tx < 0 || tx >= SCAN_CHANNELS || hopping)
+        return false;
+
+    cs = CS_RX;
+    bool rx_ok = spirit_tune(rx, true);
+    bool tx_ok = spirit_tx_idle(rx, tx);
+
+    rx_channel = rx;
+    tx_channel = tx;
+    return rx_ok && tx_ok;
+}
+
+//
+// End of block
+//
+
+//
+// Listen before talk
+//
+
+// Persistent TX keeps the carrier up for good, fine for one point-to-point
+// pair but every frame collides once a third node shares the channel. In
+// CSMA mode the TX radio idles in READY and every frame is keyed on its
+// own, over the modem control lines of the data tty: the bridge raises
+// RTS, the TX command runs the chip's CCA and backoff engine, and CTS goes
+// up once the radio is in TX. After the frame RTS drops, the carrier too.
+// Without a clear channel after max_bo backoffs CTS stays down.
+#define RSSI_TH_REG         0x22
+#define CSMA_CONFIG1_REG    0x66            // BU_PRESCALER[7:2], CCA_PERIOD[1:0]
+#define CSMA_CONFIG0_REG    0x67            // CCA_LENGTH[7:4], NBACKOFF_MAX[2:0]
+#define CSMA_SEED_REG       0x64            // BU_COUNTER_SEED, 2 bytes
+#define PROTOCOL1_REG       0x51
+#define PROTOCOL0_REG       0x52
+#define IRQ_MASK1_REG       0x92
+#define IRQ_STATUS_REG      0xFA            // 4 bytes, cleared by reading
+
+#define CSMA_ON             0x04            // PROTOCOL[1]
+#define PROTOCOL0_PERS      0x0B            // NACK_TX, PERS_RX, PERS_TX
+#define PROTOCOL0_KEYED     0x0A            // the same without PERS_TX
+#define CCA_PERIOD          0x00            // 64 bit periods per CCA, ~3ms at 9600
+#define CCA_LENGTH          0x01            // one CCA period
+#define IRQ_MAX_BO_CCA      0x00000800      // IRQ_STATUS bit 11
+#define KEY_TIMEOUT_US      200000
+
+typedef struct mac_config {
+    bool    csma;
+    uint8_t rssi_th;                        // RSSI_LEVEL units
+    uint8_t prescaler;                      // 0..63
+    uint8_t max_bo;                         // 0..7
+} mac_config;
+
+typedef struct mac_counters {
+    uint32_t requests;                      // RTS edges
+    uint32_t granted;                       // clear channel, CTS up
+    uint32_t busy;                          // gave up after max_bo backoffs
+    uint32_t timeouts;                      // neither within KEY_TIMEOUT_US
+    uint32_t overruns;                      // TDMA: still on air at the end of the slot
+    uint32_t turn_us_max;                   // TDMA: LOCKTX to STATE_TX, the guard time floor
+} mac_counters;
+
+InterruptIn rts(PB_0);
+DigitalOut  cts(PB_1);
+
+mac_config   mac = { false, 0, 0, 0 };
+mac_counters mac_stats;
+
+static uint32_t spirit_irq_status(void)
+{
+    uint8_t b[4];
+
+    spirit_spi_read_burst(IRQ_STATUS_REG, b, 4);
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+// On the sampler thread: the SPI bus is only used under radio_lock
+static void mac_key(void)
+{
+    Timer t;
+
+    radio_lock.lock();
+    cs = CS_TX;
+    mac_stats.requests++;
+
+    spirit_irq_status();
+    spirit_spi_command(0x66);       // LOCKTX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(0x60);       // TX, once CCA finds the channel clear
+    t.start();
+
+    while (1) {
+        if ((spirit_spi_read(0xC1) >> 1) == STATE_TX) {
+            cts = 1;
+            mac_stats.granted++;
+            break;
+        }
+        if (spirit_irq_status() & IRQ_MAX_BO_CCA) {
+            mac_stats.busy++;
+            break;
+        }
+        if (t.elapsed_time().count() > KEY_TIMEOUT_US) {
+            spirit_spi_command(0x62);
+            mac_stats.timeouts++;
+            break;
+        }
+        wait_us(50);
+    }
+
+    radio_lock.unlock();
+}
+
+int tdma_cutoff_id = 0;
+
+static void mac_release(void)
+{
+    radio_lock.lock();
+    if (tdma_cutoff_id) {
+        sampler_queue.cancel(tdma_cutoff_id);
+        tdma_cutoff_id = 0;
+    }
+    cts = 0;
+    cs = CS_TX;
+    spirit_spi_command(0x62);       // READY, carrier off
+    spirit_wait_state(STATE_READY);
+    if (diversity)
+        spirit_tune(rx_channel, true);
+    radio_lock.unlock();
+}
+
+static void tdma_key(void);
+static bool tdma_active(void);
+static void div_key(void);
+
+static void mac_rts_rise(void)
+{
+    if (diversity)
+        sampler_queue.call(div_key);
+    else if (mac.csma)
+        sampler_queue.call(mac_key);
+    else if (tx_keyed)
+        sampler_queue.call(tdma_key);
+}
+
+static void mac_rts_fall(void)
+{
+    if (tx_keyed)
+        sampler_queue.call(mac_release);
+}
+
+// Not with diversity or TDMA, which key the TX radio their own way and
+// turn it back to persistent TX once they are off; no CSMA while hopping.
+// The caller holds radio_lock.
+bool mac_configure(const mac_config *c)
+{
+    if (c->prescaler > 63 || c->max_bo > 7 || diversity || tdma_active() || (c->csma && hopping))
+        return false;
+
+    cs = CS_TX;
+    spirit_spi_command(0x62);       // READY
+    spirit_wait_state(STATE_READY);
+
+    if (c->csma) {
+        // Noise on the receiver seeds the backoff, different on every node
+        uint8_t seed[2];
+        cs = CS_RX;
+        seed[0] = spirit_spi_read(0xC8);
+        seed[1] = spirit_spi_read(0xC4) ^ 0x5A;
+        cs = CS_TX;
+
+        spirit_spi_write_burst(CSMA_SEED_REG, seed, 2);
+        spirit_spi_write(RSSI_TH_REG, c->rssi_th);
+        spirit_spi_write(CSMA_CONFIG1_REG, (c->prescaler << 2) | CCA_PERIOD);
+        spirit_spi_write(CSMA_CONFIG0_REG, (CCA_LENGTH << 4) | c->max_bo);
+        spirit_spi_write(IRQ_MASK1_REG, IRQ_MAX_BO_CCA >> 8);
+        spirit_spi_write(PROTOCOL0_REG, PROTOCOL0_KEYED);
+        spirit_spi_write(PROTOCOL1_REG, CSMA_ON);
+        tx_keyed = true;
+        cts = 0;
+    }
+    else {
+        spirit_spi_write(PROTOCOL1_REG, 0x00);
+        spirit_spi_write(PROTOCOL0_REG, PROTOCOL0_PERS);
+        spirit_spi_write(IRQ_MASK1_REG, 0x00);
+        tx_keyed = false;
+
+        spirit_spi_command(0x66);   // LOCKTX
+        spirit_wait_state(STATE_LOCK);
+        spirit_spi_command(0x60);   // TX
+        spirit_wait_state(STATE_TX);
+        cts = 1;
+    }
+
+    mac = *c;
+    return true;
+}
+
+void start_mac(void)
+{
+    cts = 1;                        // persistent TX, always clear
+    rts.rise(mac_rts_rise);
+    rts.fall(mac_rts_fall);
+}
+
+//
+// End of block
+//
+
+//
+// TDMA
+//
+
+// The bridges run the superframe (RPi/bridge/tdma.h): the master's beacon
+// opens it and hands out the slots. The firmware keeps the slot clock so
+// transmissions start and stop on a timer, not on USB latency: D sets the
+// slots, Y aligns the clock to the last beacon. RTS outside our window
+// waits for the next one, a frame still on air when the window closes is
+// cut off. Keying is that of the CSMA mode without the CCA.
+typedef struct tdma_config {
+    uint32_t slot_us;
+    uint32_t nslots;
+    uint32_t guard_us;                      // at both ends of every slot
+    uint32_t mask;                          // bit n: slot n is ours
+} tdma_config;
+
+#define TDMA_SLOTS_MAX  32                  // the bits of 'mask'
+
+tdma_config tdma = { 0, 0, 0, 0 };
+Timer   tdma_clock;
+int64_t tdma_origin_us = 0;                 // tdma_clock time of a superframe start, under radio_lock
+int     tdma_key_id = 0;                    // tdma_key() waiting for our window
+
+static bool tdma_active(void)
+{
+    return tdma.nslots != 0;
+}
+
+static int64_t tdma_now_us(void)
+{
+    return tdma_clock.elapsed_time().count();
+}
+
+// Microseconds until our next window opens, 0 inside one, -1 without a
+// slot; 'left' gets the time from then to the end of the window. The
+// caller holds radio_lock and TDMA is on.
+static int64_t tdma_next_window(int64_t *left)
+{
+    int64_t slot  = tdma.slot_us;
+    int64_t frame = slot * tdma.nslots;
+    int64_t pos   = (tdma_now_us() - tdma_origin_us) % frame;
+
+    if (pos < 0)
+        pos += frame;
+
+    for (int64_t k = pos / slot; k <= pos / slot + tdma.nslots; k++) {
+        if (!(tdma.mask & (1u << (k % tdma.nslots))))
+            continue;
+
+        int64_t open  = k * slot + tdma.guard_us;
+        int64_t close = (k + 1) * slot - tdma.guard_us;
+        if (pos >= close)
+            continue;
+
+        *left = close - (pos > open ? pos : open);
+        return pos > open ? 0 : open - pos;
+    }
+
+    return -1;
+}
+
+static void tdma_cutoff(void)
+{
+    radio_lock.lock();
+    tdma_cutoff_id = 0;
+    if (cts.read()) {
+        mac_stats.overruns++;
+        cts = 0;
+        cs = CS_TX;
+        spirit_spi_command(0x62);   // READY, carrier off
+        spirit_wait_state(STATE_READY);
+    }
+    radio_lock.unlock();
+}
+
+// On the sampler thread, like mac_key(). D may have turned TDMA off or
+// changed the slots since RTS rose or the wait was set.
+static void tdma_key(void)
+{
+    int64_t left, wait;
+    Timer t;
+
+    // This call stands for any still waiting
+    radio_lock.lock();
+    if (tdma_key_id) {
+        sampler_queue.cancel(tdma_key_id);
+        tdma_key_id = 0;
+    }
+    if (!tx_keyed || mac.csma || !tdma.nslots || !tdma.slot_us || !rts.read() ||
+        (wait = tdma_next_window(&left)) < 0) {
+        radio_lock.unlock();
+        return;
+    }
+    if (wait > 0) {
+        tdma_key_id = sampler_queue.call_in(std::chrono::microseconds(wait), tdma_key);
+        radio_lock.unlock();
+        return;
+    }
+
+    cs = CS_TX;
+    mac_stats.requests++;
+
+    t.start();
+    spirit_spi_command(0x66);       // LOCKTX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(0x60);       // TX
+    if (spirit_wait_state(STATE_TX)) {
+        uint32_t turn = (uint32_t)t.elapsed_time().count();
+        if (turn > mac_stats.turn_us_max)
+            mac_stats.turn_us_max = turn;
+
+        cts = 1;
+        mac_stats.granted++;
+        tdma_cutoff_id = sampler_queue.call_in(std::chrono::microseconds(left), tdma_cutoff);
+    }
+    else {
+        mac_stats.timeouts++;
+    }
+    radio_lock.unlock();
+}
+
+// slot_us 0 turns it off. Not with diversity or while hopping, they
+// key and retune the TX radio on their own. The caller holds radio_lock.
+bool tdma_configure(const tdma_config *c)
+{
+    mac_config off = { false, 0, 0, 0 };
+    tdma_config none = { 0, 0, 0, 0 };
+
+    if (c->slot_us != 0 && (c->nslots == 0 || c->nslots > TDMA_SLOTS_MAX ||
+                            c->slot_us <= 2 * (uint64_t)c->guard_us || diversity || hopping))
+        return false;
+
+    // Nothing of the old slots may fire under the new ones
+    if (tdma_key_id) {
+        sampler_queue.cancel(tdma_key_id);
+        tdma_key_id = 0;
+    }
+    if (tdma_cutoff_id) {
+        sampler_queue.cancel(tdma_cutoff_id);
+        tdma_cutoff_id = 0;
+    }
+
+    // Off when it was not on leaves the MAC or diversity in use alone
+    if (c->slot_us == 0) {
+        bool was_on = tdma_active();
+        tdma = none;
+        return !was_on || mac_configure(&off);
+    }
+    tdma = *c;
+
+    cs = CS_TX;
+    spirit_spi_command(0x62);       // READY
+    spirit_wait_state(STATE_READY);
+    spirit_spi_write(PROTOCOL1_REG, 0x00);
+    spirit_spi_write(PROTOCOL0_REG, PROTOCOL0_KEYED);
+
+    mac = off;
+    tx_keyed = true;
+    cts = 0;
+    tdma_clock.start();
+    return true;
+}
+
+//
+// Frequency hopping
+//
+
+// The bridges agree on the hop sequence and the dwell clock
+// (RPi/bridge/fhss.h), the firmware hops on a timer of its own so that a
+// hop lands within the guard of the other end's instead of a USB round
+// trip later: H loads a table of pair shifts, J aligns the clock. The
+// first H, H 0 as well, calibrates the VCO on every grid channel; while
+// hopping the automatic calibration is off and a hop writes the stored
+// SYNT bytes and VCO word, so it costs the SPI writes and the lock.
+#define PROTOCOL2_REG           0x50
+#define PROTOCOL2_AUTOCAL       0x06        // RCO and VCO calibration, configure_common_registers()
+#define PROTOCOL2_STORED        0x04        // RCO only, the VCO word comes from VCO_CALIBR_IN
+#define VCO_CALIBR_IN2_REG      0x6D        // TX word
+#define VCO_CALIBR_IN1_REG      0x6E        // RX word
+#define VCO_CALIBR_DATA_REG     0xE5
+#define HOP_MAX                 12
+
+typedef struct hop_channel {
+    uint8_t synt[4];
+    uint8_t vco[2];                         // as the RX radio, as the TX radio
+} hop_channel;
+
+typedef struct hop_table {
+    uint32_t from;                          // first dwell
+    int      n;
+    int8_t   shift[HOP_MAX];
+} hop_table;
+
+hop_channel hop_cal[SCAN_CHANNELS];
+bool        hop_calibrated = false;
+hop_table   hop_seq = { 0, 0, { 0 } };
+hop_table   hop_next = { 0, 0, { 0 } };     // takes over at its 'from', n 0 none
+uint32_t    hop_dwell_us = 0;
+Timer       hop_clock;
+int64_t     hop_origin_us = 0;              // hop_clock time of dwell 0
+int         hop_event_id = 0;
+int         hop_rx_base = SCAN_CHANNEL_A;   // the pair at shift 0
+int         hop_tx_base = SCAN_CHANNEL_B;
+uint32_t    hop_count = 0;
+uint32_t    hop_lock_errors = 0;
+
+// VCO word of a locked channel. The caller holds radio_lock and has
+// selected the radio.
+static uint8_t spirit_calibrate(int channel, bool rx)
+{
+    spirit_spi_command(0x62);                   // READY
+    spirit_wait_state(STATE_READY);
+    spirit_spi_write(PROTOCOL2_REG, PROTOCOL2_AUTOCAL);
+    spirit_write_synt(channel);
+
+    spirit_spi_command(rx ? 0x65 : 0x66);       // LOCKRX / LOCKTX, calibrates
+    spirit_wait_state(STATE_LOCK);
+    uint8_t vco = spirit_spi_read(VCO_CALIBR_DATA_REG) & 0x7F;
+
+    spirit_spi_command(0x62);
+    spirit_wait_state(STATE_READY);
+    return vco;
+}
+
+// About 2ms a channel and radio, 0.2s for the grid, the carrier is off
+// meanwhile
+static void hop_calibrate(void)
+{
+    for (int ch = 0; ch < SCAN_CHANNELS; ch++) {
+        spirit_synt_regs(ch, hop_cal[ch].synt);
+        cs = CS_RX;
+        hop_cal[ch].vco[0] = spirit_calibrate(ch, true);
+        cs = CS_TX;
+        hop_cal[ch].vco[1] = spirit_calibrate(ch, false);
+    }
+
+    hop_calibrated = true;
+    cs = CS_RX;
+    spirit_tune(rx_channel, true);
+    spirit_tx_idle(rx_channel, tx_channel);
+}
+
+static bool spirit_hop(int channel, bool rx)
+{
+    const hop_channel *h = &hop_cal[channel];
+
+    spirit_spi_command(0x62);                   // READY
+    spirit_wait_state(STATE_READY);
+    spirit_spi_write_burst(0x08, h->synt, 4);
+    spirit_spi_write(rx ? VCO_CALIBR_IN1_REG : VCO_CALIBR_IN2_REG, h->vco[rx ? 0 : 1]);
+    if (!rx && tx_keyed)
+        return true;
+
+    spirit_spi_command(rx ? 0x65 : 0x66);       // LOCKRX / LOCKTX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(rx ? 0x61 : 0x60);       // RX / TX
+    return spirit_wait_state(rx ? STATE_RX : STATE_TX);
+}
+
+static void hop_to(int shift)
+{
+    int rx = hop_rx_base + shift;
+    int tx = hop_tx_base + shift;
+
+    cs = CS_RX;
+    bool rx_ok = spirit_hop(rx, true);
+    cs = CS_TX;
+    bool tx_ok = spirit_hop(tx, false);
+
+    rx_channel = rx;
+    tx_channel = tx;
+    hop_count++;
+    if (!rx_ok || !tx_ok)
+        hop_lock_errors++;
+}
+
+// On the sampler thread, at every dwell boundary
+static void hop_tick(void)
+{
+    radio_lock.lock();
+    hop_event_id = 0;
+    if (!hopping) {
+        radio_lock.unlock();
+        return;
+    }
+
+    int64_t pos = hop_clock.elapsed_time().count() - hop_origin_us;
+    uint32_t k = pos < 0 ? 0 : (uint32_t)(pos / hop_dwell_us);
+
+    if (hop_next.n && k >= hop_next.from) {
+        hop_seq = hop_next;
+        hop_next.n = 0;
+    }
+    uint32_t i = k >= hop_seq.from ? (k - hop_seq.from) % hop_seq.n : 0;
+    hop_to(hop_seq.shift[i]);
+
+    int64_t next = (int64_t)(k + 1) * hop_dwell_us - pos;
+    hop_event_id = sampler_queue.call_in(std::chrono::microseconds(next), hop_tick);
+    radio_lock.unlock();
+}
+
+// Not with diversity or under a MAC, like they are not while hopping.
+// The caller holds radio_lock.
+bool hop_load(uint32_t dwell_us, const hop_table *t)
+{
+    if (dwell_us == 0 || t->n < 1 || t->n > HOP_MAX || diversity || tdma.nslots || mac.csma)
+        return false;
+    for (int i = 0; i < t->n; i++) {
+        int rx = hop_rx_base + t->shift[i], tx = hop_tx_base + t->shift[i];
+        if (rx < 0 || rx >= SCAN_CHANNELS || tx < 0 || tx >= SCAN_CHANNELS)
+            return false;
+    }
+
+    if (!hop_calibrated)
+        hop_calibrate();
+
+    // A table that starts later than the current one is the next one
+    if (hop_seq.n == 0 || t->from <= hop_seq.from) {
+        hop_seq = *t;
+        hop_next.n = 0;
+    }
+    else {
+        hop_next = *t;
+    }
+    hop_dwell_us = dwell_us;
+    hop_clock.start();
+    return true;
+}
+
+// Starts hopping on the first call after H, unless diversity or a MAC
+// came on since. The caller holds radio_lock.
+void hop_sync(uint32_t index, uint32_t age_us)
+{
+    if (hop_seq.n == 0 || (!hopping && (diversity || tdma.nslots || mac.csma)))
+        return;
+
+    if (!hopping) {
+        hop_rx_base = rx_channel < tx_channel ? SCAN_CHANNEL_A : SCAN_CHANNEL_B;
+        hop_tx_base = rx_channel < tx_channel ? SCAN_CHANNEL_B : SCAN_CHANNEL_A;
+        cs = CS_RX;
+        spirit_spi_write(PROTOCOL2_REG, PROTOCOL2_STORED);
+        cs = CS_TX;
+        spirit_spi_write(PROTOCOL2_REG, PROTOCOL2_STORED);
+        hopping = true;
+    }
+
+    hop_origin_us = hop_clock.elapsed_time().count() - age_us - (int64_t)index * hop_dwell_us;
+    if (hop_event_id)
+        sampler_queue.cancel(hop_event_id);
+    hop_event_id = sampler_queue.call(hop_tick);
+}
+
+// Back to the home pair with the automatic calibration. The caller holds
+// radio_lock.
+void hop_stop(void)
+{
+    if (!hopping)
+        return;
+
+    hopping = false;
+    if (hop_event_id)
+        sampler_queue.cancel(hop_event_id);
+    hop_event_id = 0;
+    hop_seq.n = 0;
+    hop_next.n = 0;
+
+    cs = CS_RX;
+    spirit_spi_write(PROTOCOL2_REG, PROTOCOL2_AUTOCAL);
+    cs = CS_TX;
+    spirit_spi_write(PROTOCOL2_REG, PROTOCOL2_AUTOCAL);
+    rx_channel = hop_rx_base;
+    tx_channel = hop_tx_base;
+    set_channel_shift(0);
+}
+
+//
+// End of block
+//
+
+//
+// Receive diversity
+//
+
+// Both radios on freq A, each on its own antenna: the TX radio's GPIO_3
+// puts out what it demodulates just like the RX radio's, and wired to a
+// second USB serial port it gives the bridge a second copy of every frame
+// (RPi/bridge/div.h). The RX radio keeps receiving while we send; the TX
+// radio leaves RX for freq B for the length of each of our frames, keyed
+// over RTS/CTS as in the CSMA mode without the CCA.
+
+// On the sampler thread, like mac_key()
+static void div_key(void)
+{
+    radio_lock.lock();
+    cs = CS_TX;
+    mac_stats.requests++;
+
+    spirit_spi_command(0x62);       // READY
+    spirit_wait_state(STATE_READY);
+    spirit_write_synt(tx_channel);
+    spirit_spi_command(0x66);       // LOCKTX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(0x60);       // TX
+    if (spirit_wait_state(STATE_TX)) {
+        cts = 1;
+        mac_stats.granted++;
+    }
+    else {
+        mac_stats.timeouts++;
+        spirit_tune(rx_channel, true);
+    }
+    radio_lock.unlock();
+}
+
+// Not while hopping or under a MAC, both retune the TX radio on their
+// own. The caller holds radio_lock.
+bool div_configure(bool on)
+{
+    mac_config off = { false, 0, 0, 0 };
+
+    if (on && (hopping || mac.csma || tdma.nslots))
+        return false;
+
+    if (!on && !diversity)
+        return true;
+    if (!on) {
+        diversity = false;
+        cs = CS_TX;
+        spirit_spi_command(0x62);   // READY
+        spirit_wait_state(STATE_READY);
+        spirit_write_synt(tx_channel);
+        return mac_configure(&off);
+    }
+
+    cs = CS_TX;
+    spirit_spi_command(0x62);       // READY
+    spirit_wait_state(STATE_READY);
+    spirit_spi_write(PROTOCOL1_REG, 0x00);
+    spirit_spi_write(PROTOCOL0_REG, PROTOCOL0_KEYED);
+
+    tx_keyed = true;
+    diversity = true;
+    cts = 0;
+    return spirit_tune(rx_channel, true);
+}
+
+//
+// End of block
+//
+
+//
+// Frequency offset tracking
+//
+
+// The crystals of the two ends drift apart with temperature, and a few
+// hundred Hz is a good part of the margin of the 6.057kHz filter. With
+// the AFC on, AFC_CORR says how far off the carrier comes in. Every
+// AFC_TRIM_PERIOD its average over the samples that had a carrier moves
+// FC_OFFSET of the RX radio one step, fXO / 2^18 or about 100Hz, towards
+// it: the carrier stays in the middle of the filter and the AFC keeps its
+// whole pull-in range. Which way AFC_CORR counts against FC_OFFSET is
+// learnt, a step that leaves the average further out turns the direction
+// round. The TX radio keeps its offset, moving it would move our carrier.
+#define FC_OFFSET1_REG      0x0E            // FC_OFFSET[11:8]
+#define FC_OFFSET0_REG      0x0F            // FC_OFFSET[7:0]
+#define AFC2_REG            0x1E
+#define AFC2_STATIC         0x27            // configure_common_registers(), AFC off
+#define AFC2_ENABLED        0x40
+#define AFC_MIN_RSSI        40              // RSSI_LEVEL, -110dBm: a carrier to measure
+#define AFC_MIN_SAMPLES     20              // of the 100 in a trim period
+#define AFC_DEADBAND_X10    20              // average AFC_CORR, tenths
+#define FC_OFFSET_MAX       40              // steps, about 4kHz
+#define AFC_TRIM_PERIOD     10s
+#define AFC_LOG_PERIOD      60s
+#define AFC_HISTORY         64
+
+typedef struct afc_entry {
+    uint32_t t_s;                           // afc_clock
+    int16_t  offset;                        // FC_OFFSET at the end of the period
+    int16_t  afc_x10;                       // average AFC_CORR over the period, tenths
+    uint16_t samples;                       // with a carrier
+} afc_entry;
+
+typedef struct afc_tracker {
+    bool      on;
+    int       offset;
+    int       dir;                          // +1 or -1, learnt
+    int       last_x10;                     // |average| before the last step, 0 none
+    int32_t   sum;                          // this trim period
+    uint32_t  n;
+    int32_t   log_sum;                      // this log period
+    uint32_t  log_n;
+    uint32_t  trims;
+    uint32_t  reversals;
+    afc_entry log[AFC_HISTORY];
+    uint32_t  logged;                       // entries ever, the latest at (logged - 1) % AFC_HISTORY
+} afc_tracker;
+
+afc_tracker afc = { false, 0, 1, 0, 0, 0, 0, 0, 0, 0, { }, 0 };
+Timer       afc_clock;
+
+// On the sampler thread, under radio_lock
+static void afc_sample(const uint8_t *regs)
+{
+    if (!afc.on || regs[8] < AFC_MIN_RSSI)
+        return;
+
+    afc.sum += (int8_t)regs[4];
+    afc.n++;
+    afc.log_sum += (int8_t)regs[4];
+    afc.log_n++;
+}
+
+// Takes effect through LOCK, like a SYNT change. The caller holds
+// radio_lock.
+static void spirit_write_fc_offset(int offset)
+{
+    cs = CS_RX;
+    spirit_spi_command(0x62);       // READY
+    spirit_wait_state(STATE_READY);
+
+    spirit_spi_write(FC_OFFSET1_REG, (uint8_t)((offset >> 8) & 0x0F));
+    spirit_spi_write(FC_OFFSET0_REG, (uint8_t)offset);
+
+    spirit_spi_command(0x65);       // LOCKRX
+    spirit_wait_state(STATE_LOCK);
+    spirit_spi_command(0x61);       // RX
+    spirit_wait_state(STATE_RX);
+}
+
+static void afc_trim(void)
+{
+    radio_lock.lock();
+
+    if (afc.on && afc.n >= AFC_MIN_SAMPLES) {
+        int avg_x10 = afc.sum * 10 / (int32_t)afc.n;
+        int mag = avg_x10 < 0 ? -avg_x10 : avg_x10;
+
+        // The last step made it worse
+        if (afc.last_x10 && mag > afc.last_x10) {
+            afc.dir = -afc.dir;
+            afc.reversals++;
+        }
+        afc.last_x10 = 0;
+
+        if (mag > AFC_DEADBAND_X10) {
+            int next = afc.offset + (avg_x10 > 0 ? afc.dir : -afc.dir);
+            if (next >= -FC_OFFSET_MAX && next <= FC_OFFSET_MAX) {
+                afc.offset = next;
+                afc.last_x10 = mag;
+                afc.trims++;
+                spirit_write_fc_offset(next);
+            }
+        }
+    }
+    afc.sum = 0;
+    afc.n = 0;
+
+    radio_lock.unlock();
+}
+
+static void afc_log_entry(void)
+{
+    radio_lock.lock();
+
+    afc_entry *e = &afc.log[afc.logged++ % AFC_HISTORY];
+    e->t_s     = (uint32_t)(afc_clock.elapsed_time().count() / 1000000);
+    e->offset  = (int16_t)afc.offset;
+    e->afc_x10 = afc.log_n ? (int16_t)(afc.log_sum * 10 / (int32_t)afc.log_n) : 0;
+    e->samples = (uint16_t)afc.log_n;
+    afc.log_sum = 0;
+    afc.log_n = 0;
+
+    radio_lock.unlock();
+}
+
+// The offset reached so far stays when tracking stops. The caller holds
+// radio_lock.
+void afc_configure(bool on)
+{
+    cs = CS_RX;
+    spirit_spi_write(AFC2_REG, on ? AFC2_STATIC | AFC2_ENABLED : AFC2_STATIC);
+
+    afc.on = on;
+    afc.sum = 0;
+    afc.n = 0;
+    afc.last_x10 = 0;
+}
+
+void start_afc(void)
+{
+    afc_clock.start();
+
+    radio_lock.lock();
+    afc_configure(true);
+    radio_lock.unlock();
+
+    sampler_queue.call_every(AFC_TRIM_PERIOD, afc_trim);
+    sampler_queue.call_every(AFC_LOG_PERIOD, afc_log_entry);
+}
+
+// Oldest entry first, ages in seconds
+void report_drift(void)
+{
+    radio_lock.lock();
+    afc_tracker a = afc;
+    uint32_t now_s = (uint32_t)(afc_clock.elapsed_time().count() / 1000000);
+    radio_lock.unlock();
+
+    uint32_t n = a.logged < AFC_HISTORY ? a.logged : AFC_HISTORY;
+
+    printf("\r\nO %d %d %lu %lu %lu\r\n", a.on ? 1 : 0, a.offset, (unsigned long)a.trims,
+           (unsigned long)a.reversals, (unsigned long)n);
+    for (uint32_t i = a.logged - n; i < a.logged; i++) {
+        const afc_entry *e = &a.log[i % AFC_HISTORY];
+        printf("o %lu %d %d %u\r\n", (unsigned long)(now_s - e->t_s), e->offset, e->afc_x10, e->samples);
+    }
+}
+
+//
+// End of block
+//
+
+//
+// Bit modem
+//
+
+// Direct mode at the air bit rate without the CPU in the loop. TIM1
+// counts sample periods, MODEM_OVERSAMPLE to a bit: on every compare of
+// CH1 DMA2 Stream 1 copies the upper byte of GPIOB->IDR, rx_spirit in
+// bit 5, into a circular buffer, and the repetition counter makes the
+// update event come once a bit, on which DMA2 Stream 5 copies the next
+// word of the TX buffer to GPIOB->BSRR to set or reset tx_spirit. Both
+// run off the one counter, so the bit clock is the timer's crystal; on
+// the F4 only DMA2 reaches the GPIOs, and TIM1 is on it. The half and
+// full transfer interrupts come every MODEM_HALF_BITS bits, hand the
+// samples of one half on and refill one half of the TX buffer.
+#define MODEM_OVERSAMPLE    8
+#define MODEM_HALF_BITS     64              // 3.3ms at 19200
+#define MODEM_RX_PIN        0x20            // PB_13 in IDR[15:8]
+#define MODEM_TX_SET        (1u << 12)      // PB_12 in BSRR
+#define MODEM_TX_RESET      (1u << 28)
+#define MODEM_MAX_BPS       50000
+#define MODEM_DMA_CHANNEL   6               // TIM1_CH1 on Stream 1, TIM1_UP on Stream 5
+
+typedef enum { MODEM_TX_OFF, MODEM_TX_PN9 } modem_tx_source;
+
+typedef struct modem_counters {
+    uint32_t bps;                           // 0: stopped
+    int32_t  ppm;                           // of the timer's rate against bps
+    uint32_t rx_halves;
+    uint32_t tx_halves;
+    uint32_t overruns;                      // both halves done before the interrupt ran
+} modem_counters;
+
+// Gets the samples of 'nbits' bits, MODEM_OVERSAMPLE bytes each, in
+// interrupt context
+typedef void (*modem_rx_handler)(const uint8_t *samples, int nbits);
+
+static uint8_t  modem_rx_buf[2 * MODEM_HALF_BITS * MODEM_OVERSAMPLE];
+static uint32_t modem_tx_buf[2 * MODEM_HALF_BITS];
+
+modem_counters   modem;
+modem_tx_source  modem_tx = MODEM_TX_OFF;
+modem_rx_handler modem_rx = 0;
+uint16_t         modem_lfsr = 0x1FF;
+
+// The timer clock is twice PCLK2 unless APB2 runs undivided
+static uint32_t modem_timer_clock(void)
+{
+    uint32_t pclk2 = HAL_RCC_GetPCLK2Freq();
+
+    return (RCC->CFGR & RCC_CFGR_PPRE2) == RCC_CFGR_PPRE2_DIV1 ? pclk2 : 2 * pclk2;
+}
+
+static void modem_tx_fill(uint32_t *bsrr)
+{
+    for (int i = 0; i < MODEM_HALF_BITS; i++) {
+        int bit = 0;
+
+        if (modem_tx == MODEM_TX_PN9) {
+            bit = modem_lfsr & 1;
+            modem_lfsr = (modem_lfsr >> 1) | (((modem_lfsr ^ (modem_lfsr >> 5)) & 1) << 8);
+        }
+        bsrr[i] = bit ? MODEM_TX_SET : MODEM_TX_RESET;
+    }
+}
+
+static void modem_rx_irq(void)
+{
+    uint32_t isr = DMA2->LISR;
+
+    DMA2->LIFCR = DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTCIF1;
+    if ((isr & DMA_LISR_HTIF1) && (isr & DMA_LISR_TCIF1))
+        modem.overruns++;
+
+    if (isr & DMA_LISR_HTIF1) {
+        modem.rx_halves++;
+        if (modem_rx)
+            modem_rx(modem_rx_buf, MODEM_HALF_BITS);
+    }
+    if (isr & DMA_LISR_TCIF1) {
+        modem.rx_halves++;
+        if (modem_rx)
+            modem_rx(modem_rx_buf + MODEM_HALF_BITS * MODEM_OVERSAMPLE, MODEM_HALF_BITS);
+    }
+}
+
+static void modem_tx_irq(void)
+{
+    uint32_t isr = DMA2->HISR;
+
+    DMA2->HIFCR = DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTCIF5;
+    if ((isr & DMA_HISR_HTIF5) && (isr & DMA_HISR_TCIF5))
+        modem.overruns++;
+
+    if (isr & DMA_HISR_HTIF5) {
+        modem.tx_halves++;
+        modem_tx_fill(modem_tx_buf);
+    }
+    if (isr & DMA_HISR_TCIF5) {
+        modem.tx_halves++;
+        modem_tx_fill(modem_tx_buf + MODEM_HALF_BITS);
+    }
+}
+
+static void modem_dma_stop(DMA_Stream_TypeDef *s)
+{
+    s->CR &= ~DMA_SxCR_EN;
+    while (s->CR & DMA_SxCR_EN) {}
+}
+
+// Circular, half and full transfer interrupts, direct mode
+static void modem_dma_start(DMA_Stream_TypeDef *s, uint32_t cr, volatile void *periph, void *mem, uint32_t n)
+{
+    s->PAR  = (uint32_t)periph;
+    s->M0AR = (uint32_t)mem;
+    s->NDTR = n;
+    s->FCR  = 0;
+    s->CR   = (MODEM_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_CIRC |
+              DMA_SxCR_HTIE | DMA_SxCR_TCIE | cr;
+    s->CR  |= DMA_SxCR_EN;
+}
+
+void modem_stop(void)
+{
+    TIM1->CR1 &= ~TIM_CR1_CEN;
+    TIM1->DIER = 0;
+    modem_dma_stop(DMA2_Stream1);
+    modem_dma_stop(DMA2_Stream5);
+    DMA2->LIFCR = DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTCIF1 | DMA_LIFCR_CTEIF1 | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1;
+    DMA2->HIFCR = DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTCIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+    modem.bps = 0;
+}
+
+// Starts over at 'bps', 0 stops. With the TX off tx_spirit is left
+// alone. Not from interrupt context.
+bool modem_start(uint32_t bps, modem_tx_source tx)
+{
+    if (bps > MODEM_MAX_BPS)
+        return false;
+
+    modem_stop();
+    memset(&modem, 0, sizeof(modem));
+    modem_tx = tx;
+    if (bps == 0)
+        return true;
+
+    uint32_t clk = modem_timer_clock();
+    uint32_t ticks = (clk + bps * MODEM_OVERSAMPLE / 2) / (bps * MODEM_OVERSAMPLE);
+
+    modem.bps = bps;
+    modem.ppm = (int32_t)(((int64_t)clk - (int64_t)ticks * MODEM_OVERSAMPLE * bps) * 1000000 /
+                          ((int64_t)ticks * MODEM_OVERSAMPLE * bps));
+
+    TIM1->PSC  = 0;
+    TIM1->ARR  = ticks - 1;
+    TIM1->RCR  = MODEM_OVERSAMPLE - 1;      // an update a bit
+    TIM1->CCR1 = ticks / 2;                 // a compare a sample
+    TIM1->CNT  = 0;
+    TIM1->EGR  = TIM_EGR_UG;                // loads PSC and RCR
+    TIM1->SR   = 0;
+
+    modem_dma_start(DMA2_Stream1, 0, (volatile uint8_t *)&GPIOB->IDR + 1, modem_rx_buf,    // bytes, to memory
+                    sizeof(modem_rx_buf));
+    TIM1->DIER = TIM_DIER_CC1DE;
+    if (tx != MODEM_TX_OFF) {
+        modem_tx_fill(modem_tx_buf);
+        modem_tx_fill(modem_tx_buf + MODEM_HALF_BITS);
+        modem_dma_start(DMA2_Stream5, DMA_SxCR_DIR_0 | DMA_SxCR_PSIZE_1 | DMA_SxCR_MSIZE_1, &GPIOB->BSRR,
+                        modem_tx_buf, 2 * MODEM_HALF_BITS);
+        TIM1->DIER |= TIM_DIER_UDE;
+    }
+    TIM1->CR1 = TIM_CR1_CEN;
+    return true;
+}
+
+void start_modem(void)
+{
+    __HAL_RCC_TIM1_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    NVIC_SetVector(DMA2_Stream1_IRQn, (uint32_t)modem_rx_irq);
+    NVIC_SetVector(DMA2_Stream5_IRQn, (uint32_t)modem_tx_irq);
+    NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+    NVIC_EnableIRQ(DMA2_Stream5_IRQn);
+}
+
+//
+// End of block
+//
+
+//
+// Clock recovery
+//
+
+// The bits of the modem's samples, with the far end's clock recovered
+// the way bridge_bench cdr does it on captures (RPi/bridge/cdr.h), and the
+// bridge's frames found on air by their sync word: 0x2D 0xD4 as the UART
+// sends them, start bit, LSB first, stop bit. Runs in the DMA interrupt,
+// the samples of a half take well under 0.1ms.
+#define RX_SYNC_WORD        0x5A457
+#define RX_SYNC_BITS        20
+#define RX_SYNC_ERRORS      1
+
+cdr_ctx  rx_cdr;
+cdr_sync rx_sync;
+
+static void ber_rx(const uint64_t *words, int n);
+volatile bool ber_active = false;
+
+// What a half recovers into, a block of modem_pool (Buffer pools)
+typedef struct rx_scratch {
+    uint64_t words[MODEM_HALF_BITS / 64 + 1];
+    uint32_t hits[4];
+} rx_scratch;
+
+typedef struct pool pool;
+extern pool modem_pool;
+void *pool_alloc(pool *p);
+void pool_free(pool *p, void *block);
+
+static void rx_recover(const uint8_t *samples, int nbits)
+{
+    rx_scratch *s = (rx_scratch *)pool_alloc(&modem_pool);
+
+    // None free is the pool's exhausted count; the CDR picks up again
+    if (!s)
+        return;
+
+    int n = cdr_push(&rx_cdr, samples, nbits * MODEM_OVERSAMPLE, MODEM_RX_PIN, s->words);
+    cdr_sync_push(&rx_sync, s->words, n, s->hits, 4);
+    if (ber_active)
+        ber_rx(s->words, n);
+    pool_free(&modem_pool, s);
+}
+
+// From the host link, the interrupt may run meanwhile
+bool rx_sync_configure(uint32_t word, int bits, int errors)
+{
+    cdr_sync s;
+
+    if (cdr_sync_init(&s, word, bits, errors) < 0)
+        return false;
+
+    core_util_critical_section_enter();
+    rx_sync = s;
+    core_util_critical_section_exit();
+    return true;
+}
+
+void start_rx_recovery(void)
+{
+    cdr_init(&rx_cdr, MODEM_OVERSAMPLE);
+    cdr_sync_init(&rx_sync, RX_SYNC_WORD, RX_SYNC_BITS, RX_SYNC_ERRORS);
+    modem_rx = rx_recover;
+}
+
+//
+// End of block
+//
+
+//
+// PN9 bit error rate
+//
+
+// With the far end sending PN9 (PCKTCTRL1 0x0C, see SPIRIT/main.cpp) the
+// bits recovered from the RX radio's data out, rx_spirit, are checked
+// against the sequence by the engine of RPi/bridge/pn9.c on 32-bit words:
+// the last 9 bits of a word give the phase, every word after that is
+// XORed with the 32 bits expected there and the set bits are the errors.
+// A block with more than BER_LOSS_ERRORS of them has lost the sequence,
+// a bit slipped past the clock recovery or the signal went, and does not
+// count.
+#define BER_PERIOD          511
+#define BER_BLOCK_WORDS     8               // 256 bits
+#define BER_LOSS_ERRORS     64
+#define BER_BURST_GAP       8
+#define BER_BURST_BINS      8               // 1, 2-3, 4-7, ... 128 and longer
+#define BER_RING            64              // words, 213ms at 9600
+#define BER_DRAIN_PERIOD    50ms
+
+typedef struct ber_counters {
+    uint32_t bps;                           // 0: off
+    uint64_t bits;                          // in sync
+    uint64_t errors;
+    uint32_t acquisitions;
+    uint32_t sync_losses;                   // after at least one good block
+    uint64_t dropped;                       // bits out of sync
+    uint32_t overruns;                      // words the drain was too late for
+    uint32_t bursts[BER_BURST_BINS];
+    uint32_t max_burst;
+} ber_counters;
+
+typedef struct ber_engine {
+    bool     sync;
+    int      phase;                         // of the next bit
+    uint32_t good_blocks;
+    uint32_t block[BER_BLOCK_WORDS];        // error words
+    int      nblock;
+    bool     in_burst;
+    int      burst_len;
+    int      gap;
+    ber_counters c;
+} ber_engine;
+
+static uint32_t ber_words[BER_PERIOD];      // bits p..p+31, the first in the MSB
+static int16_t  ber_phase_of[512];          // 9 bits, the first in the MSB
+
+ber_engine ber;
+Mutex      ber_lock;                        // the drain and the host link
+
+// Bit modem interrupt context
+volatile uint32_t ber_ring[BER_RING];
+volatile uint32_t ber_head = 0;             // written by the ISR only
+volatile uint32_t ber_tail = 0;             // by the drain only
+volatile uint32_t ber_overruns = 0;
+
+// x^9 + x^5 + 1 from all ones, as the SPIRIT1 sends it
+static void ber_tables(void)
+{
+    static uint8_t seq[BER_PERIOD + 32];
+    uint16_t lfsr = 0x1FF;
+
+    for (int i = 0; i < BER_PERIOD; i++) {
+        seq[i] = lfsr & 1;
+        lfsr = (lfsr >> 1) | (((lfsr ^ (lfsr >> 5)) & 1) << 8);
+    }
+    for (int i = BER_PERIOD; i < BER_PERIOD + 32; i++)
+        seq[i] = seq[i - BER_PERIOD];
+
+    for (int p = 0; p < BER_PERIOD; p++) {
+        uint32_t w = 0;
+        for (int i = 0; i < 32; i++)
+            w = (w << 1) | seq[p + i];
+        ber_words[p] = w;
+        ber_phase_of[w >> 23] = (int16_t)p;
+    }
+}
+
+static void ber_rx(const uint64_t *words, int n)
+{
+    for (int i = 0; i < 2 * n; i++) {
+        if (ber_head - ber_tail < BER_RING)
+            ber_ring[ber_head++ % BER_RING] = (uint32_t)(words[i / 2] >> (i & 1 ? 0 : 32));
+        else
+            ber_overruns++;
+    }
+}
+
+static void ber_burst_end(ber_engine *b)
+{
+    int bin = 0;
+
+    if (!b->in_burst)
+        return;
+    while (bin < BER_BURST_BINS - 1 && (2 << bin) <= b->burst_len)
+        bin++;
+    b->c.bursts[bin]++;
+    if ((uint32_t)b->burst_len > b->c.max_burst)
+        b->c.max_burst = b->burst_len;
+    b->in_burst = false;
+}
+
+static void ber_good(ber_engine *b, int n)
+{
+    b->gap += n;
+    if (b->gap >= BER_BURST_GAP) {
+        ber_burst_end(b);
+        b->gap = BER_BURST_GAP;
+    }
+}
+
+static void ber_commit(ber_engine *b, int errors)
+{
+    b->c.bits += 32 * BER_BLOCK_WORDS;
+    b->c.errors += errors;
+    b->good_blocks++;
+
+    for (int i = 0; i < BER_BLOCK_WORDS; i++) {
+        uint32_t e = b->block[i];
+        int left = 32;
+
+        while (e) {
+            int z = __builtin_clz(e);
+
+            ber_good(b, z);
+            if (b->in_burst) {
+                b->burst_len += b->gap + 1;
+            } else {
+                b->in_burst = true;
+                b->burst_len = 1;
+            }
+            b->gap = 0;
+            e = (e << z) << 1;
+            left -= z + 1;
+        }
+        ber_good(b, left);
+    }
+}
+
+static void ber_push(ber_engine *b, uint32_t w)
+{
+    if (!b->sync) {
+        // The last 9 bits give the phase, all zeros is no signal
+        b->c.dropped += 32;
+        if ((w & 0x1FF) == 0)
+            return;
+        b->phase = (ber_phase_of[w & 0x1FF] + 9) % BER_PERIOD;
+        b->sync = true;
+        b->good_blocks = 0;
+        b->nblock = 0;
+        b->c.acquisitions++;
+        return;
+    }
+
+    b->block[b->nblock++] = w ^ ber_words[b->phase];
+    b->phase = (b->phase + 32) % BER_PERIOD;
+    if (b->nblock < BER_BLOCK_WORDS)
+        return;
+    b->nblock = 0;
+
+    int errors = 0;
+    for (int i = 0; i < BER_BLOCK_WORDS; i++)
+        errors += __builtin_popcount(b->block[i]);
+
+    if (errors <= BER_LOSS_ERRORS) {
+        ber_commit(b, errors);
+        return;
+    }
+
+    // Out of step: a slip after good blocks, or a bad acquisition
+    b->c.dropped += 32 * BER_BLOCK_WORDS;
+    if (b->good_blocks > 0)
+        b->c.sync_losses++;
+    b->sync = false;
+    ber_burst_end(b);
+    b->gap = BER_BURST_GAP;
+}
+
+// On the sampler thread
+static void ber_drain(void)
+{
+    ber_lock.lock();
+    while (ber_tail != ber_head) {
+        ber_push(&ber, ber_ring[ber_tail % BER_RING]);
+        ber_tail++;
+    }
+    ber.c.overruns = ber_overruns;
+    ber_lock.unlock();
+}
+
+// Starts over at 'bps', 0 stops. The bit modem is moved to 'bps' unless
+// it runs at that rate already, its TX as it is; B 0 leaves it running.
+// The caller holds ber_lock.
+bool ber_configure(uint32_t bps)
+{
+    if (bps > MODEM_MAX_BPS)
+        return false;
+
+    core_util_critical_section_enter();
+    ber_active = false;
+    ber_head = 0;
+    ber_tail = 0;
+    ber_overruns = 0;
+    core_util_critical_section_exit();
+
+    memset(&ber, 0, sizeof(ber));
+    ber.gap = BER_BURST_GAP;
+    ber.c.bps = bps;
+    if (bps == 0)
+        return true;
+
+    if (modem.bps != bps && !modem_start(bps, modem_tx))
+        return false;
+    ber_active = true;
+    return true;
+}
+
+void start_ber(void)
+{
+    ber_tables();
+    sampler_queue.call_every(BER_DRAIN_PERIOD, ber_drain);
+}
+
+void report_ber(void)
+{
+    ber_lock.lock();
+    ber_counters c = ber.c;
+    ber_lock.unlock();
+
+    printf("\r\nE %lu %llu %llu %lu %lu %llu %lu %lu", (unsigned long)c.bps, (unsigned long long)c.bits,
+           (unsigned long long)c.errors, (unsigned long)c.acquisitions, (unsigned long)c.sync_losses,
+           (unsigned long long)c.dropped, (unsigned long)c.overruns, (unsigned long)c.max_burst);
+    for (int i = 0; i < BER_BURST_BINS; i++)
+        printf(" %lu", (unsigned long)c.bursts[i]);
+    printf("\r\n");
+}
+
+//
+// End of block
+//
+
+//
+// Buffer pools
+//
+
+// Fixed-size blocks from static memory, the same from interrupt handlers
+// and threads: no heap, nothing on an ISR's stack, and a block in a few
+// instructions whatever else is going on. Packets do not go through the
+// firmware, the radios run direct; what it moves itself is the bit
+// modem's, every half of the DMA buffer recovers into a block of
+// modem_pool in the interrupt, and the whitening check's FIFO read. The free
+// blocks are a stack of indices and its top changes with one compare and
+// swap. The top carries a tag that every change moves on, so a pop that
+// an interrupt overtook (it popped A and B and pushed A back) fails its
+// compare and tries again, rather than putting B, which is out, on top.
+// Each pool counts the blocks it hands out, the most out at once and the
+// allocations it had to refuse; U reports them.
+#define POOL_NONE           0xFFFF
+#define POOL_MAX            4
+#define POOL_TAG_ONE        0x10000u
+
+typedef struct pool {
+    const char *name;
+    uint8_t  *mem;
+    uint16_t *next;                         // the free block below each, by index
+    uint16_t block_size;
+    uint16_t blocks;
+    volatile uint32_t top;                  // tag << 16 | index of the first free block
+    volatile uint32_t in_use;
+    volatile uint32_t high_water;
+    volatile uint32_t allocs;
+    volatile uint32_t exhausted;
+} pool;
+
+#define POOL_DEFINE(var, size, count)                                           \
+    static uint8_t  var##_mem[(count) * (size)] __attribute__((aligned(8)));    \
+    static uint16_t var##_next[count];                                          \
+    pool var = { #var, var##_mem, var##_next, (size), (count), 0, 0, 0, 0, 0 }
+
+// The contents of a SPIRIT1 FIFO, 96 bytes
+POOL_DEFINE(fifo_pool, 96, 8);
+
+// Recovered words and sync hits of a modem half, one out at a time
+POOL_DEFINE(modem_pool, sizeof(rx_scratch), 2);
+
+pool *pools[POOL_MAX] = { &fifo_pool, &modem_pool };
+
+// Before anything takes a block
+static void pool_init(pool *p)
+{
+    for (int i = 0; i < p->blocks; i++)
+        p->next[i] = i + 1 < p->blocks ? i + 1 : POOL_NONE;
+    p->top = 0;
+}
+
+// A block, or 0 when all are out. Any context.
+void *pool_alloc(pool *p)
+{
+    uint32_t top = core_util_atomic_load_u32(&p->top);
+    uint16_t i;
+
+    do {
+        i = (uint16_t)top;
+        if (i == POOL_NONE) {
+            core_util_atomic_incr_u32(&p->exhausted, 1);
+            return 0;
+        }
+    } while (!core_util_atomic_cas_u32(&p->top, &top, ((top + POOL_TAG_ONE) & 0xFFFF0000u) | p->next[i]));
+
+    uint32_t n = core_util_atomic_incr_u32(&p->in_use, 1);
+    uint32_t high = core_util_atomic_load_u32(&p->high_water);
+    while (n > high && !core_util_atomic_cas_u32(&p->high_water, &high, n)) {}
+    core_util_atomic_incr_u32(&p->allocs, 1);
+
+    return p->mem + (uint32_t)i * p->block_size;
+}
+
+// Any context. in_use goes down first, so it never counts more than there are.
+void pool_free(pool *p, void *block)
+{
+    if (!block)
+        return;
+
+    uint16_t i = (uint16_t)(((uint8_t *)block - p->mem) / p->block_size);
+    uint32_t top = core_util_atomic_load_u32(&p->top);
+
+    core_util_atomic_decr_u32(&p->in_use, 1);
+    do {
+        p->next[i] = (uint16_t)top;
+    } while (!core_util_atomic_cas_u32(&p->top, &top, ((top + POOL_TAG_ONE) & 0xFFFF0000u) | i));
+}
+
+// U <n> first has the thread take and give back blocks of a pool n times,
+// up to all of them at once, while a Ticker interrupt swaps the one it
+// holds for another every POOL_STRESS_PERIOD. A block carries the mark of
+// whoever has it; one that comes out marked, or whose mark changed while
+// it was out, was handed out twice.
+#define POOL_STRESS_PERIOD  50us
+#define POOL_STRESS_MAX     1000000
+#define POOL_MARK_THREAD    0x5A
+#define POOL_MARK_ISR       0xA5
+#define POOL_MAX_BLOCKS     32
+
+typedef struct pool_stress_result {
+    uint32_t cycles;
+    uint32_t isr_cycles;
+    uint32_t clashes;
+    uint32_t us;
+} pool_stress_result;
+
+static Ticker   pool_ticker;
+static pool    *stress_pool;
+static uint8_t *stress_isr_block;
+static volatile uint32_t stress_isr_cycles;
+static volatile uint32_t stress_clashes;
+
+static void pool_stress_isr(void)
+{
+    uint8_t *b = (uint8_t *)pool_alloc(stress_pool);
+
+    if (b) {
+        if (b[0])
+            stress_clashes++;
+        b[0] = POOL_MARK_ISR;
+    }
+    if (stress_isr_block) {
+        if (stress_isr_block[0] != POOL_MARK_ISR)
+            stress_clashes++;
+        stress_isr_block[0] = 0;
+        pool_free(stress_pool, stress_isr_block);
+    }
+    stress_isr_block = b;
+    stress_isr_cycles++;
+}
+
+// From the host link, with none of the pool's blocks out
+bool pool_stress(pool *p, uint32_t n, pool_stress_result *r)
+{
+    uint8_t *held[POOL_MAX_BLOCKS];
+    Timer t;
+
+    if (n > POOL_STRESS_MAX || p->blocks > POOL_MAX_BLOCKS || core_util_atomic_load_u32(&p->in_use))
+        return false;
+
+    memset(p->mem, 0, (uint32_t)p->blocks * p->block_size);
+    stress_pool = p;
+    stress_isr_block = 0;
+    stress_isr_cycles = 0;
+    stress_clashes = 0;
+    pool_ticker.attach(pool_stress_isr, POOL_STRESS_PERIOD);
+
+    t.start();
+    for (uint32_t i = 0; i < n; i++) {
+        int want = 1 + i % p->blocks, got = 0;
+
+        while (got < want && (held[got] = (uint8_t *)pool_alloc(p)) != 0) {
+            if (held[got][0])
+                core_util_atomic_incr_u32(&stress_clashes, 1);
+            held[got][0] = POOL_MARK_THREAD;
+            got++;
+        }
+        while (got > 0) {
+            uint8_t *b = held[--got];
+
+            if (b[0] != POOL_MARK_THREAD)
+                core_util_atomic_incr_u32(&stress_clashes, 1);
+            b[0] = 0;
+            pool_free(p, b);
+        }
+    }
+    t.stop();
+
+    pool_ticker.detach();
+    pool_free(p, stress_isr_block);
+    stress_isr_block = 0;
+
+    r->cycles = n;
+    r->isr_cycles = stress_isr_cycles;
+    r->clashes = stress_clashes;
+    r->us = (uint32_t)t.elapsed_time().count();
+    return true;
+}
+
+void report_pools(const pool_stress_result *r)
+{
+    int n = 0;
+
+    while (n < POOL_MAX && pools[n])
+        n++;
+
+    printf("\r\nU %lu %lu %lu %lu %d\r\n", (unsigned long)r->cycles, (unsigned long)r->isr_cycles,
+           (unsigned long)r->clashes, (unsigned long)r->us, n);
+    for (int i = 0; i < n; i++) {
+        pool *p = pools[i];
+
+        printf("u %s %u %u %lu %lu %lu %lu\r\n", p->name, p->block_size, p->blocks,
+               (unsigned long)p->in_use, (unsigned long)p->high_water, (unsigned long)p->allocs,
+               (unsigned long)p->exhausted);
+    }
+}
+
+void start_pools(void)
+{
+    for (int i = 0; i < POOL_MAX && pools[i]; i++)
+        pool_init(pools[i]);
+}
+
+//
+// End of block
+//
+
+//
+// Whitening check
+//
+
+// The bridge whitens its air frames itself with -W (RPi/bridge/pn9.h), as
+// the chip does in packet mode and not in direct mode. W holds its
+// sequence against the chip's: the TX radio sends one packet of
+// WHITEN_CHECK_LEN zeros from its FIFO with WHIT_EN on, on the RX radio's
+// channel, and the RX radio takes it in packet mode with WHIT_EN off, so
+// that its FIFO gets the sequence as the chip makes it. The far end's
+// carrier on freq A is far weaker than ours next door. Both radios are
+// back in direct mode within WHITEN_TIMEOUT.
+#define WHITEN_CHECK_LEN    64              // of the 96 byte FIFOs
+#define WHITEN_TIMEOUT      200ms
+#define PCKT_REGS_START     0x30            // PCKTCTRL4 ... PCKTLEN0
+#define PCKT_REGS_COUNT     6
+#define PCKTCTRL3_PACKET    0x07            // RX_MODE normal, LEN_WID 8
+#define PCKTCTRL1_WHIT_EN   0x10            // TXSOURCE normal, no CRC
+#define RX_FIFO_STATUS_REG  0xE7            // LINEAR_FIFO_STATUS0
+#define FIFO_REG            0xFF
+
+typedef struct whiten_result {
+    int received;
+    int matches;
+    uint8_t first[8];
+} whiten_result;
+
+static uint8_t whiten_seq[WHITEN_CHECK_LEN];
+
+// x^9 + x^5 + 1 from all ones, eight bits a byte with the first in the
+// LSB: FF E1 1D 9A ...
+static void whiten_tables(void)
+{
+    uint16_t lfsr = 0x1FF;
+
+    for (int i = 0; i < WHITEN_CHECK_LEN; i++) {
+        whiten_seq[i] = (uint8_t)lfsr;
+        for (int k = 0; k < 8; k++)
+            lfsr = (lfsr >> 1) | (((lfsr ^ (lfsr >> 5)) & 1) << 8);
+    }
+}
+
+// PCKTCTRL3, PCKTCTRL1 and the packet length of the selected radio, in
+// READY; 'saved' gets them as they were
+static void whiten_packet_mode(uint8_t *saved, uint8_t pcktctrl3, uint8_t pcktctrl1)
+{
+    uint8_t regs[PCKT_REGS_COUNT];
+
+    spirit_spi_command(0x62);                   // READY
+    spirit_wait_state(STATE_READY);
+
+    spirit_spi_read_burst(PCKT_REGS_START, saved, PCKT_REGS_COUNT);
+    memcpy(regs, saved, PCKT_REGS_COUNT);
+    regs[1] = pcktctrl3;
+    regs[3] = pcktctrl1;
+    regs[4] = 0;                                // PCKTLEN1
+    regs[5] = WHITEN_CHECK_LEN;                 // PCKTLEN0
+    spirit_spi_write_burst(PCKT_REGS_START, regs, PCKT_REGS_COUNT);
+}
+
+// Not while hopping, under a MAC or with diversity, they all move the TX
+// radio on their own. The caller holds radio_lock.
+bool whiten_check(whiten_result *r)
+{
+    uint8_t rx_regs[PCKT_REGS_COUNT], tx_regs[PCKT_REGS_COUNT];
+    Timer t;
+
+    if (hopping || tx_keyed || diversity)
+        return false;
+    uint8_t *buf = (uint8_t *)pool_alloc(&fifo_pool);
+    if (!buf)
+        return false;
+    memset(r, 0, sizeof(*r));
+    memset(buf, 0, WHITEN_CHECK_LEN);
+
+    cs = CS_RX;
+    whiten_packet_mode(rx_regs, PCKTCTRL3_PACKET, 0x00);
+    spirit_spi_command(0x71);                   // FLUSHRXFIFO
+    spirit_tune(rx_channel, true);
+
+    // One packet, then back to READY without PERS_TX
+    cs = CS_TX;
+    whiten_packet_mode(tx_regs, PCKTCTRL3_PACKET, PCKTCTRL1_WHIT_EN);
+    spirit_spi_write(PROTOCOL0_REG, PROTOCOL0_KEYED);
+    spirit_spi_command(0x72);                   // FLUSHTXFIFO
+    spirit_spi_write_burst(FIFO_REG, buf, WHITEN_CHECK_LEN);
+    spirit_tune(rx_channel, false);
+
+    cs = CS_RX;
+    t.start();
+    while (r->received < WHITEN_CHECK_LEN && t.elapsed_time() < WHITEN_TIMEOUT)
+        r->received = spirit_spi_read(RX_FIFO_STATUS_REG) & 0x7F;
+    if (r->received > WHITEN_CHECK_LEN)
+        r->received = WHITEN_CHECK_LEN;
+    spirit_spi_read_burst(FIFO_REG, buf, r->received);
+
+    for (int i = 0; i < r->received; i++)
+        r->matches += buf[i] == whiten_seq[i];
+    memcpy(r->first, buf, sizeof(r->first));
+
+    // Back to direct mode
+    spirit_spi_command(0x62);                   // READY
+    spirit_wait_state(STATE_READY);
+    spirit_spi_write_burst(PCKT_REGS_START, rx_regs, PCKT_REGS_COUNT);
+    spirit_spi_command(0x71);                   // FLUSHRXFIFO
+    spirit_tune(rx_channel, true);
+
+    cs = CS_TX;
+    spirit_spi_command(0x62);
+    spirit_wait_state(STATE_READY);
+    spirit_spi_write_burst(PCKT_REGS_START, tx_regs, PCKT_REGS_COUNT);
+    spirit_spi_write(PROTOCOL0_REG, PROTOCOL0_PERS);
+    spirit_spi_command(0x72);                   // FLUSHTXFIFO
+    spirit_tx_idle(rx_channel, tx_channel);
+    pool_free(&fifo_pool, buf);
+    return true;
+}
+
+//
+// End of block
+//
+
+//
+// AES engine
+//
+
+// The SPIRIT1 has an AES-128 coprocessor behind the same SPI registers.
+// The bridge encrypts its frames itself (RPi/bridge/aes.h), the bytes
+// never pass through here; X measures what the TX radio's engine would
+// do instead. The engine runs whatever the radio does, persistent TX
+// included, and radio_lock is only held for one block, so the sampler
+// and the keying go on meanwhile. The registers hold a block last byte
+// first, DATA_IN_15 at 0x80, as ST's library writes them.
+#define ANA_FUNC_CONF0_REG  0x01
+#define ANA_FUNC_AES_ON     0x20
+#define AES_KEY_IN_REG      0x70
+#define AES_DATA_IN_REG     0x80
+#define AES_DATA_OUT_REG    0xD4
+#define AES_BLOCK           16
+#define AES_WAIT_US         20              // the engine, with margin
+#define AES_MAX_BLOCKS      100000
+
+// FIPS-197 appendix C.1
+static const uint8_t aes_test_key[AES_BLOCK] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F
+};
+static const uint8_t aes_test_in[AES_BLOCK] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF
+};
+static const uint8_t aes_test_out[AES_BLOCK] = {
+    0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A
+};
+
+static void spirit_aes_write(uint8_t address, const uint8_t *block)
+{
+    uint8_t regs[AES_BLOCK];
+
+    for (int i = 0; i < AES_BLOCK; i++)
+        regs[AES_BLOCK - 1 - i] = block[i];
+    spirit_spi_write_burst(address, regs, AES_BLOCK);
+}
+
+// The engine on and the key in. The caller holds radio_lock.
+static void spirit_aes_key(const uint8_t *key)
+{
+    cs = CS_TX;
+    spirit_spi_write(ANA_FUNC_CONF0_REG, spirit_spi_read(ANA_FUNC_CONF0_REG) | ANA_FUNC_AES_ON);
+    spirit_aes_write(AES_KEY_IN_REG, key);
+}
+
+// One block, three SPI transactions. The caller holds radio_lock.
+static void spirit_aes_encrypt(const uint8_t *in, uint8_t *out)
+{
+    uint8_t regs[AES_BLOCK];
+
+    cs = CS_TX;
+    spirit_aes_write(AES_DATA_IN_REG, in);
+    spirit_spi_command(0x6A);                   // AES_ENC
+    wait_us(AES_WAIT_US);
+    spirit_spi_read_burst(AES_DATA_OUT_REG, regs, AES_BLOCK);
+    for (int i = 0; i < AES_BLOCK; i++)
+        out[i] = regs[AES_BLOCK - 1 - i];
+}
+
+// The engine off again, it draws current
+static void spirit_aes_off(void)
+{
+    cs = CS_TX;
+    spirit_spi_write(ANA_FUNC_CONF0_REG, spirit_spi_read(ANA_FUNC_CONF0_REG) & ~ANA_FUNC_AES_ON);
+}
+
+typedef struct aes_result {
+    bool known_answer;
+    uint32_t blocks;
+    uint32_t us;
+} aes_result;
+
+// Counter blocks as CTR mode feeds them, from the host link
+bool aes_bench(uint32_t n, aes_result *r)
+{
+    uint8_t block[AES_BLOCK], out[AES_BLOCK];
+    Timer t;
+
+    if (n > AES_MAX_BLOCKS)
+        return false;
+
+    radio_lock.lock();
+    spirit_aes_key(aes_test_key);
+    spirit_aes_encrypt(aes_test_in, out);
+    radio_lock.unlock();
+    r->known_answer = memcmp(out, aes_test_out, AES_BLOCK) == 0;
+
+    memset(block, 0, sizeof(block));
+    t.start();
+    for (uint32_t i = 0; i < n; i++) {
+        block[12] = (uint8_t)(i >> 24);
+        block[13] = (uint8_t)(i >> 16);
+        block[14] = (uint8_t)(i >> 8);
+        block[15] = (uint8_t)i;
+
+        radio_lock.lock();
+        spirit_aes_encrypt(block, out);
+        radio_lock.unlock();
+    }
+    t.stop();
+
+    radio_lock.lock();
+    spirit_aes_off();
+    radio_lock.unlock();
+
+    r->blocks = n;
+    r->us = (uint32_t)t.elapsed_time().count();
+    return true;
+}
+
+//
+// End of block
+//
+
+void configure_tx(void)
+{
+    cs = CS_TX;
+    configure_common_registers();
+
+    configure_freq_b();
+
+    start_tx();
+    printf("\r\n ...TX part configured...");
+
+    uint8_t part_num    = spirit_spi_read(0xF0);
+    uint8_t version_num = spirit_spi_read(0xF1);
+
+    printf("\r\n SPI part_num (=1): %d", part_num);
+    printf("\r\n SPI version_num (=48): %d", version_num);
+}
+
+void configure_rx(void)
+{
+    cs = CS_RX;
+    configure_common_registers();
+
+    configure_freq_a();
+
+    start_rx();
+    printf("\r\n ...RX part configured...");
+
+    uint8_t part_num    = spirit_spi_read(0xF0);
+    uint8_t version_num = spirit_spi_read(0xF1);
+
+    printf("\r\n SPI part_num (=1): %d", part_num); 
+    printf("\r\n SPI version_num (=48): %d", version_num); 
+}
+
+int main()
+{
+    serial_init(&stdio_uart, PA_9, PA_10);
+    stdio_uart_inited = 1; 
+ 
+    cs = INITIAL;
+    cs_tx  = 1;
+    cs_rx = 1;
+    sdn = 0;
+
+    spi.frequency(1000000);
+    spi.format(8, 0);
+    
+    printf("\r\n -------------------------------");
+    configure_rx();
+    configure_tx();
+    printf("\r\n Ready!");
+    printf("\r\n -------------------------------");
+
+    start_sampler();
+    start_mac();
+    start_afc();
+    start_modem();
+    start_pools();
+    start_rx_recovery();
+    start_ber();
+    whiten_tables();
+
+    //
+    // Host link: commands from the RPi bridge (RPi/bridge/radio.h)
+    //
+    char str[8] = { '\0' };
+
+    while (1) {
+        scanf("%7s", str);
+
+        if (str[0] == 'P') {           // Switch profile
+            scanf("%7s", str);
+            int n = atoi(str);
+
+            radio_lock.lock();
+            bool ok = apply_profile(n);
+            radio_lock.unlock();
+
+            if (ok)
+                printf("\r\nP %d\r\n", n);
+            else
+                printf("\r\nERR profile %d\r\n", n);
+        }
+
+        else if (str[0] == 'Q') {      // RSSI_LEVEL and LQI of the receiver
+            radio_lock.lock();
+            cs = CS_RX;
+            uint8_t rssi = spirit_spi_read(0xC8);
+            uint8_t lqi  = spirit_spi_read(0xC7) >> 4;
+            radio_lock.unlock();
+            printf("\r\nQ %d %d\r\n", rssi, lqi);
+        }
+
+        else if (str[0] == 'T') {      // Telemetry windows
+            report_telemetry();
+        }
+
+        else if (str[0] == 'S') {      // Noise floor map
+            Timer t;
+
+            radio_lock.lock();
+            if (hopping) {
+                radio_lock.unlock();
+                printf("\r\nERR hopping\r\n");
+                continue;
+            }
+            t.start();
+            scan_band();
+            t.stop();
+            radio_lock.unlock();
+
+            printf("\r\nS %d %d %d %d %d", (int)(t.elapsed_time().count() / 1000),
+                   SCAN_CHANNELS, SCAN_STEP_HZ, rx_channel, tx_channel);
+            for (int ch = 0; ch < SCAN_CHANNELS; ch++)
+                printf(" %d", noise_map[ch]);
+            printf("\r\n");
+        }
+
+        else if (str[0] == 'M') {      // MAC mode
+            int v[4];
+            for (int i = 0; i < 4; i++) {
+                scanf("%7s", str);
+                v[i] = atoi(str);
+            }
+            mac_config c = { v[0] != 0, (uint8_t)v[1], (uint8_t)v[2], (uint8_t)v[3] };
+
+            radio_lock.lock();
+            bool ok = mac_configure(&c);
+            radio_lock.unlock();
+
+            if (ok)
+                printf("\r\nM %d %d %d %d\r\n", v[0], v[1], v[2], v[3]);
+            else
+                printf("\r\nERR mac\r\n");
+        }
+
+        else if (str[0] == 'C') {      // Listen-before-talk counters
+            radio_lock.lock();
+            mac_counters c = mac_stats;
+            radio_lock.unlock();
+
+            printf("\r\nC %lu %lu %lu %lu %lu %lu\r\n", (unsigned long)c.requests, (unsigned long)c.granted,
+                   (unsigned long)c.busy, (unsigned long)c.timeouts,
+                   (unsigned long)c.overruns, (unsigned long)c.turn_us_max);
+        }
+
+        else if (str[0] == 'D') {      // TDMA slots
+            unsigned long v[4];
+            for (int i = 0; i < 4; i++) {
+                scanf("%7s", str);
+                v[i] = strtoul(str, 0, 10);
+            }
+            tdma_config c = { (uint32_t)v[0], (uint32_t)v[1], (uint32_t)v[2], (uint32_t)v[3] };
+
+            radio_lock.lock();
+            bool ok = tdma_configure(&c);
+            radio_lock.unlock();
+
+            if (ok)
+                printf("\r\nD %lu %lu %lu %lu\r\n", v[0], v[1], v[2], v[3]);
+            else
+                printf("\r\nERR tdma\r\n");
+        }
+
+        else if (str[0] == 'Y') {      // TDMA superframe sync, no answer
+            scanf("%7s", str);
+            long age = atol(str);
+
+            // Two stores on the M4, tdma_key() must not see half of them
+            radio_lock.lock();
+            tdma_origin_us = tdma_now_us() - age;
+            radio_lock.unlock();
+        }
+
+        else if (str[0] == 'H') {      // Hop table
+            unsigned long v[3] = { 0, 0, 0 };
+            hop_table t = { 0, 0, { 0 } };
+            bool ok = true;
+
+            scanf("%7s", str);
+            v[0] = strtoul(str, 0, 10);
+            if (v[0] > 0) {
+                for (int i = 1; i < 3; i++) {
+                    scanf("%7s", str);
+                    v[i] = strtoul(str, 0, 10);
+                }
+                // A count off the wire, more than a table holds would
+                // read the commands after it as shifts
+                t.from = (uint32_t)v[1];
+                t.n = v[2] > HOP_MAX ? 0 : (int)v[2];
+                for (int i = 0; i < t.n; i++) {
+                    scanf("%7s", str);
+                    t.shift[i] = (int8_t)atoi(str);
+                }
+            }
+
+            radio_lock.lock();
+            if (v[0] == 0 && !hop_calibrated)
+                hop_calibrate();
+            if (v[0] == 0)
+                hop_stop();
+            else
+                ok = hop_load((uint32_t)v[0], &t);
+            radio_lock.unlock();
+
+            if (ok)
+                printf("\r\nH %lu %lu %lu\r\n", v[0], v[1], v[2]);
+            else
+                printf("\r\nERR hop table\r\n");
+        }
+
+        else if (str[0] == 'J') {      // Dwell clock, no answer
+            scanf("%7s", str);
+            uint32_t index = (uint32_t)strtoul(str, 0, 10);
+            scanf("%7s", str);
+            uint32_t age = (uint32_t)strtoul(str, 0, 10);
+
+            radio_lock.lock();
+            hop_sync(index, age);
+            radio_lock.unlock();
+        }
+
+        else if (str[0] == 'V') {      // Receive diversity
+            scanf("%7s", str);
+            int on = atoi(str);
+
+            radio_lock.lock();
+            bool ok = div_configure(on != 0);
+            radio_lock.unlock();
+
+            if (ok)
+                printf("\r\nV %d\r\n", on);
+            else
+                printf("\r\nERR diversity\r\n");
+        }
+
+        else if (str[0] == 'A') {      // FC_OFFSET tracking
+            scanf("%7s", str);
+            int on = atoi(str);
+
+            radio_lock.lock();
+            afc_configure(on != 0);
+            int offset = afc.offset;
+            radio_lock.unlock();
+
+            printf("\r\nA %d %d\r\n", on != 0, offset);
+        }
+
+        else if (str[0] == 'O') {      // Drift history
+            report_drift();
+        }
+
+        else if (str[0] == 'B') {      // PN9 bit error rate test
+            scanf("%7s", str);
+            unsigned long bps = strtoul(str, 0, 10);
+
+            ber_lock.lock();
+            bool ok = ber_configure((uint32_t)bps);
+            ber_lock.unlock();
+
+            if (ok)
+                printf("\r\nB %lu\r\n", bps);
+            else
+                printf("\r\nERR bps %lu\r\n", bps);
+        }
+
+        else if (str[0] == 'E') {      // Bit error counts
+            report_ber();
+        }
+
+        else if (str[0] == 'W') {      // Whitening check
+            whiten_result r;
+
+            radio_lock.lock();
+            bool ok = whiten_check(&r);
+            radio_lock.unlock();
+
+            if (!ok) {
+                printf("\r\nERR whiten\r\n");
+                continue;
+            }
+            printf("\r\nW %d %d", r.received, r.matches);
+            for (int i = 0; i < 8; i++)
+                printf(" %02X", r.first[i]);
+            printf("\r\n");
+        }
+
+        else if (str[0] == 'X') {      // AES engine
+            scanf("%7s", str);
+            unsigned long n = strtoul(str, 0, 10);
+            aes_result r;
+
+            if (aes_bench((uint32_t)n, &r))
+                printf("\r\nX %d %lu %lu\r\n", r.known_answer, (unsigned long)r.blocks, (unsigned long)r.us);
+            else
+                printf("\r\nERR aes %lu\r\n", n);
+        }
+
+        else if (str[0] == 'U') {      // Buffer pools
+            scanf("%7s", str);
+            unsigned long n = strtoul(str, 0, 10);
+            pool_stress_result r = { 0, 0, 0, 0 };
+
+            if (n == 0 || pool_stress(&fifo_pool, (uint32_t)n, &r))
+                report_pools(&r);
+            else
+                printf("\r\nERR pools %lu\r\n", n);
+        }
+
+        else if (str[0] == 'G') {      // Bit modem
+            scanf("%7s", str);
+            unsigned long bps = strtoul(str, 0, 10);
+            scanf("%7s", str);
+            int tx = atoi(str) != 0;
+
+            ber_lock.lock();
+            if (bps != modem.bps)
+                ber_configure(0);
+            bool ok = modem_start((uint32_t)bps, tx ? MODEM_TX_PN9 : MODEM_TX_OFF);
+            int32_t ppm = modem.ppm;
+            ber_lock.unlock();
+
+            if (ok)
+                printf("\r\nG %lu %d %ld\r\n", bps, tx, (long)ppm);
+            else
+                printf("\r\nERR bps %lu\r\n", bps);
+        }
+
+        else if (str[0] == 'K') {      // Bit modem and clock recovery counters
+            core_util_critical_section_enter();
+            modem_counters c = modem;
+            cdr_ctx r = rx_cdr;
+            uint64_t syncs = rx_sync.hits;
+            core_util_critical_section_exit();
+
+            unsigned long timing = r.transitions ? (unsigned long)(r.timing_error * 100 / CDR_PHASE_ONE / r.transitions) : 0;
+            printf("\r\nK %lu %ld %lu %lu %lu %llu %llu %lu %llu\r\n", (unsigned long)c.bps, (long)c.ppm,
+                   (unsigned long)c.rx_halves, (unsigned long)c.tx_halves, (unsigned long)c.overruns,
+                   (unsigned long long)r.bits, (unsigned long long)r.transitions, timing,
+                   (unsigned long long)syncs);
+        }
+
+        else if (str[0] == 'Z') {      // Sync word
+            char hex[12];
+            scanf("%11s", hex);
+            uint32_t word = (uint32_t)strtoul(hex, 0, 16);
+            scanf("%7s", str);
+            int bits = atoi(str);
+            scanf("%7s", str);
+            int errors = atoi(str);
+
+            if (rx_sync_configure(word, bits, errors))
+                printf("\r\nZ %lX %d %d\r\n", (unsigned long)word, bits, errors);
+            else
+                printf("\r\nERR sync\r\n");
+        }
+
+        else if (str[0] == 'F') {      // Channel shift
+            scanf("%7s", str);
+            int n = atoi(str);
+
+            radio_lock.lock();
+            bool ok = set_channel_shift(n);
+            radio_lock.unlock();
+
+            if (ok)
+                printf("\r\nF %d\r\n", n);
+            else
+                printf("\r\nERR shift %d\r\n", n);
+        }
+
+        else {
+            printf("\r\nERR %s\r\n", str);
+        }
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,660 @@
+/*
+    AES-128 link encryption
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_HAVE_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define AES_HAVE_ARMV8 1
+#endif
+
+#define AES_POLY            0x11B
+#define AES_CTR_CHUNK       8               // counter blocks a kernel call
+
+typedef void (*blocks_fn)(const aes_key *k, const uint8_t *in, uint8_t *out, int n);
+typedef void (*cbc_fn)(const aes_key *k, uint8_t *x, const uint8_t *in, int n);
+
+static uint8_t sbox[256];
+static uint32_t te[256];                    // SubBytes and MixColumns of row 0
+static int tables_ready;
+
+static blocks_fn blocks = 0;
+static cbc_fn cbc = 0;
+static aes_backend backend_in_use = AES_SCALAR;
+
+static uint8_t xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ (x & 0x80 ? AES_POLY & 0xFF : 0));
+}
+
+static uint32_t rotl32(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// The S-box from the inverses in GF(2^8) and the affine map, the table
+// with bytes 2s, s, s, 3s from the LSB up
+static void aes_tables(void)
+{
+    uint8_t p = 1, q = 1;
+
+    if (tables_ready)
+        return;
+
+    // p runs over the powers of 3, q over those of its inverse
+    do
+    {
+        p = (uint8_t)(p ^ xtime(p));
+        q ^= (uint8_t)(q << 1);
+        q ^= (uint8_t)(q << 2);
+        q ^= (uint8_t)(q << 4);
+        if (q & 0x80)
+            q ^= 0x09;
+
+        uint8_t x = (uint8_t)(q ^ (q << 1 | q >> 7) ^ (q << 2 | q >> 6) ^ (q << 3 | q >> 5) ^ (q << 4 | q >> 4));
+        sbox[p] = (uint8_t)(x ^ 0x63);
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t s = sbox[i];
+        uint8_t s2 = xtime(s);
+
+        te[i] = (uint32_t)s2 | ((uint32_t)s << 8) | ((uint32_t)s << 16) | ((uint32_t)(s2 ^ s) << 24);
+    }
+
+    tables_ready = 1;
+}
+
+void aes_set_key(aes_key *k, const uint8_t key[AES_BLOCK])
+{
+    uint8_t rcon = 1;
+
+    aes_tables();
+    memcpy(k->rk, key, AES_BLOCK);
+
+    for (int i = 4; i < 4 * (AES_ROUNDS + 1); i++)
+    {
+        uint8_t t[4];
+
+        memcpy(t, k->rk + 4 * (i - 1), 4);
+        if (i % 4 == 0)
+        {
+            uint8_t t0 = t[0];
+
+            t[0] = (uint8_t)(sbox[t[1]] ^ rcon);
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[t0];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++)
+            k->rk[4 * i + j] = k->rk[4 * (i - 4) + j] ^ t[j];
+    }
+}
+
+// A column a 32-bit word, row 0 in the LSB; row r of column c comes from
+// column c + r before ShiftRows
+static void blocks_scalar(const aes_key *k, const uint8_t *in, uint8_t *out, int n)
+{
+    for (int b = 0; b < n; b++, in += AES_BLOCK, out += AES_BLOCK)
+    {
+        uint32_t s[4], t[4];
+
+        for (int c = 0; c < 4; c++)
+            s[c] = le32(in + 4 * c) ^ le32(k->rk + 4 * c);
+
+        for (int r = 1; r < AES_ROUNDS; r++)
+        {
+            for (int c = 0; c < 4; c++)
+                t[c] = te[s[c] & 0xFF] ^ rotl32(te[(s[(c + 1) & 3] >> 8) & 0xFF], 8) ^
+                       rotl32(te[(s[(c + 2) & 3] >> 16) & 0xFF], 16) ^ rotl32(te[s[(c + 3) & 3] >> 24], 24) ^
+                       le32(k->rk + 16 * r + 4 * c);
+            memcpy(s, t, sizeof(s));
+        }
+
+        for (int c = 0; c < 4; c++)
+            t[c] = ((uint32_t)sbox[s[c] & 0xFF] | ((uint32_t)sbox[(s[(c + 1) & 3] >> 8) & 0xFF] << 8) |
+                    ((uint32_t)sbox[(s[(c + 2) & 3] >> 16) & 0xFF] << 16) |
+                    ((uint32_t)sbox[s[(c + 3) & 3] >> 24] << 24)) ^
+                   le32(k->rk + 16 * AES_ROUNDS + 4 * c);
+        for (int c = 0; c < 4; c++)
+            put_le32(out + 4 * c, t[c]);
+    }
+}
+
+// CBC-MAC: 'x' through the cipher with each of 'n' blocks XORed in
+static void cbc_scalar(const aes_key *k, uint8_t *x, const uint8_t *in, int n)
+{
+    for (int b = 0; b < n; b++, in += AES_BLOCK)
+    {
+        for (int i = 0; i < AES_BLOCK; i++)
+            x[i] ^= in[i];
+        blocks_scalar(k, x, x, 1);
+    }
+}
+
+#ifdef AES_HAVE_X86
+// Four blocks in flight hide the latency of AESENC
+__attribute__((target("aes,sse2")))
+static void blocks_ni(const aes_key *k, const uint8_t *in, uint8_t *out, int n)
+{
+    __m128i rk[AES_ROUNDS + 1];
+    int i = 0;
+
+    for (int r = 0; r <= AES_ROUNDS; r++)
+        rk[r] = _mm_load_si128((const __m128i *)(k->rk + 16 * r));
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i)), rk[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i + 16)), rk[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i + 32)), rk[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i + 48)), rk[0]);
+
+        for (int r = 1; r < AES_ROUNDS; r++)
+        {
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+            b1 = _mm_aesenc_si128(b1, rk[r]);
+            b2 = _mm_aesenc_si128(b2, rk[r]);
+            b3 = _mm_aesenc_si128(b3, rk[r]);
+        }
+        _mm_storeu_si128((__m128i *)(out + 16 * i), _mm_aesenclast_si128(b0, rk[AES_ROUNDS]));
+        _mm_storeu_si128((__m128i *)(out + 16 * i + 16), _mm_aesenclast_si128(b1, rk[AES_ROUNDS]));
+        _mm_storeu_si128((__m128i *)(out + 16 * i + 32), _mm_aesenclast_si128(b2, rk[AES_ROUNDS]));
+        _mm_storeu_si128((__m128i *)(out + 16 * i + 48), _mm_aesenclast_si128(b3, rk[AES_ROUNDS]));
+    }
+
+    for (; i < n; i++)
+    {
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i)), rk[0]);
+
+        for (int r = 1; r < AES_ROUNDS; r++)
+            b = _mm_aesenc_si128(b, rk[r]);
+        _mm_storeu_si128((__m128i *)(out + 16 * i), _mm_aesenclast_si128(b, rk[AES_ROUNDS]));
+    }
+}
+
+__attribute__((target("aes,sse2")))
+static void cbc_ni(const aes_key *k, uint8_t *x, const uint8_t *in, int n)
+{
+    __m128i rk[AES_ROUNDS + 1];
+    __m128i b = _mm_loadu_si128((const __m128i *)x);
+
+    for (int r = 0; r <= AES_ROUNDS; r++)
+        rk[r] = _mm_load_si128((const __m128i *)(k->rk + 16 * r));
+
+    for (int i = 0; i < n; i++)
+    {
+        b = _mm_xor_si128(b, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i)), rk[0]));
+        for (int r = 1; r < AES_ROUNDS; r++)
+            b = _mm_aesenc_si128(b, rk[r]);
+        b = _mm_aesenclast_si128(b, rk[AES_ROUNDS]);
+    }
+    _mm_storeu_si128((__m128i *)x, b);
+}
+#endif
+
+#ifdef AES_HAVE_ARMV8
+// AESE is AddRoundKey, SubBytes and ShiftRows, AESMC MixColumns
+__attribute__((target("+crypto")))
+static void blocks_armv8(const aes_key *k, const uint8_t *in, uint8_t *out, int n)
+{
+    uint8x16_t rk[AES_ROUNDS + 1];
+    int i = 0;
+
+    for (int r = 0; r <= AES_ROUNDS; r++)
+        rk[r] = vld1q_u8(k->rk + 16 * r);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        uint8x16_t b0 = vld1q_u8(in + 16 * i);
+        uint8x16_t b1 = vld1q_u8(in + 16 * i + 16);
+        uint8x16_t b2 = vld1q_u8(in + 16 * i + 32);
+        uint8x16_t b3 = vld1q_u8(in + 16 * i + 48);
+
+        for (int r = 0; r < AES_ROUNDS - 1; r++)
+        {
+            b0 = vaesmcq_u8(vaeseq_u8(b0, rk[r]));
+            b1 = vaesmcq_u8(vaeseq_u8(b1, rk[r]));
+            b2 = vaesmcq_u8(vaeseq_u8(b2, rk[r]));
+            b3 = vaesmcq_u8(vaeseq_u8(b3, rk[r]));
+        }
+        vst1q_u8(out + 16 * i, veorq_u8(vaeseq_u8(b0, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]));
+        vst1q_u8(out + 16 * i + 16, veorq_u8(vaeseq_u8(b1, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]));
+        vst1q_u8(out + 16 * i + 32, veorq_u8(vaeseq_u8(b2, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]));
+        vst1q_u8(out + 16 * i + 48, veorq_u8(vaeseq_u8(b3, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]));
+    }
+
+    for (; i < n; i++)
+    {
+        uint8x16_t b = vld1q_u8(in + 16 * i);
+
+        for (int r = 0; r < AES_ROUNDS - 1; r++)
+            b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+        vst1q_u8(out + 16 * i, veorq_u8(vaeseq_u8(b, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]));
+    }
+}
+
+__attribute__((target("+crypto")))
+static void cbc_armv8(const aes_key *k, uint8_t *x, const uint8_t *in, int n)
+{
+    uint8x16_t rk[AES_ROUNDS + 1];
+    uint8x16_t b = vld1q_u8(x);
+
+    for (int r = 0; r <= AES_ROUNDS; r++)
+        rk[r] = vld1q_u8(k->rk + 16 * r);
+
+    for (int i = 0; i < n; i++)
+    {
+        b = veorq_u8(b, vld1q_u8(in + 16 * i));
+        for (int r = 0; r < AES_ROUNDS - 1; r++)
+            b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+        b = veorq_u8(vaeseq_u8(b, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]);
+    }
+    vst1q_u8(x, b);
+}
+#endif
+
+aes_backend aes_set_backend(aes_backend backend)
+{
+    aes_tables();
+    blocks = blocks_scalar;
+    cbc = cbc_scalar;
+    backend_in_use = AES_SCALAR;
+
+#ifdef AES_HAVE_X86
+    __builtin_cpu_init();
+    if (backend == AES_NI && __builtin_cpu_supports("aes"))
+    {
+        blocks = blocks_ni;
+        cbc = cbc_ni;
+        backend_in_use = AES_NI;
+    }
+#endif
+
+#ifdef AES_HAVE_ARMV8
+    if (backend == AES_ARMV8 && (getauxval(AT_HWCAP) & HWCAP_AES))
+    {
+        blocks = blocks_armv8;
+        cbc = cbc_armv8;
+        backend_in_use = AES_ARMV8;
+    }
+#endif
+
+    return backend_in_use;
+}
+
+const char *aes_backend_name(void)
+{
+    switch (backend_in_use)
+    {
+        case AES_NI:    return "aes-ni";
+        case AES_ARMV8: return "armv8-ce";
+        default:        return "scalar";
+    }
+}
+
+// The fastest kernel there is, on first use
+static void aes_default_backend(void)
+{
+    if (blocks)
+        return;
+    aes_set_backend(AES_NI);
+#ifdef AES_HAVE_ARMV8
+    aes_set_backend(AES_ARMV8);
+#endif
+}
+
+void aes_encrypt_blocks(const aes_key *k, const uint8_t *in, uint8_t *out, int n)
+{
+    aes_default_backend();
+    blocks(k, in, out, n);
+}
+
+// CBC-MAC over B0, the associated data with its length and the message,
+// each zero-padded to whole blocks
+static void ccm_mac(const aes_key *k, const uint8_t *nonce, const uint8_t *aad, int alen, const uint8_t *msg,
+                    int len, int tag_len, uint8_t *x)
+{
+    uint8_t blk[AES_BLOCK];
+    int full = len / AES_BLOCK;
+
+    aes_default_backend();
+
+    x[0] = (uint8_t)((alen > 0 ? 0x40 : 0) | (((tag_len - 2) / 2) << 3) | (15 - AES_NONCE_LEN - 1));
+    memcpy(x + 1, nonce, AES_NONCE_LEN);
+    x[14] = (uint8_t)(len >> 8);
+    x[15] = (uint8_t)len;
+    blocks(k, x, x, 1);
+
+    if (alen > 0)
+    {
+        int pos = 2;
+
+        memset(blk, 0, sizeof(blk));
+        blk[0] = (uint8_t)(alen >> 8);
+        blk[1] = (uint8_t)alen;
+        for (int i = 0; i < alen; i++)
+        {
+            blk[pos++] = aad[i];
+            if (pos == AES_BLOCK || i == alen - 1)
+            {
+                cbc(k, x, blk, 1);
+                memset(blk, 0, sizeof(blk));
+                pos = 0;
+            }
+        }
+    }
+
+    cbc(k, x, msg, full);
+    if (len > full * AES_BLOCK)
+    {
+        memset(blk, 0, sizeof(blk));
+        memcpy(blk, msg + full * AES_BLOCK, len - full * AES_BLOCK);
+        cbc(k, x, blk, 1);
+    }
+}
+
+// XORs the keystream from counter 1 on into 'buf', and returns S0 in 's0'
+static void ccm_ctr(const aes_key *k, const uint8_t *nonce, uint8_t *buf, int len, uint8_t *s0)
+{
+    uint8_t ctr[AES_CTR_CHUNK * AES_BLOCK], ks[AES_CTR_CHUNK * AES_BLOCK];
+    int next = 0;               // counter of the first block of the chunk
+    int pos = -AES_BLOCK;       // where S_next goes in 'buf', S0 before it
+
+    while (pos < len)
+    {
+        int n = (len - pos + AES_BLOCK - 1) / AES_BLOCK;
+
+        if (n > AES_CTR_CHUNK)
+            n = AES_CTR_CHUNK;
+        for (int b = 0; b < n; b++)
+        {
+            uint8_t *a = ctr + AES_BLOCK * b;
+
+            a[0] = 15 - AES_NONCE_LEN - 1;
+            memcpy(a + 1, nonce, AES_NONCE_LEN);
+            a[14] = (uint8_t)((next + b) >> 8);
+            a[15] = (uint8_t)(next + b);
+        }
+        aes_encrypt_blocks(k, ctr, ks, n);
+
+        for (int b = 0; b < n; b++, pos += AES_BLOCK)
+        {
+            const uint8_t *s = ks + AES_BLOCK * b;
+
+            if (pos < 0)
+            {
+                memcpy(s0, s, AES_BLOCK);
+                continue;
+            }
+            int m = len - pos < AES_BLOCK ? len - pos : AES_BLOCK;
+            for (int j = 0; j < m; j++)
+                buf[pos + j] ^= s[j];
+        }
+        next += n;
+    }
+}
+
+void aes_ccm_seal(const aes_key *k, const uint8_t nonce[AES_NONCE_LEN], const uint8_t *aad, int alen,
+                  uint8_t *buf, int len, uint8_t *tag, int tag_len)
+{
+    uint8_t x[AES_BLOCK], s0[AES_BLOCK];
+
+    ccm_mac(k, nonce, aad, alen, buf, len, tag_len, x);
+    ccm_ctr(k, nonce, buf, len, s0);
+    for (int i = 0; i < tag_len; i++)
+        tag[i] = x[i] ^ s0[i];
+}
+
+int aes_ccm_open(const aes_key *k, const uint8_t nonce[AES_NONCE_LEN], const uint8_t *aad, int alen,
+                 uint8_t *buf, int len, const uint8_t *tag, int tag_len)
+{
+    uint8_t x[AES_BLOCK], s0[AES_BLOCK];
+    uint8_t diff = 0;
+
+    ccm_ctr(k, nonce, buf, len, s0);
+    ccm_mac(k, nonce, aad, alen, buf, len, tag_len, x);
+    for (int i = 0; i < tag_len; i++)
+        diff |= (uint8_t)(tag[i] ^ x[i] ^ s0[i]);
+
+    if (diff)
+    {
+        ccm_ctr(k, nonce, buf, len, s0);
+        return -1;
+    }
+    return 0;
+}
+
+// 'upto' on disk before any counter below it goes on air: a temporary
+// file, synced and renamed over the old one, a crash leaves either
+static int aes_reserve(aes_ctx *a, uint64_t upto)
+{
+    char tmp[AES_PATH_MAX + 8];
+    FILE *f;
+    int ok;
+
+    if (!a->counter_path[0])
+    {
+        a->reserved = upto;
+        return 0;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", a->counter_path);
+    if (!(f = fopen(tmp, "w")))
+        return -1;
+    ok = fprintf(f, "%llu\n", (unsigned long long)upto) > 0 && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, a->counter_path) < 0)
+        return -1;
+
+    a->reserved = upto;
+    return 0;
+}
+
+int aes_init(aes_ctx *a, int id, const uint8_t key[AES_BLOCK], const char *counter_path)
+{
+    struct timespec ts;
+
+    if (id < 0 || id >= AES_MAX_SENDERS || (counter_path && strlen(counter_path) >= AES_PATH_MAX))
+        return -1;
+
+    memset(a, 0, sizeof(*a));
+    aes_set_key(&a->key, key);
+    a->id = id;
+
+    // Microseconds since the epoch fit in the 7 bytes for two thousand
+    // years, unless the clock went back since the last run
+    clock_gettime(CLOCK_REALTIME, &ts);
+    a->counter = ((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000) & 0xFFFFFFFFFFFFFFull;
+    if (counter_path)
+    {
+        unsigned long long stored = 0;
+        FILE *f = fopen(counter_path, "r");
+
+        snprintf(a->counter_path, sizeof(a->counter_path), "%s", counter_path);
+        if (f)
+        {
+            int got = fscanf(f, "%llu", &stored) == 1;
+
+            fclose(f);
+            if (!got)
+                return -1;
+        }
+        if (stored > a->counter)
+            a->counter = stored;
+    }
+
+    return aes_reserve(a, a->counter + AES_COUNTER_RESERVE);
+}
+
+static int hex_digit(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int aes_load_key(const char *path, uint8_t key[AES_BLOCK])
+{
+    char line[128];
+    FILE *f = fopen(path, "r");
+    int n = 0;
+
+    if (!f)
+        return -1;
+    if (!fgets(line, sizeof(line), f))
+        line[0] = '\0';
+    fclose(f);
+
+    for (char *p = line; *p && n < 2 * AES_BLOCK; p++)
+    {
+        int d = hex_digit(*p);
+
+        if (d < 0)
+            continue;
+        if (n % 2 == 0)
+            key[n / 2] = (uint8_t)(d << 4);
+        else
+            key[n / 2] |= (uint8_t)d;
+        n++;
+    }
+
+    return n == 2 * AES_BLOCK ? 0 : -1;
+}
+
+// Seen, or too far below the highest counter to tell
+static int aes_replayed(const aes_replay *r, uint64_t counter)
+{
+    if (counter > r->top)
+        return 0;
+    if (r->top - counter >= AES_REPLAY_WINDOW)
+        return 1;
+    return (int)((r->window >> (r->top - counter)) & 1);
+}
+
+static void aes_seen(aes_replay *r, uint64_t counter)
+{
+    if (counter > r->top)
+    {
+        uint64_t shift = counter - r->top;
+
+        r->window = shift >= AES_REPLAY_WINDOW ? 0 : r->window << shift;
+        r->window |= 1;
+        r->top = counter;
+    }
+    else
+        r->window |= 1ull << (r->top - counter);
+}
+
+// The header goes in the AES_HDR_LEN bytes the pipeline keeps free in
+// front, 'len' counts them
+static int aes_stage_tx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    aes_ctx *a = (aes_ctx *)ctx;
+    uint8_t nonce[AES_NONCE_LEN] = { 0 };
+
+    if (len + AES_TAG_LEN > cap)
+        return -1;
+
+    if (a->counter >= a->reserved && aes_reserve(a, a->counter + AES_COUNTER_RESERVE) < 0)
+    {
+        a->reserve_failures++;
+        return -1;
+    }
+
+    len -= AES_HDR_LEN;
+    buf[0] = (uint8_t)a->id;
+    for (int i = 1; i < AES_HDR_LEN; i++)
+        buf[i] = (uint8_t)(a->counter >> (8 * (AES_HDR_LEN - 1 - i)));
+    a->counter++;
+
+    memcpy(nonce, buf, AES_HDR_LEN);
+    aes_ccm_seal(&a->key, nonce, 0, 0, buf + AES_HDR_LEN, len, buf + AES_HDR_LEN + len, AES_TAG_LEN);
+    a->sealed++;
+    return len + AES_OVERHEAD;
+}
+
+static int aes_stage_rx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    aes_ctx *a = (aes_ctx *)ctx;
+    uint8_t nonce[AES_NONCE_LEN] = { 0 };
+    uint64_t counter = 0;
+    int n = len - AES_OVERHEAD;
+    (void)cap;
+
+    if (n < 0 || buf[0] >= AES_MAX_SENDERS)
+    {
+        a->malformed++;
+        return -1;
+    }
+    for (int i = 1; i < AES_HDR_LEN; i++)
+        counter = (counter << 8) | buf[i];
+
+    aes_replay *r = &a->peers[buf[0]];
+    if (buf[0] == a->id || aes_replayed(r, counter))
+    {
+        a->replays++;
+        return -1;
+    }
+
+    memcpy(nonce, buf, AES_HDR_LEN);
+    if (aes_ccm_open(&a->key, nonce, 0, 0, buf + AES_HDR_LEN, n, buf + AES_HDR_LEN + n, AES_TAG_LEN) < 0)
+    {
+        a->auth_failures++;
+        return -1;
+    }
+
+    aes_seen(r, counter);
+    a->opened++;
+    return n;
+}
+
+static void aes_print_stats(void *ctx, FILE *out)
+{
+    aes_ctx *a = (aes_ctx *)ctx;
+
+    fprintf(out, "aes: backend=%s id=%d sealed=%llu opened=%llu auth_failures=%llu replays=%llu malformed=%llu "
+            "reserve_failures=%llu\n",
+            aes_backend_name(), a->id, (unsigned long long)a->sealed, (unsigned long long)a->opened,
+            (unsigned long long)a->auth_failures, (unsigned long long)a->replays,
+            (unsigned long long)a->malformed, (unsigned long long)a->reserve_failures);
+}
+
+stage aes_stage(aes_ctx *a)
+{
+    stage s = { "aes", aes_stage_tx, aes_stage_rx, aes_print_stats, a, AES_HDR_LEN };
+    return s;
+}
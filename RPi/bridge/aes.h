@@ -0,0 +1,102 @@
+/*
+    AES-128 link encryption
+
+    The encryption stage seals every air frame with AES-128 in CCM mode
+    (RFC 3610) and an AES_TAG_LEN byte tag:
+
+        sender (1) | counter (7, BE) | ciphertext | tag
+
+    The nonce is the first 8 bytes with 5 zeros after them. Every node of
+    a link has its own sender number, -K id,keyfile with the same key
+    file on all of them. A nonce used twice under the key gives the
+    keystream away, so the counter must never go back, and the clock of
+    a Raspberry Pi can: it has no RTC, and fake-hwclock or an NTP step at
+    boot moves it. The highest counter handed out is kept in a file next
+    to the key, 'keyfile'.counter, written AES_COUNTER_RESERVE frames
+    ahead and synced before any of them goes on air; a start takes the
+    higher of that and the clock's microseconds. A crash loses at most
+    the reserve, never reuses it. When the file cannot be written no
+    frame is sealed. A receiver keeps the highest counter and a window of
+    AES_REPLAY_WINDOW below it per sender and drops frames it has seen,
+    its own and those whose tag does not check out.
+
+    The block cipher has AES-NI and ARMv8 crypto extension (Raspberry Pi
+    5) kernels and a portable one on 32-bit tables for the rest. The
+    counter blocks of a frame go through the kernel several at a time,
+    the CBC-MAC a block after the other.
+*/
+
+#ifndef AES_H
+#define AES_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "stage.h"
+
+#define AES_BLOCK           16
+#define AES_ROUNDS          10
+#define AES_TAG_LEN         8
+#define AES_HDR_LEN         8
+#define AES_OVERHEAD        (AES_HDR_LEN + AES_TAG_LEN)
+#define AES_NONCE_LEN       13              // L = 2, frames up to 64k
+#define AES_MAX_SENDERS     16
+#define AES_REPLAY_WINDOW   64
+#define AES_COUNTER_RESERVE 65536           // frames a write of the counter file covers
+#define AES_PATH_MAX        256
+
+typedef enum { AES_SCALAR, AES_NI, AES_ARMV8 } aes_backend;
+
+typedef struct aes_key {
+    uint8_t rk[(AES_ROUNDS + 1) * AES_BLOCK] __attribute__((aligned(16)));
+} aes_key;
+
+typedef struct aes_replay {
+    uint64_t top;                           // 0: nothing yet
+    uint64_t window;                        // bit n: top - n seen
+} aes_replay;
+
+typedef struct aes_ctx {
+    aes_key key;
+    int id;
+    uint64_t counter;                       // of the next frame
+    uint64_t reserved;                      // on disk, counters below it are ours
+    char counter_path[AES_PATH_MAX];        // "" keeps it in memory only
+    aes_replay peers[AES_MAX_SENDERS];
+
+    uint64_t sealed;
+    uint64_t opened;
+    uint64_t auth_failures;
+    uint64_t replays;
+    uint64_t malformed;                     // short, or from an unknown sender
+    uint64_t reserve_failures;              // frames not sealed, the counter file could not be written
+} aes_ctx;
+
+void aes_set_key(aes_key *k, const uint8_t key[AES_BLOCK]);
+
+// 'n' blocks, each on its own (ECB), in place is fine
+void aes_encrypt_blocks(const aes_key *k, const uint8_t *in, uint8_t *out, int n);
+
+// Selects a kernel; falls back to scalar when the CPU lacks it. Returns the one in use.
+aes_backend aes_set_backend(aes_backend backend);
+const char *aes_backend_name(void);
+
+// CCM with a 'tag_len' byte tag over 'aad' and 'buf', which is encrypted
+// or decrypted in place. open returns 0 or -1 when the tag does not match,
+// 'buf' is then left encrypted.
+void aes_ccm_seal(const aes_key *k, const uint8_t nonce[AES_NONCE_LEN], const uint8_t *aad, int alen,
+                  uint8_t *buf, int len, uint8_t *tag, int tag_len);
+int  aes_ccm_open(const aes_key *k, const uint8_t nonce[AES_NONCE_LEN], const uint8_t *aad, int alen,
+                  uint8_t *buf, int len, const uint8_t *tag, int tag_len);
+
+// 'id' 0..AES_MAX_SENDERS-1, the counter kept in 'counter_path', or
+// only in memory when it is 0; -1 if the id is out of range or the file
+// cannot be read or written
+int  aes_init(aes_ctx *a, int id, const uint8_t key[AES_BLOCK], const char *counter_path);
+
+// The key as 32 hex digits, the first line of 'path'; -1 if there is none
+int  aes_load_key(const char *path, uint8_t key[AES_BLOCK]);
+
+stage aes_stage(aes_ctx *a);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+    Frame aggregation
+*/
+
+#include <string.h>
+
+#include "frame.h"
+#include "agg.h"
+
+void agg_init(agg_ctx *ctx, int max_size, int max_delay_ms)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (max_size < 64)
+        max_size = 64;
+    if (max_size > BRIDGE_BUF_SIZE / 2)
+        max_size = BRIDGE_BUF_SIZE / 2;
+
+    ctx->max_size = max_size;
+    ctx->max_delay_ns = (uint64_t)max_delay_ms * 1000000ULL;
+}
+
+int agg_add(agg_ctx *ctx, int hop, const uint8_t *pkt, int len, uint64_t now_ns)
+{
+    agg_queue *q = &ctx->q[hop];
+    int need = len + AGG_SUB_OVERHEAD;
+
+    // A packet bigger than max_size still goes, alone
+    if (q->count > 0 && 1 + q->len + need > ctx->max_size)
+        return 0;
+    if (1 + q->len + need > BRIDGE_BUF_SIZE)
+        return 0;
+
+    uint8_t *p = q->buf + q->len;
+    p[0] = (uint8_t)(len >> 8);
+    p[1] = (uint8_t)len;
+    p[2] = crc8(p, 2);
+    memcpy(p + AGG_SUB_HDR, pkt, len);
+
+    uint16_t crc = crc16_ccitt(p, AGG_SUB_HDR + len);
+    p[AGG_SUB_HDR + len]     = (uint8_t)(crc >> 8);
+    p[AGG_SUB_HDR + len + 1] = (uint8_t)crc;
+
+    if (q->count++ == 0)
+        q->first_ns = now_ns;
+    q->len += need;
+
+    return 1;
+}
+
+int agg_pending(const agg_ctx *ctx, int hop)
+{
+    return ctx->q[hop].count;
+}
+
+int agg_is_full(const agg_ctx *ctx, int hop)
+{
+    // Not even a minimal packet would fit any more
+    return 1 + ctx->q[hop].len + AGG_SUB_OVERHEAD + 20 > ctx->max_size;
+}
+
+int64_t agg_time_left(const agg_ctx *ctx, int hop, uint64_t now_ns)
+{
+    const agg_queue *q = &ctx->q[hop];
+
+    if (!q->count)
+        return -1;
+    if (now_ns >= q->first_ns + ctx->max_delay_ns)
+        return 0;
+
+    return (int64_t)(q->first_ns + ctx->max_delay_ns - now_ns);
+}
+
+int agg_take(agg_ctx *ctx, int hop, uint8_t *out, int cap, agg_reason reason)
+{
+    agg_queue *q = &ctx->q[hop];
+    int len;
+
+    if (!q->count || 1 + q->len > cap)
+        return 0;
+
+    if (q->count == 1)
+    {
+        // Nothing to share the frame with: the packet as it is
+        len = q->len - AGG_SUB_OVERHEAD;
+        memcpy(out, q->buf + AGG_SUB_HDR, len);
+        ctx->stats.singles++;
+    }
+    else
+    {
+        out[0] = AGG_TYPE;
+        memcpy(out + 1, q->buf, q->len);
+        len = 1 + q->len;
+        ctx->stats.frames++;
+        ctx->stats.subframes += q->count;
+    }
+    if (reason == AGG_FLUSH_FULL)
+        ctx->stats.flush_full++;
+    else
+        ctx->stats.flush_delay++;
+
+    q->len = 0;
+    q->count = 0;
+
+    return len;
+}
+
+int agg_is_aggregate(const uint8_t *buf, int len)
+{
+    return len > 1 && buf[0] == AGG_TYPE;
+}
+
+void agg_iter_init(agg_iter *it, uint8_t *buf, int len)
+{
+    it->buf = buf;
+    it->len = len;
+    it->pos = 1;
+}
+
+int agg_next(agg_ctx *ctx, agg_iter *it, uint8_t **pkt)
+{
+    if (it->pos == 1)
+        ctx->stats.rx_frames++;
+
+    while (it->pos + AGG_SUB_OVERHEAD <= it->len)
+    {
+        uint8_t *p = it->buf + it->pos;
+        int len = (p[0] << 8) | p[1];
+
+        if (crc8(p, 2) != p[2] || it->pos + AGG_SUB_OVERHEAD + len > it->len)
+        {
+            // Lost the subframe boundaries, the rest is unusable
+            ctx->stats.rx_truncated++;
+            it->pos = it->len;
+            return 0;
+        }
+
+        it->pos += AGG_SUB_OVERHEAD + len;
+
+        uint16_t crc = (p[AGG_SUB_HDR + len] << 8) | p[AGG_SUB_HDR + len + 1];
+        if (crc16_ccitt(p, AGG_SUB_HDR + len) != crc)
+        {
+            ctx->stats.rx_crc_errors++;
+            continue;
+        }
+
+        ctx->stats.rx_subframes++;
+        *pkt = p + AGG_SUB_HDR;
+        return len;
+    }
+
+    return 0;
+}
+
+void agg_print_stats(agg_ctx *ctx, FILE *out)
+{
+    agg_stats *s = &ctx->stats;
+
+    fprintf(out, "agg: max_size=%d max_delay=%llums frames=%llu subframes=%llu (%.2f/frame) singles=%llu "
+                 "flush full/delay=%llu/%llu rx frames=%llu subframes=%llu crc_errors=%llu truncated=%llu\n",
+            ctx->max_size, (unsigned long long)(ctx->max_delay_ns / 1000000ULL),
+            (unsigned long long)s->frames, (unsigned long long)s->subframes,
+            s->frames ? (double)s->subframes / s->frames : 0.0, (unsigned long long)s->singles,
+            (unsigned long long)s->flush_full, (unsigned long long)s->flush_delay,
+            (unsigned long long)s->rx_frames, (unsigned long long)s->rx_subframes,
+            (unsigned long long)s->rx_crc_errors, (unsigned long long)s->rx_truncated);
+}
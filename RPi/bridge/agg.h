@@ -0,0 +1,91 @@
+/*
+    Frame aggregation
+
+    Packets queued for the same next hop are packed into one air frame so
+    that the preamble, sync word and radio turnaround are paid once:
+
+        0xFB { len (2, BE) | crc8(len) | packet | crc16(len, packet) } ...
+
+    Each subframe has its own CRC, a corrupted packet does not take the
+    rest of the frame with it; only a corrupted length stops the parse. A
+    packet that is alone when its queue is flushed goes as it is, without
+    the 6 bytes of aggregate framing; no packet type starts with 0xFB.
+    A queue is flushed when it reaches max_size, or when the line is idle
+    and its oldest packet has waited max_delay: aggregation adds at most
+    max_delay of latency, and whatever arrives while the radio is busy
+    rides along in the next burst. With a max_delay of 0 a packet goes as
+    soon as the line is idle, and only what arrives while it is busy is
+    packed: at low load that is the latency of sending every packet alone
+    (bridge_bench agg -A 0). On receive the subframes are returned as
+    pointers into the frame buffer.
+*/
+
+#ifndef AGG_H
+#define AGG_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define AGG_TYPE        0xFB
+#define AGG_SUB_HDR     3
+#define AGG_SUB_OVERHEAD (AGG_SUB_HDR + 2)
+#define AGG_MAX_HOPS    8
+
+typedef struct agg_queue {
+    uint8_t buf[BRIDGE_BUF_SIZE];
+    int len;
+    int count;
+    uint64_t first_ns;
+} agg_queue;
+
+typedef struct agg_stats {
+    uint64_t frames;
+    uint64_t subframes;
+    uint64_t singles;       // flushed alone, sent bare
+    uint64_t flush_full;
+    uint64_t flush_delay;
+    uint64_t rx_frames;
+    uint64_t rx_subframes;
+    uint64_t rx_crc_errors;
+    uint64_t rx_truncated;
+} agg_stats;
+
+typedef struct agg_ctx {
+    int max_size;
+    uint64_t max_delay_ns;
+    agg_queue q[AGG_MAX_HOPS];
+    agg_stats stats;
+} agg_ctx;
+
+typedef enum { AGG_FLUSH_FULL, AGG_FLUSH_DELAY } agg_reason;
+
+typedef struct agg_iter {
+    uint8_t *buf;
+    int len;
+    int pos;
+} agg_iter;
+
+void agg_init(agg_ctx *ctx, int max_size, int max_delay_ms);
+
+// Queues a packet for 'hop'; returns 0 if it does not fit and the queue must be flushed first
+int  agg_add(agg_ctx *ctx, int hop, const uint8_t *pkt, int len, uint64_t now_ns);
+
+int  agg_pending(const agg_ctx *ctx, int hop);
+int  agg_is_full(const agg_ctx *ctx, int hop);
+
+// Nanoseconds until 'hop' must be flushed (0 if overdue), -1 if empty
+int64_t agg_time_left(const agg_ctx *ctx, int hop, uint64_t now_ns);
+
+// Moves the aggregate frame of 'hop' into 'out', or a lone packet as it
+// is; returns its length
+int  agg_take(agg_ctx *ctx, int hop, uint8_t *out, int cap, agg_reason reason);
+
+// Iterates over the intact subframes of a received frame, in place
+int  agg_is_aggregate(const uint8_t *buf, int len);
+void agg_iter_init(agg_iter *it, uint8_t *buf, int len);
+int  agg_next(agg_ctx *ctx, agg_iter *it, uint8_t **pkt);
+
+void agg_print_stats(agg_ctx *ctx, FILE *out);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+    Selective-repeat ARQ
+*/
+
+#include <string.h>
+
+#include "arq.h"
+
+#define MS(x) ((int64_t)(x) * 1000000)
+
+static arq_slot *tx_slot(arq_ctx *ctx, uint8_t seq)
+{
+    return &ctx->tx[seq & (ARQ_MAX_WINDOW - 1)];
+}
+
+static arq_slot *rx_slot(arq_ctx *ctx, uint8_t seq)
+{
+    return &ctx->rx[seq & (ARQ_MAX_WINDOW - 1)];
+}
+
+void arq_init(arq_ctx *ctx, int window)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (window < 1)
+        window = 1;
+    if (window > ARQ_MAX_WINDOW)
+        window = ARQ_MAX_WINDOW;
+
+    ctx->window = window;
+    ctx->rto_base_ns = MS(ARQ_RTO_INIT_MS);
+    ctx->rto_ns = ctx->rto_base_ns;
+}
+
+int arq_can_send(const arq_ctx *ctx)
+{
+    return (uint8_t)(ctx->snd_nxt - ctx->snd_una) < ctx->window;
+}
+
+// Header carrying the current ACK state, returns its length
+static int arq_write_hdr(arq_ctx *ctx, uint8_t *p, uint8_t flags, uint8_t seq)
+{
+    uint32_t sack = 0;
+
+    for (int i = 0; i < ctx->window - 1; i++)
+        if (rx_slot(ctx, ctx->rcv_nxt + 1 + i)->state == 2)
+            sack |= 1u << i;
+
+    if (sack)
+        flags |= ARQ_F_SACK;
+
+    p[0] = flags;
+    p[1] = seq;
+    p[2] = ctx->rcv_nxt;
+    ctx->ack_pending = 0;
+
+    if (!sack)
+        return ARQ_HDR_LEN;
+
+    p[3] = (uint8_t)(sack >> 24);
+    p[4] = (uint8_t)(sack >> 16);
+    p[5] = (uint8_t)(sack >> 8);
+    p[6] = (uint8_t)sack;
+
+    return ARQ_HDR_LEN + ARQ_SACK_LEN;
+}
+
+int arq_send(arq_ctx *ctx, uint8_t **buf, int len, uint64_t now_ns)
+{
+    if (!arq_can_send(ctx) || len + ARQ_HDR_LEN + ARQ_SACK_LEN > BRIDGE_BUF_SIZE)
+        return -1;
+
+    uint8_t seq = ctx->snd_nxt++;
+    arq_slot *s = tx_slot(ctx, seq);
+
+    memcpy(s->buf, *buf, len);
+    s->len = len;
+    s->state = 1;
+    s->tx_count = 1;
+    s->sent_ns = now_ns;
+
+    uint8_t hdr[ARQ_HDR_LEN + ARQ_SACK_LEN];
+    int hl = arq_write_hdr(ctx, hdr, ARQ_F_DATA, seq);
+
+    *buf -= hl;
+    memcpy(*buf, hdr, hl);
+
+    ctx->stats.tx_frames++;
+    return hl + len;
+}
+
+static void arq_rtt_sample(arq_ctx *ctx, int64_t rtt)
+{
+    if (ctx->srtt_ns == 0)
+    {
+        ctx->srtt_ns = rtt;
+        ctx->rttvar_ns = rtt / 2;
+    }
+    else
+    {
+        int64_t err = ctx->srtt_ns - rtt;
+        if (err < 0)
+            err = -err;
+        ctx->rttvar_ns = (3 * ctx->rttvar_ns + err) / 4;
+        ctx->srtt_ns = (7 * ctx->srtt_ns + rtt) / 8;
+    }
+
+    ctx->rto_base_ns = ctx->srtt_ns + 4 * ctx->rttvar_ns;
+    if (ctx->rto_base_ns < MS(ARQ_RTO_MIN_MS))
+        ctx->rto_base_ns = MS(ARQ_RTO_MIN_MS);
+    if (ctx->rto_base_ns > MS(ARQ_RTO_MAX_MS))
+        ctx->rto_base_ns = MS(ARQ_RTO_MAX_MS);
+    ctx->rto_ns = ctx->rto_base_ns;
+
+    ctx->stats.rtt_samples++;
+}
+
+// Karn: only frames sent once give an unambiguous RTT
+static void arq_acked(arq_ctx *ctx, arq_slot *s, uint64_t now_ns)
+{
+    if (s->state == 1 && s->tx_count == 1)
+        arq_rtt_sample(ctx, (int64_t)(now_ns - s->sent_ns));
+}
+
+static int arq_later_sacked(const arq_ctx *ctx, uint8_t seq)
+{
+    for (uint8_t s = seq + 1; s != ctx->snd_nxt; s++)
+        if (ctx->tx[s & (ARQ_MAX_WINDOW - 1)].state == 2)
+            return 1;
+
+    return 0;
+}
+
+static int arq_retransmit(arq_ctx *ctx, uint8_t seq, uint8_t *out, int cap, uint64_t now_ns)
+{
+    arq_slot *s = tx_slot(ctx, seq);
+
+    if (s->len + ARQ_HDR_LEN + ARQ_SACK_LEN > cap)
+        return -1;
+
+    int hl = arq_write_hdr(ctx, out, ARQ_F_DATA, seq);
+    memcpy(out + hl, s->buf, s->len);
+
+    s->tx_count++;
+    s->sent_ns = now_ns;
+    ctx->stats.retransmits++;
+
+    return hl + s->len;
+}
+
+int arq_poll(arq_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns)
+{
+    for (uint8_t seq = ctx->snd_una; seq != ctx->snd_nxt; seq++)
+    {
+        arq_slot *s = tx_slot(ctx, seq);
+
+        if (s->state != 1)
+            continue;
+
+        if (now_ns >= s->sent_ns + ctx->rto_ns)
+        {
+            // Back off once per loss of the oldest frame, not per frame.
+            // A link loses frames to noise, not congestion: stay aggressive.
+            if (seq == ctx->snd_una)
+            {
+                ctx->rto_ns *= 2;
+                if (ctx->rto_ns > ARQ_MAX_BACKOFF * ctx->rto_base_ns)
+                    ctx->rto_ns = ARQ_MAX_BACKOFF * ctx->rto_base_ns;
+                if (ctx->rto_ns > MS(ARQ_RTO_MAX_MS))
+                    ctx->rto_ns = MS(ARQ_RTO_MAX_MS);
+            }
+            ctx->stats.timeouts++;
+            return arq_retransmit(ctx, seq, out, cap, now_ns);
+        }
+
+        if (s->tx_count == 1 && ctx->srtt_ns &&
+            now_ns >= s->sent_ns + ctx->srtt_ns && arq_later_sacked(ctx, seq))
+        {
+            ctx->stats.fast_retransmits++;
+            return arq_retransmit(ctx, seq, out, cap, now_ns);
+        }
+    }
+
+    if (ctx->ack_pending && now_ns >= ctx->ack_due_ns && cap >= ARQ_HDR_LEN + ARQ_SACK_LEN)
+    {
+        ctx->stats.acks_sent++;
+        return arq_write_hdr(ctx, out, 0, ctx->snd_nxt);
+    }
+
+    return 0;
+}
+
+int64_t arq_time_left(const arq_ctx *ctx, uint64_t now_ns)
+{
+    int64_t left = -1;
+
+    for (uint8_t seq = ctx->snd_una; seq != ctx->snd_nxt; seq++)
+    {
+        const arq_slot *s = &ctx->tx[seq & (ARQ_MAX_WINDOW - 1)];
+
+        if (s->state != 1)
+            continue;
+
+        int64_t t = (int64_t)(s->sent_ns + ctx->rto_ns - now_ns);
+        if (s->tx_count == 1 && ctx->srtt_ns && (int64_t)(s->sent_ns + ctx->srtt_ns - now_ns) < t &&
+            arq_later_sacked(ctx, seq))
+            t = (int64_t)(s->sent_ns + ctx->srtt_ns - now_ns);
+        if (t < 0)
+            t = 0;
+        if (left < 0 || t < left)
+            left = t;
+    }
+
+    if (ctx->ack_pending)
+    {
+        int64_t t = ctx->ack_due_ns > now_ns ? (int64_t)(ctx->ack_due_ns - now_ns) : 0;
+        if (left < 0 || t < left)
+            left = t;
+    }
+
+    return left;
+}
+
+static void arq_ack_at(arq_ctx *ctx, uint64_t due_ns)
+{
+    if (!ctx->ack_pending || due_ns < ctx->ack_due_ns)
+        ctx->ack_due_ns = due_ns;
+    ctx->ack_pending = 1;
+}
+
+static void arq_process_ack(arq_ctx *ctx, uint8_t ack, uint32_t sack, uint64_t now_ns)
+{
+    uint8_t inflight = ctx->snd_nxt - ctx->snd_una;
+
+    // Stale or bogus ACKs fall outside what is in flight
+    if ((uint8_t)(ack - ctx->snd_una) > inflight)
+        return;
+
+    for (; ctx->snd_una != ack; ctx->snd_una++)
+    {
+        arq_slot *s = tx_slot(ctx, ctx->snd_una);
+        arq_acked(ctx, s, now_ns);
+        s->state = 0;
+    }
+
+    inflight = ctx->snd_nxt - ctx->snd_una;
+    for (int i = 0; i < 32 && sack; i++)
+    {
+        uint8_t seq = ack + 1 + i;
+
+        if (!(sack & (1u << i)) || (uint8_t)(seq - ctx->snd_una) >= inflight)
+            continue;
+
+        arq_slot *s = tx_slot(ctx, seq);
+        arq_acked(ctx, s, now_ns);
+        s->state = 2;
+    }
+}
+
+int arq_receive(arq_ctx *ctx, uint8_t *buf, int len, uint8_t **payload, uint64_t now_ns)
+{
+    if (len < ARQ_HDR_LEN)
+    {
+        ctx->stats.rx_errors++;
+        return -1;
+    }
+
+    uint8_t flags = buf[0];
+    uint8_t seq = buf[1];
+    uint32_t sack = 0;
+    int hl = ARQ_HDR_LEN;
+
+    if (flags & ARQ_F_SACK)
+    {
+        if (len < ARQ_HDR_LEN + ARQ_SACK_LEN)
+        {
+            ctx->stats.rx_errors++;
+            return -1;
+        }
+        sack = ((uint32_t)buf[3] << 24) | ((uint32_t)buf[4] << 16) | ((uint32_t)buf[5] << 8) | buf[6];
+        hl += ARQ_SACK_LEN;
+    }
+
+    arq_process_ack(ctx, buf[2], sack, now_ns);
+
+    if (!(flags & ARQ_F_DATA))
+        return 0;
+
+    ctx->stats.rx_frames++;
+
+    uint8_t d = seq - ctx->rcv_nxt;
+    if (d >= ctx->window)
+    {
+        // Already delivered, our ACK got lost
+        ctx->stats.rx_duplicates++;
+        arq_ack_at(ctx, now_ns);
+        return 0;
+    }
+
+    if (d > 0)
+    {
+        arq_slot *s = rx_slot(ctx, seq);
+
+        if (s->state == 2)
+            ctx->stats.rx_duplicates++;
+        else
+        {
+            memcpy(s->buf, buf + hl, len - hl);
+            s->len = len - hl;
+            s->state = 2;
+            ctx->stats.rx_out_of_order++;
+        }
+
+        // Tell the sender about the gap now
+        arq_ack_at(ctx, now_ns);
+        return 0;
+    }
+
+    ctx->rcv_nxt++;
+    ctx->stats.rx_delivered++;
+
+    // Filling a gap releases buffered frames: ACK them all at once
+    if (rx_slot(ctx, ctx->rcv_nxt)->state == 2)
+        arq_ack_at(ctx, now_ns);
+    else
+        arq_ack_at(ctx, now_ns + MS(ARQ_ACK_DELAY_MS));
+
+    *payload = buf + hl;
+    return len - hl;
+}
+
+int arq_next(arq_ctx *ctx, uint8_t **payload)
+{
+    arq_slot *s = rx_slot(ctx, ctx->rcv_nxt);
+
+    if (s->state != 2)
+        return 0;
+
+    s->state = 0;
+    ctx->rcv_nxt++;
+    ctx->stats.rx_delivered++;
+
+    *payload = s->buf;
+    return s->len;
+}
+
+void arq_print_stats(arq_ctx *ctx, FILE *out)
+{
+    arq_stats *s = &ctx->stats;
+
+    fprintf(out, "arq: window=%d in_flight=%d srtt=%.0fms rto=%.0fms tx=%llu retransmits=%llu "
+                 "(timeout %llu, fast %llu) acks=%llu rx=%llu delivered=%llu dup=%llu ooo=%llu errors=%llu\n",
+            ctx->window, (uint8_t)(ctx->snd_nxt - ctx->snd_una),
+            ctx->srtt_ns / 1e6, ctx->rto_ns / 1e6,
+            (unsigned long long)s->tx_frames, (unsigned long long)s->retransmits,
+            (unsigned long long)s->timeouts, (unsigned long long)s->fast_retransmits,
+            (unsigned long long)s->acks_sent, (unsigned long long)s->rx_frames,
+            (unsigned long long)s->rx_delivered, (unsigned long long)s->rx_duplicates,
+            (unsigned long long)s->rx_out_of_order, (unsigned long long)s->rx_errors);
+}
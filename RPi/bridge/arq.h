@@ -0,0 +1,116 @@
+/*
+    Selective-repeat ARQ
+
+    Every air frame gets a small header in front of its payload:
+
+        flags | seq | ack [| sack (4, BE)]
+
+    'ack' is cumulative (the next sequence number expected) and rides on
+    every frame, data or not. When frames arrived out of order the SACK
+    bitmap follows, bit i set meaning ack + 1 + i is already held by the
+    receiver. A frame that carries no data is a pure ACK; those are only
+    sent when the reverse direction stays quiet for ARQ_ACK_DELAY_MS, or
+    right away after a gap or a duplicate.
+
+    The sender keeps up to 'window' frames in flight and retransmits one
+    when its RTO expires (Karn's rule, bounded backoff) or when a later
+    frame has been SACKed and it has been outstanding for longer than the
+    smoothed RTT. The RTO follows RFC 6298 with the measured RTT, which on
+    the half-duplex radio includes the turnaround. The receiver delivers in
+    sequence order: the frame that is next is handed over in place, frames
+    after a gap are copied aside until the gap is filled.
+
+    Both ends must run ARQ, the header has no type byte. It relies on the
+    link CRC to never see a corrupted header.
+*/
+
+#ifndef ARQ_H
+#define ARQ_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define ARQ_MAX_WINDOW      32
+#define ARQ_HDR_LEN         3
+#define ARQ_SACK_LEN        4
+
+#define ARQ_F_DATA          0x01
+#define ARQ_F_SACK          0x02
+
+#define ARQ_RTO_INIT_MS     3000
+#define ARQ_RTO_MIN_MS      100
+#define ARQ_RTO_MAX_MS      60000
+#define ARQ_MAX_BACKOFF     8
+#define ARQ_ACK_DELAY_MS    20
+
+typedef struct arq_slot {
+    uint8_t buf[BRIDGE_BUF_SIZE];
+    int len;
+    int state;                  // 0 free, 1 in flight, 2 SACKed / received
+    int tx_count;
+    uint64_t sent_ns;
+} arq_slot;
+
+typedef struct arq_stats {
+    uint64_t tx_frames;
+    uint64_t retransmits;
+    uint64_t timeouts;
+    uint64_t fast_retransmits;
+    uint64_t acks_sent;
+    uint64_t rx_frames;
+    uint64_t rx_duplicates;
+    uint64_t rx_out_of_order;
+    uint64_t rx_delivered;
+    uint64_t rx_errors;
+    uint64_t rtt_samples;
+} arq_stats;
+
+typedef struct arq_ctx {
+    int window;
+
+    // Sender
+    uint8_t snd_una;
+    uint8_t snd_nxt;
+    arq_slot tx[ARQ_MAX_WINDOW];
+    int64_t srtt_ns;            // 0 until the first sample
+    int64_t rttvar_ns;
+    int64_t rto_base_ns;        // from the RTT estimate
+    int64_t rto_ns;             // with backoff
+
+    // Receiver
+    uint8_t rcv_nxt;
+    arq_slot rx[ARQ_MAX_WINDOW];
+    int ack_pending;
+    uint64_t ack_due_ns;
+
+    arq_stats stats;
+} arq_ctx;
+
+void arq_init(arq_ctx *ctx, int window);
+
+// Room in the window for another data frame
+int  arq_can_send(const arq_ctx *ctx);
+
+// Puts the header in front of a data frame, in the bytes before '*buf',
+// which moves back to it, and keeps a copy for retransmission. Returns
+// the new length or -1 if the window is full or it does not fit.
+int  arq_send(arq_ctx *ctx, uint8_t **buf, int len, uint64_t now_ns);
+
+// Next retransmission or pure ACK that is due, 0 if there is none
+int  arq_poll(arq_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns);
+
+// Nanoseconds until arq_poll() has something to do, -1 if nothing is pending
+int64_t arq_time_left(const arq_ctx *ctx, uint64_t now_ns);
+
+// Processes a received frame. Returns the payload length if it is the next
+// one in sequence (*payload points into 'buf'), 0 if there is nothing to
+// deliver now, -1 if it is malformed. Follow with arq_next().
+int  arq_receive(arq_ctx *ctx, uint8_t *buf, int len, uint8_t **payload, uint64_t now_ns);
+
+// Frames held back by a gap that are now in sequence, 0 when done
+int  arq_next(arq_ctx *ctx, uint8_t **payload);
+
+void arq_print_stats(arq_ctx *ctx, FILE *out);
+
+#endif
@@ -0,0 +1,365 @@
+/*
+    Link bonding
+*/
+
+#include <string.h>
+
+#include "bond.h"
+
+#define MS(x) ((int64_t)(x) * 1000000)
+
+static bond_slot *rx_slot(bond_ctx *ctx, uint16_t seq)
+{
+    return &ctx->rx[seq % BOND_REORDER];
+}
+
+static int bond_count(uint32_t bits)
+{
+    int n = 0;
+
+    for (; bits; bits &= bits - 1)
+        n++;
+    return n;
+}
+
+void bond_init(bond_ctx *ctx, int nlinks, const int *baud, int max_frame, uint64_t now_ns)
+{
+    int slowest = 0;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (nlinks < 1)
+        nlinks = 1;
+    if (nlinks > BOND_MAX_LINKS)
+        nlinks = BOND_MAX_LINKS;
+    ctx->nlinks = nlinks;
+
+    // Up until the peer says otherwise, reports spread over the period
+    for (int i = 0; i < nlinks; i++)
+    {
+        bond_link *l = &ctx->link[i];
+
+        l->baud = baud[i];
+        l->ratio = 255;
+        l->up = 1;
+        l->next_report_ns = now_ns + MS(BOND_REPORT_MS) * (i + 1) / nlinks;
+        l->last_ns = now_ns;
+        if (slowest == 0 || baud[i] < slowest)
+            slowest = baud[i];
+    }
+
+    // A gap may wait for the backlog and a whole frame on the slowest
+    // link, twice over
+    ctx->max_hold_ns = 2 * ((int64_t)max_frame * 10 * 1000000000LL / (slowest > 0 ? slowest : 1) + MS(BOND_BACKLOG_MS)) +
+                       MS(BOND_HOLD_MIN_MS);
+}
+
+static int64_t bond_weight(const bond_link *l)
+{
+    return (int64_t)(l->baud / 100) * l->ratio;
+}
+
+// Smooth weighted round robin, charged by the byte
+static int bond_pick(bond_ctx *ctx, int len)
+{
+    int64_t total = 0;
+    int pick = -1;
+
+    for (int i = 0; i < ctx->nlinks; i++)
+    {
+        bond_link *l = &ctx->link[i];
+
+        if (!l->up)
+            continue;
+        l->current += bond_weight(l) * len;
+        total += bond_weight(l) * len;
+        if (pick < 0 || l->current > ctx->link[pick].current)
+            pick = i;
+    }
+
+    if (pick >= 0)
+    {
+        ctx->link[pick].current -= total;
+        return pick;
+    }
+
+    // Every link down: the best of them
+    pick = 0;
+    for (int i = 1; i < ctx->nlinks; i++)
+        if (bond_weight(&ctx->link[i]) > bond_weight(&ctx->link[pick]))
+            pick = i;
+    return pick;
+}
+
+int bond_send(bond_ctx *ctx, uint8_t **buf, int len, int *link)
+{
+    int i = bond_pick(ctx, len);
+    bond_link *l = &ctx->link[i];
+    uint16_t seq = ctx->snd_nxt++;
+    uint8_t *h = *buf -= BOND_HDR_LEN;
+
+    h[0] = BOND_TYPE;
+    h[1] = BOND_MSG_DATA;
+    h[2] = l->lseq++;
+    h[3] = (uint8_t)(seq >> 8);
+    h[4] = (uint8_t)seq;
+
+    l->tx_frames++;
+    l->tx_bytes += len;
+    *link = i;
+    return len + BOND_HDR_LEN;
+}
+
+// Delivery ratio of a link as this end receives it, out of 255
+static int bond_rx_ratio(const bond_link *l, uint64_t now_ns)
+{
+    if (now_ns > l->last_ns + MS(BOND_DEAD_MS))
+        return 0;
+    if (l->expected == 0)
+        return 255;
+    return bond_count(l->seen & (uint32_t)((1ull << l->expected) - 1)) * 255 / l->expected;
+}
+
+int bond_poll(bond_ctx *ctx, uint8_t *out, int cap, int *link, uint64_t now_ns)
+{
+    if (cap < BOND_MSG_MAX)
+        return 0;
+
+    for (int i = 0; i < ctx->nlinks; i++)
+    {
+        bond_link *l = &ctx->link[i];
+
+        if (now_ns < l->next_report_ns)
+            continue;
+
+        l->next_report_ns = now_ns + MS(BOND_REPORT_MS);
+        out[0] = BOND_TYPE;
+        out[1] = BOND_MSG_REPORT;
+        out[2] = l->lseq++;
+        out[3] = (uint8_t)ctx->nlinks;
+        for (int k = 0; k < ctx->nlinks; k++)
+            out[4 + k] = (uint8_t)bond_rx_ratio(&ctx->link[k], now_ns);
+
+        l->tx_frames++;
+        ctx->stats.reports_tx++;
+        *link = i;
+        return 4 + ctx->nlinks;
+    }
+
+    return 0;
+}
+
+// The 'lseq' gaps of a link are its losses
+static void bond_heard(bond_link *l, uint8_t lseq, uint64_t now_ns)
+{
+    uint8_t gap = (uint8_t)(lseq - l->rx_lseq);
+
+    // The first frame, a repeat, a peer that restarted, or a link back
+    // from a silence: a fresh start
+    if (l->expected == 0 || gap == 0 || gap > 128 || now_ns > l->last_ns + MS(BOND_DEAD_MS))
+    {
+        l->seen = 1;
+        l->expected = 1;
+    }
+    else
+    {
+        l->seen = gap >= BOND_WINDOW ? 1 : (l->seen << gap) | 1;
+        l->expected += gap;
+        if (l->expected > BOND_WINDOW)
+            l->expected = BOND_WINDOW;
+    }
+
+    l->rx_lseq = lseq;
+    l->last_ns = now_ns;
+    l->rx_frames++;
+}
+
+static void bond_report_rx(bond_ctx *ctx, const uint8_t *msg, int len)
+{
+    int n = msg[3];
+
+    if (len < 4 + n)
+    {
+        ctx->stats.errors++;
+        return;
+    }
+
+    ctx->stats.reports_rx++;
+    for (int i = 0; i < n && i < ctx->nlinks; i++)
+    {
+        bond_link *l = &ctx->link[i];
+
+        l->ratio = msg[4 + i];
+        if (l->up && l->ratio < BOND_DOWN_PERCENT * 255 / 100)
+        {
+            l->up = 0;
+            l->current = 0;
+            l->downs++;
+        }
+        else if (!l->up && l->ratio >= BOND_UP_PERCENT * 255 / 100)
+            l->up = 1;
+    }
+}
+
+// Earliest arrival among the held frames, the gap has been open since
+static uint64_t bond_gap_since(const bond_ctx *ctx)
+{
+    uint64_t since = UINT64_MAX;
+
+    for (int i = 0; i < BOND_REORDER; i++)
+        if (ctx->rx[i].held && ctx->rx[i].arrived_ns < since)
+            since = ctx->rx[i].arrived_ns;
+    return since;
+}
+
+static int64_t bond_hold(const bond_ctx *ctx)
+{
+    int64_t hold = 2 * ctx->skew_ns;
+
+    if (hold < MS(BOND_HOLD_MIN_MS))
+        hold = MS(BOND_HOLD_MIN_MS);
+    return hold > ctx->max_hold_ns ? ctx->max_hold_ns : hold;
+}
+
+int bond_receive(bond_ctx *ctx, int link, uint8_t *buf, int len, uint8_t **payload, uint64_t now_ns)
+{
+    if (link < 0 || link >= ctx->nlinks || len < 4 || buf[0] != BOND_TYPE)
+    {
+        ctx->stats.errors++;
+        return -1;
+    }
+
+    bond_heard(&ctx->link[link], buf[2], now_ns);
+
+    if (buf[1] == BOND_MSG_REPORT)
+    {
+        bond_report_rx(ctx, buf, len);
+        return 0;
+    }
+    if (buf[1] != BOND_MSG_DATA || len < BOND_HDR_LEN)
+    {
+        ctx->stats.errors++;
+        return -1;
+    }
+
+    uint16_t seq = (uint16_t)((buf[3] << 8) | buf[4]);
+    uint16_t d = (uint16_t)(seq - ctx->rcv_nxt);
+
+    *payload = buf + BOND_HDR_LEN;
+    len -= BOND_HDR_LEN;
+
+    if (d == 0)
+    {
+        // Filled a gap: how far behind the frames on the other links it was
+        if (ctx->held > 0)
+        {
+            int64_t skew = (int64_t)(now_ns - bond_gap_since(ctx));
+
+            ctx->skew_ns = skew > ctx->skew_ns ? skew : ctx->skew_ns - (ctx->skew_ns - skew) / 8;
+            ctx->stats.gaps_filled++;
+        }
+        ctx->rcv_nxt++;
+        return len;
+    }
+
+    if (d < BOND_REORDER)
+    {
+        bond_slot *s = rx_slot(ctx, seq);
+
+        if (s->held)
+        {
+            ctx->stats.duplicates++;
+            return 0;
+        }
+        memcpy(s->buf, *payload, len);
+        s->len = len;
+        s->held = 1;
+        s->arrived_ns = now_ns;
+        ctx->held++;
+        ctx->stats.reordered++;
+        return 0;
+    }
+
+    // Behind: its gap was given up on, better late than never. The hold
+    // was too short for the skew.
+    if (d >= 0x8000)
+    {
+        ctx->skew_ns += ctx->skew_ns / 2 + MS(BOND_HOLD_MIN_MS);
+        if (ctx->skew_ns > ctx->max_hold_ns / 2)
+            ctx->skew_ns = ctx->max_hold_ns / 2;
+        ctx->stats.late++;
+        return len;
+    }
+
+    // Further ahead than the reorder buffer: the links are out of step,
+    // whatever was missing is not coming
+    if (ctx->held == 0)
+    {
+        ctx->stats.lost += d;
+        ctx->rcv_nxt = seq + 1;
+    }
+    else
+        ctx->stats.late++;
+    return len;
+}
+
+int bond_next(bond_ctx *ctx, uint8_t **payload, uint64_t now_ns)
+{
+    while (ctx->held > 0)
+    {
+        bond_slot *s = rx_slot(ctx, ctx->rcv_nxt);
+
+        if (s->held)
+        {
+            s->held = 0;
+            ctx->held--;
+            ctx->rcv_nxt++;
+            *payload = s->buf;
+            return s->len;
+        }
+
+        if (now_ns < bond_gap_since(ctx) + bond_hold(ctx))
+            return 0;
+
+        // Given up on, the frames behind it go up
+        ctx->rcv_nxt++;
+        ctx->stats.lost++;
+    }
+
+    return 0;
+}
+
+int64_t bond_time_left(const bond_ctx *ctx, uint64_t now_ns)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0; i < ctx->nlinks; i++)
+        if (ctx->link[i].next_report_ns < next)
+            next = ctx->link[i].next_report_ns;
+    if (ctx->held > 0 && bond_gap_since(ctx) + bond_hold(ctx) < next)
+        next = bond_gap_since(ctx) + bond_hold(ctx);
+
+    return next > now_ns ? (int64_t)(next - now_ns) : 0;
+}
+
+void bond_print_stats(bond_ctx *ctx, FILE *out)
+{
+    bond_stats *s = &ctx->stats;
+
+    fprintf(out, "bond: reports_tx=%llu reports_rx=%llu reordered=%llu gaps_filled=%llu lost=%llu late=%llu "
+                 "duplicates=%llu errors=%llu hold=%lldms\n",
+            (unsigned long long)s->reports_tx, (unsigned long long)s->reports_rx,
+            (unsigned long long)s->reordered, (unsigned long long)s->gaps_filled,
+            (unsigned long long)s->lost, (unsigned long long)s->late,
+            (unsigned long long)s->duplicates, (unsigned long long)s->errors,
+            (long long)(bond_hold(ctx) / 1000000));
+    for (int i = 0; i < ctx->nlinks; i++)
+    {
+        bond_link *l = &ctx->link[i];
+
+        fprintf(out, "bond: link=%d baud=%d %s ratio=%d%% tx_frames=%llu tx_bytes=%llu rx_frames=%llu downs=%llu\n",
+                i, l->baud, l->up ? "up" : "down", l->ratio * 100 / 255,
+                (unsigned long long)l->tx_frames, (unsigned long long)l->tx_bytes,
+                (unsigned long long)l->rx_frames, (unsigned long long)l->downs);
+    }
+}
@@ -0,0 +1,137 @@
+/*
+    Link bonding
+
+    Several radio links, each its own tty and SPIRIT1 pair, carry one
+    logical link. Every frame goes out on one of them, after the ARQ and
+    before the link stages, with a header in front:
+
+        0xF5 1 lseq seq(2)          data
+        0xF5 2 lseq n ratio[n]      report
+
+    'seq' numbers the data frames of the bond, 'lseq' every frame of one
+    link. The links are picked by smooth weighted round robin over the
+    bytes sent, each weighted by its rate times the delivery ratio the
+    peer reports for it, so every link gets the share it can carry.
+
+    The receiver works the delivery ratio of each link out of the 'lseq'
+    gaps over the last BOND_WINDOW frames and reports all of them on every
+    link every BOND_REPORT_MS; a link that has been silent for
+    BOND_DEAD_MS counts as 0. A link whose ratio drops under
+    BOND_DOWN_PERCENT gets no more data, only the reports, which keep
+    probing it; it is back in once it is over BOND_UP_PERCENT. With every
+    link down the best one is used anyway.
+
+    The sender stops taking packets while any link has more than
+    BOND_BACKLOG_MS queued in its tty, so the links stay about as far
+    behind as each other. Frames that arrive ahead of a gap are held
+    until the gap is filled or it has been open for the hold time, twice
+    the skew between the links seen when gaps filled, at least
+    BOND_HOLD_MIN_MS. The bond does not retransmit, the ARQ above it does.
+*/
+
+#ifndef BOND_H
+#define BOND_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "stage.h"
+
+#define BOND_TYPE           0xF5
+#define BOND_MSG_DATA       1
+#define BOND_MSG_REPORT     2
+
+#define BOND_MAX_LINKS      4
+#define BOND_HDR_LEN        5
+#define BOND_REORDER        32      // frames held for a gap, at most
+#define BOND_WINDOW         32
+#define BOND_REPORT_MS      500
+#define BOND_DEAD_MS        2000
+#define BOND_DOWN_PERCENT   40
+#define BOND_UP_PERCENT     70
+#define BOND_HOLD_MIN_MS    20
+#define BOND_BACKLOG_MS     500     // queued on a tty before the sender waits
+#define BOND_MSG_MAX        (4 + BOND_MAX_LINKS)
+
+typedef struct bond_link {
+    int baud;
+
+    // Sender
+    uint8_t lseq;
+    int ratio;              // delivery ratio the peer reports, out of 255
+    int up;
+    int64_t current;        // smooth weighted round robin
+    uint64_t next_report_ns;
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    uint64_t downs;
+
+    // Receiver
+    uint8_t rx_lseq;
+    uint32_t seen;          // last BOND_WINDOW frames, bit 0 the latest
+    int expected;           // frames the window covers so far
+    uint64_t last_ns;
+    uint64_t rx_frames;
+} bond_link;
+
+typedef struct bond_slot {
+    uint8_t buf[BRIDGE_BUF_SIZE];
+    int len;
+    int held;
+    uint64_t arrived_ns;
+} bond_slot;
+
+typedef struct bond_stats {
+    uint64_t reports_tx;
+    uint64_t reports_rx;
+    uint64_t reordered;     // held for a gap
+    uint64_t gaps_filled;
+    uint64_t lost;          // gaps given up on
+    uint64_t late;          // after their gap was given up on
+    uint64_t duplicates;
+    uint64_t errors;
+} bond_stats;
+
+typedef struct bond_ctx {
+    int nlinks;
+    bond_link link[BOND_MAX_LINKS];
+
+    // Sender
+    uint16_t snd_nxt;
+
+    // Receiver
+    uint16_t rcv_nxt;
+    int held;
+    bond_slot rx[BOND_REORDER];
+    int64_t skew_ns;        // arrival spread between the links
+    int64_t max_hold_ns;
+
+    bond_stats stats;
+} bond_ctx;
+
+// 'max_frame' bytes and the backlog on the slowest link bound the hold time
+void bond_init(bond_ctx *ctx, int nlinks, const int *baud, int max_frame, uint64_t now_ns);
+
+// Puts the header in front of a data frame, in the BOND_HDR_LEN bytes
+// before '*buf', which moves back to it, and picks its link. Returns the
+// new length.
+int  bond_send(bond_ctx *ctx, uint8_t **buf, int len, int *link);
+
+// Report due on a link, 0 if there is none
+int  bond_poll(bond_ctx *ctx, uint8_t *out, int cap, int *link, uint64_t now_ns);
+
+// Processes a frame off 'link'. Returns the payload length if it is the
+// next one in sequence (*payload points into 'buf'), 0 if there is nothing
+// to deliver now, -1 if it is malformed. Follow with bond_next().
+int  bond_receive(bond_ctx *ctx, int link, uint8_t *buf, int len, uint8_t **payload, uint64_t now_ns);
+
+// Held frames that are in sequence now, or whose gap has been given up
+// on, 0 when done
+int  bond_next(bond_ctx *ctx, uint8_t **payload, uint64_t now_ns);
+
+// Nanoseconds until a report is due or a gap is given up on
+int64_t bond_time_left(const bond_ctx *ctx, uint64_t now_ns);
+
+void bond_print_stats(bond_ctx *ctx, FILE *out);
+
+#endif
@@ -0,0 +1,4381 @@
+//
+// Compile with: gcc -Wall -O2 -o bridge_bench bridge_bench.c stage.c frame.c fec.c gf256.c hc.c lz.c agg.c arq.c chan.c rate.c scan.c mac.c tdma.c fhss.c mesh.c bond.c div.c pn9.c cdr.c aes.c pbuf.c fq.c cls.c pf.c -lm
+//
+
+/*
+    InverseG bridge - stage benchmarks
+
+    ./bridge_bench fec                 FEC encode/decode throughput, scalar vs SIMD
+    ./bridge_bench ber [options]       goodput versus BER with error injection
+        -l len      packet length (default 60)
+        -n count    packets per BER point (default 2000)
+        -B burst    error burst length in bits (default 1 = independent errors)
+        -b baud     tty rate used to turn efficiency into bytes/s (default 9600)
+    ./bridge_bench hc [-L loss%]       header compression on synthetic UDP/TCP flows
+    ./bridge_bench lz [-D dict] [trace.pcap]
+                                        dictionary compression; without -D a dictionary
+                                        is trained on the first half of the trace
+    ./bridge_bench lztrain trace.pcap out.dict
+    ./bridge_bench agg [options]       aggregation on a simulated line, chatty small packets
+        -l len      packet length (default 40)
+        -a size     aggregate size (default 512)
+        -A ms       aggregation delay (default 50)
+        -T ms       radio turnaround per frame (default 0)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench arq [options]       selective-repeat ARQ over the lossy channel emulator
+        -L loss%    frame loss rate (default: sweep 0..30%)
+        -B burst    mean loss burst length in frames (default 1)
+        -w window   ARQ window (default 8)
+        -l len      frame payload (default 100)
+        -n count    frames per direction (default 500)
+        -T ms       radio turnaround per frame (default 0)
+        -F          FullDuplex radio pair instead of one half-duplex radio
+        -x          traffic both ways, ACKs ride on data
+        -b baud     tty rate (default 9600)
+    ./bridge_bench rate [-m minutes]   rate adaptation on a fading link versus fixed profiles
+    ./bridge_bench scan [-t trials]    sweep time and channel selection in a band with
+                                        random interferers, through the scan handshake
+    ./bridge_bench mac [options]       CSMA versus ALOHA with several nodes on one channel
+        -n nodes    nodes sharing the channel (default: 3, 6 and 10)
+        -l len      frame payload (default 100)
+        -T ms       decision to carrier, the collision window (default 1)
+        -m max_bo   CSMA backoffs before a frame is given up (default 4)
+        -u ms       backoff unit (default: an eighth of the frame airtime)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench tdma [options]      beacon-synchronized TDMA with N virtual nodes,
+                                        against CSMA and ALOHA at the same load
+        -n nodes    nodes, node 0 the master (default: 3 and 6)
+        -l len      frame payload (default 100)
+        -s slots    slots per superframe (default 8)
+        -S ms       slot length (default 400)
+        -g ms       guard at both ends of a slot (default 20, plus the turnaround)
+        -j ms       how late a beacon gets time-stamped, at most (default 10)
+        -d ppm      clock error of the nodes, at most (default 50)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench fhss [options]      frequency hopping against the fixed pair in bands
+                                        with random interferers, through the SYNC protocol
+        -t trials   bands (default 100)
+        -m minutes  per band (default 5)
+        -D ms       dwell (default 800)
+        -l len      frame payload (default 100)
+        -j ms       how late a SYNC gets time-stamped, at most (default 10)
+        -d ppm      clock error of the slave (default 50)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench mesh [options]      mesh routing and forwarding on a 2x5 ladder of nodes,
+                                        throughput and latency per hop count to the gateway
+        -l len      packet length (default 100)
+        -s seconds  per flow (default 120)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench bond [options]      a 9600 and a 4800 baud link bonded, against each
+                                        alone and plain round robin, and a link degrading
+        -l len      packet length (default 200)
+        -s seconds  per run (default 120)
+        -L loss%    frame loss on both links (default 2)
+    ./bridge_bench div [options]       receive diversity on a Rayleigh fading channel: frame
+                                        errors and ARQ retransmissions with one receiver
+                                        and with two, Eb/N0 10..30 dB
+        -l len      packet length (default 100)
+        -n count    packets per point (default 3000)
+        -f nsym     Reed-Solomon parity bytes (default 16)
+        -D hz       Doppler spread, how fast the fades come and go (default 1)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench pn9 [options] [capture.bin]
+                                        PN9 bit error rate tester on a recorded bit capture,
+                                        the first bit in the MSB; without one on a synthetic
+                                        stream, against the bit-serial check
+        -B ber      bit error rate injected (default 1e-3)
+        -b burst    error burst length in bits (default 1)
+        -n Mbits    stream length (default 16)
+        -s bits     a bit slips every so many (default 1000000, 0 = never)
+    ./bridge_bench cdr [options]       clock recovery against mid-bit sampling, frames found
+                                        by the sync word at 16, 8 and 4 samples a bit, and
+                                        the correlator's throughput
+        -n frames   frames per point (default 1000)
+        -l len      payload length (default 32)
+        -p ppm      how much slower the far end's bit clock is (default 100)
+        -f flip     share of the samples flipped (default 0.005)
+    ./bridge_bench cdr [options] samples.bin
+                                        clock recovery on a capture of the bit modem, a
+                                        byte a sample
+        -o n        samples a bit (default 8)
+        -m mask     the pin in a sample (default 0x20)
+        -s hex      sync word, 4 bits a digit (default 5A457, the bridge's
+                    0x2D 0xD4 with the UART's start and stop bits)
+        -w file     the recovered bits, for bridge_bench pn9
+    ./bridge_bench whiten [options]    PN9 whitening a bit, a byte and 8 bytes at a time,
+                                        checked against each other and the SPIRIT1's
+                                        sequence, and the balance of the bits on air
+        -l len      frame length (default 1024)
+        -n MB       data whitened (default 64)
+    ./bridge_bench aes [options]       AES-128 CCM link encryption: known answers, throughput
+                                        of every kernel the CPU has, the stage end to end, and
+                                        what the SPIRIT1's engine over SPI would carry
+        -l len      frame length (default 256)
+        -n MB       data sealed per kernel (default 16)
+        -s hz       SPI clock to the SPIRIT1 (default 1000000, the firmware's)
+        -b baud     tty rate (default 9600)
+    ./bridge_bench path [options]      a packet from the TUN read to the tty write, with the
+                                        packet moved up for every header and copied into an
+                                        air buffer as it was, and in place
+        -l len      packet length (default 1400)
+        -n count    packets per path (default 200000)
+    ./bridge_bench fq [options]        a bulk TCP-like transfer and a ping through one
+                                        FIFO and through the fair queues with CoDel: ping
+                                        time, the bulk packets' time and goodput
+        -l len      bulk packet length (default 512)
+        -s seconds  per run (default 600)
+        -b baud     tty rate (default: 1200 and 9600)
+    ./bridge_bench cls [options]       the same with SNMP-like control traffic as well,
+                                        through one FIFO, through one class and through the
+                                        traffic classes and the airtime shaper at 100% and 50%
+        -l len      bulk packet length (default 512)
+        -s seconds  per run (default 600)
+        -b baud     tty rate (default: 1200 and 9600)
+    ./bridge_bench pf [options] [rules]
+                                        the packet filter: the tables against the rules one
+                                        by one, lookups of both, and a LAN's chatter through
+                                        the rules; without a file the ones in pf.h
+        -n count    lookups (default 1000000)
+        -s seconds  of chatter (default 600)
+        -b baud     tty rate (default 9600)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "stage.h"
+#include "frame.h"
+#include "fec.h"
+#include "gf256.h"
+#include "hc.h"
+#include "lz.h"
+#include "agg.h"
+#include "arq.h"
+#include "chan.h"
+#include "rate.h"
+#include "scan.h"
+#include "mac.h"
+#include "tdma.h"
+#include "fhss.h"
+#include "mesh.h"
+#include "bond.h"
+#include "div.h"
+#include "pn9.h"
+#include "aes.h"
+#include "cdr.h"
+#include "pbuf.h"
+#include "fq.h"
+#include "cls.h"
+#include "pf.h"
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double rng_uniform(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void rng_fill(uint8_t *buf, int len)
+{
+    for (int i = 0; i < len; i++)
+        buf[i] = (uint8_t)rng_next();
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//
+// FEC throughput
+//
+
+static void bench_fec_config(int nsym, int depth, int len)
+{
+    static uint8_t buf[BRIDGE_BUF_SIZE];
+    static uint8_t ref[BRIDGE_BUF_SIZE];
+    const gf_backend backends[] = { GF_SCALAR, GF_SSSE3, GF_AVX2, GF_NEON };
+    fec_ctx fec;
+
+    if (fec_init(&fec, nsym, depth) < 0)
+        return;
+
+    rng_fill(ref, len);
+
+    for (unsigned b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        if (gf_set_backend(backends[b]) != backends[b])
+            continue;
+
+        int iters = 2000000 / len + 1;
+        int air = 0;
+
+        double t0 = now_sec();
+        for (int i = 0; i < iters; i++)
+        {
+            memcpy(buf, ref, len);
+            air = fec_encode(&fec, buf, len, sizeof(buf));
+        }
+        double t1 = now_sec();
+
+        // Decode with nsym/4 symbol errors in every codeword
+        int d = (air - len) / nsym;
+        int k = (len + d - 1) / d;
+        int pad = k * d - len;
+        int errors = 0;
+        double t2 = 0;
+        for (int i = 0; i < iters; i++)
+        {
+            memcpy(buf, ref, len);
+            fec_encode(&fec, buf, len, sizeof(buf));
+            errors = 0;
+            for (int r = 1; r <= nsym / 4 && r < k; r++)
+            {
+                for (int j = 0; j < d; j++)
+                    buf[r * d - pad + j] ^= 0x5A;
+                errors++;
+            }
+            double ts = now_sec();
+            fec_decode(&fec, buf, air);
+            t2 += now_sec() - ts;
+        }
+
+        printf("  %-6s RS(%d) len=%4d depth=%2d  encode %8.1f MB/s  decode(%2d err) %8.1f MB/s\n",
+               gf_backend_name(), 255 - nsym, len, depth,
+               iters * (double)len / (t1 - t0) / 1e6, errors,
+               iters * (double)len / t2 / 1e6);
+    }
+
+    if (fec.stats.frames_failed)
+        printf("  !! %llu frames failed to decode\n", (unsigned long long)fec.stats.frames_failed);
+
+    fec_free(&fec);
+}
+
+static int bench_fec(void)
+{
+    printf("FEC throughput\n");
+
+    bench_fec_config(16, 1, 60);
+    bench_fec_config(16, 4, 60);
+    bench_fec_config(32, 1, 223);
+    bench_fec_config(32, 8, 1500);
+    bench_fec_config(32, 32, 1500);
+
+    gf_set_backend(GF_AVX2);
+    gf_set_backend(GF_NEON);
+    return 0;
+}
+
+//
+// Goodput versus BER
+//
+
+static void inject_errors(uint8_t *buf, int len, double ber, int burst)
+{
+    for (int bit = 0; bit < len * 8; bit++)
+    {
+        if (rng_uniform() >= ber / burst)
+            continue;
+
+        for (int b = bit; b < bit + burst && b < len * 8; b++)
+            if (burst == 1 || (rng_next() & 1))
+                buf[b / 8] ^= (uint8_t)(1 << (b % 8));
+        bit += burst - 1;
+    }
+}
+
+typedef struct ber_result {
+    double delivered;
+    double efficiency;
+} ber_result;
+
+static ber_result run_ber(pipeline *p, double ber, int len, int count, int burst)
+{
+    static uint8_t pkt[BRIDGE_BUF_SIZE];
+    static uint8_t mem[BRIDGE_HEADROOM + BRIDGE_BUF_SIZE];
+    static uint8_t air[BRIDGE_BUF_SIZE + 64];
+    static deframer d;
+    long air_bytes = 0;
+    long good_bytes = 0;
+    int delivered = 0;
+
+    deframer_init(&d);
+
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t *buf = mem + BRIDGE_HEADROOM;
+
+        rng_fill(pkt, len);
+        memcpy(buf, pkt, len);
+
+        int n = pipeline_tx(p, &buf, len, BRIDGE_BUF_SIZE);
+        n = frame_build(air, sizeof(air), buf, n, 4);
+        air_bytes += n;
+
+        inject_errors(air, n, ber, burst);
+
+        for (int j = 0; j < n; j++)
+        {
+            int flen = deframer_push(&d, air[j]);
+            if (flen <= 0)
+                continue;
+
+            uint8_t *body = d.buf;
+            flen = pipeline_rx(p, &body, flen, sizeof(d.buf));
+            if (flen == len && memcmp(body, pkt, len) == 0)
+            {
+                delivered++;
+                good_bytes += len;
+            }
+        }
+
+        // Idle line between frames
+        for (int j = 0; j < 8; j++)
+            deframer_push(&d, (uint8_t)rng_next());
+    }
+
+    ber_result r = { (double)delivered / count, (double)good_bytes / air_bytes };
+    return r;
+}
+
+static int bench_ber(int argc, char *argv[])
+{
+    const double bers[] = { 0, 1e-5, 3e-5, 1e-4, 3e-4, 1e-3, 3e-3, 1e-2 };
+    const int configs[][2] = { { 0, 0 }, { 8, 1 }, { 16, 1 }, { 32, 1 }, { 16, 4 } };
+    const int nconfigs = sizeof(configs) / sizeof(configs[0]);
+    int len = 60;
+    int count = 2000;
+    int burst = 1;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:n:B:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'B': burst = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    if (len <= 0 || len > BRIDGE_BUF_SIZE / 2 || burst < 1)
+        return 1;
+
+    printf("Goodput vs BER: %d-byte packets, %d per point, bursts of %d bits, %d baud (8N1)\n",
+           len, count, burst, baud);
+    printf("%-8s", "BER");
+    for (int c = 0; c < nconfigs; c++)
+    {
+        char name[32];
+        if (configs[c][0] == 0)
+            snprintf(name, sizeof(name), "no FEC");
+        else
+            snprintf(name, sizeof(name), "RS(%d) d%d", 255 - configs[c][0], configs[c][1]);
+        printf(" | %-20s", name);
+    }
+    printf("\n");
+
+    for (unsigned b = 0; b < sizeof(bers) / sizeof(bers[0]); b++)
+    {
+        printf("%-8.0e", bers[b]);
+        for (int c = 0; c < nconfigs; c++)
+        {
+            pipeline p = { .nstages = 0 };
+            crc_ctx crc = { 0 };
+            fec_ctx fec;
+
+            pipeline_add(&p, crc_stage(&crc));
+            if (configs[c][0] > 0)
+            {
+                fec_init(&fec, configs[c][0], configs[c][1]);
+                pipeline_add(&p, fec_stage(&fec));
+            }
+
+            ber_result r = run_ber(&p, bers[b], len, count, burst);
+            printf(" | %5.1f%% %7.1f B/s  ", r.delivered * 100.0, r.efficiency * baud / 10.0);
+
+            if (configs[c][0] > 0)
+                fec_free(&fec);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+//
+// Header compression
+//
+
+#define AIR_OVERHEAD (4 + FRAME_HDR_LEN + 2)    // preamble, frame header, CRC16
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, (uint16_t)(v >> 16));
+    put16(p + 2, (uint16_t)v);
+}
+
+static uint16_t inet_csum(uint32_t sum, const uint8_t *p, int len)
+{
+    for (int i = 0; i + 1 < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    if (len & 1)
+        sum += p[len - 1] << 8;
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+// Builds an IPv4 packet with valid checksums; tcp_opt adds a 12-byte timestamp option
+static int build_packet(uint8_t *p, int proto, int flow, uint16_t ipid, uint32_t seq, uint32_t ack,
+                        uint32_t tsval, int payload)
+{
+    int l4 = proto == 6 ? 32 : 8;
+    int len = 20 + l4 + payload;
+
+    memset(p, 0, 20 + l4);
+    p[0] = 0x45;
+    put16(p + 2, (uint16_t)len);
+    put16(p + 4, ipid);
+    put16(p + 6, 0x4000);
+    p[8] = 64;
+    p[9] = (uint8_t)proto;
+    put32(p + 12, 0x0A000502);
+    put32(p + 16, 0x0A000501);
+    put16(p + 10, inet_csum(0, p, 20));
+
+    put16(p + 20, (uint16_t)(40000 + flow));
+    put16(p + 22, proto == 6 ? 22 : 5000 + flow);
+    for (int i = 0; i < payload; i++)
+        p[20 + l4 + i] = (uint8_t)(i * 7 + (flow << 4) + (tsval & 3));
+
+    uint32_t sum = 0;
+    for (int i = 12; i < 20; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    sum += proto + l4 + payload;
+
+    if (proto == 6)
+    {
+        put32(p + 24, seq);
+        put32(p + 28, ack);
+        p[32] = 8 << 4;
+        p[33] = 0x18;                   // PSH ACK
+        put16(p + 34, 501);
+        p[40] = 1;                      // NOP NOP TS
+        p[41] = 1;
+        p[42] = 8;
+        p[43] = 10;
+        put32(p + 44, tsval);
+        put32(p + 48, tsval - 40);
+        put16(p + 36, inet_csum(sum, p + 20, l4 + payload));
+    }
+    else
+    {
+        put16(p + 24, (uint16_t)(8 + payload));
+        uint16_t csum = inet_csum(sum, p + 20, l4 + payload);
+        put16(p + 26, csum ? csum : 0xFFFF);
+    }
+
+    return len;
+}
+
+// What the end host checks when a damaged context slips past the CRC8
+static int l4_csum_ok(const uint8_t *p, int len)
+{
+    uint32_t sum = 0;
+
+    for (int i = 12; i < 20; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    sum += p[9] + len - 20;
+
+    return inet_csum(sum, p + 20, len - 20) == 0;
+}
+
+static int bench_hc(int argc, char *argv[])
+{
+    static hc_ctx tx, rx;
+    static uint8_t pkt[BRIDGE_BUF_SIZE];
+    static uint8_t buf[BRIDGE_BUF_SIZE];
+    const char *names[] = { "UDP telemetry (3 flows, 20 B)", "TCP data (100 B, timestamps)", "TCP pure ACKs (timestamps)" };
+    double loss = 0;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "L:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'L': loss = atof(optarg) / 100.0; break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    printf("Header compression, %.1f%% link loss, %d baud, %d bytes framing per packet\n",
+           loss * 100.0, baud, AIR_OVERHEAD);
+
+    for (int scenario = 0; scenario < 3; scenario++)
+    {
+        long orig_bytes = 0, link_bytes = 0, sent = 0, delivered = 0, bad = 0;
+        double t = 0;
+
+        hc_init(&tx, HC_REFRESH);
+        hc_init(&rx, HC_REFRESH);
+
+        for (int i = 0; i < 20000; i++)
+        {
+            int len;
+
+            if (scenario == 0)
+                len = build_packet(pkt, 17, i % 3, (uint16_t)(i / 3), 0, 0, i, 20);
+            else if (scenario == 1)
+                len = build_packet(pkt, 6, 0, (uint16_t)i, 1000 + 100 * i, 777, 5000 + i / 4, 100);
+            else
+                len = build_packet(pkt, 6, 1, (uint16_t)i, 555, 1000 + 1448 * i, 5000 + i / 4, 0);
+
+            memcpy(buf, pkt, len);
+            double t0 = now_sec();
+            int clen = hc_compress(&tx, buf, len, sizeof(buf));
+            t += now_sec() - t0;
+
+            orig_bytes += len + AIR_OVERHEAD;
+            link_bytes += clen + AIR_OVERHEAD;
+            sent++;
+
+            if (rng_uniform() < loss)
+                continue;
+
+            t0 = now_sec();
+            int dlen = hc_decompress(&rx, buf, clen, sizeof(buf));
+            t += now_sec() - t0;
+
+            if (dlen == len && memcmp(buf, pkt, len) == 0)
+                delivered++;
+            else if (dlen > 0 && l4_csum_ok(buf, dlen))
+                bad++;
+
+            // Ideal reverse channel for the feedback
+            int flen;
+            while ((flen = hc_take_feedback(&rx, buf, sizeof(buf))) > 0)
+                hc_decompress(&tx, buf, flen, sizeof(buf));
+        }
+
+        double pps_raw = baud / 10.0 / ((double)orig_bytes / sent);
+        double pps_hc  = baud / 10.0 / ((double)link_bytes / sent);
+
+        printf("  %-32s air %6.1f -> %5.1f B/pkt  %6.1f -> %6.1f pkt/s (x%.2f)  delivered %5.1f%%  undetected %ld  %.0f ns/pkt\n",
+               names[scenario], (double)orig_bytes / sent, (double)link_bytes / sent,
+               pps_raw, pps_hc, pps_hc / pps_raw, 100.0 * delivered / sent, bad, t / sent * 1e9);
+    }
+
+    return 0;
+}
+
+//
+// Payload compression
+//
+
+typedef struct trace {
+    uint8_t **pkts;
+    int *lens;
+    int count;
+} trace;
+
+static void trace_add(trace *t, const uint8_t *data, int len)
+{
+    if (len <= 0 || len > BRIDGE_BUF_SIZE / 2)
+        return;
+
+    if ((t->count & 1023) == 0)
+    {
+        t->pkts = realloc(t->pkts, (t->count + 1024) * sizeof(*t->pkts));
+        t->lens = realloc(t->lens, (t->count + 1024) * sizeof(*t->lens));
+    }
+
+    t->pkts[t->count] = malloc(len);
+    memcpy(t->pkts[t->count], data, len);
+    t->lens[t->count++] = len;
+}
+
+static void trace_free(trace *t)
+{
+    for (int i = 0; i < t->count; i++)
+        free(t->pkts[i]);
+    free(t->pkts);
+    free(t->lens);
+}
+
+static uint32_t pcap32(const uint8_t *p, int swap)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+// Classic pcap with raw IP, Ethernet or Linux cooked link types; IP packets only
+static int trace_load_pcap(trace *t, const char *path)
+{
+    static uint8_t rec[65536];
+    uint8_t hdr[24];
+    FILE *f = fopen(path, "rb");
+    int swap;
+
+    if (!f)
+    {
+        fprintf(stderr, "error: cannot open %s\n", path);
+        return -1;
+    }
+
+    if (fread(hdr, 1, 24, f) != 24)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    uint32_t magic = pcap32(hdr, 0);
+    if (magic == 0xA1B2C3D4 || magic == 0xA1B23C4D)
+        swap = 0;
+    else if (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1)
+        swap = 1;
+    else
+    {
+        fprintf(stderr, "error: %s is not a pcap file\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    uint32_t linktype = pcap32(hdr + 20, swap);
+    int skip = linktype == 1 ? 14 : linktype == 113 ? 16 : 0;
+
+    while (fread(hdr, 1, 16, f) == 16)
+    {
+        uint32_t caplen = pcap32(hdr + 8, swap);
+        if (caplen > sizeof(rec) || fread(rec, 1, caplen, f) != caplen)
+            break;
+        if ((int)caplen <= skip)
+            continue;
+        if ((rec[skip] >> 4) != 4 && (rec[skip] >> 4) != 6)
+            continue;
+        trace_add(t, rec + skip, caplen - skip);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Telemetry-like JSON over UDP, for when no capture is at hand
+static void trace_synthesize(trace *t, int count)
+{
+    static const char *names[] = { "temp", "rssi", "volt", "lqi" };
+    uint8_t pkt[512];
+
+    for (int i = 0; i < count; i++)
+    {
+        char json[256];
+        int n = snprintf(json, sizeof(json),
+                         "{\"node\":\"inverseg-%02d\",\"seq\":%d,\"sensor\":\"%s\",\"value\":%d.%d,\"unit\":\"%s\"}",
+                         i % 5, i, names[i % 4], (int)(rng_next() % 100), (int)(rng_next() % 10),
+                         i % 4 == 1 ? "dBm" : "raw");
+        int len = build_packet(pkt, 17, i % 5, (uint16_t)i, 0, 0, 0, 0);
+        memcpy(pkt + len, json, n);
+        trace_add(t, pkt, len + n);
+    }
+}
+
+static void bench_lz_run(lz_ctx *lz, const trace *t, int first, const char *name)
+{
+    static uint8_t buf[BRIDGE_BUF_SIZE];
+    stage s = lz_stage(lz);
+    long bad = 0;
+
+    memset(&lz->stats, 0, sizeof(lz->stats));
+
+    for (int i = first; i < t->count; i++)
+    {
+        memcpy(buf, t->pkts[i], t->lens[i]);
+        int n = s.tx(lz, buf, t->lens[i], sizeof(buf));
+        n = s.rx(lz, buf, n, sizeof(buf));
+        if (n != t->lens[i] || memcmp(buf, t->pkts[i], n) != 0)
+            bad++;
+    }
+
+    lz_stats *st = &lz->stats;
+    printf("  %-22s ratio %5.1f%%  compressed %5.1f%%  stored %5.1f%%  tx %5.0f ns/pkt  rx %5.0f ns/pkt  roundtrip errors %ld\n",
+           name, 100.0 * st->bytes_out / st->bytes_in,
+           100.0 * st->compressed / st->packets_in, 100.0 * st->stored / st->packets_in,
+           (double)st->tx_ns / st->packets_in,
+           st->decompressed ? (double)st->rx_ns / st->decompressed : 0.0, bad);
+}
+
+static int bench_lz(int argc, char *argv[])
+{
+    static lz_ctx lz;
+    static uint8_t dict[LZ_MAX_DICT];
+    const char *dict_path = 0;
+    trace t = { 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "D:")) != -1)
+    {
+        if (opt == 'D')
+            dict_path = optarg;
+        else
+            return 1;
+    }
+
+    if (optind < argc)
+    {
+        if (trace_load_pcap(&t, argv[optind]) < 0)
+            return 1;
+    }
+    else
+        trace_synthesize(&t, 4000);
+
+    if (t.count < 2)
+    {
+        fprintf(stderr, "error: not enough IP packets in the trace\n");
+        return 1;
+    }
+
+    printf("Payload compression, %d packets (%s)\n", t.count, optind < argc ? argv[optind] : "synthetic telemetry");
+
+    lz_init(&lz);
+    bench_lz_run(&lz, &t, 0, "no dictionary");
+
+    int first = 0;
+    if (dict_path)
+    {
+        if (lz_load_dict(&lz, dict_path) < 0)
+        {
+            fprintf(stderr, "error: cannot load %s\n", dict_path);
+            return 1;
+        }
+    }
+    else
+    {
+        // Train on the first half, measure on the second
+        first = t.count / 2;
+        int len = lz_train((const uint8_t *const *)t.pkts, t.lens, first, dict, 4096);
+        lz_set_dict(&lz, dict, len);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%d B dictionary", lz.dict_len);
+    bench_lz_run(&lz, &t, first, name);
+
+    trace_free(&t);
+    return 0;
+}
+
+static int bench_lztrain(int argc, char *argv[])
+{
+    static uint8_t dict[LZ_MAX_DICT];
+    trace t = { 0 };
+
+    if (argc < 3 || trace_load_pcap(&t, argv[1]) < 0)
+        return 1;
+
+    int len = lz_train((const uint8_t *const *)t.pkts, t.lens, t.count, dict, 4096);
+    FILE *f = fopen(argv[2], "wb");
+    if (!f || fwrite(dict, 1, len, f) != (size_t)len)
+    {
+        fprintf(stderr, "error: cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fclose(f);
+
+    printf("Wrote a %d-byte dictionary trained on %d packets to %s\n", len, t.count, argv[2]);
+    trace_free(&t);
+    return 0;
+}
+
+// Airtime of one frame with 'len' body bytes, in seconds
+static double air_time(int len, int baud, double turnaround)
+{
+    return turnaround + (double)(4 + FRAME_HDR_LEN + len) * 10.0 / baud;
+}
+
+typedef struct agg_sim {
+    double free;            // the line is busy until then
+    double air;
+    long frames;
+    long packets;
+    double latency;
+    double worst;
+} agg_sim;
+
+static void agg_sim_frame(agg_sim *s, double now, const double *arrivals, int count, int len,
+                          int baud, double turnaround)
+{
+    double start = now > s->free ? now : s->free;
+
+    s->free = start + air_time(len, baud, turnaround);
+    s->air += s->free - start;
+    s->frames++;
+
+    for (int i = 0; i < count; i++)
+    {
+        double lat = s->free - arrivals[i];
+        s->latency += lat;
+        if (lat > s->worst)
+            s->worst = lat;
+        s->packets++;
+    }
+}
+
+static int bench_agg(int argc, char *argv[])
+{
+    static agg_ctx agg;
+    static uint8_t pkt[BRIDGE_BUF_SIZE];
+    static uint8_t frame[BRIDGE_BUF_SIZE];
+    static double queued[BRIDGE_BUF_SIZE];
+    const double rates[] = { 2, 5, 10, 15, 25, 40 };
+    const double duration = 600.0;
+    int len = 40;
+    int size = 512;
+    int delay = 50;
+    int turnaround = 0;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:a:A:T:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 'a': size = atoi(optarg); break;
+            case 'A': delay = atoi(optarg); break;
+            case 'T': turnaround = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    double ta = turnaround / 1000.0;
+
+    printf("Aggregation, %d B packets, %d baud, %d ms turnaround, aggregate %d B / %d ms\n",
+           len, baud, turnaround, size, delay);
+    printf("  %6s  %-10s %9s %9s %11s %11s %9s\n",
+           "pkt/s", "mode", "pkt/frame", "air/B", "mean lat", "worst lat", "line use");
+
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        agg_sim plain = { 0 }, packed = { 0 };
+        int nq = 0;
+        double now = 0;
+        double next = 0;
+
+        agg_init(&agg, size, delay);
+        memset(pkt, 0x5A, len);
+        rng_state = 0x9E3779B97F4A7C15ULL;
+
+        // Poisson arrivals; the plain link sends every packet as it comes
+        next = -log(1.0 - rng_uniform()) / rates[r];
+        while (next < duration || nq > 0)
+        {
+            double t = next < duration ? next : 1e30;
+            double flush = 1e30;
+
+            if (nq)
+            {
+                flush = queued[0] + delay / 1000.0;
+                if (flush < packed.free)
+                    flush = packed.free;
+            }
+
+            if (flush <= t)
+            {
+                now = flush;
+                int flen = agg_take(&agg, 0, frame, sizeof(frame), AGG_FLUSH_DELAY);
+                agg_sim_frame(&packed, now, queued, nq, flen, baud, ta);
+                nq = 0;
+                continue;
+            }
+
+            now = t;
+            next = now - log(1.0 - rng_uniform()) / rates[r];
+
+            agg_sim_frame(&plain, now, &now, 1, len + 2, baud, ta);
+
+            if (!agg_add(&agg, 0, pkt, len, 0))
+            {
+                int flen = agg_take(&agg, 0, frame, sizeof(frame), AGG_FLUSH_FULL);
+                agg_sim_frame(&packed, now, queued, nq, flen, baud, ta);
+                nq = 0;
+                agg_add(&agg, 0, pkt, len, 0);
+            }
+            queued[nq++] = now;
+
+            if (agg_is_full(&agg, 0))
+            {
+                int flen = agg_take(&agg, 0, frame, sizeof(frame), AGG_FLUSH_FULL);
+                agg_sim_frame(&packed, now, queued, nq, flen, baud, ta);
+                nq = 0;
+            }
+        }
+
+        agg_sim *sims[2] = { &plain, &packed };
+        const char *modes[2] = { "per-packet", "aggregate" };
+
+        for (int m = 0; m < 2; m++)
+        {
+            agg_sim *s = sims[m];
+            double span = s->free > duration ? s->free : duration;
+
+            printf("  %6.0f  %-10s %9.2f %9.2f %9.0fms %9.0fms %8.0f%%%s\n",
+                   rates[r], modes[m], (double)s->packets / s->frames,
+                   s->air * baud / 10.0 / ((double)s->packets * len),
+                   s->latency / s->packets * 1000.0, s->worst * 1000.0,
+                   100.0 * s->air / span, s->free > duration * 1.01 ? "  saturated" : "");
+        }
+    }
+
+    return 0;
+}
+
+typedef struct arq_end {
+    arq_ctx arq;
+    int sent;                   // frames handed to ARQ
+    int expect;                 // next frame number from the other end
+    int misordered;
+} arq_end;
+
+static void arq_end_deliver(arq_end *e, const uint8_t *pkt, int len, int plen)
+{
+    uint32_t n = ((uint32_t)pkt[0] << 24) | ((uint32_t)pkt[1] << 16) | ((uint32_t)pkt[2] << 8) | pkt[3];
+
+    if (len != plen || (int)n != e->expect)
+        e->misordered++;
+    e->expect++;
+}
+
+static void bench_arq_run(double loss, double burst, int window, int plen, int count, int turnaround,
+                          int full_duplex, int both, int baud)
+{
+    static arq_end ends[2];
+    static chan ch;
+    static uint8_t mem[BRIDGE_HEADROOM + BRIDGE_BUF_SIZE];
+    uint8_t *buf = mem + BRIDGE_HEADROOM;
+    uint64_t now = 0;
+    const uint64_t limit = 7200ULL * 1000000000ULL;
+
+    chan_init(&ch, baud, turnaround, full_duplex, 12345);
+    chan_set_loss(&ch, loss, burst);
+    for (int e = 0; e < 2; e++)
+    {
+        memset(&ends[e], 0, sizeof(ends[e]));
+        arq_init(&ends[e].arq, window);
+    }
+
+    int goal[2] = { count, both ? count : 0 };
+
+    while (now < limit && (ends[1].expect < goal[0] || ends[0].expect < goal[1]))
+    {
+        for (int e = 0; e < 2; e++)
+        {
+            arq_end *x = &ends[e];
+            int len;
+
+            while (x->sent < goal[e] && arq_can_send(&x->arq))
+            {
+                uint8_t *frame = buf;
+
+                put32(frame, x->sent++);
+                memset(frame + 4, 0xA5, plen - 4);
+                len = arq_send(&x->arq, &frame, plen, now);
+                chan_send(&ch, e, frame, len, now);
+            }
+            while ((len = arq_poll(&x->arq, buf, BRIDGE_BUF_SIZE, now)) > 0)
+                chan_send(&ch, e, buf, len, now);
+        }
+
+        uint64_t next = UINT64_MAX;
+        for (int e = 0; e < 2; e++)
+        {
+            int64_t left = arq_time_left(&ends[e].arq, now);
+            if (left >= 0 && now + left < next)
+                next = now + left;
+            if (chan_next(&ch, e) < next)
+                next = chan_next(&ch, e);
+        }
+        if (next == UINT64_MAX)
+            break;
+        now = next > now ? next : now;
+
+        for (int e = 0; e < 2; e++)
+        {
+            arq_end *x = &ends[e];
+            uint8_t *pkt;
+            int len;
+
+            while ((len = chan_recv(&ch, e, buf, BRIDGE_BUF_SIZE, now)) > 0)
+            {
+                if ((len = arq_receive(&x->arq, buf, len, &pkt, now)) > 0)
+                    arq_end_deliver(x, pkt, len, plen);
+                while ((len = arq_next(&x->arq, &pkt)) > 0)
+                    arq_end_deliver(x, pkt, len, plen);
+            }
+        }
+    }
+
+    int delivered = ends[1].expect + ends[0].expect;
+    int misordered = ends[1].misordered + ends[0].misordered;
+    uint64_t retx = ends[0].arq.stats.retransmits + ends[1].arq.stats.retransmits;
+    uint64_t timeouts = ends[0].arq.stats.timeouts + ends[1].arq.stats.timeouts;
+    uint64_t acks = ends[0].arq.stats.acks_sent + ends[1].arq.stats.acks_sent;
+    double secs = now / 1e9;
+    // Airtime the payload needs without losses, both directions at once on the pair
+    double ideal = (double)(goal[0] + goal[1]) * chan_airtime(&ch, plen + ARQ_HDR_LEN) / 1e9;
+    if (full_duplex && both)
+        ideal /= 2;
+
+    printf("  %5.1f%%  %7d/%-7d %7.0fs %7.1f B/s %5.0f%%  %6llu %6llu %6llu %7.0fms %7.0fms %s\n",
+           loss * 100.0, delivered, goal[0] + goal[1], secs, delivered * (double)plen / secs,
+           100.0 * ideal / secs, (unsigned long long)retx, (unsigned long long)timeouts,
+           (unsigned long long)acks, ends[0].arq.srtt_ns / 1e6, ends[0].arq.rto_ns / 1e6,
+           misordered ? "OUT OF ORDER" : "in order");
+}
+
+static int bench_arq(int argc, char *argv[])
+{
+    const double losses[] = { 0, 0.01, 0.05, 0.10, 0.20, 0.30 };
+    double loss = -1;
+    double burst = 1;
+    int window = 8;
+    int plen = 100;
+    int count = 500;
+    int turnaround = 0;
+    int full_duplex = 0;
+    int both = 0;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "L:B:w:l:n:T:Fxb:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'L': loss = atof(optarg) / 100.0; break;
+            case 'B': burst = atof(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'l': plen = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'T': turnaround = atoi(optarg); break;
+            case 'F': full_duplex = 1; break;
+            case 'x': both = 1; break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    if (plen < 4)
+        plen = 4;
+
+    printf("ARQ, window %d, %d B frames, %s, %s traffic, %d baud, %d ms turnaround, loss bursts %.1f\n",
+           window, plen, full_duplex ? "FullDuplex pair" : "half duplex", both ? "two-way" : "one-way",
+           baud, turnaround, burst);
+    printf("  %6s  %-15s %8s %11s %6s %7s %6s %6s %9s %9s\n",
+           "loss", "delivered", "time", "goodput", "eff", "retx", "tmo", "acks", "srtt", "rto");
+
+    if (loss >= 0)
+        bench_arq_run(loss, burst, window, plen, count, turnaround, full_duplex, both, baud);
+    else
+        for (unsigned i = 0; i < sizeof(losses) / sizeof(losses[0]); i++)
+            bench_arq_run(losses[i], burst, window, plen, count, turnaround, full_duplex, both, baud);
+
+    return 0;
+}
+
+// Frame error rate of a profile at a given RSSI: 50% at its limit, 10x
+// better or worse every 2.3 dB around it
+static double rate_model_fer(int profile, double rssi)
+{
+    double margin = rssi - rate_profiles[profile].rssi_min;
+    return 1.0 / (1.0 + exp(margin));
+}
+
+// Slow fade from a strong signal to below the most robust profile and back,
+// with a few dB of fast fading on top
+static double rate_model_rssi(double t, double span)
+{
+    double slow = -96.0 - 24.0 * sin(M_PI * t / span);
+    return slow + 3.0 * (rng_uniform() + rng_uniform() + rng_uniform() - 1.5);
+}
+
+typedef struct rate_sim {
+    double bytes;
+    double outage;
+    int switches;
+} rate_sim;
+
+static void bench_rate_fixed(int profile, double span, double dt, rate_sim *r)
+{
+    memset(r, 0, sizeof(*r));
+    rng_state = 0x9E3779B97F4A7C15ULL;
+
+    for (double t = 0; t < span; t += dt)
+    {
+        double fer = rate_model_fer(profile, rate_model_rssi(t, span));
+        r->bytes += rate_profiles[profile].baud / 10.0 * dt * (1.0 - fer);
+        if (fer > 0.5)
+            r->outage += dt;
+    }
+}
+
+static void bench_rate_adaptive(double span, double dt, rate_sim *r)
+{
+    static rate_ctx ends[2];
+    static uint8_t msg[64];
+    int init = 3;
+
+    memset(r, 0, sizeof(*r));
+    rng_state = 0x9E3779B97F4A7C15ULL;
+
+    rate_init(&ends[0], 1, init, 0);
+    rate_init(&ends[1], 0, init, 0);
+
+    for (double t = 0; t < span; t += dt)
+    {
+        uint64_t now = (uint64_t)(t * 1e9);
+        double rssi = rate_model_rssi(t, span);
+        int p = ends[0].profile;
+        int same = ends[0].profile == ends[1].profile;
+        double fer = rate_model_fer(p, rssi);
+
+        // 100 byte frames both ways while the two ends agree
+        if (same)
+        {
+            int frames = (int)(rate_profiles[p].baud / 10.0 * dt / 100.0 + rng_uniform());
+            for (int e = 0; e < 2; e++)
+                for (int i = 0; i < frames; i++)
+                    rate_rx_frame(&ends[e], rng_uniform() >= fer, now);
+
+            r->bytes += rate_profiles[p].baud / 10.0 * dt * (1.0 - fer);
+        }
+        if (!same || fer > 0.5)
+            r->outage += dt;
+
+        for (int e = 0; e < 2; e++)
+        {
+            int len;
+
+            rate_set_radio(&ends[e], (int)rssi, -1);
+            while ((len = rate_poll(&ends[e], msg, sizeof(msg), now)) > 0)
+            {
+                // Only heard on the same profile, and then not always
+                if (ends[0].profile == ends[1].profile &&
+                    rng_uniform() >= rate_model_fer(ends[e].profile, rssi))
+                    rate_receive(&ends[!e], msg, len, now);
+            }
+            if (rate_take_change(&ends[e]) >= 0 && e == 0)
+                r->switches++;
+        }
+    }
+}
+
+static int bench_rate(int argc, char *argv[])
+{
+    double minutes = 20;
+    double dt = 0.05;
+    rate_sim r;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm': minutes = atof(optarg); break;
+            default: return 1;
+        }
+    }
+
+    double span = minutes * 60.0;
+
+    printf("Rate adaptation, RSSI fading -96 -> -120 -> -96 dBm over %.0f minutes\n", minutes);
+    printf("  %-32s %12s %10s %9s\n", "profile", "delivered", "outage", "switches");
+
+    for (int p = 0; p < rate_nprofiles; p++)
+    {
+        bench_rate_fixed(p, span, dt, &r);
+        printf("  %-32s %9.0f kB %9.0f%% %9s\n", rate_profiles[p].name, r.bytes / 1000.0,
+               100.0 * r.outage / span, "-");
+    }
+
+    bench_rate_adaptive(span, dt, &r);
+    printf("  %-32s %9.0f kB %9.0f%% %9d\n", "adaptive", r.bytes / 1000.0, 100.0 * r.outage / span, r.switches);
+
+    return 0;
+}
+
+// The firmware grid: 48 channels 4.25 kHz apart, freq A on 24, freq B on 28
+#define SIM_CHANNELS    48
+#define SIM_CH_A        24
+#define SIM_CH_B        28
+
+typedef struct scan_band {
+    double noise[2][SIM_CHANNELS];      // dBm at the master and at the slave
+    double duty[SIM_CHANNELS];          // of the interferer on the channel
+} scan_band;
+
+// A few narrowband interferers, each heard differently at the two ends and
+// spilling into the channels next to it
+static void scan_model_band(scan_band *b)
+{
+    int count = (int)(rng_uniform() * 7);
+
+    for (int e = 0; e < 2; e++)
+        for (int ch = 0; ch < SIM_CHANNELS; ch++)
+            b->noise[e][ch] = -121 + 2.0 * rng_uniform();
+    memset(b->duty, 0, sizeof(b->duty));
+
+    for (int i = 0; i < count; i++)
+    {
+        int ch = (int)(rng_uniform() * SIM_CHANNELS);
+        double level = -110 + 40 * rng_uniform();
+        double duty = 0.3 + 0.7 * rng_uniform();
+
+        for (int e = 0; e < 2; e++)
+        {
+            double l = e == 0 ? level : level - 20 + 30 * rng_uniform();
+            for (int d = -2; d <= 2; d++)
+            {
+                double spill = l - (d == 0 ? 0 : d == 1 || d == -1 ? 10 : 25);
+                if (ch + d >= 0 && ch + d < SIM_CHANNELS && spill > b->noise[e][ch + d])
+                {
+                    b->noise[e][ch + d] = spill;
+                    b->duty[ch + d] = duty;
+                }
+            }
+        }
+    }
+}
+
+// What one sweep of two passes catches: an interferer shows when it is on
+static void scan_model_sweep(const scan_band *b, int e, int shift, scan_map *m)
+{
+    memset(m, 0, sizeof(*m));
+    m->n = SIM_CHANNELS;
+    m->step_hz = 4250;
+    m->rx_ch = (e == 0 ? SIM_CH_A : SIM_CH_B) + shift;
+    m->tx_ch = (e == 0 ? SIM_CH_B : SIM_CH_A) + shift;
+
+    for (int ch = 0; ch < SIM_CHANNELS; ch++)
+    {
+        double dbm = b->noise[e][ch];
+        if (b->duty[ch] > 0 && rng_uniform() > b->duty[ch] && rng_uniform() > b->duty[ch])
+            dbm = -121 + 2.0 * rng_uniform();
+
+        int level = (int)((dbm + 130) * 2);
+        m->rssi[ch] = level < 0 ? 0 : level > 255 ? 255 : level;
+    }
+}
+
+// Interference at the louder of the two receivers, averaged over on/off
+static double scan_model_worst(const scan_band *b, int shift)
+{
+    double worst = -200;
+
+    for (int e = 0; e < 2; e++)
+    {
+        int ch = (e == 0 ? SIM_CH_A : SIM_CH_B) + shift;
+        double on = b->noise[e][ch];
+        double mw = b->duty[ch] > 0 ? b->duty[ch] * pow(10, on / 10) + (1 - b->duty[ch]) * pow(10, -12.0)
+                                    : pow(10, on / 10);
+        double dbm = 10 * log10(mw);
+        if (dbm > worst)
+            worst = dbm;
+    }
+
+    return worst;
+}
+
+// One round of the real handshake between two scan_ctx, messages delivered
+static int scan_model_round(const scan_band *b)
+{
+    static scan_ctx ends[2];
+    static uint8_t msg[128];
+    scan_map map;
+
+    scan_init(&ends[0], 1, 60000, 0);
+    scan_init(&ends[1], 0, 60000, 0);
+
+    for (uint64_t now = 0; now < 20000000000ULL; now += 100000000ULL)
+    {
+        for (int e = 0; e < 2; e++)
+        {
+            int len;
+
+            scan_rx_frame(&ends[e], now);
+            while ((len = scan_poll(&ends[e], msg, sizeof(msg), now)) > 0)
+                scan_receive(&ends[!e], msg, len, now);
+        }
+        for (int e = 0; e < 2; e++)
+        {
+            if (scan_take_sweep(&ends[e]))
+            {
+                scan_model_sweep(b, e, ends[e].shift, &map);
+                scan_set_local(&ends[e], &map, now);
+            }
+            scan_take_change(&ends[e]);
+        }
+    }
+
+    return ends[0].shift == ends[1].shift ? ends[0].shift : 0;
+}
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_scan(int argc, char *argv[])
+{
+    int trials = 2000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': trials = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    // Sweep time: 1 MHz SPI, ~8 us a byte plus chip select, ~100 us for the
+    // VCO calibration and lock, then the RSSI settle and four reads
+    double spi_us = 5 + 8 * 3;
+    double channel_us = spi_us * 4 + (5 + 8 * 6) + 100 + 1000 + 4 * (spi_us + 250);
+    double sweep_ms = 2 * SIM_CHANNELS * channel_us / 1000.0;
+    double slow_s = 2 * SIM_CHANNELS * 7 * 0.2;
+
+    printf("Sweep of %d channels, 2 passes: %.0f ms polling MC_STATE, %.0f s with 200 ms per write\n",
+           SIM_CHANNELS, sweep_ms, slow_s);
+
+    static double before[100000], after[100000];
+    int jammed_before = 0, jammed_after = 0, moves = 0;
+    double hop_quiet = 0, hop_random = 0;
+    scan_band band;
+
+    if (trials > 100000)
+        trials = 100000;
+
+    for (int t = 0; t < trials; t++)
+    {
+        scan_map maps[2];
+        int hops[8];
+
+        scan_model_band(&band);
+        int shift = scan_model_round(&band);
+
+        before[t] = scan_model_worst(&band, 0);
+        after[t] = scan_model_worst(&band, shift);
+        jammed_before += before[t] > -106;      // 9600 baud profile
+        jammed_after += after[t] > -106;
+        moves += shift != 0;
+
+        // Hop set of 8 from the same sweeps against 8 channels at random
+        scan_model_sweep(&band, 0, 0, &maps[0]);
+        scan_model_sweep(&band, 1, 0, &maps[1]);
+        int n = scan_hop_set(&maps[0], &maps[1], 8, 2, hops);
+        for (int i = 0; i < n; i++)
+        {
+            hop_quiet += fmax(band.noise[0][hops[i]], band.noise[1][hops[i]]) / n;
+            int ch = (int)(rng_uniform() * SIM_CHANNELS);
+            hop_random += fmax(band.noise[0][ch], band.noise[1][ch]) / n;
+        }
+    }
+
+    qsort(before, trials, sizeof(double), bench_cmp_double);
+    qsort(after, trials, sizeof(double), bench_cmp_double);
+
+    printf("%d bands with 0..6 interferers, worst receiver of the duplex pair:\n", trials);
+    printf("  %-18s %10s %10s %10s\n", "", "median", "p90", "jammed");
+    printf("  %-18s %6.1f dBm %6.1f dBm %9.1f%%\n", "fixed A/B", before[trials / 2],
+           before[trials * 9 / 10], 100.0 * jammed_before / trials);
+    printf("  %-18s %6.1f dBm %6.1f dBm %9.1f%%\n", "selected", after[trials / 2],
+           after[trials * 9 / 10], 100.0 * jammed_after / trials);
+    printf("  moved in %.1f%% of the bands\n", 100.0 * moves / trials);
+    printf("Hop set of 8: mean worst level %.1f dBm quietest, %.1f dBm random\n",
+           hop_quiet / trials, hop_random / trials);
+
+    return 0;
+}
+
+static int bench_mac(int argc, char *argv[])
+{
+    static const double loads[] = { 0.1, 0.25, 0.5, 0.75, 1.0, 1.5, 2.0 };
+    int counts[3] = { 3, 6, 10 };
+    int ncounts = 3;
+    double unit_ms = 0;
+    mac_params p;
+    int opt;
+
+    mac_params_default(&p);
+
+    while ((opt = getopt(argc, argv, "n:l:T:m:u:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': counts[0] = atoi(optarg); ncounts = 1; break;
+            case 'l': p.len = atoi(optarg); break;
+            case 'T': p.turnaround_ms = atof(optarg); break;
+            case 'm': p.max_bo = atoi(optarg); break;
+            case 'u': unit_ms = atof(optarg); break;
+            case 'b': p.baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    // The CCA is 64 bit periods at the chip rate, the backoffs have to add
+    // up to about a frame or a busy channel gives up frames it need not
+    double air_ms = (CHAN_PREAMBLE + FRAME_HDR_LEN + p.len) * 10 * 1000.0 / p.baud;
+    p.cca_ms = 64 * 1000.0 / (p.baud * 2.16);
+    p.unit_ms = unit_ms > 0 ? unit_ms : air_ms / 8;
+
+    printf("%d byte frames at %d baud (%.0f ms), CCA %.1f ms, backoff unit %.1f ms, "
+           "turnaround %.1f ms, max %d backoffs\n",
+           p.len, p.baud, air_ms, p.cca_ms, p.unit_ms, p.turnaround_ms, p.max_bo);
+
+    for (int c = 0; c < ncounts; c++)
+    {
+        p.nodes = counts[c];
+        printf("%d nodes\n  %5s | %22s | %39s\n", p.nodes, "load", "ALOHA", "CSMA");
+        printf("  %5s | %6s %7s %7s | %6s %7s %7s %7s %7s\n", "G",
+               "S", "lost", "delay", "S", "lost", "busy", "delay", "bo/frm");
+
+        for (int l = 0; l < (int)(sizeof(loads) / sizeof(loads[0])); l++)
+        {
+            mac_result a, b;
+
+            p.load = loads[l];
+            p.csma = 0;
+            mac_simulate(&p, &a);
+            p.csma = 1;
+            mac_simulate(&p, &b);
+
+            double a_sent = a.delivered + a.collided, b_sent = b.delivered + b.collided;
+            printf("  %5.2f | %6.3f %6.1f%% %5.0fms | %6.3f %6.1f%% %6.1f%% %5.0fms %7.2f\n", p.load,
+                   a.throughput, a_sent ? 100.0 * a.collided / a_sent : 0, a.delay_ms,
+                   b.throughput, b_sent ? 100.0 * b.collided / b_sent : 0,
+                   b.offered ? 100.0 * b.busy / b.offered : 0, b.delay_ms,
+                   b.offered ? (double)b.backoffs / b.offered : 0);
+        }
+    }
+
+    return 0;
+}
+
+// TDMA with N virtual nodes, each with its own tdma_ctx and its own clock:
+// an offset, a drift, and a beacon timestamp that is late by the USB and
+// tty latency. The channel is the same as in mac_simulate(): a frame that
+// overlaps another is lost, for the control messages as well.
+#define TDMA_SIM_STEP_NS    100000
+#define TDMA_SIM_QUEUE      64
+
+typedef struct tdma_sim_node {
+    tdma_ctx ctx;
+    double offset_ns;
+    double drift;
+    uint64_t q[TDMA_SIM_QUEUE];
+    int head;
+    int count;
+
+    int on_air;
+    int collided;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t air_ns;
+    uint8_t msg[TDMA_BEACON_LEN];
+    int msg_len;            // 0 for data
+} tdma_sim_node;
+
+typedef struct tdma_sim {
+    mac_result r;
+    double slot_use[TDMA_MAX_SLOTS];
+    int nslots;
+    uint64_t owners[TDMA_MAX_SLOTS];
+    uint64_t requests;
+    uint64_t grants;
+    uint64_t sync_losses;
+    uint64_t control_lost;
+} tdma_sim;
+
+static uint64_t tdma_sim_clock(const tdma_sim_node *n, uint64_t t)
+{
+    return (uint64_t)(t + n->offset_ns + t * n->drift);
+}
+
+static uint64_t tdma_sim_air(int len, int baud)
+{
+    return (uint64_t)((CHAN_PREAMBLE + FRAME_HDR_LEN + len) * 10 * 1e9 / baud);
+}
+
+static void tdma_simulate(const mac_params *p, int nslots, int slot_ms, int guard_ms,
+                          double jitter_ms, double drift_ppm, tdma_sim *sim)
+{
+    static tdma_sim_node nodes[MAC_MAX_NODES];
+    int n = p->nodes < MAC_MAX_NODES ? p->nodes : MAC_MAX_NODES;
+    uint64_t data_ns = tdma_sim_air(p->len, p->baud);
+    uint64_t end_ns = (uint64_t)(p->seconds * 1e9);
+    double arrival = p->load / n * TDMA_SIM_STEP_NS / (double)data_ns;
+    double delay_sum = 0;
+    uint64_t on_air_ns = 0;
+    int carriers = 0;
+
+    memset(sim, 0, sizeof(*sim));
+    memset(nodes, 0, sizeof(nodes));
+    rng_state = p->seed;
+
+    // The free slots shared out among the nodes other than the master
+    int want = n > 1 ? (nslots - 2) / (n - 1) : 1;
+
+    for (int i = 0; i < n; i++)
+    {
+        nodes[i].offset_ns = rng_uniform() * 1e9 * 3600;
+        nodes[i].drift = (rng_uniform() * 2 - 1) * drift_ppm * 1e-6;
+        tdma_init(&nodes[i].ctx, i, want, nslots, slot_ms, guard_ms, tdma_sim_clock(&nodes[i], 0));
+        tdma_set_turnaround(&nodes[i].ctx, (uint64_t)(p->turnaround_ms * 1e6));
+    }
+
+    for (uint64_t t = 0; t < end_ns; t += TDMA_SIM_STEP_NS)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            tdma_sim_node *nd = &nodes[i];
+            uint64_t local = tdma_sim_clock(nd, t);
+
+            if (rng_uniform() < arrival)
+            {
+                sim->r.offered++;
+                if (nd->count == TDMA_SIM_QUEUE)
+                    sim->r.overflows++;
+                else
+                    nd->q[(nd->head + nd->count++) % TDMA_SIM_QUEUE] = t;
+            }
+
+            if (nd->on_air && t >= nd->end_ns)
+            {
+                nd->on_air = 0;
+                carriers--;
+
+                if (nd->collided && nd->msg_len == 0)
+                    sim->r.collided++;
+                else if (nd->collided)
+                    sim->control_lost++;
+                else if (nd->msg_len == 0)
+                {
+                    sim->r.delivered++;
+                    on_air_ns += nd->air_ns;
+                    delay_sum += (t - nd->q[nd->head]) / 1e6;
+                }
+                if (nd->msg_len == 0)
+                {
+                    nd->head = (nd->head + 1) % TDMA_SIM_QUEUE;
+                    nd->count--;
+                }
+
+                // Everyone else hears it, time-stamped late
+                for (int j = 0; j < n && !nd->collided; j++)
+                {
+                    if (j == i)
+                        continue;
+                    uint64_t heard = tdma_sim_clock(&nodes[j], t) + (uint64_t)(rng_uniform() * jitter_ms * 1e6);
+                    tdma_heard(&nodes[j].ctx, nd->air_ns, heard - nd->air_ns);
+                    if (nd->msg_len > 0)
+                        tdma_receive(&nodes[j].ctx, nd->msg, nd->msg_len, heard - nd->air_ns, heard);
+                }
+            }
+
+            if (nd->on_air)
+                continue;
+
+            // Control first, then data that fits the slot
+            nd->msg_len = tdma_poll(&nd->ctx, nd->msg, sizeof(nd->msg), local);
+            if (nd->msg_len > 0)
+                nd->air_ns = tdma_sim_air(nd->msg_len, p->baud);
+            else if (nd->count > 0 && tdma_may_send(&nd->ctx, data_ns, local))
+                nd->air_ns = data_ns;
+            else
+                continue;
+
+            tdma_sent(&nd->ctx, nd->air_ns, local);
+            nd->collided = carriers > 0;
+            for (int j = 0; carriers > 0 && j < n; j++)
+                if (nodes[j].on_air)
+                    nodes[j].collided = 1;
+            carriers++;
+            nd->on_air = 1;
+            nd->start_ns = t;
+            nd->end_ns = t + nd->air_ns;
+        }
+    }
+
+    sim->r.throughput = (double)on_air_ns / end_ns;
+    sim->r.delay_ms = sim->r.delivered ? delay_sum / sim->r.delivered : 0;
+
+    // Occupancy as the master sees it
+    const tdma_ctx *m = &nodes[0].ctx;
+    sim->nslots = m->nslots;
+    for (int s = 0; s < m->nslots; s++)
+    {
+        sim->slot_use[s] = tdma_slot_utilization(m, s);
+        sim->owners[s] = m->owner[s];
+    }
+    sim->requests = m->stats.requests_rx;
+    sim->grants = m->stats.grants;
+    for (int i = 1; i < n; i++)
+        sim->sync_losses += nodes[i].ctx.stats.sync_losses;
+}
+
+static int bench_tdma(int argc, char *argv[])
+{
+    static const double loads[] = { 0.1, 0.25, 0.5, 0.75, 1.0, 1.5, 2.0 };
+    int counts[2] = { 3, 6 };
+    int ncounts = 2;
+    int nslots = 8;
+    int slot_ms = 400;
+    int guard_ms = 20;
+    double jitter_ms = 10;
+    double drift_ppm = 50;
+    mac_params p;
+    int opt;
+
+    mac_params_default(&p);
+
+    while ((opt = getopt(argc, argv, "n:l:s:S:g:j:d:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': counts[0] = atoi(optarg); ncounts = 1; break;
+            case 'l': p.len = atoi(optarg); break;
+            case 's': nslots = atoi(optarg); break;
+            case 'S': slot_ms = atoi(optarg); break;
+            case 'g': guard_ms = atoi(optarg); break;
+            case 'j': jitter_ms = atof(optarg); break;
+            case 'd': drift_ppm = atof(optarg); break;
+            case 'b': p.baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    double air_ms = tdma_sim_air(p.len, p.baud) / 1e6;
+    p.cca_ms = 64 * 1000.0 / (p.baud * 2.16);
+    p.unit_ms = air_ms / 8;
+
+    printf("%d byte frames at %d baud (%.0f ms), %d slots of %d ms, guard %d ms + %.0f ms turnaround, "
+           "beacon jitter %.0f ms, clocks +-%.0f ppm\n",
+           p.len, p.baud, air_ms, nslots, slot_ms, guard_ms, p.turnaround_ms, jitter_ms, drift_ppm);
+
+    for (int c = 0; c < ncounts; c++)
+    {
+        tdma_sim last;
+
+        p.nodes = counts[c];
+        printf("%d nodes\n  %5s | %25s | %14s | %14s\n", p.nodes, "load", "TDMA", "CSMA", "ALOHA");
+        printf("  %5s | %6s %7s %8s | %6s %7s | %6s %7s\n", "G",
+               "S", "lost", "delay", "S", "delay", "S", "delay");
+
+        for (int l = 0; l < (int)(sizeof(loads) / sizeof(loads[0])); l++)
+        {
+            mac_result a, b;
+
+            p.load = loads[l];
+            p.csma = 0;
+            mac_simulate(&p, &a);
+            p.csma = 1;
+            mac_simulate(&p, &b);
+            tdma_simulate(&p, nslots, slot_ms, guard_ms, jitter_ms, drift_ppm, &last);
+
+            double sent = last.r.delivered + last.r.collided;
+            printf("  %5.2f | %6.3f %6.1f%% %6.0fms | %6.3f %5.0fms | %6.3f %5.0fms\n", p.load,
+                   last.r.throughput, sent ? 100.0 * last.r.collided / sent : 0, last.r.delay_ms,
+                   b.throughput, b.delay_ms, a.throughput, a.delay_ms);
+        }
+
+        printf("  at G=%.2f: %llu requests, %llu slots granted, %llu control frames lost, "
+               "%llu sync losses\n  slot use",
+               loads[sizeof(loads) / sizeof(loads[0]) - 1], (unsigned long long)last.requests,
+               (unsigned long long)last.grants, (unsigned long long)last.control_lost,
+               (unsigned long long)last.sync_losses);
+        for (int s = 0; s < last.nslots; s++)
+        {
+            if (last.owners[s] == TDMA_SLOT_CONTENTION)
+                printf(" c:%.0f%%", 100 * last.slot_use[s]);
+            else if (last.owners[s] == TDMA_SLOT_FREE)
+                printf(" -:%.0f%%", 100 * last.slot_use[s]);
+            else
+                printf(" %llu:%.0f%%", (unsigned long long)last.owners[s], 100 * last.slot_use[s]);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+#define FHSS_SIM_STEP_NS    1000000
+#define FHSS_SIM_MODES      4
+
+static const char *fhss_sim_names[FHSS_SIM_MODES] = {
+    "fixed A/B", "hopping", "hopping + blacklist", "hopping + sweep + blacklist"
+};
+
+typedef struct fhss_sim_end {
+    fhss_ctx ctx;
+    double offset_ns;
+    double drift;
+    int on_air;
+    uint64_t end_ns;
+    uint64_t air_ns;
+    int shift;              // of the frame on air
+    uint8_t msg[FHSS_MSG_MAX];
+    int msg_len;            // 0 for data
+} fhss_sim_end;
+
+typedef struct fhss_sim {
+    uint64_t sent;          // data frames, both ways
+    uint64_t delivered;
+    double acquire_s;       // slave's first SYNC, -1 never
+    uint64_t blacklisted;
+    uint64_t sync_losses;
+    uint64_t control_lost;
+} fhss_sim;
+
+static uint64_t fhss_sim_clock(const fhss_sim_end *e, uint64_t t)
+{
+    return (uint64_t)(t + e->offset_ns + t * e->drift);
+}
+
+// A frame is lost while a loud interferer is on, 1% otherwise. The master
+// receives on freq A, the slave on freq B.
+static int fhss_sim_lost(const scan_band *b, int rx, int shift)
+{
+    int ch = (rx == 0 ? SIM_CH_A : SIM_CH_B) + shift;
+
+    if (b->noise[rx][ch] > -106)        // 9600 baud profile
+        return rng_uniform() < (b->duty[ch] > 0 ? b->duty[ch] : 1);
+    return rng_uniform() < 0.01;
+}
+
+// Both ends saturated with data frames for 'seconds', the master starting
+// to hop at once and the slave parked until it hears a SYNC
+static void fhss_simulate(const scan_band *b, int mode, double seconds, int dwell_ms, int len,
+                          double jitter_ms, double drift_ppm, int baud, fhss_sim *sim)
+{
+    static fhss_sim_end ends[2];
+    uint64_t data_ns = tdma_sim_air(len, baud);
+    uint64_t end_ns = (uint64_t)(seconds * 1e9);
+
+    memset(sim, 0, sizeof(*sim));
+    memset(ends, 0, sizeof(ends));
+    sim->acquire_s = -1;
+
+    for (int e = 0; e < 2; e++)
+    {
+        ends[e].offset_ns = e == 0 ? 0 : rng_uniform() * 1e9 * 3600;
+        ends[e].drift = e == 0 ? 0 : (rng_uniform() * 2 - 1) * drift_ppm * 1e-6;
+        fhss_init(&ends[e].ctx, e == 0, dwell_ms, fhss_sim_clock(&ends[e], 0));
+        ends[e].ctx.blacklist = mode >= 2;
+    }
+    if (mode == 3)
+    {
+        scan_map map;
+
+        scan_model_sweep(b, 0, 0, &map);
+        fhss_set_map(&ends[0].ctx, &map);
+    }
+    if (mode > 0)
+        fhss_start(&ends[0].ctx, fhss_sim_clock(&ends[0], 0));
+
+    for (uint64_t t = 0; t < end_ns; t += FHSS_SIM_STEP_NS)
+    {
+        for (int e = 0; e < 2; e++)
+        {
+            fhss_sim_end *nd = &ends[e];
+            fhss_sim_end *peer = &ends[!e];
+            uint64_t local = fhss_sim_clock(nd, t);
+
+            if (nd->on_air && t >= nd->end_ns)
+            {
+                // Heard only if the peer's receiver sat on the same channel
+                uint64_t heard = fhss_sim_clock(peer, t) + (uint64_t)(rng_uniform() * jitter_ms * 1e6);
+                uint64_t start = heard - nd->air_ns;
+                int shift = mode > 0 ? fhss_shift(&peer->ctx, start) : 0;
+
+                nd->on_air = 0;
+
+                int lost = shift != nd->shift || fhss_sim_lost(b, !e, nd->shift);
+
+                if (mode > 0 && shift == nd->shift)
+                    fhss_rx_frame(&peer->ctx, !lost, start);
+                if (lost && nd->msg_len > 0)
+                    sim->control_lost++;
+                else if (!lost && nd->msg_len > 0)
+                    fhss_receive(&peer->ctx, nd->msg, nd->msg_len, start, heard);
+                else if (!lost)
+                    sim->delivered++;
+            }
+
+            if (e == 1 && sim->acquire_s < 0 && nd->ctx.stats.acquisitions)
+                sim->acquire_s = t / 1e9;
+
+            if (nd->on_air)
+                continue;
+
+            // Control first, then data that ends before the hop
+            nd->msg_len = mode > 0 ? fhss_poll(&nd->ctx, nd->msg, sizeof(nd->msg), local) : 0;
+            if (nd->msg_len > 0)
+                nd->air_ns = tdma_sim_air(nd->msg_len, baud);
+            else if (mode == 0 || fhss_may_send(&nd->ctx, data_ns, local))
+            {
+                nd->air_ns = data_ns;
+                sim->sent++;
+            }
+            else
+                continue;
+
+            nd->shift = mode > 0 ? fhss_shift(&nd->ctx, local) : 0;
+            nd->on_air = 1;
+            nd->end_ns = t + nd->air_ns;
+        }
+    }
+
+    sim->blacklisted = ends[0].ctx.stats.blacklisted;
+    sim->sync_losses = ends[1].ctx.stats.sync_losses;
+}
+
+static int bench_fhss(int argc, char *argv[])
+{
+    int trials = 100;
+    double minutes = 5;
+    int dwell_ms = 800;
+    int len = 100;
+    double jitter_ms = 10;
+    double drift_ppm = 50;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:m:D:l:j:d:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': trials = atoi(optarg); break;
+            case 'm': minutes = atof(optarg); break;
+            case 'D': dwell_ms = atoi(optarg); break;
+            case 'l': len = atoi(optarg); break;
+            case 'j': jitter_ms = atof(optarg); break;
+            case 'd': drift_ppm = atof(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+
+    double air_ms = tdma_sim_air(len, baud) / 1e6;
+    if (dwell_ms <= 2 * FHSS_GUARD_MS + air_ms || trials < 1)
+    {
+        fprintf(stderr, "error: a %.0f ms frame does not fit a %d ms dwell\n", air_ms, dwell_ms);
+        return 1;
+    }
+
+    // Hop cost in the firmware: READY, 4 SYNT bytes in one burst, the VCO
+    // word, LOCK and RX/TX on both radios, ~30 us of SPI each, then the
+    // lock itself, against ~100 us more for a calibration
+    double spi_us = 5 + 8 * 3;
+    double hop_us = 2 * (spi_us * 4 + (5 + 8 * 6) + 50);
+
+    printf("%d bands of %.0f min, %d byte frames at %d baud (%.0f ms), %d ms dwell, "
+           "hop %.0f us + lock, SYNC jitter %.0f ms, clocks +-%.0f ppm\n",
+           trials, minutes, len, baud, air_ms, dwell_ms, hop_us, jitter_ms, drift_ppm);
+
+    double delivered[FHSS_SIM_MODES] = { 0 }, worst[FHSS_SIM_MODES];
+    double acquire = 0, acquire_max = 0;
+    uint64_t blacklisted[FHSS_SIM_MODES] = { 0 }, losses[FHSS_SIM_MODES] = { 0 }, frames[FHSS_SIM_MODES] = { 0 };
+    int acquired = 0, jammed = 0;
+    double jammed_fixed = 0, jammed_best = 0;
+    scan_band band;
+
+    for (int m = 0; m < FHSS_SIM_MODES; m++)
+        worst[m] = 1;
+
+    for (int t = 0; t < trials; t++)
+    {
+        uint64_t seed;
+        double share[FHSS_SIM_MODES];
+
+        scan_model_band(&band);
+        seed = rng_next();
+
+        for (int m = 0; m < FHSS_SIM_MODES; m++)
+        {
+            fhss_sim r;
+
+            // Same band and same luck for every mode
+            rng_state = seed;
+            fhss_simulate(&band, m, minutes * 60, dwell_ms, len, jitter_ms, drift_ppm, baud, &r);
+
+            share[m] = r.sent ? (double)r.delivered / r.sent : 0;
+            delivered[m] += share[m];
+            if (share[m] < worst[m])
+                worst[m] = share[m];
+            blacklisted[m] += r.blacklisted;
+            losses[m] += r.sync_losses;
+            frames[m] += r.delivered;
+            if (m == 2 && r.acquire_s >= 0)
+            {
+                acquired++;
+                acquire += r.acquire_s;
+                if (r.acquire_s > acquire_max)
+                    acquire_max = r.acquire_s;
+            }
+        }
+
+        if (scan_model_worst(&band, 0) > -106)
+        {
+            jammed++;
+            jammed_fixed += share[0];
+            jammed_best += share[3];
+        }
+        rng_state = seed;
+    }
+
+    printf("  %-30s %10s %10s %12s %12s %12s\n", "", "delivered", "worst", "frames/s", "blacklisted", "sync losses");
+    for (int m = 0; m < FHSS_SIM_MODES; m++)
+        printf("  %-30s %9.1f%% %9.1f%% %12.2f %12.1f %12.1f\n", fhss_sim_names[m],
+               100 * delivered[m] / trials, 100 * worst[m],
+               frames[m] / (trials * minutes * 60),
+               (double)blacklisted[m] / trials, (double)losses[m] / trials);
+
+    printf("  home jammed in %d bands: %.1f%% delivered fixed, %.1f%% hopping with sweep and blacklist\n",
+           jammed, jammed ? 100 * jammed_fixed / jammed : 0, jammed ? 100 * jammed_best / jammed : 0);
+    printf("  slave acquired the hop clock in %d/%d bands, %.1f s mean, %.1f s worst\n",
+           acquired, trials, acquired ? acquire / acquired : 0, acquire_max);
+
+    return 0;
+}
+
+// A ladder of two rows of five, the gateway at the top left. Neighbours
+// in a row and across hear each other well, diagonals and two-apart
+// nodes in a row badly: shortcuts an airtime metric should not take.
+// One collision domain with an ideal MAC: whoever has a frame gets the
+// channel in turn, no collisions, no hidden nodes.
+#define MESH_SIM_NODES      10
+#define MESH_SIM_QUEUE      32
+#define MESH_SIM_STEP_NS    1000000
+#define MESH_SIM_PKT        (MESH_HDR_LEN + 256)
+
+typedef struct mesh_sim_node {
+    mesh_ctx ctx;
+    uint8_t q[MESH_SIM_QUEUE][MESH_SIM_PKT];
+    int qlen[MESH_SIM_QUEUE];
+    int head;
+    int count;
+    uint8_t hello[MESH_HELLO_MAX];
+    int hello_len;
+} mesh_sim_node;
+
+typedef struct mesh_sim {
+    mesh_sim_node nodes[MESH_SIM_NODES];
+    double link[MESH_SIM_NODES][MESH_SIM_NODES];    // delivery ratio
+    int baud;
+    uint64_t now;
+    int on_air;                 // node, -1 idle
+    uint64_t end_ns;
+    uint8_t frame[MESH_SIM_PKT];
+    int frame_len;
+    uint64_t delivered;         // at the gateway
+    uint64_t delivered_bytes;
+    double delay_sum;
+    uint64_t queue_drops;
+} mesh_sim;
+
+static void mesh_sim_links(mesh_sim *m)
+{
+    memset(m->link, 0, sizeof(m->link));
+
+    for (int r = 0; r < 2; r++)
+        for (int c = 0; c < 5; c++)
+        {
+            int i = r * 5 + c;
+
+            if (c + 1 < 5)
+                m->link[i][i + 1] = 0.95;
+            if (c + 2 < 5)
+                m->link[i][i + 2] = 0.3;
+            if (r == 0)
+                m->link[i][i + 5] = 0.9;
+            if (r == 0 && c + 1 < 5)
+                m->link[i][i + 6] = 0.4;
+            if (r == 0 && c > 0)
+                m->link[i][i + 4] = 0.4;
+        }
+
+    for (int i = 0; i < MESH_SIM_NODES; i++)
+        for (int j = 0; j < i; j++)
+            m->link[i][j] = m->link[j][i];
+}
+
+static void mesh_sim_enqueue(mesh_sim *m, int i, const uint8_t *pkt, int len)
+{
+    mesh_sim_node *nd = &m->nodes[i];
+
+    if (nd->count == MESH_SIM_QUEUE)
+    {
+        m->queue_drops++;
+        return;
+    }
+
+    int at = (nd->head + nd->count++) % MESH_SIM_QUEUE;
+    memcpy(nd->q[at], pkt, len);
+    nd->qlen[at] = len;
+}
+
+// One packet from 'src' to the gateway, its birth time in the payload
+static void mesh_sim_originate(mesh_sim *m, int src, int len)
+{
+    uint8_t mem[MESH_SIM_PKT], *pkt = mem + MESH_HDR_LEN;
+
+    memset(pkt, 0, MESH_SIM_PKT - MESH_HDR_LEN);
+    memcpy(pkt, &m->now, sizeof(m->now));
+    if ((len = mesh_encap(&m->nodes[src].ctx, &pkt, len, 0)) > 0)
+        mesh_sim_enqueue(m, src, pkt, len);
+}
+
+static void mesh_sim_step(mesh_sim *m)
+{
+    if (m->on_air >= 0 && m->now >= m->end_ns)
+    {
+        int from = m->on_air;
+
+        m->on_air = -1;
+        for (int j = 0; j < MESH_SIM_NODES; j++)
+        {
+            uint8_t copy[MESH_SIM_PKT];
+
+            if (j == from || rng_uniform() >= m->link[from][j])
+                continue;
+
+            memcpy(copy, m->frame, m->frame_len);
+            switch (mesh_receive(&m->nodes[j].ctx, copy, m->frame_len, m->now))
+            {
+                case MESH_DELIVER:
+                {
+                    uint64_t born;
+
+                    memcpy(&born, copy + MESH_HDR_LEN, sizeof(born));
+                    m->delivered++;
+                    m->delivered_bytes += m->frame_len - MESH_HDR_LEN;
+                    m->delay_sum += (m->now - born) / 1e6;
+                    break;
+                }
+                case MESH_FORWARD:
+                    mesh_sim_enqueue(m, j, copy, m->frame_len);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    for (int i = 0; i < MESH_SIM_NODES; i++)
+    {
+        mesh_sim_node *nd = &m->nodes[i];
+
+        if (nd->hello_len == 0)
+            nd->hello_len = mesh_poll(&nd->ctx, nd->hello, sizeof(nd->hello), m->now);
+    }
+
+    if (m->on_air >= 0)
+        return;
+
+    // The channel to one of the nodes with something to send
+    int ready[MESH_SIM_NODES], n = 0;
+
+    for (int i = 0; i < MESH_SIM_NODES; i++)
+        if (m->nodes[i].hello_len > 0 || m->nodes[i].count > 0)
+            ready[n++] = i;
+    if (n == 0)
+        return;
+
+    mesh_sim_node *nd = &m->nodes[ready[(int)(rng_uniform() * n)]];
+
+    if (nd->hello_len > 0)
+    {
+        memcpy(m->frame, nd->hello, nd->hello_len);
+        m->frame_len = nd->hello_len;
+        nd->hello_len = 0;
+    }
+    else
+    {
+        memcpy(m->frame, nd->q[nd->head], nd->qlen[nd->head]);
+        m->frame_len = nd->qlen[nd->head];
+        nd->head = (nd->head + 1) % MESH_SIM_QUEUE;
+        nd->count--;
+    }
+
+    m->on_air = (int)(nd - m->nodes);
+    m->end_ns = m->now + tdma_sim_air(m->frame_len, m->baud);
+}
+
+static int mesh_sim_converged(const mesh_sim *m)
+{
+    for (int i = 1; i < MESH_SIM_NODES; i++)
+        if (m->nodes[i].ctx.route[0].via == MESH_NONE)
+            return 0;
+    return 1;
+}
+
+// 'src' sends to the gateway for 'seconds', one packet every 'gap_ms' or
+// back to back with 'gap_ms' 0
+static void mesh_sim_flow(mesh_sim *m, int src, int len, double seconds, int gap_ms)
+{
+    uint64_t end = m->now + (uint64_t)(seconds * 1e9);
+    uint64_t next = m->now;
+
+    m->delivered = 0;
+    m->delivered_bytes = 0;
+    m->delay_sum = 0;
+
+    for (; m->now < end; m->now += MESH_SIM_STEP_NS)
+    {
+        if (gap_ms == 0 ? m->nodes[src].count == 0 : m->now >= next)
+        {
+            mesh_sim_originate(m, src, len);
+            next = m->now + (uint64_t)gap_ms * 1000000;
+        }
+        mesh_sim_step(m);
+    }
+
+    // What is still on its way arrives
+    for (uint64_t drain = m->now + 10000000000ULL; m->now < drain; m->now += MESH_SIM_STEP_NS)
+        mesh_sim_step(m);
+}
+
+static int bench_mesh(int argc, char *argv[])
+{
+    static mesh_sim m;
+    static const uint8_t net[3] = { 10, 0, 5 };
+    int len = 100;
+    double seconds = 120;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+    if (len < 8 || len > 256)
+    {
+        fprintf(stderr, "error: packet length 8..256\n");
+        return 1;
+    }
+
+    memset(&m, 0, sizeof(m));
+    m.baud = baud;
+    m.on_air = -1;
+    mesh_sim_links(&m);
+    for (int i = 0; i < MESH_SIM_NODES; i++)
+        mesh_init(&m.nodes[i].ctx, i, net, 0, baud, 0);
+
+    double air_ms = tdma_sim_air(len, baud) / 1e6;
+    printf("2x5 ladder, gateway node 0, %d byte packets at %d baud (%.0f ms a hop), %.0f s per flow\n",
+           len, baud, air_ms, seconds);
+
+    while (!mesh_sim_converged(&m) && m.now < 600000000000ULL)
+    {
+        mesh_sim_step(&m);
+        m.now += MESH_SIM_STEP_NS;
+    }
+    printf("Routes to the gateway from every node after %.1f s\n", m.now / 1e9);
+
+    // Settle the delivery ratios over a full window of HELLOs
+    for (uint64_t end = m.now + (uint64_t)MESH_WINDOW * MESH_HELLO_MS * 1000000; m.now < end; m.now += MESH_SIM_STEP_NS)
+        mesh_sim_step(&m);
+
+    double thr[MESH_TTL + 1] = { 0 }, lat[MESH_TTL + 1] = { 0 };
+    int count[MESH_TTL + 1] = { 0 };
+
+    printf("  %4s %6s %10s %12s %10s %10s\n", "node", "hops", "metric", "throughput", "latency", "delivered");
+    for (int src = 1; src < MESH_SIM_NODES; src++)
+    {
+        mesh_route r = m.nodes[src].ctx.route[0];
+        double bps, delay, ratio;
+        uint64_t sent;
+
+        mesh_sim_flow(&m, src, len, seconds, 0);
+        bps = m.delivered_bytes / seconds;
+
+        sent = m.nodes[src].ctx.stats.originated;
+        mesh_sim_flow(&m, src, len, seconds, 2000);
+        delay = m.delivered ? m.delay_sum / m.delivered : 0;
+        ratio = 100.0 * m.delivered / (m.nodes[src].ctx.stats.originated - sent);
+
+        printf("  %4d %6d %8u ms %8.0f B/s %7.0f ms %9.1f%%\n", src, r.hops, (unsigned)r.metric, bps, delay, ratio);
+        if (r.hops <= MESH_TTL)
+        {
+            thr[r.hops] += bps;
+            lat[r.hops] += delay;
+            count[r.hops]++;
+        }
+    }
+
+    printf("Per hop count:\n");
+    for (int h = 1; h <= MESH_TTL; h++)
+        if (count[h])
+            printf("  %d hops: %6.0f B/s %6.0f ms (%d nodes)\n", h, thr[h] / count[h], lat[h] / count[h], count[h]);
+
+    uint64_t hellos = 0, recomputed = 0;
+    for (int i = 0; i < MESH_SIM_NODES; i++)
+    {
+        hellos += m.nodes[i].ctx.stats.hellos_rx;
+        recomputed += m.nodes[i].ctx.stats.recomputed;
+    }
+    printf("Route entries recomputed per HELLO: %.2f, against %d for a full recomputation\n",
+           hellos ? (double)recomputed / hellos : 0, MESH_SIM_NODES);
+
+    // Cut the top row between 1 and 2: node 2 has to go round
+    uint64_t cut = m.now;
+
+    m.link[1][2] = m.link[2][1] = 0;
+    m.link[1][7] = m.link[7][1] = 0;
+    m.link[2][6] = m.link[6][2] = 0;
+    m.link[0][2] = m.link[2][0] = 0;
+    while ((m.nodes[2].ctx.route[0].via == MESH_NONE || m.link[2][m.nodes[2].ctx.route[0].via] == 0) &&
+           m.now < cut + 600000000000ULL)
+    {
+        mesh_sim_step(&m);
+        m.now += MESH_SIM_STEP_NS;
+    }
+    printf("Links from node 2 to 0, 1 and 6 cut: node 2 rerouted via %d (%u hops) after %.1f s\n",
+           m.nodes[2].ctx.route[0].via, m.nodes[2].ctx.route[0].hops, (m.now - cut) / 1e9);
+
+    return 0;
+}
+
+#define BOND_SIM_QUEUE      16      // frames the tty driver holds
+#define BOND_SIM_FRAME      (BOND_HDR_LEN + 512)
+
+typedef struct bond_sim_tty {
+    uint8_t buf[BOND_SIM_QUEUE][BOND_SIM_FRAME];
+    int len[BOND_SIM_QUEUE];
+    int head;
+    int count;
+    uint64_t end_ns;        // of the frame at the head, 0 not on air
+} bond_sim_tty;
+
+typedef struct bond_sim {
+    int nlinks;
+    int baud[BOND_MAX_LINKS];
+    double loss[BOND_MAX_LINKS];
+    bond_sim_tty fwd[BOND_MAX_LINKS];
+    bond_sim_tty rev[BOND_MAX_LINKS];
+    bond_ctx tx;            // the sending end
+    bond_ctx rx;
+    uint64_t now;
+
+    uint32_t next_id;
+    uint32_t expect_id;
+    uint64_t delivered;
+    uint64_t delivered_bytes;
+    uint64_t out_of_order;
+    double delay_sum;
+} bond_sim;
+
+static void bond_sim_put(bond_sim_tty *t, const uint8_t *buf, int len)
+{
+    if (t->count == BOND_SIM_QUEUE)
+        return;
+
+    int at = (t->head + t->count++) % BOND_SIM_QUEUE;
+    memcpy(t->buf[at], buf, len);
+    t->len[at] = len;
+}
+
+// What tty_pending() tells the bridge, as airtime
+static uint64_t bond_sim_backlog(const bond_sim *b, int link)
+{
+    const bond_sim_tty *t = &b->fwd[link];
+    uint64_t ns = t->end_ns > b->now ? t->end_ns - b->now : 0;
+
+    for (int i = 1; i < t->count; i++)
+        ns += tdma_sim_air(t->len[(t->head + i) % BOND_SIM_QUEUE], b->baud[link]);
+    return ns;
+}
+
+static void bond_sim_up(bond_sim *b, const uint8_t *pkt, int len)
+{
+    uint64_t born;
+    uint32_t id;
+
+    memcpy(&born, pkt, sizeof(born));
+    memcpy(&id, pkt + sizeof(born), sizeof(id));
+    if (id < b->expect_id)
+        b->out_of_order++;
+    else
+        b->expect_id = id + 1;
+    b->delivered++;
+    b->delivered_bytes += len;
+    b->delay_sum += (b->now - born) / 1e6;
+}
+
+// The frame at the head of a tty is done, the far end gets it unless lost
+static void bond_sim_arrive(bond_sim *b, int link, bond_sim_tty *t, bond_ctx *far, int data)
+{
+    uint8_t copy[BOND_SIM_FRAME], *payload;
+    int len = t->len[t->head];
+
+    memcpy(copy, t->buf[t->head], len);
+    t->head = (t->head + 1) % BOND_SIM_QUEUE;
+    t->count--;
+    t->end_ns = 0;
+
+    if (rng_uniform() < b->loss[link])
+        return;
+
+    int plen = bond_receive(far, link, copy, len, &payload, b->now);
+    if (data && plen > 0)
+        bond_sim_up(b, payload, plen);
+    while (data && (plen = bond_next(far, &payload, b->now)) > 0)
+        bond_sim_up(b, payload, plen);
+}
+
+// Saturated like a busy TUN: a packet whenever no tty is over the backlog
+static int bond_sim_room(const bond_sim *b)
+{
+    for (int i = 0; i < b->nlinks; i++)
+        if (b->tx.link[i].up && bond_sim_backlog(b, i) > BOND_BACKLOG_MS * 1000000ULL)
+            return 0;
+    return 1;
+}
+
+static void bond_sim_step(bond_sim *b, int len)
+{
+    uint8_t msg[BOND_MSG_MAX], mem[BOND_SIM_FRAME], *pkt, *payload;
+    int link, plen;
+
+    for (int i = 0; i < b->nlinks; i++)
+    {
+        bond_sim_tty *f = &b->fwd[i], *r = &b->rev[i];
+
+        if (f->end_ns && b->now >= f->end_ns)
+            bond_sim_arrive(b, i, f, &b->rx, 1);
+        if (r->end_ns && b->now >= r->end_ns)
+            bond_sim_arrive(b, i, r, &b->tx, 0);
+    }
+    while ((plen = bond_next(&b->rx, &payload, b->now)) > 0)
+        bond_sim_up(b, payload, plen);
+
+    while ((plen = bond_poll(&b->tx, msg, sizeof(msg), &link, b->now)) > 0)
+        bond_sim_put(&b->fwd[link], msg, plen);
+    while ((plen = bond_poll(&b->rx, msg, sizeof(msg), &link, b->now)) > 0)
+        bond_sim_put(&b->rev[link], msg, plen);
+
+    while (bond_sim_room(b))
+    {
+        pkt = mem + BOND_HDR_LEN;
+        memset(pkt, 0, BOND_SIM_FRAME - BOND_HDR_LEN);
+        memcpy(pkt, &b->now, sizeof(b->now));
+        memcpy(pkt + sizeof(b->now), &b->next_id, sizeof(b->next_id));
+        b->next_id++;
+        plen = bond_send(&b->tx, &pkt, len, &link);
+        bond_sim_put(&b->fwd[link], pkt, plen);
+        if (b->fwd[link].count == 1)
+            break;
+    }
+
+    for (int i = 0; i < b->nlinks; i++)
+    {
+        if (!b->fwd[i].end_ns && b->fwd[i].count)
+            b->fwd[i].end_ns = b->now + tdma_sim_air(b->fwd[i].len[b->fwd[i].head], b->baud[i]);
+        if (!b->rev[i].end_ns && b->rev[i].count)
+            b->rev[i].end_ns = b->now + tdma_sim_air(b->rev[i].len[b->rev[i].head], b->baud[i]);
+    }
+}
+
+// 'weights' are the rates the bond is told, the links run at 'baud'
+static void bond_sim_init(bond_sim *b, int nlinks, const int *baud, const int *weights, double loss, int len)
+{
+    memset(b, 0, sizeof(*b));
+    b->nlinks = nlinks;
+    for (int i = 0; i < nlinks; i++)
+    {
+        b->baud[i] = baud[i];
+        b->loss[i] = loss;
+    }
+    bond_init(&b->tx, nlinks, weights, BOND_HDR_LEN + len, 0);
+    bond_init(&b->rx, nlinks, weights, BOND_HDR_LEN + len, 0);
+}
+
+static void bond_sim_run(bond_sim *b, int len, double seconds)
+{
+    b->delivered = 0;
+    b->delivered_bytes = 0;
+    b->out_of_order = 0;
+    b->delay_sum = 0;
+    memset(&b->rx.stats, 0, sizeof(b->rx.stats));
+
+    for (uint64_t end = b->now + (uint64_t)(seconds * 1e9); b->now < end; b->now += 1000000)
+        bond_sim_step(b, len);
+}
+
+static void bond_sim_print(const char *name, bond_sim *b, double seconds, double sum)
+{
+    printf("  %-28s %7.0f B/s %6.1f%% %8.0f ms %6.1f%% %8llu %6llu\n", name, b->delivered_bytes / seconds,
+           sum > 0 ? 100.0 * b->delivered_bytes / seconds / sum : 100.0,
+           b->delivered ? b->delay_sum / b->delivered : 0,
+           b->delivered ? 100.0 * b->rx.stats.reordered / b->delivered : 0,
+           (unsigned long long)b->out_of_order, (unsigned long long)b->rx.stats.lost);
+}
+
+static int bench_bond(int argc, char *argv[])
+{
+    static bond_sim b;
+    static const int baud[2] = { 9600, 4800 };
+    static const int equal[2] = { 9600, 9600 };
+    int len = 200;
+    double seconds = 120;
+    double loss = 0.02;
+    double sum = 0;
+    char name[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:L:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'L': loss = atof(optarg) / 100; break;
+            default: return 1;
+        }
+    }
+    if (len < 16 || len > 512)
+    {
+        fprintf(stderr, "error: packet length 16..512\n");
+        return 1;
+    }
+
+    printf("%d byte packets, %.0f%% frame loss, %.0f s per run\n", len, loss * 100, seconds);
+    printf("  %-28s %11s %7s %11s %7s %8s %6s\n", "", "goodput", "of sum", "latency", "held", "misorder", "lost");
+
+    for (int i = 0; i < 2; i++)
+    {
+        bond_sim_init(&b, 1, &baud[i], &baud[i], loss, len);
+        bond_sim_run(&b, len, seconds);
+        sum += b.delivered_bytes / seconds;
+        snprintf(name, sizeof(name), "link %d alone, %d baud", i, baud[i]);
+        bond_sim_print(name, &b, seconds, 0);
+    }
+
+    bond_sim_init(&b, 2, baud, equal, loss, len);
+    bond_sim_run(&b, len, seconds);
+    bond_sim_print("bonded, plain round robin", &b, seconds, sum);
+
+    bond_sim_init(&b, 2, baud, baud, loss, len);
+    bond_sim_run(&b, len, seconds);
+    bond_sim_print("bonded, weighted by capacity", &b, seconds, sum);
+
+    // Link 0 degrades for a while and recovers
+    double third = seconds / 3;
+    uint64_t cut, down = 0, up = 0;
+    int was_down;
+
+    bond_sim_init(&b, 2, baud, baud, loss, len);
+    bond_sim_run(&b, len, third);
+    bond_sim_print("failover: before", &b, third, sum);
+
+    cut = b.now;
+    b.loss[0] = 0.7;
+    b.delivered = b.delivered_bytes = b.out_of_order = 0;
+    b.delay_sum = 0;
+    memset(&b.rx.stats, 0, sizeof(b.rx.stats));
+    for (uint64_t end = b.now + (uint64_t)(third * 1e9); b.now < end; b.now += 1000000)
+    {
+        bond_sim_step(&b, len);
+        if (!down && !b.tx.link[0].up)
+            down = b.now - cut;
+    }
+    bond_sim_print("failover: link 0 70% loss", &b, third, sum);
+
+    cut = b.now;
+    b.loss[0] = loss;
+    was_down = !b.tx.link[0].up;
+    b.delivered = b.delivered_bytes = b.out_of_order = 0;
+    b.delay_sum = 0;
+    memset(&b.rx.stats, 0, sizeof(b.rx.stats));
+    for (uint64_t end = b.now + (uint64_t)(third * 1e9); b.now < end; b.now += 1000000)
+    {
+        bond_sim_step(&b, len);
+        if (!up && b.tx.link[0].up)
+            up = b.now - cut;
+    }
+    bond_sim_print("failover: link 0 recovered", &b, third, sum);
+    if (was_down)
+        printf("Link 0 taken out after %.1f s, back in after %.1f s\n", down / 1e9, up / 1e9);
+    else
+        printf("Link 0 taken out after %.1f s, back in before it recovered\n", down / 1e9);
+
+    return 0;
+}
+
+#define DIV_SIM_TRIES       8       // per packet, as the ARQ would
+#define DIV_SIM_USB_MS      8       // spread between the two ttys
+
+typedef struct div_sim_branch {
+    double h_re, h_im;      // Rayleigh fading, unit mean power
+    deframer d;
+} div_sim_branch;
+
+typedef struct div_sim {
+    pipeline tx;
+    pipeline rx;
+    crc_ctx crc[2];
+    fec_ctx fec[2];
+    div_ctx send;
+    div_ctx recv;
+    div_sim_branch branch[DIV_BRANCHES];
+    int nbranches;
+    double snr;             // mean Eb/N0, linear
+    double a;               // fade correlation from one frame to the next
+    uint64_t now;
+
+    uint64_t packets;
+    uint64_t attempts;
+    uint64_t failed;        // given up after DIV_SIM_TRIES
+    uint64_t undetected;    // went up with errors
+} div_sim;
+
+static double rng_gauss(void)
+{
+    double u = rng_uniform();
+
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2 * M_PI * rng_uniform());
+}
+
+// Jakes-like: the fade moves on by one frame airtime
+static double div_sim_fade(div_sim_branch *b, double a)
+{
+    double s = sqrt((1 - a * a) / 2);
+
+    b->h_re = a * b->h_re + s * rng_gauss();
+    b->h_im = a * b->h_im + s * rng_gauss();
+    return b->h_re * b->h_re + b->h_im * b->h_im;
+}
+
+static void div_sim_init(div_sim *s, int nbranches, double margin_db, int nsym, double doppler, int len, int baud)
+{
+    memset(s, 0, sizeof(*s));
+    s->nbranches = nbranches;
+    s->snr = pow(10, margin_db / 10);
+    s->a = exp(-2 * M_PI * doppler * (len + 16) * 10.0 / baud);
+
+    for (int e = 0; e < 2; e++)
+    {
+        pipeline *p = e ? &s->rx : &s->tx;
+
+        pipeline_add(p, crc_stage(&s->crc[e]));
+        fec_init(&s->fec[e], nsym, 1);
+        pipeline_add(p, fec_stage(&s->fec[e]));
+    }
+    div_init(&s->send, 1);
+    div_init(&s->recv, nbranches);
+    for (int i = 0; i < DIV_BRANCHES; i++)
+    {
+        s->branch[i].h_re = rng_gauss() / sqrt(2);
+        s->branch[i].h_im = rng_gauss() / sqrt(2);
+        deframer_init(&s->branch[i].d);
+    }
+}
+
+static void div_sim_free(div_sim *s)
+{
+    fec_free(&s->fec[0]);
+    fec_free(&s->fec[1]);
+}
+
+static int div_sim_check(div_sim *s, const uint8_t *pkt, int len, const uint8_t *got, int glen)
+{
+    if (glen != len || memcmp(got, pkt, len))
+    {
+        s->undetected++;
+        return 0;
+    }
+    return 1;
+}
+
+// One try of a packet, 1 if it went up intact
+static int div_sim_attempt(div_sim *s, const uint8_t *pkt, int len, int baud)
+{
+    static uint8_t mem[BRIDGE_HEADROOM + BRIDGE_BUF_SIZE];
+    static uint8_t air[BRIDGE_BUF_SIZE + 64];
+    static uint8_t copy[BRIDGE_BUF_SIZE + 64];
+    uint64_t lag[DIV_BRANCHES];
+    uint8_t *payload, *buf = mem + BRIDGE_HEADROOM;
+    int ok = 0, plen;
+
+    memcpy(buf, pkt, len);
+    int n = div_send(&s->send, &buf, len);
+    n = pipeline_tx(&s->tx, &buf, n, BRIDGE_BUF_SIZE);
+    n = frame_build(air, sizeof(air), buf, n, CHAN_PREAMBLE);
+    s->now += (uint64_t)n * 10 * 1000000000ULL / baud;
+
+    // Non-coherent FSK, one fade over the frame
+    // Either tty may be the first to hand over its copy
+    int first = s->nbranches == 2 && (rng_next() & 1);
+    lag[first] = 0;
+    lag[1 - first] = (uint64_t)(rng_uniform() * DIV_SIM_USB_MS * 1e6);
+    for (int o = 0; o < s->nbranches; o++)
+    {
+        int i = o ^ first;
+        div_sim_branch *b = &s->branch[i];
+        double ber = 0.5 * exp(-s->snr * div_sim_fade(b, s->a) / 2);
+
+        memcpy(copy, air, n);
+        inject_errors(copy, n, ber, 1);
+        for (int j = 0; j < n; j++)
+        {
+            int flen = deframer_push(&b->d, copy[j]);
+            if (flen <= 0)
+                continue;
+
+            uint64_t fixed = s->fec[1].stats.symbols_corrected;
+            uint8_t *body = b->d.buf;
+            flen = pipeline_rx(&s->rx, &body, flen, sizeof(b->d.buf));
+            if (flen < 0)
+                continue;
+
+            plen = div_receive(&s->recv, i, body, flen, (int)(s->fec[1].stats.symbols_corrected - fixed),
+                               &payload, s->now + lag[i]);
+            if (plen > 0)
+                ok |= div_sim_check(s, pkt, len, payload, plen);
+            while ((plen = div_next(&s->recv, &payload, s->now + lag[i])) > 0)
+                ok |= div_sim_check(s, pkt, len, payload, plen);
+        }
+        for (int j = 0; j < 8; j++)
+            deframer_push(&b->d, (uint8_t)rng_next());
+    }
+
+    // Whatever waits for a copy that is not coming
+    s->now += (DIV_SIM_USB_MS + DIV_WINDOW_MS) * 1000000ULL;
+    while ((plen = div_next(&s->recv, &payload, s->now)) > 0)
+        ok |= div_sim_check(s, pkt, len, payload, plen);
+    return ok;
+}
+
+static void div_sim_run(div_sim *s, int count, int len, int baud)
+{
+    static uint8_t pkt[BRIDGE_BUF_SIZE];
+
+    for (int k = 0; k < count; k++)
+    {
+        int tries = 0, ok = 0;
+
+        rng_fill(pkt, len);
+        while (!ok && tries < DIV_SIM_TRIES)
+        {
+            ok = div_sim_attempt(s, pkt, len, baud);
+            tries++;
+        }
+        s->packets++;
+        s->attempts += tries;
+        s->failed += !ok;
+    }
+}
+
+static int bench_div(int argc, char *argv[])
+{
+    static div_sim s;
+    const double margins[] = { 10, 15, 20, 25, 30 };
+    int len = 100;
+    int count = 3000;
+    int nsym = 16;
+    double doppler = 1;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:n:f:D:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'f': nsym = atoi(optarg); break;
+            case 'D': doppler = atof(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+    if (len < 16 || len > 1024 || nsym < 2 || nsym > FEC_MAX_NSYM || doppler <= 0)
+    {
+        fprintf(stderr, "error: packet length 16..1024, nsym 2..%d, Doppler above 0\n", FEC_MAX_NSYM);
+        return 1;
+    }
+
+    printf("%d byte packets, RS(%d), Rayleigh fading at %.1f Hz Doppler, %d baud, up to %d tries\n",
+           len, 255 - nsym, doppler, baud, DIV_SIM_TRIES);
+    printf("  %-8s %-30s %-30s\n", "Eb/N0", "one receiver", "two, selection combining");
+    printf("  %-8s %9s %9s %10s %9s %9s %10s %7s\n", "",
+           "FER", "retx", "undetected", "FER", "retx", "undetected", "picked");
+
+    for (unsigned m = 0; m < sizeof(margins) / sizeof(margins[0]); m++)
+    {
+        double fer[2], retx[2];
+        uint64_t bad[2], picked = 0;
+
+        for (int nb = 1; nb <= 2; nb++)
+        {
+            rng_state = 0x9E3779B97F4A7C15ULL + m;
+            div_sim_init(&s, nb, margins[m], nsym, doppler, len, baud);
+            div_sim_run(&s, count, len, baud);
+
+            // The first try of every packet is a frame like any other
+            fer[nb - 1] = 1.0 - (double)(s.packets - s.failed) / s.attempts;
+            retx[nb - 1] = (double)(s.attempts - s.packets) / s.packets;
+            bad[nb - 1] = s.undetected;
+            if (nb == 2)
+                picked = s.recv.branch[1].picked;
+            div_sim_free(&s);
+        }
+
+        printf("  %5.0f dB %8.2f%% %9.3f %10llu %8.2f%% %9.3f %10llu %6.1f%%\n", margins[m],
+               100 * fer[0], retx[0], (unsigned long long)bad[0],
+               100 * fer[1], retx[1], (unsigned long long)bad[1],
+               100.0 * picked / (count ? count : 1));
+    }
+    printf("retx: retransmissions per packet; picked: packets that went up from the second receiver\n");
+
+    return 0;
+}
+
+//
+// PN9 bit error rate tester
+//
+
+// Bits of a synthetic capture, the first in the MSB of the first byte
+typedef struct pn9_sim {
+    uint8_t *buf;
+    long nbits;
+    long cap;
+    uint64_t flips;
+    uint64_t bursts;
+    uint64_t slips;
+} pn9_sim;
+
+static void pn9_sim_put(pn9_sim *s, int bit)
+{
+    if (s->nbits >= s->cap)
+        return;
+    if (bit)
+        s->buf[s->nbits / 8] |= (uint8_t)(0x80 >> (s->nbits % 8));
+    s->nbits++;
+}
+
+static void pn9_sim_flip(pn9_sim *s, long bit)
+{
+    s->buf[bit / 8] ^= (uint8_t)(0x80 >> (bit % 8));
+    s->flips++;
+}
+
+// The sequence from the seed, a bit dropped or doubled every 'slip' bits
+// as a receiver whose clock is off would, then bursts of errors: the
+// first and last bit of every burst wrong, those between it at random
+static void pn9_sim_build(pn9_sim *s, long nbits, double ber, int burst, long slip)
+{
+    uint16_t state = 0x1FF;
+
+    s->cap = nbits;
+    s->buf = calloc((nbits + 7) / 8, 1);
+    s->nbits = 0;
+
+    for (long i = 0; s->nbits < nbits; i++)
+    {
+        int bit = (int)pn9_bits(&state, 1);
+
+        if (slip > 0 && i > 0 && i % slip == 0)
+        {
+            s->slips++;
+            if (rng_next() & 1)
+                continue;
+            pn9_sim_put(s, bit);
+        }
+        pn9_sim_put(s, bit);
+    }
+
+    for (long b = 0; b < nbits; b++)
+    {
+        if (rng_uniform() >= ber / burst)
+            continue;
+
+        s->bursts++;
+        for (long k = b; k < b + burst && k < nbits; k++)
+            if (k == b || k == b + burst - 1 || (rng_next() & 1))
+                pn9_sim_flip(s, k);
+        b += burst - 1;
+    }
+}
+
+// The classic bit-serial check, for comparison: a bit that is not the
+// XOR of those 9 and 4 before it is wrong, every error shows up three times
+static uint64_t pn9_serial(const uint8_t *buf, long nbits)
+{
+    uint16_t h = 0;
+    uint64_t bad = 0;
+
+    for (long i = 0; i < nbits; i++)
+    {
+        int bit = (buf[i / 8] >> (7 - i % 8)) & 1;
+
+        if (i >= 9)
+            bad += bit ^ ((h >> 8) & 1) ^ ((h >> 3) & 1);
+        h = (uint16_t)((h << 1) | bit);
+    }
+    return bad;
+}
+
+static int bench_pn9_capture(const char *path)
+{
+    static uint8_t chunk[65536];
+    FILE *f = fopen(path, "rb");
+    pn9_ber b;
+    size_t n;
+    long total = 0;
+    double t = 0;
+
+    if (!f)
+    {
+        fprintf(stderr, "error: cannot open %s\n", path);
+        return 1;
+    }
+
+    pn9_ber_init(&b);
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    {
+        double t0 = now_sec();
+        pn9_ber_push_bytes(&b, chunk, (int)n);
+        t += now_sec() - t0;
+        total += n;
+    }
+    fclose(f);
+
+    printf("PN9 BER test on %s, %ld bits\n", path, total * 8);
+    pn9_ber_print(&b, stdout);
+    printf("  %.0f Mbit/s\n", t > 0 ? total * 8 / t / 1e6 : 0.0);
+    return 0;
+}
+
+static int bench_pn9(int argc, char *argv[])
+{
+    pn9_sim s = { 0 };
+    pn9_ber b;
+    double ber = 1e-3;
+    int burst = 1;
+    double mbits = 16;
+    long slip = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "B:b:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'B': ber = atof(optarg); break;
+            case 'b': burst = atoi(optarg); break;
+            case 'n': mbits = atof(optarg); break;
+            case 's': slip = atol(optarg); break;
+            default: return 1;
+        }
+    }
+    if (optind < argc)
+        return bench_pn9_capture(argv[optind]);
+
+    long nbits = (long)(mbits * 1e6) & ~63L;
+    if (ber < 0 || ber > 0.5 || burst < 1 || burst > 64 || nbits < 64 * PN9_BLOCK_WORDS || slip < 0)
+    {
+        fprintf(stderr, "error: BER 0..0.5, bursts of 1..64 bits, a slip interval of 0 or more\n");
+        return 1;
+    }
+
+    pn9_sim_build(&s, nbits, ber, burst, slip);
+
+    printf("PN9 BER test, %.0f Mbit, BER %.1e in bursts of %d, ", nbits / 1e6, ber, burst);
+    if (slip > 0)
+        printf("a slip every %ld bits\n", slip);
+    else
+        printf("no slips\n");
+    printf("  injected: errors=%llu ber=%.3e bursts=%llu slips=%llu\n",
+           (unsigned long long)s.flips, (double)s.flips / nbits,
+           (unsigned long long)s.bursts, (unsigned long long)s.slips);
+
+    // The words as the firmware hands them over
+    uint64_t *words = malloc(nbits / 8);
+    for (long i = 0; i < nbits / 64; i++)
+    {
+        uint64_t w = 0;
+        for (int k = 0; k < 8; k++)
+            w = (w << 8) | s.buf[i * 8 + k];
+        words[i] = w;
+    }
+
+    pn9_ber_init(&b);
+    double t0 = now_sec();
+    pn9_ber_push(&b, words, (int)(nbits / 64));
+    double t1 = now_sec();
+    uint64_t serial = pn9_serial(s.buf, nbits);
+    double t2 = now_sec();
+
+    pn9_ber_print(&b, stdout);
+    printf("  %-36s %8.0f Mbit/s\n", "word-parallel, XOR and popcount", nbits / (t1 - t0) / 1e6);
+    printf("  %-36s %8.0f Mbit/s  ber=%.3e\n", "bit-serial, self-synchronizing", nbits / (t2 - t1) / 1e6,
+           serial / 3.0 / nbits);
+    printf("The bit-serial check counts every error three times and a slip as a few errors, "
+           "the figure is a third of its count\n");
+
+    free(words);
+    free(s.buf);
+    return 0;
+}
+
+//
+// Clock recovery and sync word correlator
+//
+
+#define CDR_SIM_SYNC        0x1ACFFC1Du     // CCSDS attached sync marker
+#define CDR_SIM_PREAMBLE    32
+#define CDR_SIM_GAP         16
+#define CDR_SIM_MAX_ERRORS  2
+
+typedef struct cdr_sim {
+    uint8_t *samples;
+    long nsamples;
+    uint8_t (*payload)[256];
+    int frames;
+    int len;
+} cdr_sim;
+
+// Frames of preamble, sync word and payload in NRZ, 'oversample' samples
+// to one of our bits; the far end's bits are 'ppm' longer, their edges
+// move by 'jitter' of a bit at random and 'flip' of the samples are
+// wrong, the slicer chattering near the threshold
+static void cdr_sim_build(cdr_sim *s, int frames, int len, int oversample, double ppm, double jitter,
+                          double flip)
+{
+    int fbits = CDR_SIM_PREAMBLE + 32 + len * 8 + CDR_SIM_GAP;
+    long nbits = (long)frames * fbits;
+    uint8_t *bits = malloc(nbits);
+    double t_bit = oversample * (1 + ppm * 1e-6);
+
+    s->frames = frames;
+    s->len = len;
+    s->payload = malloc((size_t)frames * 256);
+    for (int f = 0; f < frames; f++)
+    {
+        uint8_t *b = bits + (long)f * fbits;
+
+        rng_fill(s->payload[f], len);
+        for (int i = 0; i < CDR_SIM_PREAMBLE; i++)
+            *b++ = i & 1;
+        for (int i = 31; i >= 0; i--)
+            *b++ = (CDR_SIM_SYNC >> i) & 1;
+        for (int i = 0; i < len * 8; i++)
+            *b++ = (s->payload[f][i / 8] >> (7 - i % 8)) & 1;
+        for (int i = 0; i < CDR_SIM_GAP; i++)
+            *b++ = i & 1;
+    }
+
+    s->nsamples = (long)(nbits * t_bit);
+    s->samples = malloc(s->nsamples);
+
+    // Sample t is in bit k while t is before the end of k, edges jittered
+    double start = rng_uniform() * oversample;
+    double edge = start + t_bit + jitter * oversample * rng_gauss();
+    long k = 0;
+    for (long t = 0; t < s->nsamples; t++)
+    {
+        while (t >= edge && k < nbits - 1)
+        {
+            k++;
+            edge = start + (k + 1) * t_bit + jitter * oversample * rng_gauss();
+        }
+        s->samples[t] = (uint8_t)((bits[k] ^ (rng_uniform() < flip)) ? 0x20 : 0);
+    }
+
+    free(bits);
+}
+
+static void cdr_sim_free(cdr_sim *s)
+{
+    free(s->samples);
+    free(s->payload);
+}
+
+static int cdr_sim_bits(const uint64_t *w, long pos, int n, uint8_t *out)
+{
+    memset(out, 0, (n + 7) / 8);
+    for (int i = 0; i < n; i++)
+        if ((w[(pos + i) / 64] >> (63 - (pos + i) % 64)) & 1)
+            out[i / 8] |= (uint8_t)(0x80 >> (i % 8));
+    return n;
+}
+
+// Frames whose payload came out whole after a sync word
+static int cdr_sim_frames(const cdr_sim *s, const uint64_t *w, int nwords)
+{
+    static uint32_t hits[65536];
+    uint8_t got[256];
+    cdr_sync sync;
+    int next = 0, good = 0;
+
+    cdr_sync_init(&sync, CDR_SIM_SYNC, 32, CDR_SIM_MAX_ERRORS);
+    int n = cdr_sync_push(&sync, w, nwords, hits, 65536);
+
+    for (int h = 0; h < n && next < s->frames; h++)
+    {
+        if ((long)hits[h] + s->len * 8 > (long)nwords * 64)
+            break;
+        cdr_sim_bits(w, hits[h], s->len * 8, got);
+
+        // The frame it is, or a later one if some went missing
+        for (int f = next; f < s->frames; f++)
+        {
+            if (memcmp(got, s->payload[f], s->len) == 0)
+            {
+                good++;
+                next = f + 1;
+                break;
+            }
+        }
+    }
+    return good;
+}
+
+// Our own bit clock, the middle sample of every bit
+static int cdr_sim_naive(const cdr_sim *s, int oversample, uint64_t *w)
+{
+    int nwords = 0, nbits = 0;
+    uint64_t word = 0;
+
+    for (long t = oversample / 2; t < s->nsamples; t += oversample)
+    {
+        word = (word << 1) | (s->samples[t] != 0);
+        if (++nbits == 64)
+        {
+            w[nwords++] = word;
+            nbits = 0;
+        }
+    }
+    return nwords;
+}
+
+static int bench_cdr_capture(const char *path, int oversample, uint8_t mask, uint32_t sync_word, int sync_len,
+                             const char *out_path)
+{
+    static uint8_t chunk[65536];
+    static uint64_t words[65536 / 2 / 64 + 1];
+    static uint32_t hits[4096];
+    FILE *f = fopen(path, "rb");
+    FILE *out = 0;
+    cdr_ctx c;
+    cdr_sync s;
+    size_t n;
+
+    if (!f)
+    {
+        fprintf(stderr, "error: cannot open %s\n", path);
+        return 1;
+    }
+    if (out_path && !(out = fopen(out_path, "wb")))
+    {
+        fprintf(stderr, "error: cannot create %s\n", out_path);
+        fclose(f);
+        return 1;
+    }
+
+    cdr_init(&c, oversample);
+    cdr_sync_init(&s, sync_word, sync_len, CDR_SIM_MAX_ERRORS);
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    {
+        int nw = cdr_push(&c, chunk, (int)n, mask, words);
+
+        cdr_sync_push(&s, words, nw, hits, 4096);
+        for (int i = 0; out && i < nw; i++)
+        {
+            uint8_t b[8];
+            for (int k = 0; k < 8; k++)
+                b[k] = (uint8_t)(words[i] >> (56 - 8 * k));
+            fwrite(b, 1, 8, out);
+        }
+    }
+    fclose(f);
+    if (out)
+        fclose(out);
+
+    printf("Clock recovery on %s, sync word 0x%X/%d\n", path, (unsigned)sync_word, sync_len);
+    cdr_print_stats(&c, &s, stdout);
+    return 0;
+}
+
+static int bench_cdr(int argc, char *argv[])
+{
+    const int oversamples[] = { 16, 8, 4 };
+    const double jitters[] = { 0.02, 0.05, 0.1 };
+    int frames = 1000;
+    int len = 32;
+    double ppm = 100;
+    double flip = 0.005;
+    uint8_t mask = 0x20;
+    uint32_t sync_word = 0x5A457;           // the bridge's 0x2D 0xD4 through the UART
+    int sync_len = 20;
+    int oversample = 8;
+    const char *out_path = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:p:f:o:m:s:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': frames = atoi(optarg); break;
+            case 'l': len = atoi(optarg); break;
+            case 'p': ppm = atof(optarg); break;
+            case 'f': flip = atof(optarg); break;
+            case 'o': oversample = atoi(optarg); break;
+            case 'm': mask = (uint8_t)strtoul(optarg, 0, 0); break;
+            case 's': sync_len = 4 * (int)strlen(optarg); sync_word = (uint32_t)strtoul(optarg, 0, 16); break;
+            case 'w': out_path = optarg; break;
+            default: return 1;
+        }
+    }
+    if (oversample < 2 || oversample > CDR_MAX_OVERSAMPLE || sync_len < 4 || sync_len > CDR_SYNC_MAX_BITS)
+    {
+        fprintf(stderr, "error: oversample 2..%d, a sync word of 1 to 8 hex digits\n", CDR_MAX_OVERSAMPLE);
+        return 1;
+    }
+    if (optind < argc)
+        return bench_cdr_capture(argv[optind], oversample, mask, sync_word, sync_len, out_path);
+    if (frames < 1 || frames > 20000 || len < 1 || len > 256)
+    {
+        fprintf(stderr, "error: 1..20000 frames of 1..256 bytes\n");
+        return 1;
+    }
+
+    printf("%d frames of %d bytes after a 32 bit sync word (%d wrong allowed), far end %.0f ppm slow, "
+           "%.1f%% of the samples flipped\n", frames, len, CDR_SIM_MAX_ERRORS, ppm, 100 * flip);
+    printf("  %-10s %-8s %-14s %-14s %s\n", "oversample", "jitter", "mid-bit", "recovered", "timing error");
+
+    for (unsigned o = 0; o < sizeof(oversamples) / sizeof(oversamples[0]); o++)
+    {
+        for (unsigned j = 0; j < sizeof(jitters) / sizeof(jitters[0]); j++)
+        {
+            cdr_sim s;
+            cdr_ctx c;
+
+            rng_state = 0x9E3779B97F4A7C15ULL + o * 16 + j;
+            cdr_sim_build(&s, frames, len, oversamples[o], ppm, jitters[j], flip);
+
+            uint64_t *w = malloc((s.nsamples / 2 / 64 + 2) * sizeof(uint64_t));
+            int naive = cdr_sim_frames(&s, w, cdr_sim_naive(&s, oversamples[o], w));
+
+            cdr_init(&c, oversamples[o]);
+            int nw = cdr_push(&c, s.samples, (int)s.nsamples, 0x20, w);
+            int recovered = cdr_sim_frames(&s, w, nw);
+
+            printf("  %10d %7.2f %8.1f%% %13.1f%% %8.2f samples\n", oversamples[o], jitters[j],
+                   100.0 * naive / frames, 100.0 * recovered / frames,
+                   c.transitions ? (double)c.timing_error / c.transitions / CDR_PHASE_ONE : 0.0);
+            free(w);
+            cdr_sim_free(&s);
+        }
+    }
+    printf("jitter: edge spread in bits, one sigma; the columns are the frames that came out whole\n");
+
+    // The correlator alone, on random bits
+    static uint64_t words[1 << 16];
+    static uint32_t hits[1 << 16];
+    cdr_sync s;
+    int iters = 20;
+
+    for (int i = 0; i < (1 << 16); i++)
+        words[i] = rng_next();
+
+    cdr_sync_init(&s, CDR_SIM_SYNC, 32, CDR_SIM_MAX_ERRORS);
+    double t0 = now_sec();
+    for (int i = 0; i < iters; i++)
+        cdr_sync_push_serial(&s, words, 1 << 16, hits, 1 << 16);
+    double t1 = now_sec();
+    uint64_t serial = s.hits;
+
+    cdr_sync_init(&s, CDR_SIM_SYNC, 32, CDR_SIM_MAX_ERRORS);
+    double t2 = now_sec();
+    for (int i = 0; i < iters; i++)
+        cdr_sync_push(&s, words, 1 << 16, hits, 1 << 16);
+    double t3 = now_sec();
+
+    double mbits = iters * 64.0 * (1 << 16) / 1e6;
+    printf("Sync word correlator, 32 bits with %d wrong:\n", CDR_SIM_MAX_ERRORS);
+    printf("  %-36s %8.0f Mbit/s  %llu hits\n", "a bit at a time, popcount", mbits / (t1 - t0),
+           (unsigned long long)serial);
+    printf("  %-36s %8.0f Mbit/s  %llu hits\n", "128 positions at a time, bit-sliced", mbits / (t3 - t2),
+           (unsigned long long)s.hits);
+
+    return 0;
+}
+
+//
+// Whitening
+//
+
+// The SPIRIT1 and CC1101 datasheets' first bytes of the sequence
+static const uint8_t whiten_published[16] = {
+    0xFF, 0xE1, 0x1D, 0x9A, 0xED, 0x85, 0x33, 0x24, 0xEA, 0x7A, 0xD2, 0x39, 0x70, 0x97, 0x57, 0x0A
+};
+
+// The LFSR a bit at a time, as the chip does it
+static void whiten_serial(uint8_t *buf, int len)
+{
+    uint16_t state = 0x1FF;
+
+    for (int i = 0; i < len; i++)
+        for (int k = 0; k < 8; k++)
+        {
+            buf[i] ^= (uint8_t)((state & 1) << k);
+            state = (uint16_t)((state >> 1) | (((state ^ (state >> 5)) & 1) << 8));
+        }
+}
+
+static void whiten_bytes(uint8_t *buf, int len, const uint8_t *table)
+{
+    for (int i = 0; i < len; i++)
+        buf[i] ^= table[i % PN9_PERIOD];
+}
+
+// Share of ones and longest run of equal bits through the UART, a start
+// bit, 8 bits LSB first and a stop bit a byte
+static void whiten_air(const uint8_t *buf, int len, double *ones, int *run)
+{
+    long n1 = 0;
+    int last = 1, cur = 0;
+
+    *run = 0;
+    for (int i = 0; i < len; i++)
+    {
+        uint16_t c = (uint16_t)(0x200 | (buf[i] << 1));
+
+        for (int k = 0; k < 10; k++)
+        {
+            int b = (c >> k) & 1;
+
+            n1 += b;
+            cur = b == last ? cur + 1 : 1;
+            last = b;
+            if (cur > *run)
+                *run = cur;
+        }
+    }
+    *ones = (double)n1 / (10.0 * len);
+}
+
+static int bench_whiten(int argc, char *argv[])
+{
+    uint8_t table[PN9_PERIOD];
+    int len = 1024;
+    double mb = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 'n': mb = atof(optarg); break;
+            default: return 1;
+        }
+    }
+    if (len < 1 || len > BRIDGE_BUF_SIZE || mb <= 0)
+    {
+        fprintf(stderr, "error: frames of 1..%d bytes\n", BRIDGE_BUF_SIZE);
+        return 1;
+    }
+
+    for (int i = 0; i < PN9_PERIOD; i++)
+        table[i] = pn9_whitening_byte(i);
+
+    int published = memcmp(table, whiten_published, sizeof(whiten_published)) == 0;
+    printf("PN9 whitening, %d byte frames\n", len);
+    printf("  sequence: %02X %02X %02X %02X %02X %02X ... %s the SPIRIT1's\n", table[0], table[1], table[2],
+           table[3], table[4], table[5], published ? "matches" : "DOES NOT MATCH");
+
+    // All three agree and whitening twice gives the frame back, on every
+    // length up to the buffer
+    uint8_t ref[BRIDGE_BUF_SIZE], a[BRIDGE_BUF_SIZE], b[BRIDGE_BUF_SIZE], orig[BRIDGE_BUF_SIZE];
+    int mismatches = 0;
+    for (int n = 1; n <= BRIDGE_BUF_SIZE; n += n < 1100 ? 1 : 97)
+    {
+        for (int i = 0; i < n; i++)
+            orig[i] = (uint8_t)rand();
+        memcpy(ref, orig, n);
+        memcpy(a, orig, n);
+        memcpy(b, orig, n);
+        whiten_serial(ref, n);
+        whiten_bytes(a, n, table);
+        pn9_whiten(b, n);
+        if (memcmp(ref, a, n) || memcmp(ref, b, n))
+            mismatches++;
+        pn9_whiten(b, n);
+        if (memcmp(b, orig, n))
+            mismatches++;
+    }
+    printf("  bit, byte and word whitening agree and undo: %s\n", mismatches ? "NO" : "yes");
+
+    int frames = (int)(mb * 1e6 / len);
+    uint8_t *buf = malloc(len);
+    for (int i = 0; i < len; i++)
+        buf[i] = (uint8_t)rand();
+
+    double t0 = now_sec();
+    for (int f = 0; f < frames / 16; f++)
+        whiten_serial(buf, len);
+    double t1 = now_sec();
+    for (int f = 0; f < frames; f++)
+        whiten_bytes(buf, len, table);
+    double t2 = now_sec();
+    for (int f = 0; f < frames; f++)
+        pn9_whiten(buf, len);
+    double t3 = now_sec();
+
+    double bytes = (double)frames * len;
+    printf("  %-36s %8.0f MB/s\n", "bit-serial LFSR", bytes / 16 / (t1 - t0) / 1e6);
+    printf("  %-36s %8.0f MB/s\n", "byte table", bytes / (t2 - t1) / 1e6);
+    printf("  %-36s %8.0f MB/s\n", "8 bytes a step, pn9_whiten", bytes / (t3 - t2) / 1e6);
+
+    // What goes on air: runs are capped by the UART's start and stop bits
+    // either way, but a frame of zeros is 90% zeros
+    static const char *names[] = { "zeros", "0xFF", "text" };
+    printf("  %-8s %-20s %s\n", "frame", "plain, ones / run", "whitened");
+    for (int k = 0; k < 3; k++)
+    {
+        double ones, wones;
+        int run, wrun;
+
+        for (int i = 0; i < len; i++)
+            buf[i] = k == 0 ? 0x00 : k == 1 ? 0xFF : (uint8_t)"the quick brown fox "[i % 20];
+        whiten_air(buf, len, &ones, &run);
+        pn9_whiten(buf, len);
+        whiten_air(buf, len, &wones, &wrun);
+        printf("  %-8s %4.2f / %-13d %4.2f / %d\n", names[k], ones, run, wones, wrun);
+    }
+
+    free(buf);
+    return published && !mismatches ? 0 : 1;
+}
+
+//
+// AES
+//
+
+#define AES_SIM_SPI_BYTES   38      // data in and out with their headers, the command
+#define AES_SIM_WAIT_US     20      // the firmware's AES_WAIT_US
+
+static const uint8_t fips197_out[AES_BLOCK] = {
+    0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A
+};
+
+// RFC 3610 packet vector 1: 8 bytes of header, 23 of payload, an 8 byte tag
+static const uint8_t rfc3610_out[31] = {
+    0x58, 0x8C, 0x97, 0x9A, 0x61, 0xC6, 0x63, 0xD2, 0xF0, 0x66, 0xD0, 0xC2, 0xC0, 0xF9, 0x89, 0x80,
+    0x6D, 0x5F, 0x6B, 0x61, 0xDA, 0xC3, 0x84, 0x17, 0xE8, 0xD1, 0x2C, 0xFD, 0xF9, 0x26, 0xE0
+};
+
+static int aes_known_answers(void)
+{
+    uint8_t key[AES_BLOCK], block[AES_BLOCK];
+    uint8_t nonce[AES_NONCE_LEN] = { 0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5 };
+    uint8_t aad[8], msg[23 + 8];
+    aes_key k;
+    int ok;
+
+    for (int i = 0; i < AES_BLOCK; i++)
+    {
+        key[i] = (uint8_t)i;
+        block[i] = (uint8_t)(0x11 * i);
+    }
+    aes_set_key(&k, key);
+    aes_encrypt_blocks(&k, block, block, 1);
+    ok = memcmp(block, fips197_out, AES_BLOCK) == 0;
+
+    for (int i = 0; i < AES_BLOCK; i++)
+        key[i] = (uint8_t)(0xC0 + i);
+    for (int i = 0; i < 8; i++)
+        aad[i] = (uint8_t)i;
+    for (int i = 0; i < 23; i++)
+        msg[i] = (uint8_t)(8 + i);
+    aes_set_key(&k, key);
+    aes_ccm_seal(&k, nonce, aad, 8, msg, 23, msg + 23, 8);
+    ok = ok && memcmp(msg, rfc3610_out, sizeof(rfc3610_out)) == 0;
+    ok = ok && aes_ccm_open(&k, nonce, aad, 8, msg, 23, msg + 23, 8) == 0 && msg[0] == 8 && msg[22] == 30;
+
+    return ok;
+}
+
+static int bench_aes(int argc, char *argv[])
+{
+    static const aes_backend backends[] = { AES_SCALAR, AES_NI, AES_ARMV8 };
+    int len = 256;
+    double mb = 16;
+    double spi_hz = 1000000;
+    int baud = 9600;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:n:s:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 'n': mb = atof(optarg); break;
+            case 's': spi_hz = atof(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+    if (len < 1 || len > BRIDGE_BUF_SIZE - AES_OVERHEAD || mb <= 0 || spi_hz <= 0 || baud <= 0)
+    {
+        fprintf(stderr, "error: frames of 1..%d bytes\n", BRIDGE_BUF_SIZE - AES_OVERHEAD);
+        return 1;
+    }
+
+    uint8_t key[AES_BLOCK];
+    aes_key k;
+    for (int i = 0; i < AES_BLOCK; i++)
+        key[i] = (uint8_t)rand();
+    aes_set_key(&k, key);
+
+    static uint8_t buf[BRIDGE_BUF_SIZE];
+    uint8_t nonce[AES_NONCE_LEN] = { 0 };
+    int frames = (int)(mb * 1e6 / len);
+    uint8_t *tags = malloc((size_t)frames * AES_TAG_LEN);
+    int blocks = (int)(mb * 1e6 / sizeof(buf)) + 1;
+
+    printf("AES-128, CCM on %d byte frames with a %d byte tag\n", len, AES_TAG_LEN);
+    printf("  %-10s %8s %12s %12s %12s\n", "kernel", "checks", "ECB MB/s", "seal MB/s", "open MB/s");
+    aes_backend best = AES_SCALAR;
+    for (int b = 0; b < (int)(sizeof(backends) / sizeof(backends[0])); b++)
+    {
+        if (aes_set_backend(backends[b]) != backends[b])
+            continue;
+        best = backends[b];
+
+        int ok = aes_known_answers();
+
+        double t0 = now_sec();
+        for (int i = 0; i < blocks; i++)
+            aes_encrypt_blocks(&k, buf, buf, sizeof(buf) / AES_BLOCK);
+        double t1 = now_sec();
+        for (int f = 0; f < frames; f++)
+        {
+            memcpy(nonce, &f, sizeof(f));
+            aes_ccm_seal(&k, nonce, 0, 0, buf, len, tags + AES_TAG_LEN * f, AES_TAG_LEN);
+        }
+        double t2 = now_sec();
+
+        // Backwards, each frame is the one sealed then
+        for (int f = frames - 1; f >= 0; f--)
+        {
+            memcpy(nonce, &f, sizeof(f));
+            ok = aes_ccm_open(&k, nonce, 0, 0, buf, len, tags + AES_TAG_LEN * f, AES_TAG_LEN) == 0 && ok;
+        }
+        double t3 = now_sec();
+
+        failed |= !ok;
+        printf("  %-10s %8s %12.0f %12.0f %12.0f\n", aes_backend_name(), ok ? "ok" : "WRONG",
+               (double)blocks * sizeof(buf) / (t1 - t0) / 1e6, (double)frames * len / (t2 - t1) / 1e6,
+               (double)frames * len / (t3 - t2) / 1e6);
+    }
+    free(tags);
+    aes_set_backend(best);
+
+    // Two nodes through the stage: every frame opens, a replay, a flipped
+    // bit and one of our own do not
+    static aes_ctx a, bctx;
+    static pipeline pa, pb;
+    aes_init(&a, 0, key, 0);
+    aes_init(&bctx, 1, key, 0);
+    pipeline_add(&pa, aes_stage(&a));
+    pipeline_add(&pb, aes_stage(&bctx));
+    int good = 0, rejected = 0;
+    static uint8_t orig[BRIDGE_BUF_SIZE], last[BRIDGE_BUF_SIZE], frame[BRIDGE_HEADROOM + BRIDGE_BUF_SIZE];
+    uint8_t *p;
+    int last_len = 0;
+
+    for (int f = 0; f < 2000; f++)
+    {
+        int n = 1 + rand() % len;
+        p = frame + BRIDGE_HEADROOM;
+        for (int i = 0; i < n; i++)
+            orig[i] = p[i] = (uint8_t)rand();
+
+        int m = pipeline_tx(&pa, &p, n, BRIDGE_BUF_SIZE);
+        memcpy(last, p, m);
+        last_len = m;
+        p[rand() % m] ^= (uint8_t)(1 << rand() % 8);
+        rejected += pipeline_rx(&pb, &p, m, BRIDGE_BUF_SIZE) < 0;
+
+        memcpy(p = frame, last, m);
+        if (pipeline_rx(&pb, &p, m, BRIDGE_BUF_SIZE) == n && memcmp(p, orig, n) == 0)
+            good++;
+    }
+    memcpy(p = frame, last, last_len);
+    rejected += pipeline_rx(&pb, &p, last_len, BRIDGE_BUF_SIZE) < 0;
+    memcpy(p = frame, last, last_len);
+    rejected += pipeline_rx(&pa, &p, last_len, BRIDGE_BUF_SIZE) < 0;
+    failed |= good != 2000 || rejected != 2002;
+
+    printf("  stage: %d of 2000 frames through, %d of 2002 forgeries and replays dropped\n", good, rejected);
+    pipeline_print_stats(&pb, stdout);
+
+    // The SPIRIT1's engine: every block its data in, the command and the
+    // data out over the SPI bus, CCM two blocks per 16 bytes and two more
+    double block_us = AES_SIM_SPI_BYTES * 8 / spi_hz * 1e6 + AES_SIM_WAIT_US;
+    int nblocks = 2 * ((len + AES_BLOCK - 1) / AES_BLOCK) + 2;
+    double offload = len / (nblocks * block_us * 1e-6);
+    printf("  SPIRIT1 engine at %.0f kHz SPI: %.0f us a block, CCM %.1f kB/s, %.1f times the air at %d baud\n",
+           spi_hz / 1e3, block_us, offload / 1e3, offload / (baud / 10.0), baud);
+    printf("The firmware's X measures the engine on the board\n");
+
+    return failed;
+}
+
+//
+// TX path copies
+//
+
+#define PATH_SIM_PREAMBLE   4
+
+// A packet from the TUN read to the tty write through the diversity
+// header and AES, the tty is /dev/null. The CRC and the FEC are the same
+// work either way and would bury the difference.
+typedef struct path_sim {
+    div_ctx div;
+    aes_ctx aes;
+    pipeline link;
+    pbuf_pool pool;
+    int fd;
+    long copied;            // bytes moved up or copied, past the read
+} path_sim;
+
+static int path_sim_init(path_sim *s, const uint8_t *key)
+{
+    memset(s, 0, sizeof(*s));
+    div_init(&s->div, 1);
+    aes_init(&s->aes, 0, key, 0);
+    s->aes.counter = 1;
+    pipeline_add(&s->link, aes_stage(&s->aes));
+    pbuf_pool_init(&s->pool);
+    return s->fd = open("/dev/null", O_WRONLY);
+}
+
+// As it was: every header moves the packet up, the frame is copied into
+// an air buffer. Returns the frame, in 'air'.
+static int path_copy(path_sim *s, const uint8_t *pkt, int len, uint8_t *air)
+{
+    static uint8_t buf[BRIDGE_BUF_SIZE];
+    uint8_t *p;
+
+    memcpy(buf, pkt, len);
+
+    memmove(buf + DIV_HDR_LEN, buf, len);
+    s->copied += len;
+    p = buf + DIV_HDR_LEN;
+    len = div_send(&s->div, &p, len);
+
+    memmove(buf + AES_HDR_LEN, buf, len);
+    s->copied += len;
+    p = buf + AES_HDR_LEN;
+    len = pipeline_tx(&s->link, &p, len, BRIDGE_BUF_SIZE - AES_HDR_LEN);
+
+    len = frame_build(air, BRIDGE_BUF_SIZE + 64, buf, len, PATH_SIM_PREAMBLE);
+    s->copied += len - PATH_SIM_PREAMBLE - FRAME_HDR_LEN;
+    if (write(s->fd, air, len) != len)
+        return -1;
+    return len;
+}
+
+// In place: the headers go into the headroom, the preamble comes from a
+// constant. Returns the frame, in its pbuf.
+static pbuf *path_zero_copy(path_sim *s, const uint8_t *pkt, int len)
+{
+    static const uint8_t preamble[PATH_SIM_PREAMBLE] = { 0x55, 0x55, 0x55, 0x55 };
+    pbuf *b = pbuf_alloc(&s->pool);
+
+    memcpy(b->data, pkt, len);
+    b->len = div_send(&s->div, &b->data, len);
+    b->len = pipeline_tx(&s->link, &b->data, b->len, pbuf_cap(b));
+    frame_header(b->data - FRAME_HDR_LEN, b->len);
+    pbuf_push(b, FRAME_HDR_LEN);
+
+    struct iovec iov[2] = { { (void *)preamble, sizeof(preamble) }, { b->data, (size_t)b->len } };
+    if (writev(s->fd, iov, 2) != (ssize_t)sizeof(preamble) + b->len)
+        b->len = -1;
+    return b;
+}
+
+static int bench_path(int argc, char *argv[])
+{
+    static uint8_t pkt[BRIDGE_BUF_SIZE], air[BRIDGE_BUF_SIZE + 64];
+    static path_sim a, b;
+    uint8_t key[AES_BLOCK] = { 0 };
+    int len = 1400;
+    int count = 200000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+    if (len < 1 || len > BRIDGE_BUF_SIZE / 2 || count < 1)
+    {
+        fprintf(stderr, "error: packets of 1..%d bytes\n", BRIDGE_BUF_SIZE / 2);
+        return 1;
+    }
+    if (path_sim_init(&a, key) < 0 || path_sim_init(&b, key) < 0)
+    {
+        fprintf(stderr, "error: open(/dev/null): %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Both give the same bytes on the line
+    int same = 1;
+    for (int i = 0; i < 1000 && same; i++)
+    {
+        int n = 1 + i % len;
+        rng_fill(pkt, n);
+        int m = path_copy(&a, pkt, n, air);
+        pbuf *f = path_zero_copy(&b, pkt, n);
+        same = m == PATH_SIM_PREAMBLE + f->len && memcmp(air + PATH_SIM_PREAMBLE, f->data, f->len) == 0;
+        pbuf_unref(&b.pool, f);
+    }
+
+    printf("TX path, %d byte packets, diversity header and AES to /dev/null\n", len);
+    printf("  same frames on the line: %s\n", same ? "yes" : "NO");
+    printf("  %-10s %12s %12s %14s\n", "path", "ns/packet", "MB/s", "copied/packet");
+
+    rng_fill(pkt, len);
+    for (int zero = 0; zero < 2; zero++)
+    {
+        path_sim *s = zero ? &b : &a;
+        long copied = s->copied;
+        double t0 = now_sec();
+
+        for (int i = 0; i < count; i++)
+        {
+            if (zero)
+                pbuf_unref(&s->pool, path_zero_copy(s, pkt, len));
+            else
+                path_copy(s, pkt, len, air);
+        }
+        double t = now_sec() - t0;
+
+        printf("  %-10s %12.0f %12.0f %14ld\n", zero ? "zero-copy" : "copy", t / count * 1e9,
+               (double)count * len / t / 1e6, (s->copied - copied) / count);
+    }
+    printf("  pool: high_water=%d of %d, exhausted=%llu\n", b.pool.high_water, PBUF_POOL_SIZE,
+           (unsigned long long)b.pool.exhausted);
+
+    close(a.fd);
+    close(b.fd);
+    return !same;
+}
+
+#define FQ_SIM_FIFO     500     // the TUN's txqueuelen
+#define FQ_SIM_RWND     65535   // the receiver's window caps the bulk sender
+#define FQ_SIM_PING     84      // ICMP echo, 56 data bytes
+#define FQ_SIM_PING_SHARE 10    // a ping a second, or rarer to stay under 1/10 of the line
+#define FQ_SIM_CONTROL  100     // an SNMP get or a trap, one at a time like a poller
+
+typedef enum { FQ_SIM_BULK, FQ_SIM_PINGS, FQ_SIM_CONTROLS } fq_sim_kind;
+
+typedef struct fq_sim_pkt {
+    double sent;
+    int len;
+    int kind;
+    uint32_t seq;
+} fq_sim_pkt;
+
+typedef struct fq_sim {
+    fq_ctx *fq;                 // 0: one FIFO, the way the tty and the TUN queue it
+    cls_ctx *cls;               // 0: everything in class 0
+    cls_shaper *shaper;         // 0: whenever the line is free
+    fq_sim_pkt fifo[FQ_SIM_FIFO];
+    int fifo_head, fifo_count;
+    int baud, len;
+    double ping_every;
+    double control_every;       // 0: no control traffic
+    double air;                 // seconds the line was busy
+
+    // Bulk sender, Reno in a few lines: a window that grows a packet a
+    // round trip and halves on a gap, once per window, and goes back to
+    // one packet on a timeout, which backs off. Nothing is resent.
+    double cwnd;
+    uint32_t snd_nxt;
+    uint32_t snd_una;           // the window starts here
+    uint32_t expect;            // next in order at the receiver
+    uint32_t recover;
+    double srtt;
+    double rto;
+    double last_delivery;
+    long delivered;
+    double bulk_latency;
+
+    // Pings and control, by kind
+    long count[3], lost[3];
+    uint32_t seq[3];
+    double sum[3], worst[3];
+} fq_sim;
+
+// An IPv4 packet of 'len' bytes, TCP port 5001, ICMP or UDP port 161,
+// its number and send time where the payload starts
+static void fq_sim_build(uint8_t *p, const fq_sim_pkt *k)
+{
+    static const uint8_t protos[3] = { 6, 1, 17 };
+
+    memset(p, 0, k->len);
+    p[0] = 0x45;
+    put16(p + 2, (uint16_t)k->len);
+    p[8] = 64;
+    p[9] = protos[k->kind];
+    put32(p + 12, 0x0A000502);
+    put32(p + 16, 0x0A000501);
+    put16(p + 20, 40000);
+    put16(p + 22, k->kind == FQ_SIM_CONTROLS ? 161 : 5001);
+    put32(p + 24, k->seq);
+    memcpy(p + 28, &k->sent, sizeof(k->sent));
+}
+
+static void fq_sim_parse(const uint8_t *p, int len, fq_sim_pkt *k)
+{
+    k->len = len;
+    k->kind = p[9] == 1 ? FQ_SIM_PINGS : p[9] == 17 ? FQ_SIM_CONTROLS : FQ_SIM_BULK;
+    k->seq = ((uint32_t)p[24] << 24) | ((uint32_t)p[25] << 16) | ((uint32_t)p[26] << 8) | p[27];
+    memcpy(&k->sent, p + 28, sizeof(k->sent));
+}
+
+static void fq_sim_enqueue(fq_sim *s, const fq_sim_pkt *k, double now)
+{
+    static uint8_t pkt[FQ_PKT_MAX];
+
+    if (s->fq)
+    {
+        fq_sim_build(pkt, k);
+        fq_enqueue(s->fq, s->cls ? (int)cls_classify(s->cls, pkt, k->len) : 0, pkt, k->len, (uint64_t)(now * 1e9));
+    }
+    else if (s->fifo_count < FQ_SIM_FIFO)
+        s->fifo[(s->fifo_head + s->fifo_count++) % FQ_SIM_FIFO] = *k;
+}
+
+static int fq_sim_dequeue(fq_sim *s, fq_sim_pkt *k, double now)
+{
+    static uint8_t pkt[FQ_PKT_MAX];
+
+    if (s->fq)
+    {
+        uint64_t ns = (uint64_t)(now * 1e9);
+        int last = s->shaper ? (int)cls_allowed(s->shaper, ns) : FQ_CLASSES - 1;
+        int c;
+        int len = fq_dequeue(s->fq, pkt, sizeof(pkt), last, &c, ns);
+
+        if (len > 0)
+        {
+            fq_sim_parse(pkt, len, k);
+            if (s->shaper)
+                cls_charge(s->shaper, (cls_class)c, len);
+        }
+        return len > 0;
+    }
+    if (!s->fifo_count)
+        return 0;
+    *k = s->fifo[s->fifo_head];
+    s->fifo_head = (s->fifo_head + 1) % FQ_SIM_FIFO;
+    s->fifo_count--;
+    return 1;
+}
+
+// As much as the window lets out
+static void fq_sim_bulk_send(fq_sim *s, double now)
+{
+    while (s->snd_nxt - s->snd_una < (uint32_t)s->cwnd)
+    {
+        fq_sim_pkt k = { now, s->len, FQ_SIM_BULK, s->snd_nxt++ };
+        fq_sim_enqueue(s, &k, now);
+    }
+}
+
+static void fq_sim_deliver(fq_sim *s, const fq_sim_pkt *k, double now)
+{
+    double rtt = now - k->sent;
+
+    if (k->kind != FQ_SIM_BULK)
+    {
+        s->lost[k->kind] += k->seq - s->seq[k->kind];
+        s->seq[k->kind] = k->seq + 1;
+        s->count[k->kind]++;
+        s->sum[k->kind] += rtt;
+        if (rtt > s->worst[k->kind])
+            s->worst[k->kind] = rtt;
+        return;
+    }
+
+    s->delivered++;
+    s->bulk_latency += rtt;
+    s->srtt = s->srtt ? 0.875 * s->srtt + 0.125 * rtt : rtt;
+    s->rto = 2 * s->srtt > 1.0 ? 2 * s->srtt : 1.0;
+    s->last_delivery = now;
+    if (k->seq < s->expect)
+        return;
+
+    if (k->seq > s->expect && s->expect >= s->recover)
+    {
+        s->cwnd = s->cwnd / 2 > 2 ? s->cwnd / 2 : 2;
+        s->recover = s->snd_nxt;
+    }
+    s->expect = k->seq + 1;
+    if (s->expect - s->snd_una < 0x80000000u)
+        s->snd_una = s->expect;
+    s->cwnd += 1.0 / s->cwnd;
+    if (s->cwnd > FQ_SIM_RWND / s->len)
+        s->cwnd = FQ_SIM_RWND / s->len;
+
+    fq_sim_bulk_send(s, now);
+}
+
+static void fq_sim_run(fq_sim *s, double seconds)
+{
+    double now = 0, line_free = 0, next_ping = s->ping_every;
+    double next_control = s->control_every ? s->control_every / 2 : seconds;
+    double shaped = seconds;    // the shaper holds the queues until then
+    fq_sim_pkt on_air = { 0, 0, 0, 0 };
+    int busy = 0;
+    uint32_t ping_seq = 0, control_seq = 0;
+
+    s->cwnd = 2;
+    s->rto = 1.0;
+    fq_sim_bulk_send(s, 0);
+
+    while (now < seconds)
+    {
+        double rto = s->last_delivery + s->rto;
+
+        now = busy && line_free < next_ping ? line_free : next_ping;
+        if (rto < now)
+            now = rto;
+        if (next_control < now)
+            now = next_control;
+        if (!busy && shaped < now)
+            now = shaped;
+
+        // Everything in flight taken for lost
+        if (now == rto)
+        {
+            s->snd_una = s->recover = s->snd_nxt;
+            s->cwnd = 1;
+            s->rto *= 2;
+            s->last_delivery = now;
+            fq_sim_bulk_send(s, now);
+        }
+        if (busy && now >= line_free)
+        {
+            busy = 0;
+            fq_sim_deliver(s, &on_air, now);
+        }
+        if (now >= next_ping)
+        {
+            fq_sim_pkt k = { now, FQ_SIM_PING, FQ_SIM_PINGS, ping_seq++ };
+            fq_sim_enqueue(s, &k, now);
+            next_ping += s->ping_every;
+        }
+        if (now >= next_control)
+        {
+            fq_sim_pkt k = { now, FQ_SIM_CONTROL, FQ_SIM_CONTROLS, control_seq++ };
+            fq_sim_enqueue(s, &k, now);
+            next_control += s->control_every;
+        }
+        shaped = seconds;
+        if (!busy && fq_sim_dequeue(s, &on_air, now))
+        {
+            busy = 1;
+            line_free = now + air_time(on_air.len, s->baud, 0);
+            s->air += line_free - now;
+        }
+        else if (!busy && s->shaper && fq_pending(s->fq) > 0)
+            shaped = now + cls_time_left(s->shaper, (uint64_t)(now * 1e9)) / 1e9 + 1e-6;
+    }
+}
+
+static int bench_fq(int argc, char *argv[])
+{
+    static fq_ctx fq;
+    static fq_sim sims[2];
+    int bauds[] = { 1200, 9600 };
+    int nbauds = 2;
+    int len = 512;
+    double seconds = 600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'b': bauds[0] = atoi(optarg); nbauds = 1; break;
+            default: return 1;
+        }
+    }
+    if (len < 40 || len > FQ_PKT_MAX)
+    {
+        fprintf(stderr, "error: packets are 40 to %d bytes\n", FQ_PKT_MAX);
+        return 1;
+    }
+
+    printf("Bulk transfer of %d B packets and a ping, %.0f s\n", len, seconds);
+    printf("  %6s %6s  %-10s %10s %10s %8s %10s %9s %8s\n",
+           "baud", "ping", "queue", "ping avg", "ping max", "lost", "bulk lat", "goodput", "drops");
+
+    for (int b = 0; b < nbauds; b++)
+    {
+        for (int m = 0; m < 2; m++)
+        {
+            fq_sim *s = &sims[m];
+
+            memset(s, 0, sizeof(*s));
+            s->baud = bauds[b];
+            s->len = len;
+            s->ping_every = FQ_SIM_PING_SHARE * air_time(FQ_SIM_PING, bauds[b], 0);
+            if (s->ping_every < 1.0)
+                s->ping_every = 1.0;
+            if (m)
+            {
+                fq_init(&fq, bauds[b]);
+                s->fq = &fq;
+            }
+
+            fq_sim_run(s, seconds);
+
+            long drops = s->fq ? (long)(fq.stats.codel_drops + fq.stats.overlimit_drops) : 0;
+            printf("  %6d %5.0fs  %-10s %8.0fms %8.0fms %8ld %8.0fms %8.0f%% %8ld\n",
+                   bauds[b], s->ping_every, m ? "fq-codel" : "fifo",
+                   s->count[FQ_SIM_PINGS] ? s->sum[FQ_SIM_PINGS] / s->count[FQ_SIM_PINGS] * 1000.0 : 0,
+                   s->worst[FQ_SIM_PINGS] * 1000.0, s->lost[FQ_SIM_PINGS],
+                   s->delivered ? s->bulk_latency / s->delivered * 1000.0 : 0,
+                   100.0 * s->delivered * air_time(len, bauds[b], 0) / seconds, drops);
+            if (m)
+                fq_print_stats(&fq, stdout);
+        }
+    }
+
+    return 0;
+}
+
+#define CLS_SIM_RUNS    4
+
+static int bench_cls(int argc, char *argv[])
+{
+    static const char *names[CLS_SIM_RUNS] = { "FIFO", "one class", "classes", "50% air" };
+    static const int shares[CLS_SIM_RUNS] = { -1, 0, 100, 50 };
+    static fq_ctx fq;
+    static cls_ctx cls;
+    static cls_shaper shaper;
+    static fq_sim sim;
+    int bauds[] = { 1200, 9600 };
+    int nbauds = 2;
+    int len = 512;
+    double seconds = 600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': len = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'b': bauds[0] = atoi(optarg); nbauds = 1; break;
+            default: return 1;
+        }
+    }
+    if (len < 40 || len > FQ_PKT_MAX)
+    {
+        fprintf(stderr, "error: packets are 40 to %d bytes\n", FQ_PKT_MAX);
+        return 1;
+    }
+
+    // The bulk transfer's port put in the bulk class by a rule, SNMP is
+    // control and ICMP interactive by default
+    cls_init(&cls);
+    cls_add_rules(&cls, "port:5001=bulk");
+
+    printf("Bulk transfer of %d B packets, a ping, a control packet of %d B as often, %.0f s\n", len,
+           FQ_SIM_CONTROL, seconds);
+    printf("  %6s  %-10s %10s %10s %10s %10s %8s %9s %8s\n",
+           "baud", "queues", "ctl avg", "ctl max", "ping avg", "ping max", "lost", "goodput", "air");
+
+    for (int b = 0; b < nbauds; b++)
+    {
+        for (int r = 0; r < CLS_SIM_RUNS; r++)
+        {
+            fq_sim *s = &sim;
+            cls_link link = { bauds[b], 4 + FRAME_HDR_LEN, 0, 0, 0, 0 };
+
+            memset(s, 0, sizeof(*s));
+            s->baud = bauds[b];
+            s->len = len;
+            s->ping_every = FQ_SIM_PING_SHARE * air_time(FQ_SIM_PING, bauds[b], 0);
+            if (s->ping_every < 1.0)
+                s->ping_every = 1.0;
+            s->control_every = FQ_SIM_PING_SHARE * air_time(FQ_SIM_CONTROL, bauds[b], 0);
+            if (s->control_every < 1.0)
+                s->control_every = 1.0;
+
+            fq_init(&fq, bauds[b]);
+            s->fq = shares[r] >= 0 ? &fq : 0;
+            if (shares[r] > 0)
+            {
+                fq_set_class(&fq, CLS_CONTROL, 1, 1);
+                fq_set_class(&fq, CLS_INTERACTIVE, 1, 1);
+                fq_set_class(&fq, CLS_DEFAULT, 0, CLS_WEIGHT_DEFAULT);
+                fq_set_class(&fq, CLS_BULK, 0, CLS_WEIGHT_BULK);
+                cls_shaper_init(&shaper, shares[r], &link, 0);
+                s->cls = &cls;
+                s->shaper = &shaper;
+            }
+
+            fq_sim_run(s, seconds);
+
+            printf("  %6d  %-10s %8.0fms %8.0fms %8.0fms %8.0fms %8ld %8.0f%% %7.0f%%\n", bauds[b], names[r],
+                   s->count[FQ_SIM_CONTROLS] ? s->sum[FQ_SIM_CONTROLS] / s->count[FQ_SIM_CONTROLS] * 1000.0 : 0,
+                   s->worst[FQ_SIM_CONTROLS] * 1000.0,
+                   s->count[FQ_SIM_PINGS] ? s->sum[FQ_SIM_PINGS] / s->count[FQ_SIM_PINGS] * 1000.0 : 0,
+                   s->worst[FQ_SIM_PINGS] * 1000.0, s->lost[FQ_SIM_PINGS] + s->lost[FQ_SIM_CONTROLS],
+                   100.0 * s->delivered * air_time(len, bauds[b], 0) / seconds, 100.0 * s->air / seconds);
+        }
+    }
+
+    return 0;
+}
+
+//
+// Packet filter
+//
+
+#define PF_SIM_PAD      200     // rules in front, for the lookups
+#define PF_SIM_SOURCES  9
+
+static const char *pf_sim_rules =
+    "drop  udp dport 5353                    # mDNS\n"
+    "drop  udp dport 1900                    # SSDP\n"
+    "limit 2/60 udp dport 123 dst broadcast  # NTP broadcasts\n"
+    "drop  icmp6 type 133                    # IPv6 router solicitations\n"
+    "drop  any dst multicast\n";
+
+// What a small LAN says on its own, and some traffic of its users
+typedef struct pf_sim_source {
+    const char *name;
+    int v6;
+    int proto;
+    int dst;                // pf_dst
+    int port;               // destination port or ICMP type
+    int len;
+    double every;           // seconds
+} pf_sim_source;
+
+static const pf_sim_source pf_sim_sources[PF_SIM_SOURCES] = {
+    { "mDNS",          0, 17, PF_MULTICAST, 5353, 120,  2 },
+    { "mDNS v6",       1, 17, PF_MULTICAST, 5353, 140,  2 },
+    { "SSDP",          0, 17, PF_MULTICAST, 1900, 300,  1 },
+    { "NTP bcast",     0, 17, PF_BROADCAST,  123,  76, 16 },
+    { "IPv6 RS",       1, 58, PF_MULTICAST,  133,  56, 30 },
+    { "IGMP report",   0,  2, PF_MULTICAST,   -1,  32, 60 },
+    { "SSH",           0,  6, PF_UNICAST,     22, 100,  1 },
+    { "DNS",           0, 17, PF_UNICAST,     53,  60, 10 },
+    { "ping",          0,  1, PF_UNICAST,      8,  84,  5 },
+};
+
+static int pf_sim_packet(uint8_t *p, const pf_sim_source *src)
+{
+    int l4 = src->v6 ? 40 : 20;
+
+    memset(p, 0, src->len);
+    if (src->v6)
+    {
+        p[0] = 0x60;
+        put16(p + 4, (uint16_t)(src->len - 40));
+        p[6] = (uint8_t)src->proto;
+        p[7] = 255;
+        p[8] = 0xFE;
+        p[9] = 0x80;
+        p[24] = src->dst == PF_MULTICAST ? 0xFF : 0xFE;
+        p[25] = 0x02;
+        p[39] = 0xFB;
+    }
+    else
+    {
+        p[0] = 0x45;
+        put16(p + 2, (uint16_t)src->len);
+        p[8] = 64;
+        p[9] = (uint8_t)src->proto;
+        put32(p + 12, 0x0A000502);
+        put32(p + 16, src->dst == PF_MULTICAST ? 0xE00000FB : src->dst == PF_BROADCAST ? 0x0A0005FF : 0x0A000501);
+    }
+    if (src->proto == 6 || src->proto == 17)
+    {
+        put16(p + l4, 40000);
+        put16(p + l4 + 2, (uint16_t)src->port);
+    }
+    else if (src->port >= 0)
+        p[l4] = (uint8_t)src->port;
+    return src->len;
+}
+
+// The rules into a file for pf_load(), 'pad' of them in front that
+// match nothing here
+static int pf_sim_load(pf_ctx *pf, const char *rules, int pad)
+{
+    char path[] = "/tmp/bridge_bench_pf_XXXXXX";
+    int fd = mkstemp(path), line;
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : 0;
+
+    if (!f)
+        return -1;
+    for (int i = 0; i < pad; i++)
+        fprintf(f, "pass tcp dport %d\n", 10000 + i);
+    fputs(rules, f);
+    fclose(f);
+
+    int ret = pf_load(pf, path, &line);
+    unlink(path);
+    return ret;
+}
+
+static int bench_pf(int argc, char *argv[])
+{
+    static pf_ctx pf;
+    static uint8_t pkts[PF_SIM_SOURCES][256];
+    static char rules[8192];
+    int lens[PF_SIM_SOURCES];
+    int count = 1000000;
+    double seconds = 600;
+    int baud = 9600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default: return 1;
+        }
+    }
+    snprintf(rules, sizeof(rules), "%s", pf_sim_rules);
+    if (optind < argc)
+    {
+        FILE *f = fopen(argv[optind], "r");
+        size_t n = f ? fread(rules, 1, sizeof(rules) - 1, f) : 0;
+
+        if (!f)
+        {
+            fprintf(stderr, "error: cannot read %s\n", argv[optind]);
+            return 1;
+        }
+        fclose(f);
+        rules[n] = 0;
+    }
+    if (count < 1 || seconds <= 0 || baud <= 0)
+        return 1;
+
+    for (int i = 0; i < PF_SIM_SOURCES; i++)
+        lens[i] = pf_sim_packet(pkts[i], &pf_sim_sources[i]);
+
+    // The tables give the rule the first match does, and a lookup costs
+    // the same however many rules are in front
+    static const uint8_t protos[6] = { 1, 2, 6, 17, 58, 47 };
+    int same = 1, nrules[2];
+    double ns[2][2];
+    volatile int sink = 0;
+
+    for (int pad = 0; pad < 2; pad++)
+    {
+        if (pf_sim_load(&pf, rules, pad ? PF_SIM_PAD : 0) < 0)
+        {
+            fprintf(stderr, "error: bad filter rules\n");
+            return 1;
+        }
+        nrules[pad] = pf.nrules;
+
+        for (int i = 0; i < 100000; i++)
+        {
+            uint8_t p[256];
+            int len = 20 + rng_next() % 200;
+
+            rng_fill(p, len);
+            p[0] = rng_next() & 1 ? 0x45 : 0x60;
+            p[6] = p[9] = protos[rng_next() % 6];
+            same = same && pf_lookup(&pf, p, len) == pf_lookup_linear(&pf, p, len);
+        }
+        for (int i = 0; i < PF_SIM_SOURCES; i++)
+            same = same && pf_lookup(&pf, pkts[i], lens[i]) == pf_lookup_linear(&pf, pkts[i], lens[i]);
+
+        for (int linear = 0; linear < 2; linear++)
+        {
+            double t0 = now_sec();
+
+            for (int i = 0; i < count; i++)
+            {
+                int k = i % PF_SIM_SOURCES;
+                sink += linear ? pf_lookup_linear(&pf, pkts[k], lens[k]) : pf_lookup(&pf, pkts[k], lens[k]);
+            }
+            ns[pad][linear] = (now_sec() - t0) / count * 1e9;
+        }
+    }
+
+    printf("Packet filter, %d rules\n", nrules[0]);
+    printf("  tables and the rules one by one agree: %s\n", same ? "yes" : "NO");
+    printf("  %-10s %4d rules %4d rules  ns/packet\n", "lookup", nrules[0], nrules[1]);
+    printf("  %-10s %10.1f %10.1f\n", "tables", ns[0][0], ns[1][0]);
+    printf("  %-10s %10.1f %10.1f\n", "linear", ns[0][1], ns[1][1]);
+
+    // The LAN through the filter
+    long offered[PF_SIM_SOURCES] = { 0 }, passed[PF_SIM_SOURCES] = { 0 };
+    double air_in = 0, air_out = 0;
+
+    pf_sim_load(&pf, rules, 0);
+    for (int i = 0; i < PF_SIM_SOURCES; i++)
+    {
+        const pf_sim_source *src = &pf_sim_sources[i];
+
+        for (double t = src->every * rng_uniform(); t < seconds; t += src->every)
+        {
+            int pass = pf_filter(&pf, pkts[i], lens[i], (uint64_t)(t * 1e9));
+
+            offered[i]++;
+            passed[i] += pass;
+            air_in += air_time(lens[i], baud, 0);
+            air_out += pass ? air_time(lens[i], baud, 0) : 0;
+        }
+    }
+
+    printf("A LAN for %.0f s at %d baud\n", seconds, baud);
+    printf("  %-12s %8s %8s %8s\n", "source", "packets", "passed", "air");
+    for (int i = 0; i < PF_SIM_SOURCES; i++)
+        printf("  %-12s %8ld %8ld %7.1f%%\n", pf_sim_sources[i].name, offered[i], passed[i],
+               100.0 * offered[i] * air_time(lens[i], baud, 0) / seconds);
+    printf("  line busy %.1f%% without the filter, %.1f%% with it\n", 100.0 * air_in / seconds,
+           100.0 * air_out / seconds);
+    pf_print_stats(&pf, stdout);
+
+    return !same;
+}
+
+int main(int argc, char *argv[])
+{
+    gf_init();
+
+    if (argc >= 2 && strcmp(argv[1], "fec") == 0)
+        return bench_fec();
+    if (argc >= 2 && strcmp(argv[1], "ber") == 0)
+        return bench_ber(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "hc") == 0)
+        return bench_hc(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "lz") == 0)
+        return bench_lz(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "lztrain") == 0)
+        return bench_lztrain(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "agg") == 0)
+        return bench_agg(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "arq") == 0)
+        return bench_arq(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "rate") == 0)
+        return bench_rate(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "scan") == 0)
+        return bench_scan(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "mac") == 0)
+        return bench_mac(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "tdma") == 0)
+        return bench_tdma(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "fhss") == 0)
+        return bench_fhss(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "mesh") == 0)
+        return bench_mesh(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "bond") == 0)
+        return bench_bond(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "div") == 0)
+        return bench_div(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "pn9") == 0)
+        return bench_pn9(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "cdr") == 0)
+        return bench_cdr(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "whiten") == 0)
+        return bench_whiten(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "aes") == 0)
+        return bench_aes(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "path") == 0)
+        return bench_path(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "fq") == 0)
+        return bench_fq(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "cls") == 0)
+        return bench_cls(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "pf") == 0)
+        return bench_pf(argc - 1, argv + 1);
+
+    fprintf(stderr, "usage: %s fec | ber [-l len] [-n count] [-B burst] [-b baud] | hc [-L loss%%] [-b baud]\n"
+                    "       | lz [-D dict] [trace.pcap] | lztrain trace.pcap out.dict\n"
+                    "       | agg [-l len] [-a size] [-A ms] [-T turnaround_ms] [-b baud]\n"
+                    "       | arq [-L loss%%] [-B burst] [-w window] [-l len] [-n count] [-T ms] [-F] [-x] [-b baud]\n"
+                    "       | rate [-m minutes] | scan [-t trials]\n"
+                    "       | mac [-n nodes] [-l len] [-T ms] [-m max_bo] [-b baud]\n"
+                    "       | tdma [-n nodes] [-l len] [-s slots] [-S slot_ms] [-g guard_ms] [-j ms] [-d ppm] [-b baud]\n"
+                    "       | fhss [-t trials] [-m minutes] [-D dwell_ms] [-l len] [-j ms] [-d ppm] [-b baud]\n"
+                    "       | mesh [-l len] [-s seconds] [-b baud] | bond [-l len] [-s seconds] [-L loss%%]\n"
+                    "       | div [-l len] [-n count] [-f nsym] [-D hz] [-b baud]\n"
+                    "       | pn9 [-B ber] [-b burst] [-n Mbits] [-s slip_bits] [capture.bin]\n"
+                    "       | cdr [-n frames] [-l len] [-p ppm] [-f flip] | cdr [-o oversample] [-m mask] [-s hex]\n"
+                    "         [-w bits.bin] samples.bin | whiten [-l len] [-n MB]\n"
+                    "       | aes [-l len] [-n MB] [-s spi_hz] [-b baud] | path [-l len] [-n count]\n"
+                    "       | fq [-l len] [-s seconds] [-b baud] | cls [-l len] [-s seconds] [-b baud]\n"
+                    "       | pf [-n count] [-s seconds] [-b baud] [rules]\n",
+            argv[0]);
+    return 1;
+}
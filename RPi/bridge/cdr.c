@@ -0,0 +1,182 @@
+/*
+    Clock recovery and sync word correlator
+*/
+
+#include <string.h>
+
+#include "cdr.h"
+
+typedef uint64_t cdr_v2 __attribute__((vector_size(16)));
+
+int cdr_init(cdr_ctx *c, int oversample)
+{
+    if (oversample < 2 || oversample > CDR_MAX_OVERSAMPLE)
+        return -1;
+
+    memset(c, 0, sizeof(*c));
+    c->oversample = oversample;
+    return 0;
+}
+
+int cdr_push(cdr_ctx *c, const uint8_t *samples, int n, uint8_t mask, uint64_t *out)
+{
+    const int32_t bit = c->oversample * CDR_PHASE_ONE;
+    int nout = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        int s = (samples[i] & mask) != 0;
+
+        c->recent = (c->recent << 1) | (uint32_t)s;
+        c->phase += CDR_PHASE_ONE;
+
+        if (s != c->last)
+        {
+            // Halfway between this sample and the one before, against the
+            // nearer boundary
+            int32_t e = c->phase - CDR_PHASE_ONE / 2;
+
+            if (e >= bit / 2)
+                e -= bit;
+            c->phase -= e / (1 << CDR_GAIN_SHIFT);
+            c->timing_error += e < 0 ? -e : e;
+            c->transitions++;
+            c->last = s;
+        }
+
+        // One sample past the middle: the three around it are in
+        if (!c->decided && c->phase >= bit / 2 + CDR_PHASE_ONE)
+        {
+            uint32_t r = c->recent & 7;
+
+            c->word = (c->word << 1) | (uint64_t)((r & (r - 1)) != 0);
+            c->decided = 1;
+            c->bits++;
+            if (++c->nbits == 64)
+            {
+                out[nout++] = c->word;
+                c->nbits = 0;
+            }
+        }
+
+        if (c->phase >= bit)
+        {
+            c->phase -= bit;
+            c->decided = 0;
+        }
+    }
+
+    c->samples += n;
+    return nout;
+}
+
+int cdr_sync_init(cdr_sync *s, uint32_t word, int len, int max_errors)
+{
+    if (len < 1 || len > CDR_SYNC_MAX_BITS || max_errors < 0 || max_errors > CDR_SYNC_MAX_ERRORS)
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->word = len < 32 ? word & ((1u << len) - 1) : word;
+    s->len = len;
+    s->max_errors = max_errors;
+    return 0;
+}
+
+static int cdr_sync_hits(cdr_sync *s, uint64_t m, int first, uint32_t *hits, int nhits, int cap)
+{
+    while (m)
+    {
+        int z = __builtin_clzll(m);
+
+        if (nhits < cap)
+            hits[nhits++] = (uint32_t)(first + z + 1);
+        s->hits++;
+        m &= ~(1ull << (63 - z));
+    }
+    return nhits;
+}
+
+int cdr_sync_push(cdr_sync *s, const uint64_t *w, int n, uint32_t *hits, int cap)
+{
+    const uint64_t t = (uint64_t)s->max_errors;
+    int nhits = 0;
+
+    for (int i = 0; i < n; i += 2)
+    {
+        int pair = i + 1 < n;
+        cdr_v2 cur = { w[i], pair ? w[i + 1] : 0 };
+        cdr_v2 prev = { s->prev, w[i] };
+        cdr_v2 c0 = { 0, 0 }, c1 = c0, c2 = c0, over = c0;
+
+        // Lane k of the stream shifted by 'sh' holds the bit 'sh' before
+        // bit k: the sync bit that many from the end is compared there
+        for (int j = 0; j < s->len; j++)
+        {
+            int sh = s->len - 1 - j;
+            cdr_v2 x = sh ? (cur >> sh) | (prev << (64 - sh)) : cur;
+            cdr_v2 d = (s->word >> sh) & 1 ? ~x : x;
+            cdr_v2 k0 = c0 & d;
+            cdr_v2 k1;
+
+            c0 ^= d;
+            k1 = c1 & k0;
+            c1 ^= k0;
+            over |= c2 & k1;
+            c2 ^= k1;
+        }
+
+        // Lanes whose count is not above max_errors, bit by bit from the top
+        cdr_v2 gt = { 0, 0 }, eq = ~gt;
+        cdr_v2 ck[3] = { c0, c1, c2 };
+        for (int b = 2; b >= 0; b--)
+        {
+            if ((t >> b) & 1)
+                eq &= ck[b];
+            else
+            {
+                gt |= eq & ck[b];
+                eq &= ~ck[b];
+            }
+        }
+        cdr_v2 match = ~(gt | over);
+
+        nhits = cdr_sync_hits(s, match[0], i * 64, hits, nhits, cap);
+        if (pair)
+            nhits = cdr_sync_hits(s, match[1], (i + 1) * 64, hits, nhits, cap);
+        s->prev = pair ? w[i + 1] : w[i];
+    }
+
+    return nhits;
+}
+
+int cdr_sync_push_serial(cdr_sync *s, const uint64_t *w, int n, uint32_t *hits, int cap)
+{
+    const uint64_t mask = s->len < 64 ? (1ull << s->len) - 1 : ~0ull;
+    uint64_t reg = s->prev;
+    int nhits = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        for (int k = 63; k >= 0; k--)
+        {
+            reg = (reg << 1) | ((w[i] >> k) & 1);
+            if (__builtin_popcountll((reg ^ s->word) & mask) > s->max_errors)
+                continue;
+            if (nhits < cap)
+                hits[nhits++] = (uint32_t)(i * 64 + 64 - k);
+            s->hits++;
+        }
+    }
+
+    s->prev = reg;
+    return nhits;
+}
+
+void cdr_print_stats(const cdr_ctx *c, const cdr_sync *s, FILE *out)
+{
+    fprintf(out, "cdr: oversample=%d samples=%llu bits=%llu transitions=%llu timing_error=%.2f syncs=%llu\n",
+            c->oversample, (unsigned long long)c->samples, (unsigned long long)c->bits,
+            (unsigned long long)c->transitions,
+            c->transitions ? (double)c->timing_error / c->transitions / CDR_PHASE_ONE : 0.0,
+            (unsigned long long)(s ? s->hits : 0));
+}
@@ -0,0 +1,89 @@
+/*
+    Clock recovery and sync word correlator
+
+    For the direct mode bitstream as the firmware's bit modem takes it off
+    rx_spirit: 'oversample' samples a bit, a byte each, the pin under
+    'mask'. The same code runs there on the samples of every DMA half
+    and here on recorded captures (bridge_bench cdr).
+
+    The recovery keeps a bit clock of its own, a phase counter
+    CDR_PHASE_ONE a sample. Every transition of the pin is taken to lie
+    halfway between the two samples either side of it and should fall on
+    a bit boundary; 1 / 2^CDR_GAIN_SHIFT of how far off it is comes off
+    the phase. The bit is the majority of the three samples around its
+    middle. The far end's clock may be a few per cent off ours and the
+    edges jitter, fixed mid-bit sampling has neither covered.
+
+    The correlator looks for a sync word of up to CDR_SYNC_MAX_BITS with
+    up to 7 bits wrong. It takes the recovered bits 64 at a time, the
+    first in the MSB, and tries all the positions of a word at once:
+    every bit of the sync word is compared with the stream shifted into
+    place, and the mismatches are added up in a counter sliced across the
+    bit lanes. Two words go through together in 128-bit vectors, which
+    the compiler turns into NEON on the RPi and into pairs of registers on
+    the STM32.
+*/
+
+#ifndef CDR_H
+#define CDR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CDR_MAX_OVERSAMPLE  16
+#define CDR_PHASE_ONE       256             // a sample
+#define CDR_GAIN_SHIFT      2
+#define CDR_SYNC_MAX_BITS   32
+#define CDR_SYNC_MAX_ERRORS 7
+
+typedef struct cdr_ctx {
+    int oversample;
+    int32_t phase;              // since the bit boundary
+    int decided;                // this bit
+    int last;                   // sample
+    uint32_t recent;            // samples, the newest in bit 0
+    uint64_t word;              // bits, the first in the MSB
+    int nbits;
+
+    uint64_t samples;
+    uint64_t bits;
+    uint64_t transitions;
+    uint64_t timing_error;      // sum of |error| at the transitions, phase units
+} cdr_ctx;
+
+typedef struct cdr_sync {
+    uint32_t word;              // the first bit in bit len - 1
+    int len;
+    int max_errors;
+    uint64_t prev;              // the last 64 bits of the stream
+    uint64_t hits;
+} cdr_sync;
+
+// -1 if 'oversample' is not 2..CDR_MAX_OVERSAMPLE
+int  cdr_init(cdr_ctx *c, int oversample);
+
+// Recovers the bits in 'n' samples, writes the words completed to 'out',
+// room for n / oversample / 64 + 1 of them, and returns how many
+int  cdr_push(cdr_ctx *c, const uint8_t *samples, int n, uint8_t mask, uint64_t *out);
+
+// -1 if 'len' is not 1..CDR_SYNC_MAX_BITS or 'max_errors' out of range
+int  cdr_sync_init(cdr_sync *s, uint32_t word, int len, int max_errors);
+
+// Bit offsets from the start of words[0] just past every sync word found
+// in 'n' words, at most 'cap' of them; returns how many
+int  cdr_sync_push(cdr_sync *s, const uint64_t *words, int n, uint32_t *hits, int cap);
+
+// The same a bit at a time with a popcount, for comparison
+int  cdr_sync_push_serial(cdr_sync *s, const uint64_t *words, int n, uint32_t *hits, int cap);
+
+void cdr_print_stats(const cdr_ctx *c, const cdr_sync *s, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
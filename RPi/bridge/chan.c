@@ -0,0 +1,136 @@
+/*
+    Lossy channel emulator
+*/
+
+#include <string.h>
+
+#include "frame.h"
+#include "chan.h"
+
+static double chan_uniform(chan *ch)
+{
+    ch->rng ^= ch->rng << 13;
+    ch->rng ^= ch->rng >> 7;
+    ch->rng ^= ch->rng << 17;
+    return (ch->rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void chan_init(chan *ch, int baud, int turnaround_ms, int full_duplex, uint64_t seed)
+{
+    memset(ch, 0, sizeof(*ch));
+
+    ch->baud = baud;
+    ch->turnaround_ns = (uint64_t)turnaround_ms * 1000000ULL;
+    ch->full_duplex = full_duplex;
+    ch->rng = seed ? seed : 0x2545F4914F6CDD1DULL;
+}
+
+void chan_set_loss(chan *ch, double loss, double burst)
+{
+    if (burst < 1)
+        burst = 1;
+    if (loss <= 0)
+    {
+        ch->p_gb = 0;
+        ch->p_bg = 1;
+        return;
+    }
+    if (loss >= 1)
+    {
+        ch->p_gb = 1;
+        ch->p_bg = 0;
+        return;
+    }
+
+    ch->p_bg = 1.0 / burst;
+    ch->p_gb = loss * ch->p_bg / (1.0 - loss);
+}
+
+uint64_t chan_airtime(const chan *ch, int len)
+{
+    return ch->turnaround_ns + (uint64_t)(CHAN_PREAMBLE + FRAME_HDR_LEN + len) * 10ULL * 1000000000ULL / ch->baud;
+}
+
+uint64_t chan_send(chan *ch, int from, const uint8_t *buf, int len, uint64_t now_ns)
+{
+    chan_dir *d = &ch->dir[from];
+    chan_dir *other = &ch->dir[!from];
+
+    if (d->count == CHAN_QUEUE || len > BRIDGE_BUF_SIZE)
+    {
+        d->overflows++;
+        return 0;
+    }
+
+    // Half duplex: wait until the other end is off the air too
+    uint64_t start = now_ns > d->busy_ns ? now_ns : d->busy_ns;
+    if (!ch->full_duplex && other->busy_ns > start)
+        start = other->busy_ns;
+
+    uint64_t air = chan_airtime(ch, len);
+    d->busy_ns = start + air;
+    d->air_ns += air;
+    d->frames++;
+
+    if (d->bad)
+        d->bad = chan_uniform(ch) >= ch->p_bg;
+    else
+        d->bad = chan_uniform(ch) < ch->p_gb;
+
+    chan_frame *f = &d->q[(d->head + d->count++) % CHAN_QUEUE];
+    memcpy(f->data, buf, len);
+    f->len = len;
+    f->lost = d->bad;
+    f->arrive_ns = d->busy_ns;
+
+    if (f->lost)
+        d->lost++;
+
+    return d->busy_ns;
+}
+
+uint64_t chan_next(const chan *ch, int to)
+{
+    const chan_dir *d = &ch->dir[!to];
+
+    return d->count ? d->q[d->head].arrive_ns : UINT64_MAX;
+}
+
+int chan_recv(chan *ch, int to, uint8_t *buf, int cap, uint64_t now_ns)
+{
+    chan_dir *d = &ch->dir[!to];
+
+    while (d->count && d->q[d->head].arrive_ns <= now_ns)
+    {
+        chan_frame *f = &d->q[d->head];
+
+        d->head = (d->head + 1) % CHAN_QUEUE;
+        d->count--;
+
+        if (f->lost || f->len > cap)
+            continue;
+
+        memcpy(buf, f->data, f->len);
+        return f->len;
+    }
+
+    return 0;
+}
+
+int chan_idle(const chan *ch, int from, uint64_t now_ns)
+{
+    return ch->dir[from].busy_ns <= now_ns;
+}
+
+void chan_print_stats(chan *ch, FILE *out)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        chan_dir *d = &ch->dir[i];
+
+        fprintf(out, "chan %d->%d: frames=%llu lost=%llu (%.1f%%) overflows=%llu air=%.1fs\n",
+                i, !i, (unsigned long long)d->frames, (unsigned long long)d->lost,
+                d->frames ? 100.0 * d->lost / d->frames : 0.0,
+                (unsigned long long)d->overflows, d->air_ns / 1e9);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+    Lossy channel emulator
+
+    Models the radio link between two bridges for the benchmarks: frames
+    written by one end arrive at the other after their airtime at the tty
+    rate (preamble and frame header included) plus the TX turnaround, in
+    the order they were written. On the half-duplex single radio both
+    directions share the air, on the FullDuplex pair (151.468/151.485 MHz)
+    each direction has its own.
+
+    Losses follow a Gilbert-Elliott model: a frame sent in the bad state is
+    lost, the mean loss rate and the mean burst length set the transition
+    probabilities (burst 1 gives independent losses).
+*/
+
+#ifndef CHAN_H
+#define CHAN_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define CHAN_QUEUE      64
+#define CHAN_PREAMBLE   4
+
+typedef struct chan_frame {
+    uint8_t data[BRIDGE_BUF_SIZE];
+    int len;
+    int lost;
+    uint64_t arrive_ns;
+} chan_frame;
+
+typedef struct chan_dir {
+    chan_frame q[CHAN_QUEUE];
+    int head;
+    int count;
+    uint64_t busy_ns;           // the transmitter is on air until then
+    int bad;                    // Gilbert-Elliott state
+
+    uint64_t frames;
+    uint64_t lost;
+    uint64_t overflows;
+    uint64_t air_ns;
+} chan_dir;
+
+typedef struct chan {
+    int baud;
+    uint64_t turnaround_ns;
+    int full_duplex;
+    double p_gb;                // good -> bad
+    double p_bg;                // bad -> good
+    uint64_t rng;
+    chan_dir dir[2];
+} chan;
+
+void chan_init(chan *ch, int baud, int turnaround_ms, int full_duplex, uint64_t seed);
+void chan_set_loss(chan *ch, double loss, double burst);
+
+// Airtime of a frame with 'len' body bytes
+uint64_t chan_airtime(const chan *ch, int len);
+
+// Queues a frame from end 'from' (0 or 1), returns when it leaves the air
+// or 0 if the transmit queue is full
+uint64_t chan_send(chan *ch, int from, const uint8_t *buf, int len, uint64_t now_ns);
+
+// Time the next frame for end 'to' arrives, UINT64_MAX if none is on its way
+uint64_t chan_next(const chan *ch, int to);
+
+// Next frame that has arrived at end 'to' by 'now', lost ones are skipped
+int  chan_recv(chan *ch, int to, uint8_t *buf, int cap, uint64_t now_ns);
+
+// The transmitter of end 'from' has nothing queued or on air
+int  chan_idle(const chan *ch, int from, uint64_t now_ns);
+
+void chan_print_stats(chan *ch, FILE *out);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+    Traffic classes and airtime shaping
+*/
+
+#include <string.h>
+
+#include "cls.h"
+
+const char *cls_names[CLS_COUNT] = { "control", "interactive", "default", "bulk" };
+
+void cls_init(cls_ctx *ctx)
+{
+    static const struct { char kind; int value; uint8_t cls; } defaults[] = {
+        { 'p', 179, CLS_CONTROL },          // BGP
+        { 'p', 161, CLS_CONTROL },          // SNMP
+        { 'p', 162, CLS_CONTROL },
+        { 'p', 514, CLS_CONTROL },          // syslog
+        { 'p', 520, CLS_CONTROL },          // RIP
+        { 'p', 521, CLS_CONTROL },
+        { 'x',  89, CLS_CONTROL },          // OSPF
+        { 'x', 112, CLS_CONTROL },          // VRRP
+        { 'd',  48, CLS_CONTROL },          // CS6
+        { 'd',  56, CLS_CONTROL },          // CS7
+        { 'p',  22, CLS_INTERACTIVE },      // SSH
+        { 'p',  23, CLS_INTERACTIVE },      // telnet
+        { 'p',  53, CLS_INTERACTIVE },      // DNS
+        { 'p', 123, CLS_INTERACTIVE },      // NTP
+        { 'x',   1, CLS_INTERACTIVE },      // ICMP
+        { 'x',  58, CLS_INTERACTIVE },      // ICMPv6
+        { 'd',  46, CLS_INTERACTIVE },      // EF
+        { 'd',  32, CLS_INTERACTIVE },      // CS4
+        { 'd',  34, CLS_INTERACTIVE },      // AF41
+        { 'd',  36, CLS_INTERACTIVE },
+        { 'd',  38, CLS_INTERACTIVE },
+        { 'd',  40, CLS_INTERACTIVE },      // CS5
+        { 'd',   8, CLS_BULK },             // CS1
+        { 'd',  10, CLS_BULK },             // AF11
+        { 'd',  12, CLS_BULK },
+        { 'd',  14, CLS_BULK },
+    };
+
+    memset(ctx, 0, sizeof(*ctx));
+    memset(ctx->port, CLS_NONE, sizeof(ctx->port));
+    memset(ctx->proto, CLS_NONE, sizeof(ctx->proto));
+    memset(ctx->dscp, CLS_NONE, sizeof(ctx->dscp));
+
+    for (unsigned i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+    {
+        if (defaults[i].kind == 'p')
+            ctx->port[defaults[i].value] = defaults[i].cls;
+        else if (defaults[i].kind == 'x')
+            ctx->proto[defaults[i].value] = defaults[i].cls;
+        else
+            ctx->dscp[defaults[i].value] = defaults[i].cls;
+    }
+}
+
+int cls_add_rules(cls_ctx *ctx, const char *rules)
+{
+    char list[512], *save = 0;
+
+    snprintf(list, sizeof(list), "%s", rules);
+    for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(0, ",", &save))
+    {
+        char kind[8], name[16];
+        int value, c;
+
+        if (sscanf(tok, "%7[a-z]:%d=%15s", kind, &value, name) != 3)
+            return -1;
+        for (c = 0; c < CLS_COUNT && strcmp(name, cls_names[c]); c++)
+            ;
+        if (c == CLS_COUNT)
+            return -1;
+
+        if (!strcmp(kind, "port") && value >= 0 && value < 65536)
+            ctx->port[value] = (uint8_t)c;
+        else if (!strcmp(kind, "proto") && value >= 0 && value < 256)
+            ctx->proto[value] = (uint8_t)c;
+        else if (!strcmp(kind, "dscp") && value >= 0 && value < 64)
+            ctx->dscp[value] = (uint8_t)c;
+        else
+            return -1;
+    }
+    return 0;
+}
+
+cls_class cls_classify(cls_ctx *ctx, const uint8_t *pkt, int len)
+{
+    int proto = -1, dscp = 0, l4 = -1;
+    uint8_t c = CLS_NONE;
+
+    if (len >= 20 && pkt[0] >> 4 == 4)
+    {
+        proto = pkt[9];
+        dscp = pkt[1] >> 2;
+        if (!(((pkt[6] & 0x1F) << 8) | pkt[7]))
+            l4 = (pkt[0] & 0x0F) * 4;
+    }
+    else if (len >= 40 && pkt[0] >> 4 == 6)
+    {
+        proto = pkt[6];
+        dscp = ((pkt[0] & 0x0F) << 2) | pkt[1] >> 6;
+        l4 = 40;
+    }
+
+    // A sender that marks its packets knows better than the port
+    if (proto >= 0)
+        c = ctx->dscp[dscp];
+    if (c == CLS_NONE && (proto == 6 || proto == 17) && l4 >= 0 && l4 + 4 <= len)
+    {
+        c = ctx->port[(pkt[l4 + 2] << 8) | pkt[l4 + 3]];
+        if (c == CLS_NONE)
+            c = ctx->port[(pkt[l4] << 8) | pkt[l4 + 1]];
+    }
+    if (c == CLS_NONE && proto >= 0)
+        c = ctx->proto[proto];
+    if (c == CLS_NONE)
+        c = CLS_DEFAULT;
+
+    ctx->packets[c]++;
+    return (cls_class)c;
+}
+
+void cls_shaper_init(cls_shaper *s, int share, const cls_link *link, uint64_t now_ns)
+{
+    memset(s, 0, sizeof(*s));
+
+    s->share = share > 0 && share <= 100 ? share : 100;
+    s->burst_ns = CLS_BURST_MS * 1000000LL;
+    s->tokens_ns = s->burst_ns;
+    s->last_ns = now_ns;
+    s->link = *link;
+}
+
+uint64_t cls_air_ns(const cls_link *l, int len)
+{
+    uint64_t body = len + l->packet_bytes;
+    uint64_t frame = l->frame_bytes;
+
+    // Parity for every codeword a frame has, or for the packet's share of
+    // an aggregate's
+    if (l->fec_data > 0 && l->agg_size > 0)
+        body += body * l->fec_parity / l->fec_data;
+    else if (l->fec_data > 0)
+        body += (body + l->fec_data - 1) / l->fec_data * l->fec_parity;
+
+    // The frame is shared by the packets of an aggregate
+    if (l->agg_size > 0 && body < (uint64_t)l->agg_size)
+        frame = frame * body / l->agg_size;
+
+    return (body + frame) * 10 * 1000000000ULL / (l->baud > 0 ? l->baud : 1);
+}
+
+static void cls_refill(cls_shaper *s, uint64_t now_ns)
+{
+    if (now_ns <= s->last_ns)
+        return;
+
+    s->tokens_ns += (int64_t)((now_ns - s->last_ns) * s->share / 100);
+    if (s->tokens_ns > s->burst_ns)
+        s->tokens_ns = s->burst_ns;
+    s->last_ns = now_ns;
+}
+
+cls_class cls_allowed(cls_shaper *s, uint64_t now_ns)
+{
+    cls_refill(s, now_ns);
+
+    if (s->tokens_ns >= 0)
+        return CLS_COUNT - 1;
+    s->waits++;
+    return CLS_CONTROL;
+}
+
+void cls_charge(cls_shaper *s, cls_class c, int len)
+{
+    uint64_t air = cls_air_ns(&s->link, len);
+
+    s->tokens_ns -= (int64_t)air;
+    s->air_ns[c] += air;
+}
+
+int64_t cls_time_left(cls_shaper *s, uint64_t now_ns)
+{
+    cls_refill(s, now_ns);
+
+    return s->tokens_ns >= 0 ? 0 : -s->tokens_ns * 100 / s->share;
+}
+
+void cls_print_stats(cls_ctx *ctx, cls_shaper *s, FILE *out)
+{
+    fprintf(out, "cls: share=%d%% tokens=%lldms waits=%llu\n", s->share, (long long)(s->tokens_ns / 1000000),
+            (unsigned long long)s->waits);
+    for (int c = 0; c < CLS_COUNT; c++)
+        fprintf(out, "cls: %s packets=%llu air=%.1fs\n", cls_names[c], (unsigned long long)ctx->packets[c],
+                s->air_ns[c] / 1e9);
+}
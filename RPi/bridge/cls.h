@@ -0,0 +1,117 @@
+/*
+    Traffic classes and airtime shaping
+
+    Under -Q every packet from the TUN is put in one of four classes
+    before it goes into the fair queues (fq.h):
+
+        control       strict priority: routing, SNMP, syslog, DSCP CS6/CS7
+        interactive   strict priority after control: ICMP, DNS, NTP, SSH,
+                      telnet, DSCP EF, CS4, CS5 and AF4x
+        default       weighted, CLS_WEIGHT_DEFAULT shares
+        bulk          weighted, CLS_WEIGHT_BULK shares: DSCP CS1 and AF1x
+
+    The class comes from flat tables, one lookup each: the DSCP, then the
+    destination port, then the source port, then the protocol, the first
+    that has an entry decides, and default if none does; a packet marked
+    CS1 goes as bulk even to port 22. Rules of
+    our own (-P) overwrite the entries, e.g.
+
+        port:5001=bulk,dscp:34=interactive,proto:47=bulk
+
+    The bridge's own messages, ARQ acknowledgements, rate and hop control,
+    mesh HELLOs, never go through the queues at all.
+
+    Against a bulk transfer of 512 B packets at 1200 baud, with a ping and
+    an SNMP poll each taking a tenth of the line (bridge_bench cls), one
+    FIFO makes both wait 47 s on average; the fair queues alone bring that
+    to 3.0 s, and the classes take control to 2.8 s (max 5.2 s). A ping
+    pays for it: 3.2 s instead of 3.0 s, max 5.7 s instead of 4.9 s, when
+    it comes in with a control packet and waits for its airtime too. That
+    is the order of the classes, not the strict priority: interactive as a
+    weighted class does no better, it is already a sparse flow there. Most
+    of either is the 4.3 s of the bulk packet already on air, which
+    nothing can cut short; a shorter MTU does. At 9600 baud it is 363 ms
+    for control and 395 ms for a ping, against 18 s through a FIFO.
+
+    What may leave the queues is metered by a token bucket in airtime,
+    not bytes: a packet costs the time its frame takes on air, preamble,
+    frame header, CRC, encryption, FEC parity and, when it is aggregated,
+    its subframe header and its share of the aggregate's frame, at the
+    line rate. The length is taken before header compression, which errs
+    on the safe side. The bucket fills at 'share' percent of real time and
+    holds CLS_BURST_MS; a packet goes when it is not in debt, and the next
+    one waits until the debt is paid off. Control is let out in debt too.
+    So nothing goes down to the radio faster than it drains, and with a
+    share under 100 the rest of the airtime stays free, for a duty cycle
+    or other users of the channel.
+*/
+
+#ifndef CLS_H
+#define CLS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CLS_WEIGHT_DEFAULT  3
+#define CLS_WEIGHT_BULK     1
+#define CLS_BURST_MS        100
+#define CLS_NONE            0xFF
+
+typedef enum { CLS_CONTROL, CLS_INTERACTIVE, CLS_DEFAULT, CLS_BULK, CLS_COUNT } cls_class;
+
+extern const char *cls_names[CLS_COUNT];
+
+typedef struct cls_ctx {
+    uint8_t port[65536];    // class or CLS_NONE
+    uint8_t proto[256];
+    uint8_t dscp[64];
+    uint64_t packets[CLS_COUNT];
+} cls_ctx;
+
+// The airtime of a frame: fixed bytes per frame and per packet, the
+// parity FEC adds, and how many packets share an aggregate
+typedef struct cls_link {
+    int baud;
+    int frame_bytes;        // preamble, frame header, CRC, AES, ARQ, bond, diversity
+    int packet_bytes;       // subframe and mesh headers
+    int agg_size;           // 0 without aggregation
+    int fec_data;           // data bytes a codeword, 0 without FEC
+    int fec_parity;
+} cls_link;
+
+typedef struct cls_shaper {
+    int share;              // percent of real time
+    int64_t tokens_ns;      // airtime, below 0 in debt
+    int64_t burst_ns;
+    uint64_t last_ns;
+    cls_link link;
+
+    uint64_t air_ns[CLS_COUNT];     // charged per class
+    uint64_t waits;                 // times the others were held back
+} cls_shaper;
+
+// With the default rules
+void cls_init(cls_ctx *ctx);
+
+// Adds "kind:value=class,..." rules, kind port, proto or dscp; -1 on a bad one
+int  cls_add_rules(cls_ctx *ctx, const char *rules);
+
+cls_class cls_classify(cls_ctx *ctx, const uint8_t *pkt, int len);
+
+void cls_shaper_init(cls_shaper *s, int share, const cls_link *link, uint64_t now_ns);
+
+// Airtime of a packet of 'len' bytes as it goes on air
+uint64_t cls_air_ns(const cls_link *link, int len);
+
+// The last class that may go now: all of them, or only control in debt
+cls_class cls_allowed(cls_shaper *s, uint64_t now_ns);
+
+// Takes the airtime of a packet that went
+void cls_charge(cls_shaper *s, cls_class c, int len);
+
+// Nanoseconds until the debt is paid off, 0 if there is none
+int64_t cls_time_left(cls_shaper *s, uint64_t now_ns);
+
+void cls_print_stats(cls_ctx *ctx, cls_shaper *s, FILE *out);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+    Receive diversity
+*/
+
+#include <string.h>
+
+#include "div.h"
+
+#define MS(x) ((int64_t)(x) * 1000000)
+
+void div_init(div_ctx *ctx, int nbranches)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (nbranches < 1)
+        nbranches = 1;
+    if (nbranches > DIV_BRANCHES)
+        nbranches = DIV_BRANCHES;
+    ctx->nbranches = nbranches;
+
+    // No telemetry yet: no branch is preferred
+    for (int i = 0; i < DIV_BRANCHES; i++)
+        ctx->branch[i].rssi_dbm = -130;
+}
+
+void div_set_rssi(div_ctx *ctx, int branch, int rssi_dbm)
+{
+    if (branch >= 0 && branch < ctx->nbranches)
+        ctx->branch[branch].rssi_dbm = rssi_dbm;
+}
+
+int div_send(div_ctx *ctx, uint8_t **buf, int len)
+{
+    uint16_t seq = ctx->snd_nxt++;
+    uint8_t *h = *buf -= DIV_HDR_LEN;
+
+    h[0] = DIV_TYPE;
+    h[1] = (uint8_t)(seq >> 8);
+    h[2] = (uint8_t)seq;
+    return len + DIV_HDR_LEN;
+}
+
+// Delivered within the last DIV_HISTORY frames. Anything older than that
+// is no copy of ours but a peer that started over.
+static int div_done(const div_ctx *ctx, uint16_t seq)
+{
+    int16_t d = (int16_t)(ctx->top - seq);
+
+    return ctx->have_top && d >= 0 && d < DIV_HISTORY && (ctx->done >> d) & 1;
+}
+
+static void div_mark(div_ctx *ctx, uint16_t seq)
+{
+    int16_t d = (int16_t)(seq - ctx->top);
+
+    if (!ctx->have_top || d >= DIV_HISTORY || d <= -DIV_HISTORY)
+    {
+        ctx->have_top = 1;
+        ctx->top = seq;
+        ctx->done = 1;
+    }
+    else if (d > 0)
+    {
+        ctx->top = seq;
+        ctx->done = (ctx->done << d) | 1;
+    }
+    else
+        ctx->done |= 1ull << -d;
+}
+
+static int div_better(const div_ctx *ctx, int corrected, int branch, const div_slot *s)
+{
+    if (corrected != s->corrected)
+        return corrected < s->corrected;
+    return ctx->branch[branch].rssi_dbm > ctx->branch[s->branch].rssi_dbm;
+}
+
+static div_slot *div_slot_at(div_ctx *ctx, int i)
+{
+    return &ctx->pend[(ctx->head + i) % (DIV_PENDING + 1)];
+}
+
+// Hands out the oldest held frame, its slot stays as it is until the next
+// one is taken
+static int div_pop(div_ctx *ctx, uint8_t **payload)
+{
+    div_slot *s = div_slot_at(ctx, 0);
+
+    ctx->head = (ctx->head + 1) % (DIV_PENDING + 1);
+    ctx->npend--;
+
+    div_mark(ctx, s->seq);
+    ctx->branch[s->branch].picked++;
+    ctx->stats.delivered++;
+    *payload = s->buf;
+    return s->len;
+}
+
+int div_receive(div_ctx *ctx, int branch, uint8_t *buf, int len, int corrected, uint8_t **payload, uint64_t now_ns)
+{
+    if (branch < 0 || branch >= ctx->nbranches)
+    {
+        ctx->stats.errors++;
+        return -1;
+    }
+
+    if (len < 1 || buf[0] != DIV_TYPE)
+    {
+        ctx->stats.untagged++;
+        if (branch != 0)
+            return 0;
+        *payload = buf;
+        return len;
+    }
+    if (len < DIV_HDR_LEN)
+    {
+        ctx->stats.errors++;
+        return -1;
+    }
+
+    uint16_t seq = (uint16_t)((buf[1] << 8) | buf[2]);
+    div_branch *b = &ctx->branch[branch];
+
+    b->frames++;
+    b->corrected += corrected;
+    b->has_seq = 1;
+    b->last_seq = seq;
+
+    buf += DIV_HDR_LEN;
+    len -= DIV_HDR_LEN;
+
+    if (div_done(ctx, seq))
+    {
+        ctx->stats.duplicates++;
+        return 0;
+    }
+
+    for (int i = 0; i < ctx->npend; i++)
+    {
+        div_slot *s = div_slot_at(ctx, i);
+
+        if (s->seq != seq)
+            continue;
+        if (s->copies & (1 << branch))
+        {
+            ctx->stats.duplicates++;
+            return 0;
+        }
+        s->copies |= 1 << branch;
+        if (div_better(ctx, corrected, branch, s))
+        {
+            memcpy(s->buf, buf, len);
+            s->len = len;
+            s->branch = branch;
+            s->corrected = corrected;
+            ctx->stats.replaced++;
+        }
+        return 0;
+    }
+
+    // Clean with nothing held ahead of it: no copy can be better
+    if (corrected == 0 && ctx->npend == 0)
+    {
+        div_mark(ctx, seq);
+        b->picked++;
+        ctx->stats.delivered++;
+        *payload = buf;
+        return len;
+    }
+
+    int out = 0;
+    if (ctx->npend == DIV_PENDING)
+    {
+        ctx->stats.forced++;
+        out = div_pop(ctx, payload);
+    }
+
+    div_slot *s = div_slot_at(ctx, ctx->npend++);
+
+    memcpy(s->buf, buf, len);
+    s->len = len;
+    s->seq = seq;
+    s->branch = branch;
+    s->corrected = corrected;
+    s->copies = 1 << branch;
+    s->arrived_ns = now_ns;
+    if (corrected > 0)
+        ctx->stats.waited++;
+    return out;
+}
+
+// Every branch has had its say: a copy, a later frame, or a clean copy
+// that nothing beats
+static int div_complete(const div_ctx *ctx, const div_slot *s)
+{
+    if (s->corrected == 0)
+        return 1;
+
+    for (int i = 0; i < ctx->nbranches; i++)
+    {
+        const div_branch *b = &ctx->branch[i];
+
+        if (!(s->copies & (1 << i)) && !(b->has_seq && (int16_t)(b->last_seq - s->seq) > 0))
+            return 0;
+    }
+    return 1;
+}
+
+int div_next(div_ctx *ctx, uint8_t **payload, uint64_t now_ns)
+{
+    if (ctx->npend == 0)
+        return 0;
+
+    div_slot *s = div_slot_at(ctx, 0);
+
+    if (div_complete(ctx, s))
+        return div_pop(ctx, payload);
+    if (now_ns >= s->arrived_ns + MS(DIV_WINDOW_MS))
+    {
+        ctx->stats.timeouts++;
+        return div_pop(ctx, payload);
+    }
+    return 0;
+}
+
+int64_t div_time_left(const div_ctx *ctx, uint64_t now_ns)
+{
+    if (ctx->npend == 0)
+        return -1;
+
+    uint64_t due = ctx->pend[ctx->head].arrived_ns + MS(DIV_WINDOW_MS);
+    return due > now_ns ? (int64_t)(due - now_ns) : 0;
+}
+
+void div_print_stats(div_ctx *ctx, FILE *out)
+{
+    div_stats *s = &ctx->stats;
+
+    fprintf(out, "div: delivered=%llu duplicates=%llu replaced=%llu waited=%llu timeouts=%llu forced=%llu "
+                 "untagged=%llu errors=%llu\n",
+            (unsigned long long)s->delivered, (unsigned long long)s->duplicates,
+            (unsigned long long)s->replaced, (unsigned long long)s->waited,
+            (unsigned long long)s->timeouts, (unsigned long long)s->forced,
+            (unsigned long long)s->untagged, (unsigned long long)s->errors);
+
+    // What the branch would have delivered on its own
+    for (int i = 0; i < ctx->nbranches; i++)
+    {
+        div_branch *b = &ctx->branch[i];
+
+        fprintf(out, "div: branch=%d rssi=%ddBm frames=%llu alone=%.1f%% picked=%llu corrected=%llu\n",
+                i, b->rssi_dbm, (unsigned long long)b->frames,
+                s->delivered ? 100.0 * b->frames / s->delivered : 0.0,
+                (unsigned long long)b->picked, (unsigned long long)b->corrected);
+    }
+}
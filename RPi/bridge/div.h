@@ -0,0 +1,111 @@
+/*
+    Receive diversity
+
+    Both SPIRIT1 radios of a board receive the same channel on their own,
+    spatially separated antennas, each on a tty of its own, so most frames
+    arrive twice. A fade deep enough to break a frame on one antenna is
+    seldom as deep on the other, the combiner keeps whichever copy made it.
+
+    The sender numbers every frame, after the ARQ and before the link
+    stages, so the copies can be told apart from retransmissions:
+
+        0xF4 seq(2)
+
+    A copy only counts once it has passed the CRC. Of two good copies the
+    one the FEC corrected fewer symbols in wins, between equals the one of
+    the radio with the better RSSI; a copy the FEC left alone is as good
+    as it gets and goes up at once. One that was corrected waits up to
+    DIV_WINDOW_MS for the other, less if the other radio has already
+    moved on to a later frame. The sequence numbers of the last
+    DIV_HISTORY frames delivered catch the copies that come in after.
+
+    Frames without the header, from a peer that does not number them, go
+    up from branch 0 only.
+*/
+
+#ifndef DIV_H
+#define DIV_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "stage.h"
+
+#define DIV_TYPE            0xF4
+#define DIV_HDR_LEN         3
+#define DIV_BRANCHES        2
+#define DIV_PENDING         4       // corrected frames waiting for a better copy
+#define DIV_WINDOW_MS       20      // two USB latency timers apart, at most
+#define DIV_HISTORY         64
+
+typedef struct div_branch {
+    int rssi_dbm;           // from the radio telemetry
+    int has_seq;
+    uint16_t last_seq;      // of its last good copy
+    uint64_t frames;        // good copies
+    uint64_t picked;
+    uint64_t corrected;     // FEC symbols over its good copies
+} div_branch;
+
+typedef struct div_slot {
+    uint8_t buf[BRIDGE_BUF_SIZE];
+    int len;
+    uint16_t seq;
+    int branch;             // of the copy held
+    int corrected;
+    int copies;             // bit per branch
+    uint64_t arrived_ns;
+} div_slot;
+
+typedef struct div_stats {
+    uint64_t delivered;
+    uint64_t duplicates;
+    uint64_t replaced;      // by a better copy
+    uint64_t waited;        // corrected, held for the other copy
+    uint64_t timeouts;      // the other copy never came
+    uint64_t forced;        // out of slots
+    uint64_t untagged;
+    uint64_t errors;
+} div_stats;
+
+typedef struct div_ctx {
+    int nbranches;          // 1 only numbers the frames it sends
+    div_branch branch[DIV_BRANCHES];
+
+    // Sender
+    uint16_t snd_nxt;
+
+    // Receiver, a ring with one slot to spare for the frame handed out
+    div_slot pend[DIV_PENDING + 1];
+    int head;
+    int npend;
+    int have_top;
+    uint16_t top;           // newest sequence number delivered
+    uint64_t done;          // bit k: top - k delivered
+
+    div_stats stats;
+} div_ctx;
+
+void div_init(div_ctx *ctx, int nbranches);
+
+void div_set_rssi(div_ctx *ctx, int branch, int rssi_dbm);
+
+// Puts the header in the DIV_HDR_LEN bytes before '*buf', which moves
+// back to it, returns the new length
+int  div_send(div_ctx *ctx, uint8_t **buf, int len);
+
+// Processes a copy that passed the link stages off 'branch', with
+// 'corrected' FEC symbols. Returns the payload length if it goes up now
+// (*payload points into 'buf' or a held slot), 0 if there is nothing to
+// deliver, -1 if it is malformed. Follow with div_next().
+int  div_receive(div_ctx *ctx, int branch, uint8_t *buf, int len, int corrected, uint8_t **payload, uint64_t now_ns);
+
+// Held frames that are due, 0 when done
+int  div_next(div_ctx *ctx, uint8_t **payload, uint64_t now_ns);
+
+// Nanoseconds until a held frame is given up on waiting, -1 if none is held
+int64_t div_time_left(const div_ctx *ctx, uint64_t now_ns);
+
+void div_print_stats(div_ctx *ctx, FILE *out);
+
+#endif
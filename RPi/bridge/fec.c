@@ -0,0 +1,328 @@
+/*
+    Reed-Solomon FEC stage with block interleaving
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gf256.h"
+#include "fec.h"
+
+static int fec_max_depth(const fec_ctx *ctx)
+{
+    int d = BRIDGE_BUF_SIZE / (255 - ctx->nsym) + 1;
+    return d > ctx->depth ? d : ctx->depth;
+}
+
+static int fec_depth_for(const fec_ctx *ctx, int len)
+{
+    int kmax = 255 - ctx->nsym;
+    int d = (len + kmax - 1) / kmax;
+    return d > ctx->depth ? d : ctx->depth;
+}
+
+int fec_init(fec_ctx *ctx, int nsym, int depth)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (nsym < 2 || nsym > FEC_MAX_NSYM || (nsym & 1))
+        return -1;
+    if (depth < 1 || depth > FEC_MAX_DEPTH)
+        return -1;
+
+    gf_init();
+
+    ctx->nsym  = nsym;
+    ctx->depth = depth;
+
+    // gen(x) = (x - a^0)(x - a^1)...(x - a^(nsym-1)), highest degree first
+    ctx->gen[0] = 1;
+    for (int i = 0; i < nsym; i++)
+    {
+        uint8_t root = gf_exp[i];
+        for (int j = i + 1; j > 0; j--)
+            ctx->gen[j] ^= gf_mul(ctx->gen[j - 1], root);
+    }
+
+    // Parity ring (nsym rows) + feedback row + padded first row
+    ctx->scratch = malloc((size_t)(nsym + 2) * fec_max_depth(ctx));
+    if (!ctx->scratch)
+        return -1;
+
+    return 0;
+}
+
+void fec_free(fec_ctx *ctx)
+{
+    free(ctx->scratch);
+    ctx->scratch = 0;
+}
+
+int fec_encoded_len(const fec_ctx *ctx, int len)
+{
+    return len + ctx->nsym * fec_depth_for(ctx, len);
+}
+
+// Row 'r' of the D-column data matrix; the first row is padded with virtual
+// leading zeros, which leave the LFSR state (and the syndromes) untouched.
+static const uint8_t *fec_row(const uint8_t *buf, uint8_t *row0, int r, int d, int pad)
+{
+    if (r > 0 || pad == 0)
+        return buf + r * d - pad;
+
+    memset(row0, 0, pad);
+    memcpy(row0 + pad, buf, d - pad);
+    return row0;
+}
+
+int fec_encode(fec_ctx *ctx, uint8_t *buf, int len, int cap)
+{
+    int nsym = ctx->nsym;
+    int d    = fec_depth_for(ctx, len);
+    int k    = (len + d - 1) / d;
+    int pad  = k * d - len;
+
+    if (len <= 0 || len + nsym * d > cap || d > fec_max_depth(ctx))
+        return -1;
+
+    uint8_t *ring = ctx->scratch;
+    uint8_t *fb   = ring + nsym * d;
+    uint8_t *row0 = fb + d;
+    int r = 0;
+
+    memset(ring, 0, (size_t)nsym * d);
+
+    // Systematic LFSR encoder, all D codewords at once
+    for (int i = 0; i < k; i++)
+    {
+        memcpy(fb, fec_row(buf, row0, i, d, pad), d);
+        gf_add_region(fb, ring + r * d, d);
+
+        gf_mul_region(ring + r * d, fb, ctx->gen[nsym], d);
+        for (int j = 0; j < nsym - 1; j++)
+            gf_mul_add_region(ring + ((r + j + 1) % nsym) * d, fb, ctx->gen[j + 1], d);
+
+        r = (r + 1) % nsym;
+    }
+
+    for (int p = 0; p < nsym; p++)
+        memcpy(buf + len + p * d, ring + ((r + p) % nsym) * d, d);
+
+    ctx->stats.frames_encoded++;
+    return len + nsym * d;
+}
+
+// Berlekamp-Massey, Chien search and Forney for one codeword of length n.
+// Returns the number of errors (positions/magnitudes filled) or -1.
+static int rs_solve(const uint8_t *synd, int nsym, int n, int *pos, uint8_t *mag)
+{
+    uint8_t c[FEC_MAX_NSYM + 1] = { 1 };
+    uint8_t b[FEC_MAX_NSYM + 1] = { 1 };
+    uint8_t t[FEC_MAX_NSYM + 1];
+    uint8_t omega[FEC_MAX_NSYM];
+    uint8_t last = 1;
+    int l = 0;
+    int m = 1;
+
+    for (int k = 0; k < nsym; k++)
+    {
+        uint8_t delta = synd[k];
+        for (int i = 1; i <= l; i++)
+            delta ^= gf_mul(c[i], synd[k - i]);
+
+        if (delta == 0)
+        {
+            m++;
+            continue;
+        }
+
+        uint8_t coef = gf_div(delta, last);
+        memcpy(t, c, sizeof(c));
+        for (int i = 0; i + m <= nsym; i++)
+            c[i + m] ^= gf_mul(coef, b[i]);
+
+        if (2 * l <= k)
+        {
+            l = k + 1 - l;
+            memcpy(b, t, sizeof(b));
+            last = delta;
+            m = 1;
+        }
+        else
+            m++;
+    }
+
+    if (l == 0 || l > nsym / 2)
+        return -1;
+
+    int found = 0;
+    for (int idx = 0; idx < n; idx++)
+    {
+        uint8_t xinv = gf_exp[(255 - (n - 1 - idx)) % 255];
+        uint8_t v = 0;
+        for (int i = l; i >= 0; i--)
+            v = gf_mul(v, xinv) ^ c[i];
+        if (v == 0)
+        {
+            if (found == l)
+                return -1;
+            pos[found++] = idx;
+        }
+    }
+
+    if (found != l)
+        return -1;
+
+    // Omega(x) = S(x) * Lambda(x) mod x^nsym
+    for (int i = 0; i < nsym; i++)
+    {
+        omega[i] = 0;
+        for (int j = 0; j <= i && j <= l; j++)
+            omega[i] ^= gf_mul(c[j], synd[i - j]);
+    }
+
+    for (int e = 0; e < found; e++)
+    {
+        int deg = n - 1 - pos[e];
+        uint8_t x    = gf_exp[deg % 255];
+        uint8_t xinv = gf_exp[(255 - deg) % 255];
+        uint8_t num = 0;
+        uint8_t den = 0;
+
+        for (int i = nsym - 1; i >= 0; i--)
+            num = gf_mul(num, xinv) ^ omega[i];
+
+        // Formal derivative keeps the odd terms only
+        for (int i = l - (l % 2 == 0); i >= 1; i -= 2)
+            den = gf_mul(den, gf_mul(xinv, xinv)) ^ c[i];
+
+        if (den == 0)
+            return -1;
+        mag[e] = gf_mul(x, gf_div(num, den));
+    }
+
+    return found;
+}
+
+int fec_decode(fec_ctx *ctx, uint8_t *buf, int len)
+{
+    int nsym = ctx->nsym;
+    int d, data_len = -1;
+
+    ctx->stats.frames_decoded++;
+
+    // The air length determines the depth: the ranges never overlap
+    for (d = ctx->depth; d <= fec_max_depth(ctx); d++)
+    {
+        int l = len - nsym * d;
+        if (l <= 0)
+            break;
+        if (fec_depth_for(ctx, l) == d)
+        {
+            data_len = l;
+            break;
+        }
+    }
+
+    if (data_len < 0)
+    {
+        ctx->stats.frames_failed++;
+        return -1;
+    }
+
+    int k   = (data_len + d - 1) / d;
+    int pad = k * d - data_len;
+    int n   = k + nsym;
+
+    uint8_t *synd = ctx->scratch;
+    uint8_t *row0 = synd + nsym * d;
+    int dirty = 0;
+
+    memset(synd, 0, (size_t)nsym * d);
+
+    // Horner over the rows: S_i = S_i * a^i + row
+    for (int r = 0; r < n; r++)
+    {
+        const uint8_t *row = r < k ? fec_row(buf, row0, r, d, pad)
+                                   : buf + data_len + (r - k) * d;
+        gf_add_region(synd, row, d);
+        for (int i = 1; i < nsym; i++)
+        {
+            gf_mul_region(synd + i * d, synd + i * d, gf_exp[i], d);
+            gf_add_region(synd + i * d, row, d);
+        }
+    }
+
+    for (int j = 0; j < d; j++)
+    {
+        uint8_t s[FEC_MAX_NSYM];
+        uint8_t mag[FEC_MAX_NSYM];
+        int pos[FEC_MAX_NSYM];
+        int any = 0;
+
+        for (int i = 0; i < nsym; i++)
+        {
+            s[i] = synd[i * d + j];
+            any |= s[i];
+        }
+        if (!any)
+            continue;
+
+        dirty = 1;
+        int errors = rs_solve(s, nsym, n, pos, mag);
+        if (errors < 0)
+        {
+            ctx->stats.frames_failed++;
+            return -1;
+        }
+
+        for (int e = 0; e < errors; e++)
+        {
+            int off = pos[e] < k ? pos[e] * d - pad + j
+                                 : data_len + (pos[e] - k) * d + j;
+            if (off < 0)
+            {
+                // Located inside the shortened (virtual) part
+                ctx->stats.frames_failed++;
+                return -1;
+            }
+            buf[off] ^= mag[e];
+        }
+        ctx->stats.symbols_corrected += errors;
+    }
+
+    if (!dirty)
+        ctx->stats.frames_clean++;
+
+    return data_len;
+}
+
+void fec_print_stats(void *ctx, FILE *out)
+{
+    fec_ctx *fec = (fec_ctx *)ctx;
+
+    fprintf(out, "fec: RS(255,%d) depth>=%d encoded=%llu decoded=%llu clean=%llu failed=%llu corrected=%llu\n",
+            255 - fec->nsym, fec->depth,
+            (unsigned long long)fec->stats.frames_encoded,
+            (unsigned long long)fec->stats.frames_decoded,
+            (unsigned long long)fec->stats.frames_clean,
+            (unsigned long long)fec->stats.frames_failed,
+            (unsigned long long)fec->stats.symbols_corrected);
+}
+
+static int fec_stage_tx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    return fec_encode((fec_ctx *)ctx, buf, len, cap);
+}
+
+static int fec_stage_rx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    (void)cap;
+    return fec_decode((fec_ctx *)ctx, buf, len);
+}
+
+stage fec_stage(fec_ctx *ctx)
+{
+    stage s = { "fec", fec_stage_tx, fec_stage_rx, fec_print_stats, ctx, 0 };
+    return s;
+}
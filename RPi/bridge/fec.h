@@ -0,0 +1,56 @@
+/*
+    Reed-Solomon FEC stage with block interleaving
+
+    A frame of L bytes is split over D codewords of a shortened RS(k + nsym, k)
+    code, D = max(depth, ceil(L / (255 - nsym))). Codeword j takes every D-th
+    byte of the frame, so the data goes on air unchanged and a burst of B
+    bytes costs each codeword at most ceil(B / D) symbols. The nsym parity
+    rows are appended after the data, also interleaved.
+
+    Because the codewords are the columns of a row-major matrix, encoding and
+    syndrome computation run on whole rows with the GF(256) SIMD kernels.
+*/
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define FEC_MAX_NSYM    64
+#define FEC_MAX_DEPTH   64
+
+typedef struct fec_stats {
+    uint64_t frames_encoded;
+    uint64_t frames_decoded;
+    uint64_t frames_clean;
+    uint64_t frames_failed;
+    uint64_t symbols_corrected;
+} fec_stats;
+
+typedef struct fec_ctx {
+    int nsym;                           // parity symbols per codeword, corrects nsym/2
+    int depth;                          // minimum interleaving depth
+    uint8_t gen[FEC_MAX_NSYM + 1];      // generator polynomial, gen[0] == 1
+    uint8_t *scratch;
+    fec_stats stats;
+} fec_ctx;
+
+int  fec_init(fec_ctx *ctx, int nsym, int depth);
+void fec_free(fec_ctx *ctx);
+
+// Air length of a protected frame of 'len' bytes
+int  fec_encoded_len(const fec_ctx *ctx, int len);
+
+// Appends the parity rows, returns the new length or -1 if it does not fit in 'cap'
+int  fec_encode(fec_ctx *ctx, uint8_t *buf, int len, int cap);
+
+// Corrects the frame in place, returns the data length or -1 if uncorrectable
+int  fec_decode(fec_ctx *ctx, uint8_t *buf, int len);
+
+void fec_print_stats(void *ctx, FILE *out);
+
+stage fec_stage(fec_ctx *ctx);
+
+#endif
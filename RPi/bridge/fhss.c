@@ -0,0 +1,537 @@
+/*
+    Frequency hopping
+*/
+
+#include <string.h>
+
+#include "fhss.h"
+
+#define MS(x) ((uint64_t)(x) * 1000000ULL)
+
+static uint64_t fhss_rng(fhss_ctx *ctx)
+{
+    ctx->rng ^= ctx->rng << 13;
+    ctx->rng ^= ctx->rng >> 7;
+    ctx->rng ^= ctx->rng << 17;
+    return ctx->rng;
+}
+
+static fhss_channel *fhss_channel_of(fhss_ctx *ctx, int shift)
+{
+    for (int i = 0; i < ctx->ncand; i++)
+        if (ctx->cand[i].shift == shift)
+            return &ctx->cand[i];
+    return NULL;
+}
+
+static int fhss_blocked(const fhss_channel *c, uint64_t now_ns)
+{
+    return c->blocked_until_ns > now_ns;
+}
+
+static int fhss_in_seq(const fhss_seq *seq, int shift)
+{
+    for (int i = 0; i < seq->n; i++)
+        if (seq->shift[i] == shift)
+            return 1;
+    return 0;
+}
+
+static int fhss_seq_equal(const fhss_seq *a, const fhss_seq *b)
+{
+    return a->n == b->n && a->from == b->from && memcmp(a->shift, b->shift, a->n) == 0;
+}
+
+void fhss_init(fhss_ctx *ctx, int master, int dwell_ms, uint64_t now_ns)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->master = master;
+    ctx->blacklist = 1;
+    ctx->dwell_ns = MS(dwell_ms);
+    ctx->guard_ns = MS(FHSS_GUARD_MS);
+    ctx->park_until_ns = now_ns + FHSS_PARK_DWELLS * ctx->dwell_ns;
+    ctx->rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)(master + 1) << 32) ^ now_ns;
+    if (ctx->rng == 0)
+        ctx->rng = 1;
+
+    // Every shift that keeps both frequencies on the grid
+    for (int s = -FHSS_CH_A; FHSS_CH_B + s < FHSS_GRID; s += FHSS_GAP)
+    {
+        fhss_channel *c = &ctx->cand[ctx->ncand++];
+
+        c->shift = s;
+    }
+}
+
+void fhss_set_map(fhss_ctx *ctx, const scan_map *map)
+{
+    for (int i = 0; i < ctx->ncand; i++)
+    {
+        fhss_channel *c = &ctx->cand[i];
+        int level = scan_move_cost(map, NULL, c->shift);
+
+        // This end's sweep stands in for the peer's receiver as well
+        if (level >= 0 && map->rssi[map->tx_ch + c->shift] > level)
+            level = map->rssi[map->tx_ch + c->shift];
+        c->level = level < 0 ? 255 : level;
+    }
+}
+
+// Home, then the quietest channels that are not blacklisted, then the
+// blacklisted ones if that is too few; shuffled into a sequence
+static void fhss_pick(fhss_ctx *ctx, fhss_seq *seq, uint32_t from, uint64_t now_ns)
+{
+    int order[FHSS_MAX_CANDIDATES];
+    int n = ctx->ncand;
+
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+
+    // Shuffled first, so that ties fall differently every time
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = (int)(fhss_rng(ctx) % (uint64_t)(i + 1));
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0; j--)
+        {
+            const fhss_channel *a = &ctx->cand[order[j - 1]];
+            const fhss_channel *b = &ctx->cand[order[j]];
+            int ka = (a->shift != 0) * 2 + fhss_blocked(a, now_ns);
+            int kb = (b->shift != 0) * 2 + fhss_blocked(b, now_ns);
+
+            if (ka < kb || (ka == kb && a->level <= b->level))
+                break;
+
+            int t = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = t;
+        }
+
+    seq->from = from;
+    seq->n = 0;
+    for (int i = 0; i < n && seq->n < FHSS_CHANNELS; i++)
+    {
+        const fhss_channel *c = &ctx->cand[order[i]];
+
+        if (fhss_blocked(c, now_ns) && seq->n >= FHSS_MIN_CHANNELS)
+            break;
+        seq->shift[seq->n++] = (int8_t)c->shift;
+    }
+
+    for (int i = seq->n - 1; i > 0; i--)
+    {
+        int j = (int)(fhss_rng(ctx) % (uint64_t)(i + 1));
+        int8_t t = seq->shift[i];
+        seq->shift[i] = seq->shift[j];
+        seq->shift[j] = t;
+    }
+}
+
+void fhss_start(fhss_ctx *ctx, uint64_t now_ns)
+{
+    if (!ctx->master || ctx->hopping)
+        return;
+
+    ctx->hopping = 1;
+    ctx->origin_ns = now_ns;
+    fhss_pick(ctx, &ctx->seq, 0, now_ns);
+    ctx->next.n = 0;
+    ctx->report_index = 0;
+    ctx->table_changed = 1;
+    ctx->clock_changed = 1;
+    ctx->stats.sequences++;
+}
+
+uint32_t fhss_index(const fhss_ctx *ctx, uint64_t now_ns)
+{
+    if (!ctx->hopping || now_ns < ctx->origin_ns || ctx->dwell_ns == 0)
+        return 0;
+    return (uint32_t)((now_ns - ctx->origin_ns) / ctx->dwell_ns);
+}
+
+static uint64_t fhss_offset(const fhss_ctx *ctx, uint64_t now_ns)
+{
+    if (now_ns < ctx->origin_ns || ctx->dwell_ns == 0)
+        return 0;
+    return (now_ns - ctx->origin_ns) % ctx->dwell_ns;
+}
+
+static int fhss_shift_at(const fhss_ctx *ctx, uint32_t k)
+{
+    const fhss_seq *s = ctx->next.n && k >= ctx->next.from ? &ctx->next : &ctx->seq;
+
+    if (s->n == 0)
+        return 0;
+    return s->shift[k >= s->from ? (k - s->from) % s->n : 0];
+}
+
+int fhss_shift(const fhss_ctx *ctx, uint64_t now_ns)
+{
+    if (!ctx->hopping)
+        return ctx->park;
+    return fhss_shift_at(ctx, fhss_index(ctx, now_ns));
+}
+
+// The firmware takes the next sequence over by itself
+static void fhss_advance(fhss_ctx *ctx, uint32_t k)
+{
+    if (ctx->next.n && k >= ctx->next.from)
+    {
+        ctx->seq = ctx->next;
+        ctx->next.n = 0;
+    }
+}
+
+// Master: blacklist the channels that lose too many frames and announce a
+// sequence without them
+static void fhss_evaluate(fhss_ctx *ctx, uint64_t now_ns)
+{
+    uint32_t k = fhss_index(ctx, now_ns);
+    int changed = 0;
+
+    if (!ctx->hopping || ctx->next.n)
+        return;
+
+    for (int i = 0; i < ctx->ncand; i++)
+    {
+        fhss_channel *c = &ctx->cand[i];
+        uint32_t total = c->ok + c->bad;
+
+        if (total < FHSS_MIN_FRAMES)
+            continue;
+
+        if (ctx->blacklist && c->shift != 0 && !fhss_blocked(c, now_ns) &&
+            c->bad * 100 > FHSS_BAD_PERCENT * total)
+        {
+            c->blocked_until_ns = now_ns + MS(FHSS_PAROLE_MS);
+            ctx->stats.blacklisted++;
+        }
+        c->ok = 0;
+        c->bad = 0;
+    }
+
+    // A blacklisted channel in the sequence, or one back from parole
+    // that there is room for
+    for (int i = 0; i < ctx->ncand; i++)
+    {
+        const fhss_channel *c = &ctx->cand[i];
+        int in = fhss_in_seq(&ctx->seq, c->shift);
+
+        if (in && fhss_blocked(c, now_ns) && ctx->seq.n > FHSS_MIN_CHANNELS)
+            changed = 1;
+        if (!in && !fhss_blocked(c, now_ns) && ctx->seq.n < FHSS_CHANNELS)
+            changed = 1;
+    }
+
+    if (!changed)
+        return;
+
+    fhss_pick(ctx, &ctx->next, k + FHSS_SWITCH_DWELLS, now_ns);
+    ctx->table_changed = 1;
+    ctx->stats.sequences++;
+}
+
+static uint32_t fhss_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void fhss_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static int fhss_read_seq(fhss_ctx *ctx, fhss_seq *seq, uint32_t from, const uint8_t *p, int n)
+{
+    if (n < 1 || n > FHSS_MAX_CANDIDATES)
+        return 0;
+    for (int i = 0; i < n; i++)
+        if (!fhss_channel_of(ctx, (int8_t)p[i]))
+            return 0;
+
+    seq->from = from;
+    seq->n = n;
+    memcpy(seq->shift, p, n);
+    return 1;
+}
+
+static void fhss_sync(fhss_ctx *ctx, const uint8_t *msg, int len, uint64_t start_ns, uint64_t now_ns)
+{
+    fhss_seq seq, next;
+    uint32_t index = fhss_get32(msg + 2);
+    uint64_t dwell_ns = MS((msg[10] << 8) | msg[11]);
+    int n = msg[13];
+
+    if (len < 14 + n || dwell_ns <= 2 * ctx->guard_ns || !fhss_read_seq(ctx, &seq, fhss_get32(msg + 6), msg + 14, n))
+        return;
+
+    next.n = 0;
+    if (len >= 14 + n + 5)
+    {
+        int m = msg[14 + n + 4];
+
+        if (len < 14 + n + 5 + m || !fhss_read_seq(ctx, &next, fhss_get32(msg + 14 + n), msg + 14 + n + 5, m))
+            return;
+    }
+
+    if (!ctx->hopping)
+    {
+        ctx->hopping = 1;
+        ctx->table_changed = 1;
+        ctx->stats.acquisitions++;
+    }
+    if (dwell_ns != ctx->dwell_ns || !fhss_seq_equal(&seq, &ctx->seq) ||
+        next.n != ctx->next.n || (next.n && !fhss_seq_equal(&next, &ctx->next)))
+        ctx->table_changed = 1;
+
+    ctx->dwell_ns = dwell_ns;
+    ctx->seq = seq;
+    ctx->next = next;
+    ctx->origin_ns = start_ns - ctx->guard_ns - MS(msg[12]) - (uint64_t)index * dwell_ns;
+    ctx->clock_changed = 1;
+    ctx->last_sync_index = index + 1;
+    ctx->last_sync_ns = now_ns;
+    if (ctx->report_index > index)
+        ctx->report_index = index;
+}
+
+int fhss_receive(fhss_ctx *ctx, const uint8_t *msg, int len, uint64_t start_ns, uint64_t now_ns)
+{
+    if (len < 2 || msg[0] != FHSS_TYPE)
+        return 0;
+
+    switch (msg[1])
+    {
+        case FHSS_MSG_SYNC:
+            if (!ctx->master && len >= 14)
+            {
+                ctx->stats.syncs_rx++;
+                fhss_sync(ctx, msg, len, start_ns, now_ns);
+            }
+            break;
+
+        case FHSS_MSG_REPORT:
+        {
+            int n = len >= 3 ? msg[2] : 0;
+
+            if (!ctx->master || len < 3 + 3 * n)
+                break;
+
+            ctx->stats.reports_rx++;
+            ctx->last_report_ns = now_ns + 1;
+            for (int i = 0; i < n; i++)
+            {
+                fhss_channel *c = fhss_channel_of(ctx, (int8_t)msg[3 + 3 * i]);
+
+                if (!c)
+                    continue;
+                c->ok += msg[3 + 3 * i + 1];
+                c->bad += msg[3 + 3 * i + 2];
+            }
+            fhss_evaluate(ctx, now_ns);
+            break;
+        }
+    }
+
+    return 1;
+}
+
+static int fhss_sync_msg(fhss_ctx *ctx, uint8_t *out, uint32_t k, uint64_t late_ns)
+{
+    uint64_t dwell_ms = ctx->dwell_ns / 1000000;
+    int len = 14;
+
+    out[0] = FHSS_TYPE;
+    out[1] = FHSS_MSG_SYNC;
+    fhss_put32(out + 2, k);
+    fhss_put32(out + 6, ctx->seq.from);
+    out[10] = (uint8_t)(dwell_ms >> 8);
+    out[11] = (uint8_t)dwell_ms;
+    out[12] = (uint8_t)(late_ns / 1000000);
+    out[13] = (uint8_t)ctx->seq.n;
+    memcpy(out + len, ctx->seq.shift, ctx->seq.n);
+    len += ctx->seq.n;
+
+    if (ctx->next.n)
+    {
+        fhss_put32(out + len, ctx->next.from);
+        out[len + 4] = (uint8_t)ctx->next.n;
+        memcpy(out + len + 5, ctx->next.shift, ctx->next.n);
+        len += 5 + ctx->next.n;
+    }
+
+    ctx->stats.syncs_tx++;
+    return len;
+}
+
+static int fhss_report_msg(fhss_ctx *ctx, uint8_t *out)
+{
+    int n = 0;
+
+    out[0] = FHSS_TYPE;
+    out[1] = FHSS_MSG_REPORT;
+    for (int i = 0; i < ctx->ncand; i++)
+    {
+        fhss_channel *c = &ctx->cand[i];
+
+        if (c->ok + c->bad == 0)
+            continue;
+        out[3 + 3 * n] = (uint8_t)(int8_t)c->shift;
+        out[3 + 3 * n + 1] = (uint8_t)(c->ok < 255 ? c->ok : 255);
+        out[3 + 3 * n + 2] = (uint8_t)(c->bad < 255 ? c->bad : 255);
+        c->ok = 0;
+        c->bad = 0;
+        n++;
+    }
+    out[2] = (uint8_t)n;
+
+    ctx->stats.reports_tx++;
+    return 3 + 3 * n;
+}
+
+// Slave: home first, then every hop channel in turn
+static void fhss_park(fhss_ctx *ctx, uint64_t now_ns)
+{
+    int i = 0;
+
+    if (now_ns < ctx->park_until_ns)
+        return;
+
+    while (i < ctx->ncand && ctx->cand[i].shift != ctx->park)
+        i++;
+    ctx->park = ctx->cand[(i + 1) % ctx->ncand].shift;
+    ctx->park_until_ns = now_ns + FHSS_PARK_DWELLS * ctx->dwell_ns;
+    ctx->park_changed = 1;
+}
+
+int fhss_poll(fhss_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns)
+{
+    if (!ctx->master && !ctx->hopping)
+        fhss_park(ctx, now_ns);
+    if (cap < FHSS_MSG_MAX || !ctx->hopping)
+        return 0;
+
+    uint32_t k = fhss_index(ctx, now_ns);
+    uint64_t off = fhss_offset(ctx, now_ns);
+
+    fhss_advance(ctx, k);
+
+    if (ctx->master)
+    {
+        if (k >= ctx->report_index + FHSS_REPORT_DWELLS)
+        {
+            ctx->report_index = k;
+            fhss_evaluate(ctx, now_ns);
+        }
+
+        // Every dwell while the slave may be parked anywhere
+        int searching = ctx->last_report_ns == 0 ||
+                        now_ns > ctx->last_report_ns + 2 * FHSS_REPORT_DWELLS * ctx->dwell_ns;
+
+        if (ctx->last_sync_index == k + 1 || off < ctx->guard_ns ||
+            (!searching && k % FHSS_SYNC_EVERY != 0 && fhss_shift_at(ctx, k) != 0))
+            return 0;
+
+        // Too late to be any use, the slave runs on until the next one
+        ctx->last_sync_index = k + 1;
+        if (off > ctx->guard_ns + MS(255))
+            return 0;
+        return fhss_sync_msg(ctx, out, k, off - ctx->guard_ns);
+    }
+
+    if (now_ns > ctx->last_sync_ns + FHSS_LOST_DWELLS * ctx->dwell_ns)
+    {
+        ctx->hopping = 0;
+        ctx->next.n = 0;
+        ctx->park = 0;
+        ctx->park_until_ns = now_ns + FHSS_PARK_DWELLS * ctx->dwell_ns;
+        ctx->table_changed = 1;
+        ctx->stats.sync_losses++;
+        return 0;
+    }
+
+    if (k >= ctx->report_index + FHSS_REPORT_DWELLS && off >= ctx->guard_ns &&
+        off + ctx->guard_ns < ctx->dwell_ns)
+    {
+        ctx->report_index = k;
+        return fhss_report_msg(ctx, out);
+    }
+
+    return 0;
+}
+
+void fhss_rx_frame(fhss_ctx *ctx, int ok, uint64_t start_ns)
+{
+    fhss_channel *c = fhss_channel_of(ctx, fhss_shift(ctx, start_ns));
+
+    if (!c)
+        return;
+
+    if (ok)
+    {
+        c->ok++;
+        c->rx_ok++;
+    }
+    else
+    {
+        c->bad++;
+        c->rx_bad++;
+    }
+}
+
+int fhss_may_send(const fhss_ctx *ctx, uint64_t air_ns, uint64_t now_ns)
+{
+    if (!ctx->hopping)
+        return 1;
+
+    uint64_t off = fhss_offset(ctx, now_ns);
+
+    return off >= ctx->guard_ns && off + air_ns + ctx->guard_ns <= ctx->dwell_ns;
+}
+
+int64_t fhss_time_left(const fhss_ctx *ctx, uint64_t now_ns)
+{
+    if (!ctx->hopping)
+        return MS(1000);
+
+    uint64_t off = fhss_offset(ctx, now_ns);
+
+    if (off < ctx->guard_ns)
+        return ctx->guard_ns - off;
+    return ctx->dwell_ns - off + ctx->guard_ns;
+}
+
+void fhss_print_stats(fhss_ctx *ctx, FILE *out)
+{
+    fhss_stats *s = &ctx->stats;
+
+    fprintf(out, "fhss: %s %s park=%+d dwell=%llums channels=%d syncs_tx=%llu syncs_rx=%llu reports_tx=%llu "
+                 "reports_rx=%llu acquisitions=%llu sync_losses=%llu blacklisted=%llu sequences=%llu\n",
+            ctx->master ? "master" : "slave", ctx->hopping ? "hopping" : "parked", ctx->park,
+            (unsigned long long)(ctx->dwell_ns / 1000000), ctx->seq.n,
+            (unsigned long long)s->syncs_tx, (unsigned long long)s->syncs_rx,
+            (unsigned long long)s->reports_tx, (unsigned long long)s->reports_rx,
+            (unsigned long long)s->acquisitions, (unsigned long long)s->sync_losses,
+            (unsigned long long)s->blacklisted, (unsigned long long)s->sequences);
+
+    fprintf(out, "fhss: channels");
+    for (int i = 0; i < ctx->ncand; i++)
+    {
+        const fhss_channel *c = &ctx->cand[i];
+        uint64_t total = c->rx_ok + c->rx_bad;
+
+        fprintf(out, " [%+d%s%s %llu/%llu]", c->shift, fhss_in_seq(&ctx->seq, c->shift) ? "*" : "",
+                c->blocked_until_ns ? " blk" : "", (unsigned long long)c->rx_bad,
+                (unsigned long long)total);
+    }
+    fprintf(out, "\n");
+}
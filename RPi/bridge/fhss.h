@@ -0,0 +1,156 @@
+/*
+    Frequency hopping
+
+    Both ends move the duplex pair along the scan grid (scan.h) every
+    dwell, the same shift at the same time, so the pair keeps its spacing
+    and one narrowband interferer only takes the dwells that land on it.
+    The hop channels are the shifts that are a multiple of FHSS_GAP grid
+    steps, ~17 kHz apart like A and B; shift 0, freq A and B, is home.
+
+    The master picks up to FHSS_CHANNELS of them, the quietest ones if it
+    has a sweep, shuffles them into a sequence and runs the dwell clock.
+    The firmware does the hops on its own timer from a table (radio.h, H
+    and J); this side mirrors the clock, keeps frames from straddling a
+    hop and keeps the two ends in step:
+
+        master  0xF7 1 index(4) from(4) dwell_ms(2) late_ms n seq[n]
+                       [ next_from(4) m next_seq[m] ]
+
+    SYNC goes out a guard plus late_ms into every FHSS_SYNC_EVERY-th dwell
+    and into every dwell on home, and into every dwell at all while no
+    report has come back from the slave. Dwell 'index' hops to
+    seq[(index - from) % n]; with the tail, from next_from on the next
+    sequence takes over, on both ends at the same dwell. A slave without
+    the clock parks on home, then on the other hop channels in turn, for
+    FHSS_PARK_DWELLS each, long enough for the master to come by, and
+    picks the clock up from the first SYNC it hears; one that has gone
+    FHSS_LOST_DWELLS without a SYNC starts parking again.
+
+    Both ends count good and bad frames per hop channel; the slave sends
+    its counts every FHSS_REPORT_DWELLS:
+
+        slave   0xF7 2 n { shift ok bad } [n]
+
+    A channel with more than FHSS_BAD_PERCENT bad frames out of at least
+    FHSS_MIN_FRAMES is blacklisted for FHSS_PAROLE_MS and replaced by the
+    best spare; home stays in, and so do FHSS_MIN_CHANNELS.
+*/
+
+#ifndef FHSS_H
+#define FHSS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#define FHSS_TYPE           0xF7
+#define FHSS_MSG_SYNC       1
+#define FHSS_MSG_REPORT     2
+
+#define FHSS_GRID           48      // the firmware's scan grid
+#define FHSS_CH_A           24
+#define FHSS_CH_B           28
+#define FHSS_GAP            4
+#define FHSS_MAX_CANDIDATES (FHSS_GRID / FHSS_GAP)
+#define FHSS_CHANNELS       8
+#define FHSS_MIN_CHANNELS   4
+#define FHSS_GUARD_MS       20      // relock plus how late a SYNC gets time-stamped
+#define FHSS_SYNC_EVERY     4
+#define FHSS_LOST_DWELLS    12
+#define FHSS_PARK_DWELLS    (FHSS_CHANNELS + 2)
+#define FHSS_SWITCH_DWELLS  8       // a new sequence is announced this far ahead
+#define FHSS_REPORT_DWELLS  16
+#define FHSS_BAD_PERCENT    30
+#define FHSS_MIN_FRAMES     8
+#define FHSS_PAROLE_MS      600000
+#define FHSS_MSG_MAX        (16 + 2 * FHSS_MAX_CANDIDATES)
+
+typedef struct fhss_seq {
+    uint32_t from;          // first dwell of the sequence
+    int n;
+    int8_t shift[FHSS_MAX_CANDIDATES];
+} fhss_seq;
+
+typedef struct fhss_channel {
+    int shift;
+    int level;              // RSSI_LEVEL of the last sweep, 0 without one
+    uint32_t ok;            // since the last evaluation, both ends
+    uint32_t bad;
+    uint64_t rx_ok;         // since start, this end
+    uint64_t rx_bad;
+    uint64_t blocked_until_ns;
+} fhss_channel;
+
+typedef struct fhss_stats {
+    uint64_t syncs_tx;
+    uint64_t syncs_rx;
+    uint64_t reports_tx;
+    uint64_t reports_rx;
+    uint64_t acquisitions;
+    uint64_t sync_losses;
+    uint64_t blacklisted;
+    uint64_t sequences;
+} fhss_stats;
+
+typedef struct fhss_ctx {
+    int master;
+    int blacklist;          // 0 keeps the first sequence for good
+    uint64_t dwell_ns;
+    uint64_t guard_ns;
+
+    // Dwell clock: dwell 0 started at origin_ns, the slave's from a SYNC
+    int hopping;
+    uint64_t origin_ns;
+    fhss_seq seq;
+    fhss_seq next;          // next.n == 0: none announced
+    uint32_t last_sync_index;   // +1, 0 none yet
+    uint64_t last_sync_ns;
+    uint32_t report_index;
+    uint64_t last_report_ns;    // master: the slave is listening, +1, 0 never
+    int table_changed;      // the bridge must load the firmware table
+    int clock_changed;      // and align its clock
+
+    // Slave without the clock
+    int park;               // shift to listen on
+    uint64_t park_until_ns;
+    int park_changed;       // the bridge must move the pair there
+
+    int ncand;
+    fhss_channel cand[FHSS_MAX_CANDIDATES];
+    uint64_t rng;
+
+    fhss_stats stats;
+} fhss_ctx;
+
+void fhss_init(fhss_ctx *ctx, int master, int dwell_ms, uint64_t now_ns);
+
+// Master: rank the hop channels by a local sweep; before the first SYNC
+// it also picks the first sequence from it
+void fhss_set_map(fhss_ctx *ctx, const scan_map *map);
+
+// Master: start hopping
+void fhss_start(fhss_ctx *ctx, uint64_t now_ns);
+
+// A control message from the peer, 0 if it is not one
+int  fhss_receive(fhss_ctx *ctx, const uint8_t *msg, int len, uint64_t start_ns, uint64_t now_ns);
+
+// Next control message to send, 0 if there is none
+int  fhss_poll(fhss_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns);
+
+// Every frame out of the deframer, 'ok' if it passed the link stages
+void fhss_rx_frame(fhss_ctx *ctx, int ok, uint64_t start_ns);
+
+// 1 if a frame of 'air_ns' ends before the next hop
+int  fhss_may_send(const fhss_ctx *ctx, uint64_t air_ns, uint64_t now_ns);
+
+// Shift of the pair at 'now_ns', the parking one without hopping
+int  fhss_shift(const fhss_ctx *ctx, uint64_t now_ns);
+uint32_t fhss_index(const fhss_ctx *ctx, uint64_t now_ns);
+
+// Nanoseconds until the next dwell opens or a message is due
+int64_t fhss_time_left(const fhss_ctx *ctx, uint64_t now_ns);
+
+void fhss_print_stats(fhss_ctx *ctx, FILE *out);
+
+#endif
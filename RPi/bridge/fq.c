@@ -0,0 +1,451 @@
+/*
+    Fair queueing with CoDel
+*/
+
+#include <string.h>
+
+#include "fq.h"
+
+static void fq_configure(fq_ctx *ctx)
+{
+    uint64_t air = (uint64_t)ctx->max_packet * 10 * 1000000000ULL / ctx->baud;
+
+    ctx->target_ns = air > FQ_TARGET_MS * 1000000ULL ? air : FQ_TARGET_MS * 1000000ULL;
+    ctx->interval_ns = ctx->target_ns * FQ_INTERVAL_FACTOR;
+    if (ctx->interval_ns < FQ_INTERVAL_MS * 1000000ULL)
+        ctx->interval_ns = FQ_INTERVAL_MS * 1000000ULL;
+
+    ctx->limit = (int)((uint64_t)ctx->baud / 10 * FQ_LIMIT_MS / 1000);
+    if (ctx->limit < FQ_LIMIT_MIN * ctx->max_packet)
+        ctx->limit = FQ_LIMIT_MIN * ctx->max_packet;
+}
+
+void fq_init(fq_ctx *ctx, int baud)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    for (int i = 0; i < FQ_SLOTS; i++)
+        ctx->pkt[i].next = i + 1 < FQ_SLOTS ? i + 1 : -1;
+    for (int i = 0; i < FQ_CLASSES * FQ_FLOWS; i++)
+    {
+        ctx->flow[i].head = ctx->flow[i].tail = -1;
+        ctx->flow[i].cls = i / FQ_FLOWS;
+    }
+    for (int c = 0; c < FQ_CLASSES; c++)
+    {
+        ctx->cls[c].new_head = ctx->cls[c].new_tail = -1;
+        ctx->cls[c].old_head = ctx->cls[c].old_tail = -1;
+        ctx->cls[c].weight = 1;
+    }
+
+    ctx->max_packet = 576;
+    fq_set_rate(ctx, baud);
+}
+
+void fq_set_class(fq_ctx *ctx, int cls, int strict, int weight)
+{
+    ctx->cls[cls].strict = strict;
+    ctx->cls[cls].weight = weight > 0 ? weight : 1;
+}
+
+void fq_set_rate(fq_ctx *ctx, int baud)
+{
+    ctx->baud = baud > 0 ? baud : 1;
+    fq_configure(ctx);
+}
+
+// FNV-1a over addresses, protocol and ports, the ports only for TCP and
+// UDP and not in fragments
+static int fq_classify(const uint8_t *pkt, int len)
+{
+    uint32_t h = 2166136261u;
+    int from = 0, to = 0, l4 = -1, proto = 0;
+
+    if (len >= 20 && pkt[0] >> 4 == 4)
+    {
+        from = 12;
+        to = 20;
+        proto = pkt[9];
+        if (!(((pkt[6] & 0x1F) << 8) | pkt[7]))
+            l4 = (pkt[0] & 0x0F) * 4;
+    }
+    else if (len >= 40 && pkt[0] >> 4 == 6)
+    {
+        from = 8;
+        to = 40;
+        proto = pkt[6];
+        l4 = 40;
+    }
+
+    for (int i = from; i < to; i++)
+        h = (h ^ pkt[i]) * 16777619u;
+    h = (h ^ proto) * 16777619u;
+    if ((proto == 6 || proto == 17) && l4 >= 0 && l4 + 4 <= len)
+        for (int i = l4; i < l4 + 4; i++)
+            h = (h ^ pkt[i]) * 16777619u;
+
+    return (int)(h % FQ_FLOWS);
+}
+
+static void fq_list_push(fq_ctx *ctx, int f, fq_list list)
+{
+    fq_class *c = &ctx->cls[ctx->flow[f].cls];
+    int *head = list == FQ_LIST_NEW ? &c->new_head : &c->old_head;
+    int *tail = list == FQ_LIST_NEW ? &c->new_tail : &c->old_tail;
+
+    ctx->flow[f].list = list;
+    ctx->flow[f].next = -1;
+    if (*tail >= 0)
+        ctx->flow[*tail].next = f;
+    else
+        *head = f;
+    *tail = f;
+}
+
+static void fq_list_pop(fq_ctx *ctx, fq_class *c, fq_list list)
+{
+    int *head = list == FQ_LIST_NEW ? &c->new_head : &c->old_head;
+    int *tail = list == FQ_LIST_NEW ? &c->new_tail : &c->old_tail;
+    int f = *head;
+
+    *head = ctx->flow[f].next;
+    if (*head < 0)
+        *tail = -1;
+    ctx->flow[f].list = FQ_LIST_NONE;
+}
+
+// The head packet of a queue off it, -1 if it is empty
+static int fq_pop(fq_ctx *ctx, fq_flow *f)
+{
+    int s = f->head;
+
+    if (s < 0)
+        return -1;
+
+    f->head = ctx->pkt[s].next;
+    if (f->head < 0)
+        f->tail = -1;
+    f->bytes -= ctx->pkt[s].len;
+    ctx->bytes -= ctx->pkt[s].len;
+    ctx->cls[f->cls].count--;
+    ctx->count--;
+    return s;
+}
+
+static void fq_release(fq_ctx *ctx, int s)
+{
+    ctx->pkt[s].next = ctx->free;
+    ctx->free = s;
+}
+
+// Over the limit or out of slots: the head of the longest queue goes
+static void fq_drop_fattest(fq_ctx *ctx)
+{
+    int fat = 0;
+
+    for (int i = 1; i < FQ_CLASSES * FQ_FLOWS; i++)
+        if (ctx->flow[i].bytes > ctx->flow[fat].bytes)
+            fat = i;
+
+    int s = fq_pop(ctx, &ctx->flow[fat]);
+    if (s >= 0)
+    {
+        fq_release(ctx, s);
+        ctx->cls[ctx->flow[fat].cls].drops++;
+        ctx->stats.overlimit_drops++;
+    }
+}
+
+int fq_enqueue(fq_ctx *ctx, int cls, const uint8_t *pkt, int len, uint64_t now_ns)
+{
+    if (len <= 0 || len > FQ_PKT_MAX || cls < 0 || cls >= FQ_CLASSES)
+        return 0;
+
+    if (len > ctx->max_packet)
+    {
+        ctx->max_packet = len;
+        fq_configure(ctx);
+    }
+
+    while (ctx->count > 0 && (ctx->free < 0 || ctx->bytes + len > ctx->limit))
+        fq_drop_fattest(ctx);
+
+    int i = cls * FQ_FLOWS + fq_classify(pkt, len);
+    fq_flow *f = &ctx->flow[i];
+    int s = ctx->free;
+    fq_pkt *p = &ctx->pkt[s];
+
+    ctx->free = p->next;
+    memcpy(p->buf, pkt, len);
+    p->len = len;
+    p->next = -1;
+    p->enqueued_ns = now_ns;
+
+    if (f->tail >= 0)
+        ctx->pkt[f->tail].next = s;
+    else
+        f->head = s;
+    f->tail = s;
+    f->bytes += len;
+    ctx->bytes += len;
+    ctx->cls[cls].count++;
+    ctx->count++;
+    ctx->stats.enqueued++;
+
+    if (f->list == FQ_LIST_NONE)
+    {
+        f->deficit = FQ_QUANTUM;
+        fq_list_push(ctx, i, FQ_LIST_NEW);
+        ctx->stats.new_flows++;
+    }
+    return 1;
+}
+
+static uint64_t fq_isqrt(uint64_t x)
+{
+    uint64_t r = 0;
+
+    for (uint64_t bit = 1ULL << 62; bit; bit >>= 2)
+    {
+        if (x >= r + bit)
+        {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+            r >>= 1;
+    }
+    return r;
+}
+
+// interval / sqrt(count) on from 't', sqrt(count) in 1/1024ths
+static uint64_t fq_control_law(const fq_ctx *ctx, uint64_t t, uint32_t count)
+{
+    return t + ctx->interval_ns * 1024 / fq_isqrt((uint64_t)count << 20);
+}
+
+// Over target for an interval, with more than a packet left behind it
+static int fq_should_drop(fq_ctx *ctx, fq_flow *f, int s, uint64_t now_ns)
+{
+    if (now_ns - ctx->pkt[s].enqueued_ns < ctx->target_ns || f->bytes <= ctx->max_packet)
+    {
+        f->first_above_ns = 0;
+        return 0;
+    }
+    if (!f->first_above_ns)
+    {
+        f->first_above_ns = now_ns + ctx->interval_ns;
+        return 0;
+    }
+    return now_ns >= f->first_above_ns;
+}
+
+static void fq_codel_drop(fq_ctx *ctx, fq_flow *f, int s)
+{
+    fq_release(ctx, s);
+    ctx->cls[f->cls].drops++;
+    ctx->stats.codel_drops++;
+}
+
+// The next packet of a queue that CoDel lets through, -1 if none is left
+static int fq_codel(fq_ctx *ctx, fq_flow *f, uint64_t now_ns)
+{
+    int s = fq_pop(ctx, f);
+
+    if (s < 0)
+    {
+        f->dropping = 0;
+        return -1;
+    }
+
+    int drop = fq_should_drop(ctx, f, s, now_ns);
+
+    if (f->dropping)
+    {
+        if (!drop)
+            f->dropping = 0;
+        while (f->dropping && now_ns >= f->drop_next_ns)
+        {
+            fq_codel_drop(ctx, f, s);
+            f->drop_count++;
+            if ((s = fq_pop(ctx, f)) < 0)
+            {
+                f->dropping = 0;
+                return -1;
+            }
+            if (!fq_should_drop(ctx, f, s, now_ns))
+                f->dropping = 0;
+            else
+                f->drop_next_ns = fq_control_law(ctx, f->drop_next_ns, f->drop_count);
+        }
+    }
+    else if (drop)
+    {
+        // Back to dropping soon after it stopped: near the old rate
+        uint32_t delta = f->drop_count - f->last_count;
+
+        fq_codel_drop(ctx, f, s);
+        s = fq_pop(ctx, f);
+        f->dropping = 1;
+        f->drop_count = delta > 1 && now_ns - f->drop_next_ns < 16 * ctx->interval_ns ? delta : 1;
+        f->drop_next_ns = fq_control_law(ctx, now_ns, f->drop_count);
+        f->last_count = f->drop_count;
+    }
+
+    return s;
+}
+
+// The next packet of a class, its flows by deficit round robin, new
+// ones first; -1 when CoDel has left none
+static int fq_serve(fq_ctx *ctx, fq_class *c, uint64_t now_ns)
+{
+    for (;;)
+    {
+        fq_list list = c->new_head >= 0 ? FQ_LIST_NEW : FQ_LIST_OLD;
+        int i = list == FQ_LIST_NEW ? c->new_head : c->old_head;
+
+        if (i < 0)
+            return -1;
+
+        fq_flow *f = &ctx->flow[i];
+
+        if (f->deficit <= 0)
+        {
+            f->deficit += FQ_QUANTUM;
+            fq_list_pop(ctx, c, list);
+            fq_list_push(ctx, i, FQ_LIST_OLD);
+            continue;
+        }
+
+        int s = fq_codel(ctx, f, now_ns);
+        if (s < 0)
+        {
+            // An emptied new flow goes round once more as an old one, so
+            // that one that keeps coming back cannot starve the others
+            fq_list_pop(ctx, c, list);
+            if (list == FQ_LIST_NEW && c->old_head >= 0)
+                fq_list_push(ctx, i, FQ_LIST_OLD);
+            continue;
+        }
+
+        f->deficit -= ctx->pkt[s].len;
+        return s;
+    }
+}
+
+// The first strict class with packets, or the weighted one whose turn it
+// is; -1 if none up to 'last' has any
+static int fq_pick(fq_ctx *ctx, int last)
+{
+    int weighted = 0;
+
+    for (int c = 0; c <= last; c++)
+    {
+        if (ctx->cls[c].count > 0 && ctx->cls[c].strict)
+            return c;
+        if (ctx->cls[c].count > 0)
+            weighted = 1;
+    }
+    if (!weighted)
+        return -1;
+
+    for (;;)
+    {
+        fq_class *c = &ctx->cls[ctx->wrr];
+
+        if (ctx->wrr <= last && c->count > 0)
+        {
+            if (c->deficit > 0)
+                return ctx->wrr;
+            c->deficit += c->weight * FQ_QUANTUM;
+        }
+        ctx->wrr = (ctx->wrr + 1) % FQ_CLASSES;
+    }
+}
+
+int fq_dequeue(fq_ctx *ctx, uint8_t *out, int cap, int last, int *cls, uint64_t now_ns)
+{
+    int c;
+
+    if (last >= FQ_CLASSES)
+        last = FQ_CLASSES - 1;
+
+    while ((c = fq_pick(ctx, last)) >= 0)
+    {
+        fq_class *k = &ctx->cls[c];
+        int s = fq_serve(ctx, k, now_ns);
+
+        // An emptied class starts afresh, like a flow
+        if (s < 0)
+        {
+            k->deficit = 0;
+            continue;
+        }
+
+        fq_pkt *p = &ctx->pkt[s];
+        int len = p->len <= cap ? p->len : 0;
+        double sojourn = (now_ns - p->enqueued_ns) / 1e9;
+        int bin = 0;
+
+        memcpy(out, p->buf, len);
+        k->deficit = k->count > 0 && !k->strict ? k->deficit - p->len : 0;
+        fq_release(ctx, s);
+
+        while (bin < FQ_HIST_BINS - 1 && sojourn > fq_hist_bound(bin))
+            bin++;
+        k->hist[bin]++;
+        k->sojourn_sum += sojourn;
+        k->dequeued++;
+        ctx->stats.dequeued++;
+
+        if (len > 0)
+        {
+            *cls = c;
+            return len;
+        }
+    }
+    return 0;
+}
+
+int fq_pending(const fq_ctx *ctx)
+{
+    return ctx->count;
+}
+
+double fq_hist_bound(int i)
+{
+    return 0.001 * (1 << i);
+}
+
+void fq_print_stats(fq_ctx *ctx, FILE *out)
+{
+    fq_stats *s = &ctx->stats;
+
+    fprintf(out, "fq: queued=%d bytes=%d/%d enqueued=%llu dequeued=%llu codel_drops=%llu overlimit_drops=%llu "
+                 "new_flows=%llu target=%llums interval=%llums\n",
+            ctx->count, ctx->bytes, ctx->limit, (unsigned long long)s->enqueued,
+            (unsigned long long)s->dequeued, (unsigned long long)s->codel_drops,
+            (unsigned long long)s->overlimit_drops, (unsigned long long)s->new_flows,
+            (unsigned long long)(ctx->target_ns / 1000000), (unsigned long long)(ctx->interval_ns / 1000000));
+
+    for (int c = 0; c < FQ_CLASSES; c++)
+    {
+        fq_class *k = &ctx->cls[c];
+
+        if (!k->dequeued && !k->drops)
+            continue;
+
+        fprintf(out, "fq: class=%d queued=%d dequeued=%llu drops=%llu sojourn avg=%.0fms", c, k->count,
+                (unsigned long long)k->dequeued, (unsigned long long)k->drops,
+                k->dequeued ? k->sojourn_sum / k->dequeued * 1000.0 : 0.0);
+        for (int i = 0; i < FQ_HIST_BINS; i++)
+            if (k->hist[i])
+            {
+                if (i < FQ_HIST_BINS - 1)
+                    fprintf(out, " <=%.0fms:%llu", fq_hist_bound(i) * 1000.0, (unsigned long long)k->hist[i]);
+                else
+                    fprintf(out, " more:%llu", (unsigned long long)k->hist[i]);
+            }
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,146 @@
+/*
+    Fair queueing with CoDel
+
+    At 9600 baud a second of queue is under a kilobyte; the few hundred
+    kilobytes a bulk transfer keeps in flight are minutes. With -Q the
+    packets the TUN gives the bridge wait here instead of in the tty, and
+    only as much goes down the TX path as keeps the line busy.
+
+    Packets are hashed by addresses, protocol and ports into FQ_FLOWS
+    queues, served by deficit round robin FQ_QUANTUM bytes a round. A
+    flow that had nothing queued goes on the list of new flows, which is
+    served before the old ones: a ping or a keystroke gets past the
+    backlog of a bulk transfer at once (RFC 8290). Every queue runs CoDel
+    (RFC 8289) on the time its packets waited, the sojourn time: once its
+    head has waited longer than 'target' for a whole 'interval', packets
+    are dropped at the head, closer together by 1/sqrt(drops), until the
+    sojourn time is under target again, and the sender backs off.
+
+    The line rate sets the numbers. 'target' is the airtime of the
+    biggest packet seen so far and at least FQ_TARGET_MS, CoDel must not
+    drop for the one packet that is on the line; 'interval' is
+    FQ_INTERVAL_FACTOR targets, at least FQ_INTERVAL_MS; the limit is
+    FQ_LIMIT_MS of line, at least FQ_LIMIT_MIN packets, after which the
+    longest queue loses its head. Call fq_set_rate() when the rate changes.
+
+    The flows belong to FQ_CLASSES classes (cls.h). A strict class is
+    served whenever it has something queued, the lower numbered first;
+    the others share what is left by deficit round robin, 'weight' times
+    FQ_QUANTUM bytes a round each. Within a class the flows are served as
+    above. A dequeue can be kept to the classes up to 'last', for the
+    airtime shaper to let control out while the others wait.
+
+    The sojourn time of every packet that goes out is counted per class
+    in FQ_HIST_BINS power-of-two buckets, under 1 ms, 2 ms ... 32 s and
+    more.
+*/
+
+#ifndef FQ_H
+#define FQ_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "stage.h"
+
+#define FQ_CLASSES          4
+#define FQ_FLOWS            64      // per class
+#define FQ_SLOTS            128
+#define FQ_PKT_MAX          (BRIDGE_BUF_SIZE / 2)   // the TUN read
+#define FQ_QUANTUM          256     // a few small packets, not an Ethernet MTU
+#define FQ_TARGET_MS        5
+#define FQ_INTERVAL_MS      100
+#define FQ_INTERVAL_FACTOR  4
+#define FQ_LIMIT_MS         10000
+#define FQ_LIMIT_MIN        4
+#define FQ_HIST_BINS        17
+
+typedef enum { FQ_LIST_NONE, FQ_LIST_NEW, FQ_LIST_OLD } fq_list;
+
+typedef struct fq_pkt {
+    uint8_t buf[FQ_PKT_MAX];
+    int len;
+    int next;               // in its queue or on the free list, -1 at the end
+    uint64_t enqueued_ns;
+} fq_pkt;
+
+typedef struct fq_flow {
+    int head, tail;         // packets, -1 if empty
+    int bytes;
+    int deficit;
+    fq_list list;
+    int next;               // on its list
+    int cls;
+
+    // CoDel
+    int dropping;
+    uint64_t first_above_ns;    // when the sojourn time has been over target for an interval
+    uint64_t drop_next_ns;
+    uint32_t drop_count;
+    uint32_t last_count;
+} fq_flow;
+
+typedef struct fq_class {
+    int strict;
+    int weight;
+    int deficit;
+    int new_head, new_tail;
+    int old_head, old_tail;
+    int count;
+
+    uint64_t dequeued;
+    uint64_t drops;
+    uint64_t hist[FQ_HIST_BINS];
+    double sojourn_sum;     // seconds
+} fq_class;
+
+typedef struct fq_stats {
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t codel_drops;
+    uint64_t overlimit_drops;
+    uint64_t new_flows;
+} fq_stats;
+
+typedef struct fq_ctx {
+    fq_pkt pkt[FQ_SLOTS];
+    int free;
+    fq_flow flow[FQ_CLASSES * FQ_FLOWS];
+    fq_class cls[FQ_CLASSES];
+    int wrr;                // the weighted class whose turn it is
+
+    int baud;
+    int max_packet;
+    int bytes;              // queued
+    int count;
+    int limit;              // bytes
+    uint64_t target_ns;
+    uint64_t interval_ns;
+
+    fq_stats stats;
+} fq_ctx;
+
+// All classes weighted 1 to start with
+void fq_init(fq_ctx *ctx, int baud);
+
+void fq_set_class(fq_ctx *ctx, int cls, int strict, int weight);
+
+// The line rate, for the target, the interval and the limit
+void fq_set_rate(fq_ctx *ctx, int baud);
+
+// Queues an IP packet in class 'cls'; returns 0 if it is too big to,
+// over the limit another packet is dropped instead
+int  fq_enqueue(fq_ctx *ctx, int cls, const uint8_t *pkt, int len, uint64_t now_ns);
+
+// The next packet of the classes up to 'last' into 'out', its length, 0
+// when they have nothing queued; its class in '*cls'
+int  fq_dequeue(fq_ctx *ctx, uint8_t *out, int cap, int last, int *cls, uint64_t now_ns);
+
+int  fq_pending(const fq_ctx *ctx);
+
+// Upper bound of sojourn time bucket 'i' in seconds, the last is unbounded
+double fq_hist_bound(int i);
+
+void fq_print_stats(fq_ctx *ctx, FILE *out);
+
+#endif
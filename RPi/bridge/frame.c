@@ -0,0 +1,152 @@
+/*
+    InverseG bridge - air framing
+*/
+
+#include <string.h>
+
+#include "frame.h"
+
+uint16_t crc16_ccitt(const uint8_t *data, int len)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+
+    return crc;
+}
+
+uint8_t crc8(const uint8_t *data, int len)
+{
+    uint8_t crc = 0x00;
+
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+
+    return crc;
+}
+
+int frame_header(uint8_t *hdr, int len)
+{
+    if (len <= 0 || len > BRIDGE_BUF_SIZE)
+        return -1;
+
+    hdr[0] = FRAME_SYNC_0;
+    hdr[1] = FRAME_SYNC_1;
+    hdr[2] = (uint8_t)(len >> 8);
+    hdr[3] = (uint8_t)len;
+    hdr[4] = crc8(hdr + 2, 2);
+    return FRAME_HDR_LEN;
+}
+
+int frame_build(uint8_t *out, int cap, const uint8_t *body, int len, int preamble)
+{
+    if (len <= 0 || len > BRIDGE_BUF_SIZE || preamble + FRAME_HDR_LEN + len > cap)
+        return -1;
+
+    memset(out, FRAME_PREAMBLE_BYTE, preamble);
+    frame_header(out + preamble, len);
+    memcpy(out + preamble + FRAME_HDR_LEN, body, len);
+    return preamble + FRAME_HDR_LEN + len;
+}
+
+void deframer_init(deframer *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->state = DEFRAME_HUNT;
+}
+
+int deframer_push(deframer *d, uint8_t byte)
+{
+    switch (d->state)
+    {
+        case DEFRAME_HUNT:
+            if (d->last == FRAME_SYNC_0 && byte == FRAME_SYNC_1)
+            {
+                d->state = DEFRAME_HEADER;
+                d->hdr_pos = 0;
+            }
+            d->last = byte;
+            break;
+
+        case DEFRAME_HEADER:
+            d->hdr[d->hdr_pos++] = byte;
+            if (d->hdr_pos < 3)
+                break;
+
+            d->len = (d->hdr[0] << 8) | d->hdr[1];
+            d->last = 0;
+            if (crc8(d->hdr, 2) != d->hdr[2] || d->len == 0 || d->len > BRIDGE_BUF_SIZE)
+            {
+                d->header_errors++;
+                d->state = DEFRAME_HUNT;
+                break;
+            }
+            d->pos = 0;
+            d->state = DEFRAME_BODY;
+            break;
+
+        case DEFRAME_BODY:
+            d->buf[d->pos++] = byte;
+            if (d->pos == d->len)
+            {
+                d->state = DEFRAME_HUNT;
+                d->frames++;
+                return d->len;
+            }
+            break;
+    }
+
+    return 0;
+}
+
+static int crc_stage_tx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    (void)ctx;
+
+    if (len + 2 > cap)
+        return -1;
+
+    uint16_t crc = crc16_ccitt(buf, len);
+    buf[len]     = (uint8_t)(crc >> 8);
+    buf[len + 1] = (uint8_t)crc;
+
+    return len + 2;
+}
+
+static int crc_stage_rx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    crc_ctx *crc = (crc_ctx *)ctx;
+    (void)cap;
+
+    if (len < 2 || crc16_ccitt(buf, len - 2) != ((buf[len - 2] << 8) | buf[len - 1]))
+    {
+        crc->errors++;
+        return -1;
+    }
+
+    crc->ok++;
+    return len - 2;
+}
+
+static void crc_print_stats(void *ctx, FILE *out)
+{
+    crc_ctx *crc = (crc_ctx *)ctx;
+
+    fprintf(out, "crc: ok=%llu errors=%llu\n",
+            (unsigned long long)crc->ok, (unsigned long long)crc->errors);
+}
+
+stage crc_stage(crc_ctx *ctx)
+{
+    stage s = { "crc", crc_stage_tx, crc_stage_rx, crc_print_stats, ctx, 0 };
+    return s;
+}
@@ -0,0 +1,62 @@
+/*
+    InverseG bridge - air framing
+
+    The tty bytes go straight to the SPIRIT1 in "direct through GPIO" mode,
+    so the receiver sees noise between frames. A frame is:
+
+        preamble (0x55 ...) | sync 0x2D 0xD4 | length (2, BE) | crc8(length) | body
+
+    The body integrity is checked by the CRC stage, which runs before the
+    FEC stage so that corrupted frames can still be repaired.
+*/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define FRAME_PREAMBLE_BYTE 0x55
+#define FRAME_SYNC_0        0x2D
+#define FRAME_SYNC_1        0xD4
+#define FRAME_HDR_LEN       5
+
+typedef enum { DEFRAME_HUNT, DEFRAME_HEADER, DEFRAME_BODY } deframe_state;
+
+typedef struct deframer {
+    deframe_state state;
+    uint8_t last;
+    uint8_t hdr[3];
+    int hdr_pos;
+    int len;
+    int pos;
+    uint8_t buf[BRIDGE_BUF_SIZE];
+
+    uint64_t frames;
+    uint64_t header_errors;
+} deframer;
+
+typedef struct crc_ctx {
+    uint64_t ok;
+    uint64_t errors;
+} crc_ctx;
+
+uint16_t crc16_ccitt(const uint8_t *data, int len);
+uint8_t  crc8(const uint8_t *data, int len);
+
+// Builds a complete air frame into 'out', returns its length or -1
+int  frame_build(uint8_t *out, int cap, const uint8_t *body, int len, int preamble);
+
+// The FRAME_HDR_LEN bytes from the sync word on for a 'len' byte body,
+// or -1; the preamble and the body go out from where they are
+int  frame_header(uint8_t *hdr, int len);
+
+void deframer_init(deframer *d);
+
+// Feeds one received byte, returns the body length once a frame is complete
+int  deframer_push(deframer *d, uint8_t byte);
+
+stage crc_stage(crc_ctx *ctx);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+    GF(2^8) arithmetic for the Reed-Solomon FEC stage
+*/
+
+#include <string.h>
+
+#include "gf256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF_HAVE_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GF_HAVE_NEON 1
+#endif
+
+#define GF_POLY 0x11D
+
+uint8_t gf_exp[512];
+uint8_t gf_log[256];
+
+// Split-nibble product tables: c * x == tbl_lo[c][x & 0x0F] ^ tbl_hi[c][x >> 4]
+static uint8_t tbl_lo[256][16] __attribute__((aligned(16)));
+static uint8_t tbl_hi[256][16] __attribute__((aligned(16)));
+
+typedef void (*region_fn)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int add);
+
+static region_fn region = 0;
+static gf_backend backend_in_use = GF_SCALAR;
+
+static void region_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int add)
+{
+    const uint8_t *lo = tbl_lo[c];
+    const uint8_t *hi = tbl_hi[c];
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t p = lo[src[i] & 0x0F] ^ hi[src[i] >> 4];
+        dst[i] = add ? (dst[i] ^ p) : p;
+    }
+}
+
+#ifdef GF_HAVE_X86
+__attribute__((target("ssse3")))
+static void region_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int add)
+{
+    const __m128i tlo  = _mm_load_si128((const __m128i *)tbl_lo[c]);
+    const __m128i thi  = _mm_load_si128((const __m128i *)tbl_hi[c]);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i x  = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_and_si128(x, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+        __m128i p  = _mm_xor_si128(_mm_shuffle_epi8(tlo, lo), _mm_shuffle_epi8(thi, hi));
+
+        if (add)
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *)(dst + i)));
+        _mm_storeu_si128((__m128i *)(dst + i), p);
+    }
+
+    region_scalar(dst + i, src + i, c, len - i, add);
+}
+
+__attribute__((target("avx2")))
+static void region_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int add)
+{
+    const __m256i tlo  = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)tbl_lo[c]));
+    const __m256i thi  = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)tbl_hi[c]));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i x  = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i lo = _mm256_and_si256(x, mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi64(x, 4), mask);
+        __m256i p  = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, lo), _mm256_shuffle_epi8(thi, hi));
+
+        if (add)
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *)(dst + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), p);
+    }
+
+    // Finish with VEX-encoded 128-bit ops, calling the SSSE3 kernel here
+    // would pay an AVX/SSE transition penalty on every row
+    const __m128i tlo128  = _mm256_castsi256_si128(tlo);
+    const __m128i thi128  = _mm256_castsi256_si128(thi);
+    const __m128i mask128 = _mm_set1_epi8(0x0F);
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i x  = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_and_si128(x, mask128);
+        __m128i hi = _mm_and_si128(_mm_srli_epi64(x, 4), mask128);
+        __m128i p  = _mm_xor_si128(_mm_shuffle_epi8(tlo128, lo), _mm_shuffle_epi8(thi128, hi));
+
+        if (add)
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *)(dst + i)));
+        _mm_storeu_si128((__m128i *)(dst + i), p);
+    }
+
+    _mm256_zeroupper();
+    region_scalar(dst + i, src + i, c, len - i, add);
+}
+#endif
+
+#ifdef GF_HAVE_NEON
+static void region_neon(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int add)
+{
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+    size_t i = 0;
+
+#if defined(__aarch64__)
+    const uint8x16_t tlo = vld1q_u8(tbl_lo[c]);
+    const uint8x16_t thi = vld1q_u8(tbl_hi[c]);
+
+    for (; i + 16 <= len; i += 16)
+    {
+        uint8x16_t x = vld1q_u8(src + i);
+        uint8x16_t p = veorq_u8(vqtbl1q_u8(tlo, vandq_u8(x, mask)),
+                                vqtbl1q_u8(thi, vshrq_n_u8(x, 4)));
+        if (add)
+            p = veorq_u8(p, vld1q_u8(dst + i));
+        vst1q_u8(dst + i, p);
+    }
+#else
+    // ARMv7 (32-bit Raspberry Pi OS): VTBL works on 8-byte halves
+    const uint8x8x2_t tlo = { { vld1_u8(tbl_lo[c]), vld1_u8(tbl_lo[c] + 8) } };
+    const uint8x8x2_t thi = { { vld1_u8(tbl_hi[c]), vld1_u8(tbl_hi[c] + 8) } };
+
+    for (; i + 16 <= len; i += 16)
+    {
+        uint8x16_t x  = vld1q_u8(src + i);
+        uint8x16_t lo = vandq_u8(x, mask);
+        uint8x16_t hi = vshrq_n_u8(x, 4);
+        uint8x16_t p  = vcombine_u8(
+            veor_u8(vtbl2_u8(tlo, vget_low_u8(lo)),  vtbl2_u8(thi, vget_low_u8(hi))),
+            veor_u8(vtbl2_u8(tlo, vget_high_u8(lo)), vtbl2_u8(thi, vget_high_u8(hi))));
+        if (add)
+            p = veorq_u8(p, vld1q_u8(dst + i));
+        vst1q_u8(dst + i, p);
+    }
+#endif
+
+    region_scalar(dst + i, src + i, c, len - i, add);
+}
+#endif
+
+void gf_init(void)
+{
+    int x = 1;
+
+    if (region)
+        return;
+
+    for (int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = (uint8_t)x;
+        gf_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    for (int i = 255; i < 512; i++)
+        gf_exp[i] = gf_exp[i - 255];
+    gf_log[0] = 0; // never used, gf_mul() checks for zero
+
+    for (int c = 0; c < 256; c++)
+    {
+        for (int n = 0; n < 16; n++)
+        {
+            tbl_lo[c][n] = gf_mul((uint8_t)c, (uint8_t)n);
+            tbl_hi[c][n] = gf_mul((uint8_t)c, (uint8_t)(n << 4));
+        }
+    }
+
+    region = region_scalar;
+    gf_set_backend(GF_AVX2);
+#ifdef GF_HAVE_NEON
+    gf_set_backend(GF_NEON);
+#endif
+}
+
+gf_backend gf_set_backend(gf_backend backend)
+{
+    region = region_scalar;
+    backend_in_use = GF_SCALAR;
+
+#ifdef GF_HAVE_X86
+    __builtin_cpu_init();
+    if (backend == GF_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+        region = region_avx2;
+        backend_in_use = GF_AVX2;
+    }
+    else if ((backend == GF_AVX2 || backend == GF_SSSE3) && __builtin_cpu_supports("ssse3"))
+    {
+        region = region_ssse3;
+        backend_in_use = GF_SSSE3;
+    }
+#endif
+
+#ifdef GF_HAVE_NEON
+    if (backend == GF_NEON)
+    {
+        region = region_neon;
+        backend_in_use = GF_NEON;
+    }
+#endif
+
+    return backend_in_use;
+}
+
+const char *gf_backend_name(void)
+{
+    switch (backend_in_use)
+    {
+        case GF_SSSE3: return "ssse3";
+        case GF_AVX2:  return "avx2";
+        case GF_NEON:  return "neon";
+        default:       return "scalar";
+    }
+}
+
+void gf_mul_region(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if (c == 0)
+        memset(dst, 0, len);
+    else if (c == 1)
+        memmove(dst, src, len);
+    else if (len < 16)
+        region_scalar(dst, src, c, len, 0);
+    else
+        region(dst, src, c, len, 0);
+}
+
+void gf_mul_add_region(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if (c == 0)
+        return;
+    else if (c == 1)
+        gf_add_region(dst, src, len);
+    else if (len < 16)
+        region_scalar(dst, src, c, len, 1);
+    else
+        region(dst, src, c, len, 1);
+}
+
+void gf_add_region(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; i++)
+        dst[i] ^= src[i];
+}
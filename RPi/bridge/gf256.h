@@ -0,0 +1,57 @@
+/*
+    GF(2^8) arithmetic for the Reed-Solomon FEC stage
+
+    Field polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D), generator alpha = 2.
+    The region operations multiply a whole buffer by a constant and are
+    implemented with the split-nibble table lookup (PSHUFB / TBL), with
+    SSSE3, AVX2 and NEON kernels and a scalar fallback.
+*/
+
+#ifndef GF256_H
+#define GF256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum { GF_SCALAR, GF_SSSE3, GF_AVX2, GF_NEON } gf_backend;
+
+extern uint8_t gf_exp[512];
+extern uint8_t gf_log[256];
+
+void gf_init(void);
+
+// Selects a kernel; falls back to scalar when the CPU lacks it. Returns the one in use.
+gf_backend gf_set_backend(gf_backend backend);
+const char *gf_backend_name(void);
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+        return 0;
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+static inline uint8_t gf_pow(uint8_t a, int n)
+{
+    if (a == 0)
+        return 0;
+    return gf_exp[(gf_log[a] * n) % 255];
+}
+
+// dst[i] = c * src[i]  (dst may be equal to src)
+void gf_mul_region(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+// dst[i] ^= c * src[i]
+void gf_mul_add_region(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+// dst[i] ^= src[i]
+void gf_add_region(uint8_t *dst, const uint8_t *src, size_t len);
+
+#endif
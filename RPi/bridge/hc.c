@@ -0,0 +1,656 @@
+/*
+    ROHC-style IPv4/UDP and IPv4/TCP header compression stage
+
+    Compressed packet: 0b10ffffff cid msn crc8, then the fields selected by
+    the flags, always in this order:
+
+        HC_F_IPID   IP ID (2)                   else previous + MSN delta
+        HC_F_IPHDR  TOS, TTL, flags/frag (4)    else unchanged
+        UDP/TCP checksum (2)
+        TCP only:
+        TCP flags (1)
+        widths (1)                  2 bits each for seq, ack, TSval, TSecr
+        seq (0, 1, 2 or 4)          against previous seq + payload
+        ack (0, 1, 2 or 4)
+        HC_F_WIN    window (2)                  else unchanged
+        urgent pointer (2, only with URG; 0 without, else an IR)
+        HC_F_TS     TSval, TSecr (0, 1, 2 or 4 each) of a NOP NOP timestamp
+                    option that starts the options
+        the rest of the TCP options (verbatim)
+
+    followed by the payload.
+
+    The decompressor is not told which packets the link lost, so nothing
+    is sent against the previous packet alone. The compressor keeps the
+    last HC_WINDOW headers it sent and sends a field when it differs from
+    any of them; seq, ack and the timestamps are sent with as few low bits
+    (0, 8, 16 or all 32, the width code) as decode right against every one
+    of them (W-LSB). Up to HC_WINDOW - 1 packets in a row can be lost
+    before a header decodes wrong; the CRC8 then catches it.
+
+    The UDP/TCP checksum is carried verbatim like in ROHC: it is the
+    end-to-end check behind the CRC8 should a damaged context decompress
+    to a wrong header.
+*/
+
+#include <string.h>
+
+#include "frame.h"
+#include "hc.h"
+
+#define HC_TYPE_IR          0xFE
+#define HC_TYPE_FEEDBACK    0xFD
+#define HC_TYPE_COMP        0x80
+#define HC_TYPE_MASK        0xC0
+
+#define HC_F_IPID   0x01
+#define HC_F_IPHDR  0x02
+#define HC_F_TS     0x04
+#define HC_F_WIN    0x10
+
+#define IPPROTO_TCP_ 6
+#define IPPROTO_UDP_ 17
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_URG 0x20
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static const int wlsb_bytes[4] = { 0, 1, 2, 4 };
+
+// Width code for a value whose distance to the references is 'lo'..'hi'
+static int wlsb_code(int32_t lo, int32_t hi)
+{
+    if (lo == 0 && hi == 0)
+        return 0;
+    if (lo >= -128 && hi <= 127)
+        return 1;
+    if (lo >= -32768 && hi <= 32767)
+        return 2;
+    return 3;
+}
+
+static int wlsb_put(uint8_t *p, int code, uint32_t value)
+{
+    if (code == 1)
+        p[0] = (uint8_t)value;
+    else if (code == 2)
+        put16(p, (uint16_t)value);
+    else if (code == 3)
+        put32(p, value);
+    return wlsb_bytes[code];
+}
+
+// The value closest to 'ref' with the low bits sent
+static uint32_t wlsb_get(const uint8_t *p, int code, uint32_t ref)
+{
+    if (code == 1)
+        return ref + (uint32_t)(int8_t)(uint8_t)(p[0] - (uint8_t)ref);
+    if (code == 2)
+        return ref + (uint32_t)(int16_t)(uint16_t)(get16(p) - (uint16_t)ref);
+    if (code == 3)
+        return get32(p);
+    return ref;
+}
+
+static uint32_t csum_add(uint32_t sum, const uint8_t *p, int len)
+{
+    int i = 0;
+
+    for (; i + 1 < len; i += 2)
+        sum += get16(p + i);
+    if (len & 1)
+        sum += p[len - 1] << 8;
+
+    return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16_t)~sum;
+}
+
+static int l4_csum_off(const uint8_t *pkt)
+{
+    return pkt[9] == IPPROTO_TCP_ ? 36 : 26;
+}
+
+// Returns the IP + UDP/TCP header length of a compressible packet, else 0
+static int hc_parse(const uint8_t *p, int len)
+{
+    if (len < 28 || p[0] != 0x45 || get16(p + 2) != len)
+        return 0;
+    if ((get16(p + 6) & 0x3FFF) != 0)
+        return 0;
+    if (csum_fold(csum_add(0, p, 20)) != 0)
+        return 0;
+
+    if (p[9] == IPPROTO_UDP_)
+        return get16(p + 24) == len - 20 ? 28 : 0;
+
+    if (p[9] == IPPROTO_TCP_ && len >= 40)
+    {
+        int hdr_len = 20 + (p[32] >> 4) * 4;
+        if (hdr_len >= 40 && hdr_len <= len && hdr_len <= HC_MAX_HDR)
+            return hdr_len;
+    }
+
+    return 0;
+}
+
+static uint32_t hc_seq_next(const uint8_t *pkt, int hdr_len, int len)
+{
+    uint32_t seq = get32(pkt + 24) + (uint32_t)(len - hdr_len);
+
+    if (pkt[33] & TCP_SYN)
+        seq++;
+    if (pkt[33] & TCP_FIN)
+        seq++;
+
+    return seq;
+}
+
+static void hc_context_update(hc_context *c, const uint8_t *pkt, int hdr_len, int len, uint8_t msn)
+{
+    memcpy(c->hdr, pkt, hdr_len);
+    c->hdr_len = hdr_len;
+    c->msn  = msn;
+    c->ipid = get16(pkt + 4);
+    if (pkt[9] == IPPROTO_TCP_)
+        c->seq_next = hc_seq_next(pkt, hdr_len, len);
+}
+
+static int hc_same_flow(const hc_context *c, const uint8_t *pkt)
+{
+    return c->valid && c->hdr[9] == pkt[9] &&
+           memcmp(c->hdr + 12, pkt + 12, 12) == 0; // addresses and ports
+}
+
+static void hc_queue_feedback(hc_ctx *ctx, uint8_t cid)
+{
+    for (int i = 0; i < ctx->nfeedback; i++)
+        if (ctx->feedback[i] == cid)
+            return;
+
+    if (ctx->nfeedback < HC_MAX_FEEDBACK)
+        ctx->feedback[ctx->nfeedback++] = cid;
+}
+
+// The fields of a header the compressor sends against the window
+static void hc_ref_of(hc_ref *r, const uint8_t *pkt, int hdr_len, int len)
+{
+    memset(r, 0, sizeof(*r));
+    r->tos  = pkt[1];
+    r->ttl  = pkt[8];
+    r->ipid = get16(pkt + 4);
+    r->frag = get16(pkt + 6);
+    if (pkt[9] != IPPROTO_TCP_)
+        return;
+
+    r->seq_next = hc_seq_next(pkt, hdr_len, len);
+    r->ack = get32(pkt + 28);
+    r->win = get16(pkt + 34);
+    r->ts  = hdr_len >= 52 && pkt[40] == 1 && pkt[41] == 1 && pkt[42] == 8 && pkt[43] == 10;
+    if (r->ts)
+    {
+        r->tsval = get32(pkt + 44);
+        r->tsecr = get32(pkt + 48);
+    }
+}
+
+static void hc_push_ref(hc_context *c, const uint8_t *pkt, int hdr_len, int len)
+{
+    hc_ref *r = &c->ref[c->ref_next];
+
+    hc_ref_of(r, pkt, hdr_len, len);
+    r->msn = c->msn;
+    c->ref_next = (c->ref_next + 1) % HC_WINDOW;
+    if (c->nref < HC_WINDOW)
+        c->nref++;
+}
+
+void hc_init(hc_ctx *ctx, int refresh)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->refresh = refresh > 0 ? refresh : HC_REFRESH;
+}
+
+int hc_compress(hc_ctx *ctx, uint8_t *buf, int len, int cap)
+{
+    uint8_t tmp[HC_MAX_HDR + 32];
+    int hdr_len = hc_parse(buf, len);
+    int cid = -1;
+    int n = 4;
+    uint8_t flags = 0;
+
+    if (hdr_len == 0)
+    {
+        ctx->passthrough++;
+        return len;
+    }
+
+    // Flow lookup, evicting the least recently used context on a miss
+    for (int i = 0; i < HC_MAX_CONTEXTS; i++)
+    {
+        if (hc_same_flow(&ctx->comp[i], buf))
+        {
+            cid = i;
+            break;
+        }
+        if (cid < 0 || ctx->comp[i].last_use < ctx->comp[cid].last_use)
+            cid = i;
+    }
+
+    hc_context *c = &ctx->comp[cid];
+    if (!hc_same_flow(c, buf))
+    {
+        memset(c, 0, sizeof(*c));
+        c->valid = 1;
+        c->need_ir = 1;
+    }
+
+    c->last_use = ++ctx->clock;
+    c->stats.packets++;
+    c->stats.hdr_in += hdr_len;
+
+    uint8_t msn = (uint8_t)(c->msn + 1);
+    int tcp = buf[9] == IPPROTO_TCP_;
+
+    int odd_urg = tcp && !(buf[33] & TCP_URG) && get16(buf + 38);
+
+    if (c->need_ir || ++c->since_ir >= ctx->refresh || hdr_len != c->hdr_len || odd_urg || len + 3 > cap)
+    {
+        if (len + 3 > cap)
+        {
+            ctx->passthrough++;
+            return len;
+        }
+
+        // Headers of another length decode against none of the old ones
+        if (hdr_len != c->hdr_len)
+            c->nref = c->ref_next = 0;
+        hc_context_update(c, buf, hdr_len, len, msn);
+        hc_push_ref(c, buf, hdr_len, len);
+        c->need_ir  = 0;
+        c->since_ir = 0;
+        c->stats.irs++;
+        c->stats.hdr_out += hdr_len + 3;
+
+        memmove(buf + 3, buf, len);
+        buf[0] = HC_TYPE_IR;
+        buf[1] = (uint8_t)cid;
+        buf[2] = msn;
+        return len + 3;
+    }
+
+    // A field goes out unless every header in the window would give it,
+    // the W-LSB ones with enough bits for the farthest
+    hc_ref now;
+    int same_ipid = 1, same_iphdr = 1, same_win = 1, ts;
+    int32_t lo[4] = { 0 }, hi[4] = { 0 };
+
+    hc_ref_of(&now, buf, hdr_len, len);
+    ts = tcp && now.ts;
+    for (int i = 0; i < c->nref; i++)
+    {
+        const hc_ref *r = &c->ref[i];
+        int32_t d[4] = { (int32_t)(get32(buf + 24) - r->seq_next), (int32_t)(now.ack - r->ack),
+                         (int32_t)(now.tsval - r->tsval), (int32_t)(now.tsecr - r->tsecr) };
+
+        same_ipid  = same_ipid && now.ipid == (uint16_t)(r->ipid + (uint8_t)(msn - r->msn));
+        same_iphdr = same_iphdr && now.tos == r->tos && now.ttl == r->ttl && now.frag == r->frag;
+        same_win   = same_win && now.win == r->win;
+        ts = ts && r->ts;
+        for (int k = 0; k < 4; k++)
+        {
+            lo[k] = d[k] < lo[k] ? d[k] : lo[k];
+            hi[k] = d[k] > hi[k] ? d[k] : hi[k];
+        }
+    }
+
+    if (!same_ipid)
+    {
+        flags |= HC_F_IPID;
+        memcpy(tmp + n, buf + 4, 2);
+        n += 2;
+    }
+
+    if (!same_iphdr)
+    {
+        flags |= HC_F_IPHDR;
+        tmp[n++] = buf[1];
+        tmp[n++] = buf[8];
+        memcpy(tmp + n, buf + 6, 2);
+        n += 2;
+    }
+
+    memcpy(tmp + n, buf + l4_csum_off(buf), 2);
+    n += 2;
+
+    if (tcp)
+    {
+        int code[4], opt = 40;
+
+        for (int k = 0; k < 4; k++)
+            code[k] = k < 2 || ts ? wlsb_code(lo[k], hi[k]) : 0;
+
+        tmp[n++] = buf[33];
+        tmp[n++] = (uint8_t)(code[0] | code[1] << 2 | code[2] << 4 | code[3] << 6);
+        n += wlsb_put(tmp + n, code[0], get32(buf + 24));
+        n += wlsb_put(tmp + n, code[1], now.ack);
+
+        if (!same_win)
+        {
+            flags |= HC_F_WIN;
+            memcpy(tmp + n, buf + 34, 2);
+            n += 2;
+        }
+
+        if (buf[33] & TCP_URG)
+        {
+            memcpy(tmp + n, buf + 38, 2);
+            n += 2;
+        }
+
+        if (ts)
+        {
+            flags |= HC_F_TS;
+            n += wlsb_put(tmp + n, code[2], now.tsval);
+            n += wlsb_put(tmp + n, code[3], now.tsecr);
+            opt = 52;
+        }
+
+        memcpy(tmp + n, buf + opt, hdr_len - opt);
+        n += hdr_len - opt;
+    }
+
+    tmp[0] = HC_TYPE_COMP | flags;
+    tmp[1] = (uint8_t)cid;
+    tmp[2] = msn;
+    tmp[3] = crc8(buf, hdr_len);
+
+    hc_context_update(c, buf, hdr_len, len, msn);
+    hc_push_ref(c, buf, hdr_len, len);
+    c->stats.hdr_out += n;
+
+    memmove(buf + n, buf + hdr_len, len - hdr_len);
+    memcpy(buf, tmp, n);
+
+    return len - hdr_len + n;
+}
+
+static int hc_decompress_ir(hc_ctx *ctx, uint8_t *buf, int len)
+{
+    if (len < 3 || buf[1] >= HC_MAX_CONTEXTS)
+        return -1;
+
+    hc_context *d = &ctx->decomp[buf[1]];
+    uint8_t msn = buf[2];
+
+    len -= 3;
+    memmove(buf, buf + 3, len);
+
+    int hdr_len = hc_parse(buf, len);
+    if (hdr_len == 0)
+        return -1;
+
+    hc_context_update(d, buf, hdr_len, len, msn);
+    d->valid   = 1;
+    d->damaged = 0;
+    d->drops   = 0;
+    d->stats.packets++;
+    d->stats.irs++;
+    d->stats.hdr_in  += hdr_len + 3;
+    d->stats.hdr_out += hdr_len;
+
+    return len;
+}
+
+static int hc_context_lost(hc_ctx *ctx, hc_context *d, uint8_t cid)
+{
+    // Ask again every few drops in case the feedback itself was lost
+    if (d->drops++ % 8 == 0)
+        hc_queue_feedback(ctx, cid);
+
+    return -1;
+}
+
+int hc_decompress(hc_ctx *ctx, uint8_t *buf, int len, int cap)
+{
+    uint8_t hdr[HC_MAX_HDR];
+
+    if (len < 1)
+        return len;
+
+    if (buf[0] == HC_TYPE_FEEDBACK)
+    {
+        if (len >= 2 && buf[1] < HC_MAX_CONTEXTS)
+            ctx->comp[buf[1]].need_ir = 1;
+        ctx->feedback_rx++;
+        return 0;
+    }
+
+    if (buf[0] == HC_TYPE_IR)
+        return hc_decompress_ir(ctx, buf, len);
+
+    if ((buf[0] & HC_TYPE_MASK) != HC_TYPE_COMP)
+        return len;
+
+    if (len < 4 || buf[1] >= HC_MAX_CONTEXTS)
+        return -1;
+
+    uint8_t flags = buf[0];
+    uint8_t cid   = buf[1];
+    uint8_t msn   = buf[2];
+    uint8_t crc   = buf[3];
+    hc_context *d = &ctx->decomp[cid];
+    int n = 4;
+
+    if (!d->valid || d->damaged)
+    {
+        ctx->no_context++;
+        return hc_context_lost(ctx, d, cid);
+    }
+
+    int hdr_len = d->hdr_len;
+    int tcp = d->hdr[9] == IPPROTO_TCP_;
+
+    memcpy(hdr, d->hdr, hdr_len);
+
+#define HC_NEED(x) do { if (n + (x) > len) return -1; } while (0)
+
+    if (flags & HC_F_IPID)
+    {
+        HC_NEED(2);
+        memcpy(hdr + 4, buf + n, 2);
+        n += 2;
+    }
+    else
+        put16(hdr + 4, (uint16_t)(d->ipid + (uint8_t)(msn - d->msn)));
+
+    if (flags & HC_F_IPHDR)
+    {
+        HC_NEED(4);
+        hdr[1] = buf[n++];
+        hdr[8] = buf[n++];
+        memcpy(hdr + 6, buf + n, 2);
+        n += 2;
+    }
+
+    HC_NEED(2);
+    memcpy(hdr + l4_csum_off(hdr), buf + n, 2);
+    n += 2;
+
+    if (tcp)
+    {
+        int opt = 40, code[4];
+
+        HC_NEED(2);
+        hdr[33] = buf[n++];
+        for (int k = 0; k < 4; k++)
+            code[k] = buf[n] >> (2 * k) & 3;
+        n++;
+
+        HC_NEED(wlsb_bytes[code[0]] + wlsb_bytes[code[1]]);
+        put32(hdr + 24, wlsb_get(buf + n, code[0], d->seq_next));
+        n += wlsb_bytes[code[0]];
+        put32(hdr + 28, wlsb_get(buf + n, code[1], get32(d->hdr + 28)));
+        n += wlsb_bytes[code[1]];
+
+        if (flags & HC_F_WIN)
+        {
+            HC_NEED(2);
+            memcpy(hdr + 34, buf + n, 2);
+            n += 2;
+        }
+
+        put16(hdr + 38, 0);
+        if (hdr[33] & TCP_URG)
+        {
+            HC_NEED(2);
+            memcpy(hdr + 38, buf + n, 2);
+            n += 2;
+        }
+
+        if (flags & HC_F_TS)
+        {
+            if (hdr_len < 52)
+                return -1;
+            HC_NEED(wlsb_bytes[code[2]] + wlsb_bytes[code[3]]);
+            hdr[40] = hdr[41] = 1;
+            hdr[42] = 8;
+            hdr[43] = 10;
+            put32(hdr + 44, wlsb_get(buf + n, code[2], get32(d->hdr + 44)));
+            n += wlsb_bytes[code[2]];
+            put32(hdr + 48, wlsb_get(buf + n, code[3], get32(d->hdr + 48)));
+            n += wlsb_bytes[code[3]];
+            opt = 52;
+        }
+
+        HC_NEED(hdr_len - opt);
+        memcpy(hdr + opt, buf + n, hdr_len - opt);
+        n += hdr_len - opt;
+    }
+
+#undef HC_NEED
+
+    int payload = len - n;
+    int total = hdr_len + payload;
+    if (total > cap)
+        return -1;
+
+    put16(hdr + 2, (uint16_t)total);
+    put16(hdr + 10, 0);
+    put16(hdr + 10, csum_fold(csum_add(0, hdr, 20)));
+    if (!tcp)
+        put16(hdr + 24, (uint16_t)(total - 20));
+
+    memmove(buf + hdr_len, buf + n, payload);
+    memcpy(buf, hdr, hdr_len);
+
+    if (crc8(buf, hdr_len) != crc)
+    {
+        ctx->crc_failures++;
+        d->damaged = 1;
+        return hc_context_lost(ctx, d, cid);
+    }
+
+    hc_context_update(d, buf, hdr_len, total, msn);
+    d->stats.packets++;
+    d->stats.hdr_in  += n;
+    d->stats.hdr_out += hdr_len;
+
+    return total;
+}
+
+int hc_take_feedback(hc_ctx *ctx, uint8_t *buf, int cap)
+{
+    if (ctx->nfeedback == 0 || cap < 2)
+        return 0;
+
+    buf[0] = HC_TYPE_FEEDBACK;
+    buf[1] = ctx->feedback[0];
+
+    ctx->nfeedback--;
+    memmove(ctx->feedback, ctx->feedback + 1, ctx->nfeedback);
+
+    return 2;
+}
+
+void hc_print_stats(void *ctx, FILE *out)
+{
+    hc_ctx *hc = (hc_ctx *)ctx;
+
+    fprintf(out, "hc: passthrough=%llu crc_failures=%llu no_context=%llu feedback_rx=%llu\n",
+            (unsigned long long)hc->passthrough, (unsigned long long)hc->crc_failures,
+            (unsigned long long)hc->no_context, (unsigned long long)hc->feedback_rx);
+
+    for (int i = 0; i < HC_MAX_CONTEXTS; i++)
+    {
+        const hc_context *c = &hc->comp[i];
+        if (!c->valid)
+            continue;
+
+        fprintf(out, "  tx cid=%-2d %s %u.%u.%u.%u:%u > %u.%u.%u.%u:%u packets=%llu irs=%llu hdr %llu -> %llu bytes (%.1f%%)\n",
+                i, c->hdr[9] == IPPROTO_TCP_ ? "tcp" : "udp",
+                c->hdr[12], c->hdr[13], c->hdr[14], c->hdr[15], get16(c->hdr + 20),
+                c->hdr[16], c->hdr[17], c->hdr[18], c->hdr[19], get16(c->hdr + 22),
+                (unsigned long long)c->stats.packets, (unsigned long long)c->stats.irs,
+                (unsigned long long)c->stats.hdr_in, (unsigned long long)c->stats.hdr_out,
+                c->stats.hdr_in ? 100.0 * c->stats.hdr_out / c->stats.hdr_in : 0.0);
+    }
+
+    for (int i = 0; i < HC_MAX_CONTEXTS; i++)
+    {
+        const hc_context *d = &hc->decomp[i];
+        if (!d->valid)
+            continue;
+
+        fprintf(out, "  rx cid=%-2d packets=%llu irs=%llu hdr %llu -> %llu bytes%s\n",
+                i, (unsigned long long)d->stats.packets, (unsigned long long)d->stats.irs,
+                (unsigned long long)d->stats.hdr_in, (unsigned long long)d->stats.hdr_out,
+                d->damaged ? " (damaged)" : "");
+    }
+}
+
+static int hc_stage_tx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    return hc_compress((hc_ctx *)ctx, buf, len, cap);
+}
+
+static int hc_stage_rx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    return hc_decompress((hc_ctx *)ctx, buf, len, cap);
+}
+
+stage hc_stage(hc_ctx *ctx)
+{
+    stage s = { "hc", hc_stage_tx, hc_stage_rx, hc_print_stats, ctx, 0 };
+    return s;
+}
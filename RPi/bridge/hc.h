@@ -0,0 +1,113 @@
+/*
+    ROHC-style IPv4/UDP and IPv4/TCP header compression stage
+
+    Packets of a flow (addresses, protocol, ports) share a context on both
+    ends, identified by a one byte CID. Packet formats on the link:
+
+        0x4X ...                        uncompressed IPv4 (or anything else)
+        0xFE cid msn <ip packet>        IR: initializes / refreshes a context
+        0xFD cid                        feedback: the decompressor lost the context
+        0b10ffffff cid msn crc8 ...     compressed header, see hc.c for the fields
+
+    Static fields are never sent, the IP ID is inferred from the MSN, the
+    TCP sequence and ack numbers and timestamps go as W-LSB low bits, and
+    the lengths and the IP checksum are rebuilt. What is sent decodes
+    against any of the last HC_WINDOW headers, so a lost packet costs only
+    itself. A CRC8 over the original header catches a stale context; the
+    decompressor then sends feedback and drops the flow's packets until the
+    next IR, which is also sent periodically.
+
+    Headers on the link (bridge_bench hc): UDP 28 -> about 6 bytes, TCP
+    with timestamps 52 -> about 13 bytes, for data and pure ACKs alike.
+    With the radio framing on top, that is x1.58 packets/s for 20-byte UDP
+    telemetry, x2.66 for pure ACKs, and x1.32 for 100-byte TCP segments,
+    whose payload dominates. 10% link loss delivers 90% of the packets.
+*/
+
+#ifndef HC_H
+#define HC_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define HC_MAX_CONTEXTS     16
+#define HC_MAX_HDR          80
+#define HC_REFRESH          64
+#define HC_MAX_FEEDBACK     8
+#define HC_WINDOW           8
+
+typedef struct hc_flow_stats {
+    uint64_t packets;
+    uint64_t irs;
+    uint64_t hdr_in;        // original header bytes
+    uint64_t hdr_out;       // header bytes on the link
+} hc_flow_stats;
+
+// What the compressor sent in one header, for the decompressor to have
+// decoded against
+typedef struct hc_ref {
+    uint8_t msn;
+    uint8_t tos;
+    uint8_t ttl;
+    int ts;                 // options start with NOP NOP timestamp
+    uint16_t ipid;
+    uint16_t frag;
+    uint16_t win;
+    uint32_t seq_next;
+    uint32_t ack;
+    uint32_t tsval;
+    uint32_t tsecr;
+} hc_ref;
+
+typedef struct hc_context {
+    int valid;
+    int damaged;
+    int need_ir;
+    int since_ir;
+    int drops;
+    uint8_t msn;
+    uint16_t ipid;
+    uint32_t seq_next;
+    uint64_t last_use;
+
+    uint8_t hdr[HC_MAX_HDR];
+    int hdr_len;
+
+    // Compressor: the last HC_WINDOW headers sent
+    hc_ref ref[HC_WINDOW];
+    int nref;
+    int ref_next;
+
+    hc_flow_stats stats;
+} hc_context;
+
+typedef struct hc_ctx {
+    int refresh;
+    uint64_t clock;
+
+    hc_context comp[HC_MAX_CONTEXTS];
+    hc_context decomp[HC_MAX_CONTEXTS];
+
+    uint8_t feedback[HC_MAX_FEEDBACK];
+    int nfeedback;
+
+    uint64_t passthrough;
+    uint64_t crc_failures;
+    uint64_t no_context;
+    uint64_t feedback_rx;
+} hc_ctx;
+
+void hc_init(hc_ctx *ctx, int refresh);
+
+int  hc_compress(hc_ctx *ctx, uint8_t *buf, int len, int cap);
+int  hc_decompress(hc_ctx *ctx, uint8_t *buf, int len, int cap);
+
+// Feedback the decompressor wants sent back to the peer; returns 0 when none
+int  hc_take_feedback(hc_ctx *ctx, uint8_t *buf, int cap);
+
+void hc_print_stats(void *ctx, FILE *out);
+
+stage hc_stage(hc_ctx *ctx);
+
+#endif
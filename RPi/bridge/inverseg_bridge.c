@@ -0,0 +1,2440 @@
+//
+// Compile with: gcc -Wall -O2 -o inverseg_bridge inverseg_bridge.c stage.c frame.c fec.c gf256.c hc.c lz.c agg.c arq.c tty.c rate.c radio.c metrics.c scan.c tdma.c fhss.c mesh.c bond.c div.c pn9.c aes.c pbuf.c fq.c cls.c pf.c
+//
+
+/*
+    InverseG bridge
+
+    Replaces pppd. IP packets read from the TUN interface go through the
+    packet stages (header and payload compression), are optionally
+    aggregated per next hop, optionally sequenced by a selective-repeat
+    ARQ, then go through the link stages (CRC, FEC) and are framed
+    straight onto the tty which drives the SPIRIT1 "direct through GPIO"
+    TX/RX pins.
+
+    A packet is not copied on its way down: it stays in the buffer the TUN
+    read put it in, every header goes into the room kept in front of it
+    and the preamble and the frame go to the tty in one writev() (pbuf.h,
+    bridge_bench path).
+
+    RPi:
+        sudo ./inverseg_bridge -t /dev/ttyUSB0 -b 9600 -H -a 512 -f 32
+        sudo ip addr add 10.0.5.2 peer 10.0.5.1 dev inversg
+        sudo ip link set inversg up
+
+    Host:
+        sudo ./inverseg_bridge -t /dev/ttyUSB0 -b 9600 -H -a 512 -f 32
+        sudo ip addr add 10.0.5.1 peer 10.0.5.2 dev inversg
+        sudo ip link set inversg up
+
+    With -c (the STM32 stdio UART) and -R master / -R slave on the other
+    end, the two bridges move the radios up and down a ladder of data
+    rate and filter profiles together, see rate.h. Adding -S minutes
+    has them sweep the band together that often and move the duplex pair
+    to quieter channels when there are any, see scan.h.
+
+    Persistent TX owns the channel, fine for one pair. With -L the radio
+    listens before it talks: every frame is keyed over RTS, the SPIRIT1
+    CSMA engine checks the channel and the firmware answers with CTS, so
+    several nodes can share a frequency (bridge_bench mac). With -T they
+    take turns instead: node 0 sends a beacon every superframe and hands
+    out the slots, the others send only in theirs, see tdma.h and
+    bridge_bench tdma.
+
+    With -F master / -F slave the pair hops over up to eight channel pairs
+    of the scan grid on a shared pseudo-random sequence, the firmware does
+    the hops on its own dwell timer and the master drops channels that
+    lose too many frames, see fhss.h and bridge_bench fhss.
+
+    With -M id,net[,gateway] the node joins a mesh: node N has address
+    net.N on a /24 and packets for nodes out of range are relayed by the
+    nodes in between, on routes by airtime (mesh.h, bridge_bench mesh).
+    Give the interface the /24 instead of a peer:
+
+        sudo ip addr add 10.0.5.3/24 dev inversg
+
+    With -B tty[:baud],... the frames are spread over several radios, each
+    on its own tty, in proportion to what each link carries and put back
+    in order at the far end; a link that loses too many frames is left
+    out until it recovers (bond.h, bridge_bench bond). The first link is
+    -t at -b, the far end lists its ttys in the same order:
+
+        sudo ./inverseg_bridge -t /dev/ttyUSB0 -B /dev/ttyUSB2:4800 -a 512
+
+    With -V tty the TX radio of the board receives too, on the RX radio's
+    channel and its own antenna, and is only keyed over RTS/CTS for our
+    frames. Its GPIO_3 goes to a second USB serial port, 'tty'. Of the two
+    copies of a frame the combiner keeps the one that passed the CRC with
+    the fewest FEC corrections, then the best RSSI (div.h, bridge_bench
+    div). The far end numbers its frames for it with -V -.
+
+    With -m port the bridge serves its counters and the radio telemetry
+    the firmware samples (RSSI, LQI, PQI/SQI, AFC, MC_STATE, see radio.h)
+    in the Prometheus text format on 127.0.0.1:port, with the FC_OFFSET
+    the firmware keeps the RX radio on the far end's carrier with.
+
+    With -W the body of every air frame is whitened with the SPIRIT1's
+    PN9 sequence, as the chip does in packet mode and not in direct mode,
+    so long runs of equal bytes do not pull the receiver's slicer off
+    (pn9.h, bridge_bench whiten). Both ends need it.
+
+    With -K id,keyfile every air frame is encrypted and authenticated
+    with AES-128 CCM under the key in 'keyfile', 32 hex digits, the same
+    on every node; 'id' is this node's, 0..15 and different on each.
+    Forged, corrupted and replayed frames are dropped (aes.h, bridge_bench
+    aes). The frame counter is kept in 'keyfile'.counter, the directory
+    has to be writable. Generate a key with
+
+        head -c 16 /dev/urandom | xxd -p > inverseg.key
+
+    With -Q the packets from the TUN wait in fair queues with CoDel
+    instead of in the tty, a queue per flow, and go down the TX path no
+    faster than the line takes them: a ping gets past a bulk transfer's
+    backlog, and the bulk sender is told to slow down by drops long before
+    its packets are minutes old (fq.h, bridge_bench fq). The queues follow
+    the rate of the link profile, or of all bonded links. The packets are
+    put in classes first, control and interactive ahead of everything,
+    default and bulk sharing the rest 3:1, by port, protocol or DSCP and
+    the rules given with -P; a token bucket in airtime, frame overheads
+    and all, lets out -U percent of the line at most (cls.h, bridge_bench
+    cls).
+
+    -X keeps the chatter of the LAN off the air: the packets from the TUN
+    go through the rules in a file first, which drop them, or let a few
+    through, by protocol, port, ICMP type and destination (pf.h).
+
+    Send SIGUSR1 to print the per-stage statistics. SIGHUP stops the
+    bridge like SIGTERM, or with -X reads the filter rules again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+#include "stage.h"
+#include "tty.h"
+#include "frame.h"
+#include "fec.h"
+#include "hc.h"
+#include "lz.h"
+#include "agg.h"
+#include "arq.h"
+#include "rate.h"
+#include "radio.h"
+#include "scan.h"
+#include "tdma.h"
+#include "fhss.h"
+#include "mesh.h"
+#include "bond.h"
+#include "div.h"
+#include "pn9.h"
+#include "aes.h"
+#include "pbuf.h"
+#include "fq.h"
+#include "cls.h"
+#include "pf.h"
+#include "metrics.h"
+
+#define TUN_TAP_IFACE_NAME  "inversg"
+#define COM_PORT_NAME       "/dev/ttyUSB0"
+#define COM_PORT_RATE       9600
+#define PREAMBLE_LEN        4
+#define PREAMBLE_MAX        256
+#define AGG_BUSY_POLL_MS    5
+#define LBT_WAIT_MS         250     // longer than the firmware's KEY_TIMEOUT_US
+#define LBT_PRESCALER       32
+#define LBT_MAX_BO          4
+#define TDMA_SLOTS          8
+#define TDMA_SLOT_MS        400     // three 100 byte frames at 9600 baud
+#define TDMA_GUARD_MS       20      // plus the turnaround the firmware measures
+#define FHSS_DWELL_MS       800     // a 512 byte aggregate at 9600 baud
+#define FHSS_SWEEP_WAIT_MS  2000    // master: hops on a blind sequence after this
+#define TELEMETRY_MS        5000
+#define DRIFT_MS            60000   // one drift history entry a minute
+#define METRICS_BUF_SIZE    32768
+#define FQ_BACKLOG_MS       20      // in the tty before the next packet leaves the queues
+
+// The TX radio: a keyed frame waiting for CTS, or a frame on air that
+// has to be off the line before RTS drops or the next hop
+typedef enum { AIR_IDLE, AIR_KEYING, AIR_SENDING } air_state;
+
+typedef struct bridge {
+    int tun_fd;
+    int tty_fd;
+    int link_fd[BOND_MAX_LINKS];    // link_fd[0] is tty_fd, the bonded links or the
+                                    // second receiver follow
+    int preamble;
+
+    pipeline pkt_pipe;      // per IP packet
+    pipeline link_pipe;     // per air frame
+    hc_ctx *hc;
+    agg_ctx *agg;
+    arq_ctx *arq;           // between aggregation and the link stages
+    rate_ctx *rate;
+    scan_ctx *scan;
+    tdma_ctx *tdma;
+    fhss_ctx *fhss;
+    uint64_t fhss_start_ns;     // master: when to start hopping without a sweep
+    mesh_ctx *mesh;
+    bond_ctx *bond;
+    div_ctx *div;
+    fq_ctx *fq;
+    cls_ctx *cls;           // with the fair queues
+    cls_shaper shaper;
+    pf_ctx *pf;
+    radio_link *radio;
+    uint64_t radio_query_ns;
+    uint64_t telemetry_ns;
+    uint64_t drift_ns;
+    int baud;
+    int lbt;                // key every frame over RTS/CTS
+    int keyed;              // -L or -T
+    pbuf_pool pool;         // the TX path's buffers
+    pbuf *held;             // a frame waiting for our TDMA slot, the next dwell or the radio
+    air_state air;
+    pbuf *air_frame;        // keying: the frame
+    uint64_t air_ns;        // keying: given up at; sending: off the line at
+    uint64_t rx_start_ns;   // when the frame being delivered started on air
+
+    // Only read for the metrics export
+    deframer *d;
+    crc_ctx *crc;
+    fec_ctx *fec;
+    aes_ctx *aes;
+
+    uint64_t tun_packets;
+    uint64_t tx_frames;
+    uint64_t rx_frames;
+    uint64_t tx_drops;
+    uint64_t rx_drops;
+    uint64_t lbt_busy;      // frames the channel never cleared for
+    uint64_t held_frames;   // frames that waited for a slot, a dwell or the radio
+    uint64_t held_late;     // dropped, one was waiting already
+} bridge;
+
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t dump_stats = 0;
+static volatile sig_atomic_t reload = 0;
+
+static int tun_tap_iface_create(const char *name, int type)
+{
+    struct ifreq ifr;
+    int fd;
+    int ret;
+
+    if (( fd = open("/dev/net/tun", O_RDWR) ) < 0)
+    {
+        fprintf(stderr, "error: open(/dev/net/tun): %s\n", strerror(errno));
+        return fd;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+
+    ifr.ifr_flags = type;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+    if (( ret = ioctl(fd, TUNSETIFF, (void *)&ifr) ) < 0)
+    {
+        fprintf(stderr, "error: ioctl(TUNSETIFF): %s\n", strerror(errno));
+        close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_all(int fd, const uint8_t *data, int len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "error: write(): %s\n", strerror(errno));
+            return;
+        }
+        data += n;
+        len  -= n;
+    }
+}
+
+// The RX radio's FC_OFFSET and the entries where it moved
+static void bridge_print_drift(bridge *br, FILE *out)
+{
+    const radio_drift *d = &br->radio->drift;
+
+    fprintf(out, "drift: tracking=%s fc_offset=%d (%+.0f Hz) trims=%u reversals=%u\n",
+            d->on ? "on" : "off", d->fc_offset, d->fc_offset * RADIO_FC_STEP_HZ, d->trims, d->reversals);
+    for (int i = 0; i < d->n; i++)
+        if (i == 0 || i == d->n - 1 || d->e[i].fc_offset != d->e[i - 1].fc_offset)
+            fprintf(out, "drift: %ds ago fc_offset=%d (%+.0f Hz) afc=%.1f samples=%d\n",
+                    -d->e[i].age_s, d->e[i].fc_offset, d->e[i].fc_offset * RADIO_FC_STEP_HZ,
+                    d->e[i].afc_avg, d->e[i].samples);
+}
+
+static void bridge_print_stats(bridge *br, FILE *out)
+{
+    fprintf(out, "bridge: tun_packets=%llu tx_frames=%llu rx_frames=%llu tx_drops=%llu rx_drops=%llu\n",
+            (unsigned long long)br->tun_packets, (unsigned long long)br->tx_frames,
+            (unsigned long long)br->rx_frames, (unsigned long long)br->tx_drops,
+            (unsigned long long)br->rx_drops);
+    fprintf(out, "pbuf: in_use=%d high_water=%d/%d allocs=%llu exhausted=%llu\n",
+            br->pool.in_use, br->pool.high_water, PBUF_POOL_SIZE,
+            (unsigned long long)br->pool.allocs, (unsigned long long)br->pool.exhausted);
+    if (br->radio)
+    {
+        bridge_print_drift(br, out);
+        for (int i = 0; i < br->radio->npools; i++)
+        {
+            const radio_pool *p = &br->radio->pool[i];
+
+            fprintf(out, "firmware pool: %s %dx%d in_use=%u high_water=%u allocs=%u exhausted=%u\n",
+                    p->name, p->blocks, p->block_size, p->in_use, p->high_water, p->allocs, p->exhausted);
+        }
+    }
+    if (br->lbt)
+        fprintf(out, "lbt: busy=%llu firmware requests=%u granted=%u busy=%u timeouts=%u\n",
+                (unsigned long long)br->lbt_busy, br->radio->lbt[0], br->radio->lbt[1],
+                br->radio->lbt[2], br->radio->lbt[3]);
+
+    pipeline_print_stats(&br->pkt_pipe, out);
+    if (br->agg)
+        agg_print_stats(br->agg, out);
+    if (br->arq)
+        arq_print_stats(br->arq, out);
+    if (br->rate)
+        rate_print_stats(br->rate, out);
+    if (br->scan)
+    {
+        scan_print_stats(br->scan, out);
+        if (br->radio->scan.n > 0)
+            scan_print_map(&br->radio->scan, out);
+    }
+    if (br->tdma)
+    {
+        tdma_print_stats(br->tdma, out);
+        fprintf(out, "tdma: held=%llu late=%llu firmware granted=%u overruns=%u turnaround=%uus\n",
+                (unsigned long long)br->held_frames, (unsigned long long)br->held_late,
+                br->radio->lbt[1], br->radio->lbt[4], br->radio->lbt[5]);
+    }
+    if (br->mesh)
+        mesh_print_stats(br->mesh, out);
+    if (br->fq)
+    {
+        fq_print_stats(br->fq, out);
+        cls_print_stats(br->cls, &br->shaper, out);
+    }
+    if (br->pf)
+        pf_print_stats(br->pf, out);
+    if (br->bond)
+        bond_print_stats(br->bond, out);
+    if (br->div)
+        div_print_stats(br->div, out);
+    if (br->fhss)
+    {
+        fhss_print_stats(br->fhss, out);
+        fprintf(out, "fhss: held=%llu late=%llu\n",
+                (unsigned long long)br->held_frames, (unsigned long long)br->held_late);
+    }
+    pipeline_print_stats(&br->link_pipe, out);
+}
+
+// Airtime of 'len' bytes on the tty, 10 bits each
+static uint64_t bridge_air_ns(bridge *br, int len)
+{
+    return (uint64_t)len * 10 * 1000000000ULL / br->baud;
+}
+
+// A buffer from the pool for a packet of ours, NULL when none is left
+static pbuf *bridge_pbuf(bridge *br)
+{
+    return pbuf_alloc(&br->pool);
+}
+
+// The preamble from a constant and the frame from its buffer, in one go
+static void bridge_write_frame(bridge *br, int link, const pbuf *p)
+{
+    static const uint8_t preamble[PREAMBLE_MAX] = { [0 ... PREAMBLE_MAX - 1] = FRAME_PREAMBLE_BYTE };
+    struct iovec iov[2] = {
+        { (void *)preamble, (size_t)br->preamble },
+        { p->data, (size_t)p->len },
+    };
+    struct iovec *v = iov;
+    int n = 2;
+
+    while (n > 0)
+    {
+        ssize_t w = writev(br->link_fd[link], v, n);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "error: writev(): %s\n", strerror(errno));
+            return;
+        }
+        for (; n > 0 && (size_t)w >= v->iov_len; v++, n--)
+            w -= v->iov_len;
+        if (n > 0)
+        {
+            v->iov_base = (uint8_t *)v->iov_base + w;
+            v->iov_len -= w;
+        }
+    }
+}
+
+static void bridge_air_write(bridge *br, int link, const pbuf *p)
+{
+    uint64_t air = bridge_air_ns(br, br->preamble + p->len), now = now_ns();
+
+    bridge_write_frame(br, link, p);
+    br->tx_frames++;
+
+    // Off the line before RTS drops or the hop that fhss_may_send()
+    // planned for, bridge_air_service() sees to it
+    if (br->keyed || br->fhss)
+    {
+        br->air = AIR_SENDING;
+        br->air_ns = now + air;
+    }
+    if (br->tdma)
+        tdma_sent(br->tdma, air, now);
+}
+
+// Keyed, the frame waits in its buffer with RTS up until the firmware
+// finds the channel clear or the slot open, bridge_air_service() watches
+// CTS. The loop goes on meanwhile.
+static void bridge_air(bridge *br, int link, pbuf *p)
+{
+    if (!br->keyed)
+    {
+        bridge_air_write(br, link, p);
+        return;
+    }
+
+    pbuf_ref(p);
+    br->air_frame = p;
+    br->air = AIR_KEYING;
+    br->air_ns = now_ns() + LBT_WAIT_MS * 1000000ULL;
+    tty_set_rts(br->tty_fd, 1);
+}
+
+// Link stages and the frame header, in front of the packet where it is.
+// Returns the frame length on air, the preamble with it, or 0.
+static int bridge_build(bridge *br, pbuf *p)
+{
+    if (br->div)
+        p->len = div_send(br->div, &p->data, p->len);
+    if (p->len > 0)
+        p->len = pipeline_tx(&br->link_pipe, &p->data, p->len, pbuf_cap(p));
+    if (p->len <= 0 || frame_header(p->data - FRAME_HDR_LEN, p->len) < 0 || !pbuf_push(p, FRAME_HDR_LEN))
+    {
+        br->tx_drops++;
+        return 0;
+    }
+
+    return br->preamble + p->len;
+}
+
+// Bytes that go in front of a packet on its way out, at most: the stage
+// headers, the mesh, ARQ, bond and diversity ones and the frame header
+static int bridge_headroom(bridge *br)
+{
+    return pipeline_headroom(&br->pkt_pipe) + (br->mesh ? MESH_HDR_LEN : 0) +
+           (br->arq ? ARQ_HDR_LEN + ARQ_SACK_LEN : 0) + (br->bond ? BOND_HDR_LEN : 0) +
+           (br->div ? DIV_HDR_LEN : 0) + pipeline_headroom(&br->link_pipe) + FRAME_HDR_LEN;
+}
+
+// 1 if a frame of 'len' bytes ends inside our TDMA slot or before the hop
+static int bridge_may_send(bridge *br, int len)
+{
+    uint64_t air = bridge_air_ns(br, len), now = now_ns();
+
+    return (!br->tdma || tdma_may_send(br->tdma, air, now)) &&
+           (!br->fhss || fhss_may_send(br->fhss, air, now));
+}
+
+static void bridge_xmit_on(bridge *br, int link, pbuf *p)
+{
+    int len = bridge_build(br, p);
+    if (len <= 0)
+        return;
+
+    // Longer than a dwell, it would wait for good
+    if (br->fhss && br->fhss->hopping &&
+        bridge_air_ns(br, len) + 2 * br->fhss->guard_ns > br->fhss->dwell_ns)
+    {
+        br->tx_drops++;
+        return;
+    }
+
+    // Outside our slot, too close to a hop or with the radio busy with
+    // another frame it waits in its buffer, the TUN is not read meanwhile
+    if (br->air != AIR_IDLE || !bridge_may_send(br, len))
+    {
+        if (br->held)
+        {
+            br->held_late++;
+            br->tx_drops++;
+            return;
+        }
+        pbuf_ref(p);
+        br->held = p;
+        br->held_frames++;
+        return;
+    }
+
+    bridge_air(br, link, p);
+}
+
+// The held frame, once its slot or dwell has come and the radio is free
+static void bridge_send_held(bridge *br)
+{
+    if (br->held && br->air == AIR_IDLE && bridge_may_send(br, br->preamble + br->held->len))
+    {
+        bridge_air(br, 0, br->held);
+        pbuf_unref(&br->pool, br->held);
+        br->held = 0;
+    }
+}
+
+// Nothing held for a slot or a hop and no frame keying or on the air: the
+// next frame goes at once. Anything sent otherwise is held, and a second
+// one dropped, so the loops that send bursts stop here and go on once the
+// air is free; what they have not sent stays where it is.
+static int bridge_air_free(bridge *br)
+{
+    return !br->held && br->air == AIR_IDLE;
+}
+
+// The keyed frame onto the line once CTS is up, or dropped when the
+// channel never clears: the ARQ or the next packet tries again. RTS drops
+// once the tty is empty and the frame's airtime is over, the adapter may
+// still hold bytes when the kernel has none. Returns the poll timeout in
+// ms.
+static int bridge_air_service(bridge *br)
+{
+    uint64_t now = now_ns();
+
+    if (br->air == AIR_KEYING && tty_cts(br->tty_fd))
+    {
+        pbuf *p = br->air_frame;
+
+        br->air_frame = 0;
+        bridge_air_write(br, 0, p);
+        pbuf_unref(&br->pool, p);
+    }
+    else if (br->air == AIR_KEYING && now >= br->air_ns)
+    {
+        tty_set_rts(br->tty_fd, 0);
+        pbuf_unref(&br->pool, br->air_frame);
+        br->air_frame = 0;
+        br->air = AIR_IDLE;
+        br->lbt_busy++;
+    }
+    if (br->air == AIR_SENDING && now >= br->air_ns && tty_pending(br->tty_fd) == 0)
+    {
+        if (br->keyed)
+            tty_set_rts(br->tty_fd, 0);
+        br->air = AIR_IDLE;
+    }
+    bridge_send_held(br);
+
+    // CTS has no edge poll() could wait for
+    now = now_ns();
+    if (br->air == AIR_KEYING)
+        return 1;
+    if (br->air == AIR_SENDING)
+        return br->air_ns > now ? (int)((br->air_ns - now) / 1000000) + 1 : 1;
+    return 1000;
+}
+
+static void bridge_xmit(bridge *br, pbuf *p)
+{
+    int link = 0;
+
+    if (br->bond && (p->len = bond_send(br->bond, &p->data, p->len, &link)) < 0)
+    {
+        br->tx_drops++;
+        return;
+    }
+
+    bridge_xmit_on(br, link, p);
+}
+
+// Every bonded link with less than BOND_BACKLOG_MS in its tty, the ones
+// left out do not count
+static int bridge_bond_room(bridge *br)
+{
+    for (int i = 0; i < br->bond->nlinks; i++)
+    {
+        const bond_link *l = &br->bond->link[i];
+
+        if (l->up && (uint64_t)tty_pending(br->link_fd[i]) * 10 * 1000 / l->baud > BOND_BACKLOG_MS)
+            return 0;
+    }
+    return 1;
+}
+
+// ARQ window space, no frame waiting for a window and room on the bonded
+// links, the TUN is not read otherwise
+static int bridge_can_send(bridge *br)
+{
+    return (!br->arq || arq_can_send(br->arq)) && bridge_air_free(br) && (!br->bond || bridge_bond_room(br));
+}
+
+// Something still going out on every link
+static int bridge_busy(bridge *br)
+{
+    for (int i = 0; i < (br->bond ? br->bond->nlinks : 1); i++)
+        if (tty_pending(br->link_fd[i]) == 0)
+            return 0;
+    return 1;
+}
+
+static void bridge_send_frame(bridge *br, pbuf *p)
+{
+    if (br->arq && (p->len = arq_send(br->arq, &p->data, p->len, now_ns())) < 0)
+    {
+        br->tx_drops++;
+        return;
+    }
+
+    bridge_xmit(br, p);
+}
+
+// Retransmissions and pure ACKs. Returns the poll timeout in ms.
+static int bridge_arq_service(bridge *br)
+{
+    uint64_t now = now_ns();
+    pbuf *p = 0;
+
+    if (!br->arq)
+        return 1000;
+
+    // arq_poll() takes the ACK and counts the retransmission as sent
+    while (bridge_air_free(br) && (p = bridge_pbuf(br)) &&
+           (p->len = arq_poll(br->arq, p->data, pbuf_cap(p), now)) > 0)
+    {
+        bridge_xmit(br, p);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+
+    // bridge_air_service() wakes the loop when the air is free again
+    if (!bridge_air_free(br))
+        return 1000;
+
+    int64_t left = arq_time_left(br->arq, now);
+    if (left < 0 || left >= 1000000000LL)
+        return 1000;
+
+    return (int)(left / 1000000) + 1;
+}
+
+static void bridge_flush(bridge *br, int hop, agg_reason reason)
+{
+    pbuf *p = bridge_pbuf(br);
+
+    if (!p)
+        return;
+
+    p->len = agg_take(br->agg, hop, p->data, pbuf_cap(p), reason);
+    if (p->len > 0)
+        bridge_send_frame(br, p);
+    pbuf_unref(&br->pool, p);
+}
+
+// Into the aggregation queue of 'hop', or straight on
+static void bridge_queue(bridge *br, pbuf *p, int hop)
+{
+    if (!br->agg)
+    {
+        bridge_send_frame(br, p);
+        return;
+    }
+
+    if (!agg_add(br->agg, hop, p->data, p->len, now_ns()))
+    {
+        bridge_flush(br, hop, AGG_FLUSH_FULL);
+        agg_add(br->agg, hop, p->data, p->len, now_ns());
+    }
+    // With the air or the ARQ window taken by the flush above,
+    // bridge_agg_service() sends it
+    if (agg_is_full(br->agg, hop) && bridge_can_send(br))
+        bridge_flush(br, hop, AGG_FLUSH_FULL);
+}
+
+static void bridge_send(bridge *br, pbuf *p, int hop)
+{
+    p->len = pipeline_tx(&br->pkt_pipe, &p->data, p->len, pbuf_cap(p));
+    if (p->len <= 0)
+    {
+        if (p->len < 0)
+            br->tx_drops++;
+        return;
+    }
+
+    bridge_queue(br, p, hop);
+}
+
+// The destination comes from the IP header before the packet stages
+// squeeze it, the mesh header goes on after them
+static void bridge_mesh_send(bridge *br, pbuf *p)
+{
+    int dst = mesh_ip_dst(br->mesh, p->data, p->len);
+
+    p->len = pipeline_tx(&br->pkt_pipe, &p->data, p->len, pbuf_cap(p));
+    if (p->len > 0)
+        p->len = mesh_encap(br->mesh, &p->data, p->len, dst);
+    if (p->len <= 0)
+    {
+        br->tx_drops++;
+        return;
+    }
+
+    bridge_queue(br, p, p->data[2] % AGG_MAX_HOPS);
+}
+
+// Relayed as it came in, the packet stages stay out of it
+static void bridge_mesh_forward(bridge *br, const uint8_t *pkt, int len)
+{
+    pbuf *p;
+
+    if (len > BRIDGE_BUF_SIZE / 2 || !(p = bridge_pbuf(br)))
+    {
+        br->tx_drops++;
+        return;
+    }
+
+    memcpy(p->data, pkt, len);
+    p->len = len;
+    bridge_queue(br, p, p->data[2] % AGG_MAX_HOPS);
+    pbuf_unref(&br->pool, p);
+}
+
+// Flushes the full queues, and those whose oldest packet has waited
+// max_delay once the radio has nothing left to send, a frame at a time
+// while the air is free. Returns the poll timeout in ms.
+static int bridge_agg_service(bridge *br)
+{
+    uint64_t now = now_ns();
+    int busy = -1;
+    int timeout = 1000;
+
+    if (!br->agg || !bridge_can_send(br))
+        return timeout;
+
+    for (int hop = 0; hop < AGG_MAX_HOPS; hop++)
+    {
+        int64_t left = agg_time_left(br->agg, hop, now);
+        int ms;
+
+        if (left < 0)
+            continue;
+        if (!bridge_can_send(br))
+            return 1000;
+        if (agg_is_full(br->agg, hop))
+        {
+            bridge_flush(br, hop, AGG_FLUSH_FULL);
+            busy = 1;
+            continue;
+        }
+
+        if (left == 0)
+        {
+            if (busy < 0)
+                busy = bridge_busy(br);
+            if (!busy)
+            {
+                bridge_flush(br, hop, AGG_FLUSH_DELAY);
+                busy = 1;
+                continue;
+            }
+            ms = AGG_BUSY_POLL_MS;
+        }
+        else
+            ms = (int)(left / 1000000) + 1;
+
+        if (ms < timeout)
+            timeout = ms;
+    }
+
+    return timeout;
+}
+
+static void bridge_tun_send(bridge *br, pbuf *p)
+{
+    if (br->mesh)
+        bridge_mesh_send(br, p);
+    else
+        bridge_send(br, p, 0);
+}
+
+// The packet goes down the TX path in the buffer it is read into, or
+// into the fair queues
+static void bridge_tun_event(bridge *br)
+{
+    pbuf *p = bridge_pbuf(br);
+
+    if (!p)
+        return;
+
+    p->len = read(br->tun_fd, p->data, BRIDGE_BUF_SIZE / 2);
+    if (p->len > 0)
+    {
+        br->tun_packets++;
+        if (br->pf && !pf_filter(br->pf, p->data, p->len, now_ns()))
+        {
+            pbuf_unref(&br->pool, p);
+            return;
+        }
+        if (br->fq)
+        {
+            int c = cls_classify(br->cls, p->data, p->len);
+
+            if (!fq_enqueue(br->fq, c, p->data, p->len, now_ns()))
+                br->tx_drops++;
+        }
+        else
+            bridge_tun_send(br, p);
+    }
+    pbuf_unref(&br->pool, p);
+}
+
+// Bytes a second the fair queues drain at, all bonded links that are up
+static int bridge_line_rate(bridge *br)
+{
+    int baud = 0;
+
+    for (int i = 0; br->bond && i < br->bond->nlinks; i++)
+        if (br->bond->link[i].up)
+            baud += br->bond->link[i].baud;
+    return baud > 0 ? baud : br->baud;
+}
+
+// Milliseconds of frames still in the tty, the longest of the links
+static int bridge_backlog_ms(bridge *br)
+{
+    int worst = 0;
+
+    for (int i = 0; i < (br->bond ? br->bond->nlinks : 1); i++)
+    {
+        int baud = br->bond ? br->bond->link[i].baud : br->baud;
+        int ms = (int)((uint64_t)tty_pending(br->link_fd[i]) * 10 * 1000 / baud);
+
+        if ((!br->bond || br->bond->link[i].up) && ms > worst)
+            worst = ms;
+    }
+    return worst;
+}
+
+// What a packet costs on air with the stages and options in use
+static cls_link bridge_cls_link(bridge *br)
+{
+    cls_link l = { bridge_line_rate(br), br->preamble + FRAME_HDR_LEN, 0, 0, 0, 0 };
+
+    // The ARQ header as it is when it carries a SACK, the longest
+    l.frame_bytes += (br->crc ? 2 : 0) + (br->aes ? AES_OVERHEAD : 0) + (br->arq ? ARQ_HDR_LEN + ARQ_SACK_LEN : 0) +
+                     (br->bond ? BOND_HDR_LEN : 0) + (br->div ? DIV_HDR_LEN : 0) + (br->agg ? 1 : 0);
+    l.packet_bytes = (br->agg ? AGG_SUB_OVERHEAD : 0) + (br->mesh ? MESH_HDR_LEN : 0);
+    l.agg_size = br->agg ? br->agg->max_size : 0;
+    if (br->fec)
+    {
+        l.fec_data = 255 - br->fec->nsym;
+        l.fec_parity = br->fec->nsym;
+    }
+    return l;
+}
+
+// Packets out of the fair queues while the TX path takes them, the tty
+// is about to run dry and the airtime is there, control regardless of
+// the airtime. Returns the poll timeout in ms.
+static int bridge_fq_service(bridge *br)
+{
+    pbuf *p = 0;
+    int backlog = 0, c;
+    int64_t debt = 0;
+
+    if (!br->fq)
+        return 1000;
+
+    if (br->fq->baud != bridge_line_rate(br))
+        fq_set_rate(br->fq, bridge_line_rate(br));
+    br->shaper.link = bridge_cls_link(br);
+
+    while (fq_pending(br->fq) > 0 && bridge_can_send(br) && (backlog = bridge_backlog_ms(br)) <= FQ_BACKLOG_MS &&
+           (p = bridge_pbuf(br)) &&
+           (p->len = fq_dequeue(br->fq, p->data, pbuf_cap(p), cls_allowed(&br->shaper, now_ns()), &c, now_ns())) > 0)
+    {
+        cls_charge(&br->shaper, c, p->len);
+        bridge_tun_send(br, p);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+
+    if (fq_pending(br->fq) == 0 || !bridge_can_send(br))
+        return 1000;
+    if (backlog > FQ_BACKLOG_MS)
+        return backlog - FQ_BACKLOG_MS + 1;
+    if ((debt = cls_time_left(&br->shaper, now_ns())) > 0)
+        return (int)(debt / 1000000) + 1;
+    return 1;
+}
+
+// Header compression feedback travels back over the link like a packet.
+// What the busy air leaves queued goes after the next frame received,
+// the flow it is about keeps sending.
+static void bridge_send_feedback(bridge *br)
+{
+    pbuf *p = 0;
+
+    while (br->hc && bridge_air_free(br) && (p = bridge_pbuf(br)) &&
+           (p->len = hc_take_feedback(br->hc, p->data, pbuf_cap(p))) > 0)
+    {
+        bridge_send(br, p, 0);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+}
+
+// Both ends change profile together: what is queued goes out on the old one
+static void bridge_set_profile(bridge *br, int profile)
+{
+    for (int hop = 0; br->agg && hop < AGG_MAX_HOPS; hop++)
+        bridge_flush(br, hop, AGG_FLUSH_DELAY);
+
+    tty_set_baud(br->tty_fd, rate_profiles[profile].baud);
+    br->baud = rate_profiles[profile].baud;
+    if (br->div && br->div->nbranches > 1)
+        tty_set_baud(br->link_fd[1], rate_profiles[profile].baud);
+    radio_set_profile(br->radio, profile);
+
+    printf("Link profile %d: %s\n", profile, rate_profiles[profile].name);
+}
+
+// Control messages, radio readings and profile switches.
+// Returns the poll timeout in ms.
+static int bridge_rate_service(bridge *br)
+{
+    uint64_t now = now_ns();
+    pbuf *p = 0;
+
+    if (!br->rate)
+        return 1000;
+
+    if (now >= br->radio_query_ns)
+    {
+        radio_query(br->radio);
+        br->radio_query_ns = now + RATE_REPORT_MS / 2 * 1000000ULL;
+    }
+
+    while (bridge_air_free(br) && (p = bridge_pbuf(br)) &&
+           (p->len = rate_poll(br->rate, p->data, pbuf_cap(p), now)) > 0)
+    {
+        bridge_send(br, p, 0);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+
+    int profile = rate_take_change(br->rate);
+    if (profile >= 0)
+        bridge_set_profile(br, profile);
+
+    int64_t left = bridge_air_free(br) ? rate_time_left(br->rate, now) : 1000000000LL;
+    if (left > (int64_t)(br->radio_query_ns - now))
+        left = br->radio_query_ns - now;
+
+    return left >= 1000000000LL ? 1000 : (int)(left / 1000000) + 1;
+}
+
+// Both ends move the pair together, like a profile change
+static void bridge_set_shift(bridge *br, int shift)
+{
+    for (int hop = 0; br->agg && hop < AGG_MAX_HOPS; hop++)
+        bridge_flush(br, hop, AGG_FLUSH_DELAY);
+
+    tty_drain(br->tty_fd);
+    radio_set_shift(br->radio, shift);
+
+    printf("Link channels moved by %d (%+d Hz)\n", shift, shift * br->radio->scan.step_hz);
+}
+
+// Scan rounds and channel moves. Returns the poll timeout in ms.
+static int bridge_scan_service(bridge *br)
+{
+    uint64_t now = now_ns();
+    pbuf *p = 0;
+
+    if (!br->scan)
+        return 1000;
+
+    while (bridge_air_free(br) && (p = bridge_pbuf(br)) &&
+           (p->len = scan_poll(br->scan, p->data, pbuf_cap(p), now)) > 0)
+    {
+        bridge_send(br, p, 0);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+
+    // The request has to be on air before the carrier goes off, after that
+    // both ends sweep at about the same time
+    if (scan_take_sweep(br->scan))
+    {
+        for (int hop = 0; br->agg && hop < AGG_MAX_HOPS; hop++)
+            bridge_flush(br, hop, AGG_FLUSH_DELAY);
+        tty_drain(br->tty_fd);
+        radio_scan(br->radio);
+    }
+
+    int shift = scan_take_change(br->scan);
+    if (shift != SCAN_NO_CHANGE)
+        bridge_set_shift(br, shift);
+
+    int64_t left = scan_time_left(br->scan, now);
+    return left >= 1000000000LL || !bridge_air_free(br) ? 1000 : (int)(left / 1000000) + 1;
+}
+
+// Beacons, slot requests and hop SYNCs go out at once, they are timed by
+// tdma_poll() and fhss_poll(); with the radio busy they would be late and
+// are dropped, the next one is not far off
+static void bridge_send_control(bridge *br, pbuf *p)
+{
+    p->len = pipeline_tx(&br->pkt_pipe, &p->data, p->len, pbuf_cap(p));
+    if (p->len > 0 && bridge_build(br, p) > 0)
+    {
+        if (br->air != AIR_IDLE)
+            br->tx_drops++;
+        else
+            bridge_air(br, 0, p);
+    }
+}
+
+// Slots and superframe start to the firmware when they change. Its
+// window is a little wider than ours, so that what we start is not cut
+// off over the odd millisecond between the clocks; nodes key the
+// contention slot for their requests.
+static void bridge_tdma_firmware(bridge *br, uint64_t now)
+{
+    tdma_ctx *t = br->tdma;
+
+    if (t->mask_changed && t->nslots > 0)
+    {
+        uint32_t mask = t->mask;
+
+        for (int s = 0; s < t->nslots && t->id != TDMA_MASTER && t->synced; s++)
+            if (t->owner[s] == TDMA_SLOT_CONTENTION)
+                mask |= 1u << s;
+
+        t->mask_changed = 0;
+        radio_set_tdma(br->radio, (int)(t->slot_ns / 1000), t->nslots, (int)(t->guard_ns / 2000), mask);
+    }
+    if (t->synced_now)
+    {
+        t->synced_now = 0;
+        radio_sync_tdma(br->radio, (int)((now - t->frame_ns) / 1000));
+    }
+}
+
+// Beacons, slot requests, the firmware's slot clock and the held frame.
+// Returns the poll timeout in ms.
+static int bridge_tdma_service(bridge *br)
+{
+    tdma_ctx *t = br->tdma;
+    uint64_t now = now_ns();
+    pbuf *p;
+
+    if (!t)
+        return 1000;
+
+    // The firmware clock first, the beacon is keyed on it
+    bridge_tdma_firmware(br, now);
+    while ((p = bridge_pbuf(br)) && (p->len = tdma_poll(t, p->data, pbuf_cap(p), now)) > 0)
+    {
+        bridge_send_control(br, p);
+        pbuf_unref(&br->pool, p);
+    }
+    pbuf_unref(&br->pool, p);
+    bridge_tdma_firmware(br, now_ns());
+
+    bridge_send_held(br);
+
+    int64_t left = tdma_time_left(t, now_ns());
+    return left >= 1000000000LL ? 1000 : (int)(left / 1000000) + 1;
+}
+
+// Hop table, parking channel and dwell clock to the firmware when they
+// change. The current sequence goes first, the firmware keeps a later one
+// for the dwell it starts at.
+static void bridge_fhss_firmware(bridge *br, uint64_t now)
+{
+    fhss_ctx *f = br->fhss;
+
+    if (f->table_changed)
+    {
+        f->table_changed = 0;
+        if (!f->hopping)
+        {
+            radio_set_hops(br->radio, 0, 0, 0, 0);
+            printf("Hopping stopped, back on home\n");
+        }
+        else
+        {
+            radio_set_hops(br->radio, (int)(f->dwell_ns / 1000), f->seq.from, f->seq.n, f->seq.shift);
+            if (f->next.n)
+                radio_set_hops(br->radio, (int)(f->dwell_ns / 1000), f->next.from, f->next.n, f->next.shift);
+        }
+    }
+    if (f->park_changed)
+    {
+        f->park_changed = 0;
+        if (!f->hopping)
+            radio_set_shift(br->radio, f->park);
+    }
+    if (f->clock_changed && f->hopping)
+    {
+        uint32_t k = fhss_index(f, now);
+
+        f->clock_changed = 0;
+        radio_sync_hops(br->radio, k, (int)((now - f->origin_ns - k * f->dwell_ns) / 1000));
+    }
+}
+
+// Hopping start, SYNCs and reports, the firmware's table and clock and the
+// held frame. Returns the poll timeout in ms.
+static int bridge_fhss_service(bridge *br)
+{
+    fhss_ctx *f = br->fhss;
+    uint64_t now = now_ns();
+    pbuf *p;
+
+    if (!f)
+        return 1000;
+
+    if (f->master && !f->hopping && now >= br->fhss_start_ns)
+    {
+        fhss_start(f, now);
+        printf("Hopping over %d channels, %llu ms dwell\n", f->seq.n, (unsigned long long)(f->dwell_ns / 1000000));
+    }
+
+    // The firmware clock first, the SYNC is timed on it
+    bridge_fhss_firmware(br, now);
+    while ((p = bridge_pbuf(br)) && (p->len = fhss_poll(f, p->data, pbuf_cap(p), now)) > 0)
+    {
+        bridge_send_control(br, p);
+        pbuf_unref(&br->pool, p);
+    }
+    pbuf_unref(&br->pool, p);
+    bridge_fhss_firmware(br, now_ns());
+
+    bridge_send_held(br);
+
+    int64_t left = fhss_time_left(f, now_ns());
+    if (f->master && !f->hopping)
+        left = br->fhss_start_ns - now;
+    return left >= 1000000000LL ? 1000 : (int)(left / 1000000) + 1;
+}
+
+// HELLOs skip the packet stages and the aggregation like the mesh header
+// does. Returns the poll timeout in ms.
+static int bridge_mesh_service(bridge *br)
+{
+    uint64_t now = now_ns();
+    pbuf *p = 0;
+
+    if (!br->mesh)
+        return 1000;
+
+    while (bridge_air_free(br) && (p = bridge_pbuf(br)) &&
+           (p->len = mesh_poll(br->mesh, p->data, pbuf_cap(p), now)) > 0)
+    {
+        bridge_xmit(br, p);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+
+    int64_t left = mesh_time_left(br->mesh, now);
+    return left >= 1000000000LL || !bridge_air_free(br) ? 1000 : (int)(left / 1000000) + 1;
+}
+
+// Telemetry windows from the firmware. Returns the poll timeout in ms.
+static int bridge_telemetry_service(bridge *br)
+{
+    uint64_t now = now_ns();
+
+    if (!br->radio)
+        return 1000;
+
+    if (now >= br->telemetry_ns)
+    {
+        radio_request_telemetry(br->radio);
+        radio_request_pools(br->radio);
+        if (br->keyed)
+            radio_request_counters(br->radio);
+        br->telemetry_ns = now + TELEMETRY_MS * 1000000ULL;
+    }
+    if (now >= br->drift_ns)
+    {
+        radio_request_drift(br->radio);
+        br->drift_ns = now + DRIFT_MS * 1000000ULL;
+    }
+
+    int64_t left = br->telemetry_ns - now;
+    return left >= 1000000000LL ? 1000 : (int)(left / 1000000) + 1;
+}
+
+static void bridge_radio_event(bridge *br)
+{
+    if (radio_read(br->radio) && br->rate)
+        rate_set_radio(br->rate, br->radio->rssi_dbm, br->radio->lqi);
+    if (br->tdma)
+        tdma_set_turnaround(br->tdma, br->radio->lbt[5] * 1000ULL);
+    if (br->mesh && br->keyed)
+        mesh_set_turnaround(br->mesh, br->radio->lbt[5] * 1000ULL);
+    if (br->div && br->radio->tel[0].windows > 0)
+    {
+        div_set_rssi(br->div, 0, (int)br->radio->tel[0].rssi_avg);
+        div_set_rssi(br->div, 1, (int)br->radio->tel[1].rssi_avg);
+    }
+
+    if (br->radio->scan_ready)
+    {
+        br->radio->scan_ready = 0;
+        scan_print_map(&br->radio->scan, stdout);
+        if (br->scan)
+            scan_set_local(br->scan, &br->radio->scan, now_ns());
+        if (br->fhss && br->fhss->master && !br->fhss->hopping)
+        {
+            fhss_set_map(br->fhss, &br->radio->scan);
+            br->fhss_start_ns = now_ns();
+        }
+    }
+}
+
+static void bridge_radio_metrics(bridge *br, metrics *m)
+{
+    static const char *names[2] = { "radio=\"rx\"", "radio=\"tx\"" };
+    char labels[64];
+    double bounds[RADIO_HIST_BINS];
+    uint64_t counts[RADIO_HIST_BINS];
+
+    struct { const char *stat; size_t off; } gauges[] = {
+        { "rssi_min_dbm", offsetof(radio_telemetry, rssi_min) },
+        { "rssi_avg_dbm", offsetof(radio_telemetry, rssi_avg) },
+        { "rssi_max_dbm", offsetof(radio_telemetry, rssi_max) },
+        { "lqi_min",      offsetof(radio_telemetry, lqi_min) },
+        { "lqi_avg",      offsetof(radio_telemetry, lqi_avg) },
+        { "lqi_max",      offsetof(radio_telemetry, lqi_max) },
+        { "pqi_avg",      offsetof(radio_telemetry, pqi_avg) },
+        { "sqi_avg",      offsetof(radio_telemetry, sqi_avg) },
+        { "afc_min",      offsetof(radio_telemetry, afc_min) },
+        { "afc_avg",      offsetof(radio_telemetry, afc_avg) },
+        { "afc_max",      offsetof(radio_telemetry, afc_max) },
+    };
+
+    for (int g = 0; g < (int)(sizeof(gauges) / sizeof(gauges[0])); g++)
+        for (int i = 0; i < 2; i++)
+        {
+            snprintf(labels, sizeof(labels), "%s,stat=\"%s\"", names[i], gauges[g].stat);
+            metrics_gauge(m, "inverseg_radio_link", "Last telemetry window of each radio",
+                          labels, *(double *)((char *)&br->radio->tel[i] + gauges[g].off));
+        }
+
+    for (int i = 0; i < 2; i++)
+        metrics_gauge(m, "inverseg_radio_mc_state", "SPIRIT1 MC_STATE at the last sample",
+                      names[i], br->radio->tel[i].mc_state);
+    for (int i = 0; i < 2; i++)
+        metrics_counter(m, "inverseg_radio_samples_total", "Telemetry samples taken",
+                        names[i], br->radio->tel[i].samples);
+    for (int i = 0; i < 2; i++)
+        metrics_counter(m, "inverseg_radio_state_errors_total", "Samples with the radio in an unexpected state",
+                        names[i], br->radio->tel[i].state_errors);
+
+    for (int i = 0; i < 2; i++)
+    {
+        const radio_telemetry *t = &br->radio->tel[i];
+        uint64_t total = 0;
+
+        for (int b = 0; b < RADIO_HIST_BINS; b++)
+        {
+            total += t->rssi_hist[b];
+            counts[b] = total;
+            bounds[b] = -130 + 8 * (b + 1);
+        }
+
+        metrics_histogram(m, "inverseg_radio_rssi_dbm", "RSSI of every telemetry sample",
+                          names[i], bounds, counts, RADIO_HIST_BINS, total, t->rssi_sum);
+    }
+
+    metrics_gauge(m, "inverseg_radio_fc_offset_hz", "FC_OFFSET the RX radio tracks the carrier with",
+                  names[0], br->radio->drift.fc_offset * RADIO_FC_STEP_HZ);
+    metrics_counter(m, "inverseg_radio_fc_trims_total", "FC_OFFSET steps taken", names[0],
+                    br->radio->drift.trims);
+
+    char pools[RADIO_POOL_MAX][32];
+    for (int i = 0; i < br->radio->npools; i++)
+        snprintf(pools[i], sizeof(pools[i]), "pool=\"%s\"", br->radio->pool[i].name);
+    for (int i = 0; i < br->radio->npools; i++)
+        metrics_gauge(m, "inverseg_firmware_pool_in_use", "Firmware pool blocks out", pools[i],
+                      br->radio->pool[i].in_use);
+    for (int i = 0; i < br->radio->npools; i++)
+        metrics_gauge(m, "inverseg_firmware_pool_high_water", "Most firmware pool blocks out at once",
+                      pools[i], br->radio->pool[i].high_water);
+    for (int i = 0; i < br->radio->npools; i++)
+        metrics_counter(m, "inverseg_firmware_pool_exhausted_total",
+                        "Firmware pool allocations refused, no block left", pools[i],
+                        br->radio->pool[i].exhausted);
+}
+
+static void bridge_metrics(bridge *br, metrics *m)
+{
+    static const char *counters = "Bridge packet and frame counters";
+
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"tun_packets\"", br->tun_packets);
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"tx_frames\"", br->tx_frames);
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"rx_frames\"", br->rx_frames);
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"tx_drops\"", br->tx_drops);
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"rx_drops\"", br->rx_drops);
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"deframed\"", br->d->frames);
+    metrics_counter(m, "inverseg_bridge_total", counters, "counter=\"header_errors\"", br->d->header_errors);
+    metrics_gauge(m, "inverseg_pbuf_high_water", "Most TX packet buffers out at once", 0, br->pool.high_water);
+    metrics_counter(m, "inverseg_pbuf_exhausted_total", "Packets dropped for want of a TX buffer", 0,
+                    br->pool.exhausted);
+
+    if (br->lbt)
+    {
+        static const char *help = "Listen-before-talk attempts in the firmware";
+
+        metrics_counter(m, "inverseg_lbt_total", help, "result=\"granted\"", br->radio->lbt[1]);
+        metrics_counter(m, "inverseg_lbt_total", help, "result=\"busy\"", br->radio->lbt[2]);
+        metrics_counter(m, "inverseg_lbt_total", help, "result=\"timeout\"", br->radio->lbt[3]);
+        metrics_counter(m, "inverseg_lbt_dropped_total", "Frames dropped without a clear channel", 0, br->lbt_busy);
+    }
+
+    if (br->tdma)
+    {
+        const tdma_ctx *t = br->tdma;
+        static const char *help = "TDMA control messages";
+        char labels[64];
+        int owned = 0;
+
+        for (int s = 0; s < t->nslots; s++)
+            owned += t->owner[s] == t->id;
+
+        metrics_gauge(m, "inverseg_tdma_synced", "Superframe timing known", 0, t->synced);
+        metrics_gauge(m, "inverseg_tdma_slots_owned", "Slots of this node", 0, owned);
+        metrics_gauge(m, "inverseg_tdma_guard_seconds", "Guard time at both ends of a slot", 0, t->guard_ns / 1e9);
+        metrics_gauge(m, "inverseg_tdma_utilization", "Share of the superframe on air", 0, tdma_utilization(t));
+        for (int s = 0; s < t->nslots; s++)
+        {
+            if (t->owner[s] == TDMA_SLOT_FREE)
+                snprintf(labels, sizeof(labels), "slot=\"%d\",owner=\"free\"", s);
+            else if (t->owner[s] == TDMA_SLOT_CONTENTION)
+                snprintf(labels, sizeof(labels), "slot=\"%d\",owner=\"contention\"", s);
+            else
+                snprintf(labels, sizeof(labels), "slot=\"%d\",owner=\"%d\"", s, t->owner[s]);
+            metrics_gauge(m, "inverseg_tdma_slot_utilization", "Share of the slot on air", labels,
+                          tdma_slot_utilization(t, s));
+        }
+        metrics_counter(m, "inverseg_tdma_messages_total", help, "msg=\"beacon_tx\"", t->stats.beacons_tx);
+        metrics_counter(m, "inverseg_tdma_messages_total", help, "msg=\"beacon_rx\"", t->stats.beacons_rx);
+        metrics_counter(m, "inverseg_tdma_messages_total", help, "msg=\"request_tx\"", t->stats.requests_tx);
+        metrics_counter(m, "inverseg_tdma_messages_total", help, "msg=\"request_rx\"", t->stats.requests_rx);
+        metrics_counter(m, "inverseg_tdma_grants_total", "Slots handed out by the master", 0, t->stats.grants);
+        metrics_counter(m, "inverseg_tdma_reclaims_total", "Slots taken back from silent nodes", 0, t->stats.reclaims);
+        metrics_counter(m, "inverseg_tdma_sync_losses_total", "Beacons lost for too long", 0, t->stats.sync_losses);
+        metrics_counter(m, "inverseg_tdma_held_total", "Frames that waited for a slot", 0, br->held_frames);
+        metrics_counter(m, "inverseg_tdma_overruns_total", "Frames the firmware cut off at the slot end", 0,
+                        br->radio->lbt[4]);
+        metrics_gauge(m, "inverseg_tdma_turnaround_seconds", "Longest TX turnaround the firmware measured", 0,
+                      br->radio->lbt[5] / 1e6);
+    }
+
+    if (br->fhss)
+    {
+        const fhss_ctx *f = br->fhss;
+        static const char *help = "FHSS control messages";
+        char labels[64];
+
+        metrics_gauge(m, "inverseg_fhss_hopping", "Dwell clock known", 0, f->hopping);
+        metrics_gauge(m, "inverseg_fhss_channels", "Channels in the hop sequence", 0, f->seq.n);
+        metrics_gauge(m, "inverseg_fhss_dwell_seconds", "Time on one channel", 0, f->dwell_ns / 1e9);
+        for (int i = 0; i < f->ncand; i++)
+        {
+            snprintf(labels, sizeof(labels), "shift=\"%d\",result=\"ok\"", f->cand[i].shift);
+            metrics_counter(m, "inverseg_fhss_frames_total", "Frames received per hop channel", labels,
+                            f->cand[i].rx_ok);
+            snprintf(labels, sizeof(labels), "shift=\"%d\",result=\"error\"", f->cand[i].shift);
+            metrics_counter(m, "inverseg_fhss_frames_total", "Frames received per hop channel", labels,
+                            f->cand[i].rx_bad);
+        }
+        metrics_counter(m, "inverseg_fhss_messages_total", help, "msg=\"sync_tx\"", f->stats.syncs_tx);
+        metrics_counter(m, "inverseg_fhss_messages_total", help, "msg=\"sync_rx\"", f->stats.syncs_rx);
+        metrics_counter(m, "inverseg_fhss_messages_total", help, "msg=\"report_tx\"", f->stats.reports_tx);
+        metrics_counter(m, "inverseg_fhss_messages_total", help, "msg=\"report_rx\"", f->stats.reports_rx);
+        metrics_counter(m, "inverseg_fhss_acquisitions_total", "Dwell clock picked up from a SYNC", 0,
+                        f->stats.acquisitions);
+        metrics_counter(m, "inverseg_fhss_sync_losses_total", "SYNCs lost for too long", 0, f->stats.sync_losses);
+        metrics_counter(m, "inverseg_fhss_blacklisted_total", "Channels dropped for losing frames", 0,
+                        f->stats.blacklisted);
+        metrics_counter(m, "inverseg_fhss_held_total", "Frames that waited for the next dwell", 0, br->held_frames);
+    }
+
+    if (br->mesh)
+    {
+        const mesh_ctx *mc = br->mesh;
+        static const char *help = "Mesh data packets";
+        char labels[64];
+
+        for (int d = 0; d < MESH_MAX_NODES; d++)
+        {
+            const mesh_route *r = &mc->route[d];
+
+            if (d == mc->id || r->via == MESH_NONE)
+                continue;
+            snprintf(labels, sizeof(labels), "dst=\"%d\",via=\"%d\"", d, r->via);
+            metrics_gauge(m, "inverseg_mesh_route_metric_seconds", "Airtime metric of the route", labels,
+                          r->metric / 1e3);
+            metrics_gauge(m, "inverseg_mesh_route_hops", "Hops of the route", labels, r->hops);
+        }
+        for (int k = 0; k < MESH_MAX_NODES; k++)
+            if (mc->nb[k].heard)
+            {
+                snprintf(labels, sizeof(labels), "neighbour=\"%d\"", k);
+                metrics_gauge(m, "inverseg_mesh_link_cost_seconds", "Airtime metric of the link", labels,
+                              mc->nb[k].cost == MESH_INFINITY ? -1 : mc->nb[k].cost / 1e3);
+            }
+        metrics_counter(m, "inverseg_mesh_packets_total", help, "result=\"originated\"", mc->stats.originated);
+        metrics_counter(m, "inverseg_mesh_packets_total", help, "result=\"delivered\"", mc->stats.delivered);
+        metrics_counter(m, "inverseg_mesh_packets_total", help, "result=\"forwarded\"", mc->stats.forwarded);
+        metrics_counter(m, "inverseg_mesh_packets_total", help, "result=\"no_route\"", mc->stats.no_route);
+        metrics_counter(m, "inverseg_mesh_packets_total", help, "result=\"ttl_expired\"", mc->stats.ttl_expired);
+        metrics_counter(m, "inverseg_mesh_hellos_total", "Mesh HELLOs", "dir=\"tx\"", mc->stats.hellos_tx);
+        metrics_counter(m, "inverseg_mesh_hellos_total", "Mesh HELLOs", "dir=\"rx\"", mc->stats.hellos_rx);
+        metrics_counter(m, "inverseg_mesh_route_changes_total", "Next hop changes", 0, mc->stats.route_changes);
+    }
+
+    if (br->bond)
+    {
+        const bond_ctx *b = br->bond;
+        static const char *help = "Bonded data frames put back in order";
+        char labels[32];
+
+        for (int i = 0; i < b->nlinks; i++)
+        {
+            snprintf(labels, sizeof(labels), "link=\"%d\"", i);
+            metrics_gauge(m, "inverseg_bond_link_up", "Link carries data", labels, b->link[i].up);
+            metrics_gauge(m, "inverseg_bond_link_delivery_ratio", "Share of the frames the far end gets", labels,
+                          b->link[i].ratio / 255.0);
+            metrics_counter(m, "inverseg_bond_tx_bytes_total", "Bytes sent per link", labels, b->link[i].tx_bytes);
+            metrics_counter(m, "inverseg_bond_rx_frames_total", "Frames received per link", labels,
+                            b->link[i].rx_frames);
+            metrics_counter(m, "inverseg_bond_link_downs_total", "Times the link was left out", labels,
+                            b->link[i].downs);
+        }
+        metrics_counter(m, "inverseg_bond_frames_total", help, "result=\"reordered\"", b->stats.reordered);
+        metrics_counter(m, "inverseg_bond_frames_total", help, "result=\"lost\"", b->stats.lost);
+        metrics_counter(m, "inverseg_bond_frames_total", help, "result=\"late\"", b->stats.late);
+        metrics_gauge(m, "inverseg_bond_skew_seconds", "Arrival spread between the links", 0, b->skew_ns / 1e9);
+    }
+
+    if (br->div)
+    {
+        const div_ctx *v = br->div;
+        static const char *help = "Frames through the diversity combiner";
+        char labels[32];
+
+        for (int i = 0; i < v->nbranches; i++)
+        {
+            snprintf(labels, sizeof(labels), "branch=\"%d\"", i);
+            metrics_counter(m, "inverseg_div_branch_frames_total", "Good copies per receiver", labels,
+                            v->branch[i].frames);
+            metrics_counter(m, "inverseg_div_branch_picked_total", "Copies that went up per receiver", labels,
+                            v->branch[i].picked);
+        }
+        metrics_counter(m, "inverseg_div_frames_total", help, "result=\"delivered\"", v->stats.delivered);
+        metrics_counter(m, "inverseg_div_frames_total", help, "result=\"duplicate\"", v->stats.duplicates);
+        metrics_counter(m, "inverseg_div_frames_total", help, "result=\"replaced\"", v->stats.replaced);
+        metrics_counter(m, "inverseg_div_frames_total", help, "result=\"timeout\"", v->stats.timeouts);
+    }
+
+    if (br->aes)
+    {
+        const char *help = "Frames through the AES stage";
+        metrics_counter(m, "inverseg_aes_frames_total", help, "result=\"sealed\"", br->aes->sealed);
+        metrics_counter(m, "inverseg_aes_frames_total", help, "result=\"opened\"", br->aes->opened);
+        metrics_counter(m, "inverseg_aes_frames_total", help, "result=\"auth_failure\"", br->aes->auth_failures);
+        metrics_counter(m, "inverseg_aes_frames_total", help, "result=\"replay\"", br->aes->replays);
+        metrics_counter(m, "inverseg_aes_frames_total", help, "result=\"malformed\"", br->aes->malformed);
+        metrics_counter(m, "inverseg_aes_frames_total", help, "result=\"reserve_failure\"",
+                        br->aes->reserve_failures);
+    }
+    if (br->crc)
+    {
+        metrics_counter(m, "inverseg_crc_frames_total", "Frames checked by the CRC stage", "result=\"ok\"", br->crc->ok);
+        metrics_counter(m, "inverseg_crc_frames_total", "Frames checked by the CRC stage", "result=\"error\"", br->crc->errors);
+    }
+    if (br->fec)
+    {
+        const fec_stats *f = &br->fec->stats;
+        metrics_counter(m, "inverseg_fec_frames_total", "Frames through the FEC decoder", "result=\"clean\"", f->frames_clean);
+        metrics_counter(m, "inverseg_fec_frames_total", "Frames through the FEC decoder", "result=\"corrected\"",
+                        f->frames_decoded - f->frames_clean - f->frames_failed);
+        metrics_counter(m, "inverseg_fec_frames_total", "Frames through the FEC decoder", "result=\"failed\"", f->frames_failed);
+        metrics_counter(m, "inverseg_fec_symbols_corrected_total", "Bytes repaired by Reed-Solomon", 0, f->symbols_corrected);
+    }
+    if (br->fq)
+    {
+        const fq_stats *q = &br->fq->stats;
+        static const char *help = "Packets through the fair queues";
+        double bounds[FQ_HIST_BINS - 1];
+        uint64_t counts[FQ_HIST_BINS - 1];
+        char labels[32];
+
+        metrics_counter(m, "inverseg_fq_packets_total", help, "result=\"dequeued\"", q->dequeued);
+        metrics_counter(m, "inverseg_fq_packets_total", help, "result=\"codel_drop\"", q->codel_drops);
+        metrics_counter(m, "inverseg_fq_packets_total", help, "result=\"overlimit_drop\"", q->overlimit_drops);
+        metrics_gauge(m, "inverseg_fq_backlog_bytes", "Bytes in the fair queues", 0, br->fq->bytes);
+        metrics_gauge(m, "inverseg_fq_target_seconds", "CoDel target at the line rate", 0, br->fq->target_ns / 1e9);
+        for (int c = 0; c < CLS_COUNT; c++)
+        {
+            const fq_class *k = &br->fq->cls[c];
+            uint64_t total = 0;
+
+            for (int i = 0; i < FQ_HIST_BINS - 1; i++)
+            {
+                total += k->hist[i];
+                counts[i] = total;
+                bounds[i] = fq_hist_bound(i);
+            }
+            snprintf(labels, sizeof(labels), "class=\"%s\"", cls_names[c]);
+            metrics_histogram(m, "inverseg_fq_sojourn_seconds", "Time packets waited in the fair queues", labels,
+                              bounds, counts, FQ_HIST_BINS - 1, k->dequeued, k->sojourn_sum);
+        }
+        for (int c = 0; c < CLS_COUNT; c++)
+        {
+            snprintf(labels, sizeof(labels), "class=\"%s\"", cls_names[c]);
+            metrics_counter(m, "inverseg_cls_packets_total", "Packets per traffic class", labels, br->cls->packets[c]);
+        }
+        for (int c = 0; c < CLS_COUNT; c++)
+        {
+            snprintf(labels, sizeof(labels), "class=\"%s\"", cls_names[c]);
+            metrics_gauge(m, "inverseg_cls_air_seconds", "Airtime let out per traffic class", labels,
+                          br->shaper.air_ns[c] / 1e9);
+        }
+    }
+    if (br->pf)
+    {
+        char labels[PF_TEXT_MAX + 16];
+
+        metrics_counter(m, "inverseg_filter_packets_total", "Packets through the filter", "result=\"passed\"",
+                        br->pf->passed);
+        metrics_counter(m, "inverseg_filter_packets_total", "Packets through the filter", "result=\"dropped\"",
+                        br->pf->dropped);
+        for (int i = 0; i < br->pf->nrules; i++)
+        {
+            snprintf(labels, sizeof(labels), "rule=\"%s\"", br->pf->rule[i].text);
+            metrics_counter(m, "inverseg_filter_rule_hits_total", "Packets a filter rule matched", labels,
+                            br->pf->rule[i].hits);
+        }
+        for (int i = 0; i < br->pf->nrules; i++)
+        {
+            snprintf(labels, sizeof(labels), "rule=\"%s\"", br->pf->rule[i].text);
+            metrics_counter(m, "inverseg_filter_rule_drops_total", "Packets a filter rule dropped", labels,
+                            br->pf->rule[i].drops);
+        }
+    }
+    if (br->agg)
+    {
+        metrics_counter(m, "inverseg_agg_frames_total", "Aggregate frames sent", 0, br->agg->stats.frames);
+        metrics_counter(m, "inverseg_agg_subframes_total", "Packets sent inside aggregates", 0, br->agg->stats.subframes);
+        metrics_counter(m, "inverseg_agg_singles_total", "Packets flushed alone and sent bare", 0, br->agg->stats.singles);
+    }
+    if (br->arq)
+    {
+        const arq_stats *a = &br->arq->stats;
+        metrics_counter(m, "inverseg_arq_retransmits_total", "ARQ retransmissions", "cause=\"timeout\"", a->timeouts);
+        metrics_counter(m, "inverseg_arq_retransmits_total", "ARQ retransmissions", "cause=\"sack\"", a->fast_retransmits);
+        metrics_gauge(m, "inverseg_arq_srtt_seconds", "Smoothed round trip time", 0, br->arq->srtt_ns / 1e9);
+        metrics_gauge(m, "inverseg_arq_rto_seconds", "Retransmission timeout", 0, br->arq->rto_ns / 1e9);
+    }
+    if (br->rate)
+    {
+        metrics_gauge(m, "inverseg_rate_profile", "Radio profile in use", 0, br->rate->profile);
+        metrics_gauge(m, "inverseg_rate_baud", "Symbol rate of the profile in use", 0, rate_profiles[br->rate->profile].baud);
+        metrics_counter(m, "inverseg_rate_steps_total", "Profile changes", "direction=\"up\"", br->rate->stats.steps_up);
+        metrics_counter(m, "inverseg_rate_steps_total", "Profile changes", "direction=\"down\"", br->rate->stats.steps_down);
+        metrics_counter(m, "inverseg_rate_fallbacks_total", "Drops to profile 0 on silence", 0, br->rate->stats.fallbacks);
+    }
+    if (br->scan)
+    {
+        metrics_gauge(m, "inverseg_scan_shift", "Scan channels the duplex pair is moved by", 0, br->scan->shift);
+        metrics_counter(m, "inverseg_scan_moves_total", "Moves of the duplex pair", 0, br->scan->stats.moves);
+        metrics_counter(m, "inverseg_scan_rounds_total", "Band sweeps started by the master", 0, br->scan->stats.rounds);
+    }
+    if (br->radio && br->radio->scan.n > 0)
+    {
+        char labels[32];
+
+        for (int ch = 0; ch < br->radio->scan.n; ch++)
+        {
+            snprintf(labels, sizeof(labels), "channel=\"%d\"", ch);
+            metrics_gauge(m, "inverseg_scan_noise_dbm", "Max-hold RSSI of the last sweep",
+                          labels, br->radio->scan.rssi[ch] / 2.0 - 130);
+        }
+    }
+    if (br->radio)
+        bridge_radio_metrics(br, m);
+}
+
+static void bridge_metrics_event(bridge *br, int listen_fd)
+{
+    static char buf[METRICS_BUF_SIZE];
+    metrics m;
+
+    metrics_init(&m, buf, sizeof(buf));
+    bridge_metrics(br, &m);
+    metrics_serve(listen_fd, &m);
+}
+
+static void bridge_deliver(bridge *br, uint8_t *pkt, int len, int cap)
+{
+    static uint8_t scratch[BRIDGE_BUF_SIZE];
+
+    if (br->mesh)
+    {
+        switch (mesh_receive(br->mesh, pkt, len, now_ns()))
+        {
+            case MESH_NOT_MESH:
+                break;
+            case MESH_DELIVER:
+                pkt += MESH_HDR_LEN;
+                len -= MESH_HDR_LEN;
+                cap -= MESH_HDR_LEN;
+                break;
+            case MESH_FORWARD:
+                bridge_mesh_forward(br, pkt, len);
+                return;
+            default:
+                return;
+        }
+    }
+
+    // Decompression grows the packet, which an in-place subframe has no
+    // room for: that is the one place where the packet gets copied
+    if (br->pkt_pipe.nstages > 0 && cap - len < BRIDGE_BUF_SIZE / 2)
+    {
+        memcpy(scratch, pkt, len);
+        pkt = scratch;
+        cap = sizeof(scratch);
+    }
+
+    len = pipeline_rx(&br->pkt_pipe, &pkt, len, cap);
+    if (len < 0)
+        br->rx_drops++;
+    else if (br->rate && rate_receive(br->rate, pkt, len, now_ns()))
+        return;
+    else if (br->scan && scan_receive(br->scan, pkt, len, now_ns()))
+        return;
+    else if (br->tdma && tdma_receive(br->tdma, pkt, len, br->rx_start_ns, now_ns()))
+        return;
+    else if (br->fhss && fhss_receive(br->fhss, pkt, len, br->rx_start_ns, now_ns()))
+        return;
+    else if (len > 0)
+        write_all(br->tun_fd, pkt, len);
+}
+
+static void bridge_rx_frame(bridge *br, uint8_t *buf, int len, int cap)
+{
+    if (br->agg && agg_is_aggregate(buf, len))
+    {
+        agg_iter it;
+        uint8_t *pkt;
+        int plen;
+
+        agg_iter_init(&it, buf, len);
+        while ((plen = agg_next(br->agg, &it, &pkt)) > 0)
+            bridge_deliver(br, pkt, plen, plen);
+    }
+    else if (len > 0)
+        bridge_deliver(br, buf, len, cap);
+}
+
+// After the link stages: the ARQ puts the frames in order
+static void bridge_rx_link(bridge *br, uint8_t *buf, int len, int cap)
+{
+    if (!br->arq)
+    {
+        bridge_rx_frame(br, buf, len, cap);
+        return;
+    }
+
+    uint8_t *payload;
+    int plen = arq_receive(br->arq, buf, len, &payload, now_ns());
+
+    if (plen < 0)
+        br->rx_drops++;
+    else if (plen > 0)
+        bridge_rx_frame(br, payload, plen, cap - (payload - buf));
+    while ((plen = arq_next(br->arq, &payload)) > 0)
+        bridge_rx_frame(br, payload, plen, plen);
+}
+
+// The bond puts the frames of all links back in order first
+static void bridge_rx_bond(bridge *br, int link, uint8_t *buf, int len, int cap)
+{
+    uint8_t *payload;
+    int plen = bond_receive(br->bond, link, buf, len, &payload, now_ns());
+
+    if (plen < 0)
+        br->rx_drops++;
+    else if (plen > 0)
+        bridge_rx_link(br, payload, plen, cap - (payload - buf));
+    while ((plen = bond_next(br->bond, &payload, now_ns())) > 0)
+        bridge_rx_link(br, payload, plen, plen);
+}
+
+// One copy of every frame goes on, the best one
+static void bridge_rx_div(bridge *br, int branch, uint8_t *buf, int len, int cap, int corrected)
+{
+    uint8_t *payload;
+    int plen = div_receive(br->div, branch, buf, len, corrected, &payload, now_ns());
+
+    if (plen < 0)
+        br->rx_drops++;
+    else if (plen > 0)
+        bridge_rx_link(br, payload, plen, payload >= buf && payload < buf + cap ? cap - (payload - buf) : plen);
+    while ((plen = div_next(br->div, &payload, now_ns())) > 0)
+        bridge_rx_link(br, payload, plen, plen);
+}
+
+static void bridge_tty_event(bridge *br, int link, deframer *d)
+{
+    uint8_t chunk[256];
+
+    int n = read(br->link_fd[link], chunk, sizeof(chunk));
+    for (int i = 0; i < n; i++)
+    {
+        int len = deframer_push(d, chunk[i]);
+        if (len <= 0)
+            continue;
+
+        br->rx_frames++;
+        uint64_t fixed = br->fec ? br->fec->stats.symbols_corrected : 0;
+        uint8_t *body = d->buf;
+        len = pipeline_rx(&br->link_pipe, &body, len, sizeof(d->buf));
+        int cap = sizeof(d->buf) - (int)(body - d->buf);
+        if (br->rate)
+            rate_rx_frame(br->rate, len >= 0, now_ns());
+        if (br->scan && len >= 0)
+            scan_rx_frame(br->scan, now_ns());
+        if (br->tdma || br->fhss)
+        {
+            // The last byte is in now: the frame started an airtime ago
+            uint64_t air = bridge_air_ns(br, br->preamble + FRAME_HDR_LEN + d->len);
+            br->rx_start_ns = now_ns() - air;
+            if (br->tdma && len >= 0)
+                tdma_heard(br->tdma, air, br->rx_start_ns);
+            if (br->fhss)
+                fhss_rx_frame(br->fhss, len >= 0, br->rx_start_ns);
+        }
+        if (len < 0)
+        {
+            br->rx_drops++;
+            continue;
+        }
+
+        if (br->bond)
+            bridge_rx_bond(br, link, body, len, cap);
+        else if (br->div)
+            bridge_rx_div(br, link, body, len, cap,
+                          br->fec ? (int)(br->fec->stats.symbols_corrected - fixed) : 0);
+        else
+            bridge_rx_link(br, body, len, cap);
+    }
+
+    bridge_send_feedback(br);
+}
+
+// Link reports, which skip the ARQ, and the frames whose gap was given up
+// on. Returns the poll timeout in ms, short while the TUN waits for the
+// ttys.
+static int bridge_bond_service(bridge *br)
+{
+    uint8_t *payload;
+    uint64_t now = now_ns();
+    int len, link;
+    pbuf *p = 0;
+
+    if (!br->bond)
+        return 1000;
+
+    while (bridge_air_free(br) && (p = bridge_pbuf(br)) &&
+           (p->len = bond_poll(br->bond, p->data, pbuf_cap(p), &link, now)) > 0)
+    {
+        bridge_xmit_on(br, link, p);
+        pbuf_unref(&br->pool, p);
+        p = 0;
+    }
+    pbuf_unref(&br->pool, p);
+    while ((len = bond_next(br->bond, &payload, now)) > 0)
+        bridge_rx_link(br, payload, len, len);
+
+    // The ttys do not say when they have drained below the backlog
+    if (!bridge_bond_room(br))
+        return AGG_BUSY_POLL_MS;
+
+    int64_t left = bond_time_left(br->bond, now_ns());
+    return left >= 1000000000LL || !bridge_air_free(br) ? 1000 : (int)(left / 1000000) + 1;
+}
+
+// Frames held for the other copy that are due. Returns the poll timeout
+// in ms.
+static int bridge_div_service(bridge *br)
+{
+    uint8_t *payload;
+    int len;
+
+    if (!br->div)
+        return 1000;
+
+    while ((len = div_next(br->div, &payload, now_ns())) > 0)
+        bridge_rx_link(br, payload, len, len);
+
+    int64_t left = div_time_left(br->div, now_ns());
+    if (left < 0 || left >= 1000000000LL)
+        return 1000;
+
+    return (int)(left / 1000000) + 1;
+}
+
+static void signal_handler(int signal)
+{
+    if (signal == SIGUSR1)
+        dump_stats = 1;
+    else
+        running = 0;
+}
+
+// SIGHUP with -X
+static void reload_handler(int signal)
+{
+    (void)signal;
+    reload = 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-i iface] [-t tty] [-b baud] [-p preamble] [-H] [-z] [-D dict]\n"
+            "          [-a max_size] [-A max_delay_ms] [-r window] [-f nsym] [-d depth]\n"
+            "          [-c ctl_tty] [-R master|slave] [-S minutes] [-m port]\n"
+            "          [-L dbm[,prescaler[,max_bo]]] [-T id[,want[,slot_ms]]]\n"
+            "          [-F master|slave[,dwell_ms]] [-M id,net[,gateway]] [-B tty[:baud],...]\n"
+            "          [-V tty|-] [-W] [-K id,keyfile] [-Q] [-P rules] [-U percent]\n"
+            "          [-X rules_file]\n"
+            "  -H        IPv4/UDP/TCP header compression\n"
+            "  -z        LZ payload compression\n"
+            "  -D dict   shared LZ dictionary (bridge_bench lztrain), same file on both ends\n"
+            "  -a size   aggregate packets into frames of up to 'size' bytes (per-packet CRC)\n"
+            "  -A ms     longest a packet may wait for company on an idle line (default 50)\n"
+            "  -r window selective-repeat ARQ with up to 'window' frames in flight\n"
+            "  -f nsym   Reed-Solomon parity bytes per codeword (0 = FEC off, 32 = RS(255,223))\n"
+            "  -d depth  minimum interleaving depth (codewords per frame)\n"
+            "  -W        PN9 whitening of the air frames\n"
+            "  -Q        fair queues with CoDel in front of the radio, sized from the line rate\n"
+            "  -P rules  traffic classes by port, protocol or DSCP, e.g. port:5001=bulk,dscp:46=control;\n"
+            "            classes control, interactive, default and bulk; needs -Q\n"
+            "  -U pct    airtime the queues let out, percent of the line (default 100); needs -Q\n"
+            "  -X file   drop or rate-limit packets by the rules in 'file' before the radio (pf.h);\n"
+            "            SIGHUP reads it again instead of stopping the bridge\n"
+            "  -K id,key AES-128 CCM on the air frames, node 'id' 0..15 and the key file\n"
+            "            (32 hex digits, the same on all nodes); not with -V\n"
+            "  -c tty    radio control port (the STM32 stdio UART)\n"
+            "  -R role   rate adaptation, one end 'master' and the other 'slave'; needs -c\n"
+            "  -S min    sweep the band every 'min' minutes and move to quieter channels; needs -R\n"
+            "  -L dbm    listen before talk, channel busy above 'dbm'; backoff prescaler\n"
+            "            (default 32) and backoffs before a frame is dropped (default 4); needs -c\n"
+            "  -T id     TDMA node 'id', 0 the master; 'want' slots (default 1) of 'slot_ms'\n"
+            "            (default 400, set by the master); needs -c, not with -L, -r or -R\n"
+            "  -F role   frequency hopping, one end 'master' and the other 'slave'; dwell\n"
+            "            (default 800, set by the master); needs -c, not with -S, -L, -T or -r\n"
+            "  -M id,net mesh node 'id' with address net.id, e.g. 3,10.0.5.0; packets off the\n"
+            "            /24 go to node 'gateway'; not with -H, -r, -R or -F\n"
+            "  -B ttys   bond these radio links to the one on -t, up to %d in all, each at\n"
+            "            'baud' (default -b); not with -R, -S, -L, -T, -F or -M\n"
+            "  -V tty    receive diversity, the TX radio's data on 'tty'; '-' only numbers the\n"
+            "            frames for a far end that has it; needs -c, not with -L, -T, -F or -B\n"
+            "  -m port   Prometheus metrics on http://127.0.0.1:port/metrics\n",
+            prog, BOND_MAX_LINKS);
+}
+
+int main(int argc, char *argv[])
+{
+    static bridge br;
+    static deframer d[BOND_MAX_LINKS];
+    static crc_ctx crc;
+    static fec_ctx fec;
+    static hc_ctx hc;
+    static lz_ctx lz;
+    static agg_ctx agg;
+    static arq_ctx arq;
+    static rate_ctx rate;
+    static scan_ctx scan;
+    static tdma_ctx tdma;
+    static fhss_ctx fhss;
+    static mesh_ctx mesh;
+    static bond_ctx bond;
+    static div_ctx div;
+    static pn9_whitener whitener;
+    static aes_ctx aes;
+    static fq_ctx fq;
+    static cls_ctx cls;
+    static pf_ctx pf;
+    static radio_link radio;
+
+    const char *iface = TUN_TAP_IFACE_NAME;
+    const char *tty = COM_PORT_NAME;
+    int baud  = COM_PORT_RATE;
+    int nsym  = 0;
+    int depth = 1;
+    int hdr_comp = 0;
+    int payload_comp = 0;
+    const char *dict = 0;
+    int agg_size = 0;
+    int agg_delay = 50;
+    int window = 0;
+    const char *ctl = 0;
+    const char *role = 0;
+    double scan_minutes = 0;
+    int metrics_port = 0;
+    const char *lbt = 0;
+    const char *tdma_opt = 0;
+    const char *fhss_opt = 0;
+    const char *mesh_opt = 0;
+    const char *bond_opt = 0;
+    const char *div_opt = 0;
+    int whiten = 0;
+    const char *aes_opt = 0;
+    int fair = 0;
+    const char *rules = 0;
+    int share = 100;
+    const char *filter = 0;
+    int line;
+    int metrics_fd = -1;
+    int opt;
+
+    br.preamble = PREAMBLE_LEN;
+    pbuf_pool_init(&br.pool);
+
+    while ((opt = getopt(argc, argv, "i:t:b:p:HzD:a:A:r:f:d:c:R:S:m:L:T:F:M:B:V:WK:QP:U:X:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i': iface = optarg; break;
+            case 't': tty = optarg; break;
+            case 'b': baud = atoi(optarg); break;
+            case 'p': br.preamble = atoi(optarg); break;
+            case 'H': hdr_comp = 1; break;
+            case 'z': payload_comp = 1; break;
+            case 'D': dict = optarg; break;
+            case 'a': agg_size = atoi(optarg); break;
+            case 'A': agg_delay = atoi(optarg); break;
+            case 'r': window = atoi(optarg); break;
+            case 'f': nsym = atoi(optarg); break;
+            case 'd': depth = atoi(optarg); break;
+            case 'c': ctl = optarg; break;
+            case 'R': role = optarg; break;
+            case 'S': scan_minutes = atof(optarg); break;
+            case 'L': lbt = optarg; break;
+            case 'T': tdma_opt = optarg; break;
+            case 'F': fhss_opt = optarg; break;
+            case 'M': mesh_opt = optarg; break;
+            case 'B': bond_opt = optarg; break;
+            case 'V': div_opt = optarg; break;
+            case 'W': whiten = 1; break;
+            case 'K': aes_opt = optarg; break;
+            case 'Q': fair = 1; break;
+            case 'P': rules = optarg; break;
+            case 'U': share = atoi(optarg); break;
+            case 'X': filter = optarg; break;
+            case 'm': metrics_port = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (br.preamble < 0 || br.preamble > PREAMBLE_MAX)
+    {
+        fprintf(stderr, "error: the preamble is 0 to %d bytes\n", PREAMBLE_MAX);
+        return 1;
+    }
+    if ((rules || share != 100) && !fair)
+    {
+        fprintf(stderr, "error: traffic classes and the airtime share need -Q\n");
+        return 1;
+    }
+    if (share < 1 || share > 100)
+    {
+        fprintf(stderr, "error: the airtime share is 1 to 100 percent\n");
+        return 1;
+    }
+    cls_init(&cls);
+    if (rules && cls_add_rules(&cls, rules) < 0)
+    {
+        fprintf(stderr, "error: bad traffic class rules %s\n", rules);
+        return 1;
+    }
+    pf_init(&pf);
+    if (filter && pf_load(&pf, filter, &line) < 0)
+    {
+        if (line)
+            fprintf(stderr, "error: %s:%d: bad filter rule\n", filter, line);
+        else
+            fprintf(stderr, "error: cannot read the filter rules %s\n", filter);
+        return 1;
+    }
+    if (filter)
+        br.pf = &pf;
+
+    if (hdr_comp)
+    {
+        hc_init(&hc, HC_REFRESH);
+        br.hc = &hc;
+        pipeline_add(&br.pkt_pipe, hc_stage(&hc));
+    }
+    if (payload_comp)
+    {
+        lz_init(&lz);
+        if (dict && lz_load_dict(&lz, dict) < 0)
+        {
+            fprintf(stderr, "error: cannot load the LZ dictionary %s\n", dict);
+            return 1;
+        }
+        pipeline_add(&br.pkt_pipe, lz_stage(&lz));
+    }
+
+    if (agg_size > 0)
+    {
+        agg_init(&agg, agg_size, agg_delay);
+        br.agg = &agg;
+    }
+    if (window > 0)
+    {
+        arq_init(&arq, window);
+        br.arq = &arq;
+    }
+
+    // First, so that the CRC throws out what the radio got wrong and the
+    // tag only has forgeries left to find. The two copies of a frame under
+    // diversity would be a replay.
+    if (aes_opt)
+    {
+        uint8_t key[AES_BLOCK];
+        char counter[AES_PATH_MAX];
+        int id = -1, n = 0;
+
+        if (div_opt || sscanf(aes_opt, "%d,%n", &id, &n) < 1 || n == 0 || id < 0 || id >= AES_MAX_SENDERS ||
+            aes_load_key(aes_opt + n, key) < 0)
+        {
+            fprintf(stderr, "error: -K needs an id 0..%d and a key file of 32 hex digits, not with -V\n",
+                    AES_MAX_SENDERS - 1);
+            return 1;
+        }
+        snprintf(counter, sizeof(counter), "%s.counter", aes_opt + n);
+        if (aes_init(&aes, id, key, counter) < 0)
+        {
+            fprintf(stderr, "error: cannot read or write the AES frame counter %s\n", counter);
+            return 1;
+        }
+        memset(key, 0, sizeof(key));
+        br.aes = &aes;
+        pipeline_add(&br.link_pipe, aes_stage(&aes));
+    }
+
+    // Aggregates carry a CRC per packet, but the ARQ header needs one too,
+    // and so do the TDMA beacons, the hop SYNCs, the mesh HELLOs and the
+    // bond and diversity headers, which do not wait to be aggregated
+    if (!br.agg || br.arq || tdma_opt || fhss_opt || mesh_opt || bond_opt || div_opt)
+    {
+        br.crc = &crc;
+        pipeline_add(&br.link_pipe, crc_stage(&crc));
+    }
+
+    if (nsym > 0)
+    {
+        if (fec_init(&fec, nsym, depth) < 0)
+        {
+            fprintf(stderr, "error: invalid FEC setting nsym=%d depth=%d\n", nsym, depth);
+            return 1;
+        }
+        br.fec = &fec;
+        pipeline_add(&br.link_pipe, fec_stage(&fec));
+    }
+
+    // Last, what goes on air
+    if (whiten)
+        pipeline_add(&br.link_pipe, pn9_stage(&whitener));
+
+    int profile = -1;
+    for (int i = 0; i < rate_nprofiles; i++)
+        if (rate_profiles[i].baud == baud)
+            profile = i;
+
+    if (role && (!ctl || profile < 0 || (strcmp(role, "master") && strcmp(role, "slave"))))
+    {
+        fprintf(stderr, "error: rate adaptation needs -c, a profile baud rate and a role\n");
+        return 1;
+    }
+
+    if (scan_minutes > 0 && !role)
+    {
+        fprintf(stderr, "error: channel selection needs -R\n");
+        return 1;
+    }
+
+    // The ARQ, the rate adaptation and the channel moves are for one pair
+    int tdma_id = -1, tdma_want = 1, tdma_slot_ms = TDMA_SLOT_MS;
+    if (tdma_opt && (!ctl || lbt || window > 0 || role ||
+                     sscanf(tdma_opt, "%d,%d,%d", &tdma_id, &tdma_want, &tdma_slot_ms) < 1 ||
+                     tdma_id < 0 || tdma_id >= TDMA_SLOT_CONTENTION || tdma_slot_ms <= 4 * TDMA_GUARD_MS))
+    {
+        fprintf(stderr, "error: TDMA needs -c and a node id, and does not go with -L, -r or -R\n");
+        return 1;
+    }
+
+    // The channel moves and the TDMA keying would fight the hops. The
+    // SYNCs skip the ARQ, which the other end would read their type byte
+    // as a header of
+    char fhss_role[8] = "";
+    int fhss_dwell_ms = FHSS_DWELL_MS;
+    if (fhss_opt && (!ctl || scan_minutes > 0 || lbt || tdma_opt || window > 0 ||
+                     sscanf(fhss_opt, "%7[a-z],%d", fhss_role, &fhss_dwell_ms) < 1 ||
+                     (strcmp(fhss_role, "master") && strcmp(fhss_role, "slave")) ||
+                     fhss_dwell_ms <= 4 * FHSS_GUARD_MS || fhss_dwell_ms > 65535))
+    {
+        fprintf(stderr, "error: frequency hopping needs -c and a role, and does not go with -S, -L, -T or -r\n");
+        return 1;
+    }
+
+    // Header compression contexts, the ARQ, the rate and the hops are kept
+    // per pair, a mesh node talks to several
+    int mesh_id = -1, mesh_gateway = -1, net[3];
+    if (mesh_opt && (hdr_comp || window > 0 || role || fhss_opt ||
+                     sscanf(mesh_opt, "%d,%d.%d.%d.%*d,%d", &mesh_id, &net[0], &net[1], &net[2], &mesh_gateway) < 4 ||
+                     mesh_id < 0 || mesh_id >= MESH_MAX_NODES || mesh_gateway >= MESH_MAX_NODES))
+    {
+        fprintf(stderr, "error: a mesh node needs an id and the net, and does not go with -H, -r, -R or -F\n");
+        return 1;
+    }
+
+    // The other ends of the bond, the radio moves and the channel access
+    // are all for the one radio on -c
+    char bond_tty[BOND_MAX_LINKS][64];
+    int bond_baud[BOND_MAX_LINKS], nlinks = 1;
+    if (bond_opt)
+    {
+        char list[256], *save = 0;
+
+        snprintf(list, sizeof(list), "%s", bond_opt);
+        for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(0, ",", &save))
+        {
+            if (nlinks == BOND_MAX_LINKS)
+            {
+                nlinks++;
+                break;
+            }
+            bond_baud[nlinks] = baud;
+            if (sscanf(tok, "%63[^:]:%d", bond_tty[nlinks], &bond_baud[nlinks]) < 1 || bond_baud[nlinks] <= 0)
+            {
+                nlinks = 0;
+                break;
+            }
+            nlinks++;
+        }
+        if (nlinks < 2 || nlinks > BOND_MAX_LINKS || role || scan_minutes > 0 || lbt || tdma_opt || fhss_opt || mesh_opt)
+        {
+            fprintf(stderr, "error: bonding needs 1 to %d more ttys, and does not go with -R, -S, -L, -T, -F or -M\n",
+                    BOND_MAX_LINKS - 1);
+            return 1;
+        }
+    }
+
+    // The TX radio is the second receiver, it cannot hop, sense the
+    // channel or wait for a slot, and it is no second link
+    if (div_opt && strcmp(div_opt, "-") && (!ctl || lbt || tdma_opt || fhss_opt || bond_opt))
+    {
+        fprintf(stderr, "error: receive diversity needs -c, and does not go with -L, -T, -F or -B\n");
+        return 1;
+    }
+
+    signal(SIGHUP,  filter ? reload_handler : signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGINT,  signal_handler);
+    signal(SIGUSR1, signal_handler);
+
+    if ((br.tun_fd = tun_tap_iface_create(iface, IFF_TUN | IFF_NO_PI)) < 0)
+        return 1;
+    if ((br.tty_fd = tty_open(tty, baud)) < 0)
+        return 1;
+    br.link_fd[0] = br.tty_fd;
+    br.baud = baud;
+    bond_baud[0] = baud;
+    for (int i = 1; i < nlinks; i++)
+        if ((br.link_fd[i] = tty_open(bond_tty[i], bond_baud[i])) < 0)
+            return 1;
+    if (div_opt && strcmp(div_opt, "-"))
+    {
+        if ((br.link_fd[1] = tty_open(div_opt, baud)) < 0)
+            return 1;
+        nlinks = 2;
+    }
+
+    if (ctl)
+    {
+        if (radio_open(&radio, ctl, COM_PORT_RATE) < 0)
+            return 1;
+        br.radio = &radio;
+    }
+    if (role)
+    {
+        rate_init(&rate, strcmp(role, "master") == 0, profile, now_ns());
+        br.rate = &rate;
+        radio_set_profile(&radio, profile);
+    }
+    if (scan_minutes > 0)
+    {
+        scan_init(&scan, strcmp(role, "master") == 0, (int)(scan_minutes * 60000), now_ns());
+        br.scan = &scan;
+    }
+    if (lbt)
+    {
+        int dbm, prescaler = LBT_PRESCALER, max_bo = LBT_MAX_BO;
+
+        if (!ctl || sscanf(lbt, "%d,%d,%d", &dbm, &prescaler, &max_bo) < 1)
+        {
+            fprintf(stderr, "error: listen before talk needs -c and a threshold\n");
+            return 1;
+        }
+
+        // RSSI_TH counts like RSSI_LEVEL, half dB steps from -130 dBm
+        radio_set_mac(&radio, 1, (dbm + 130) * 2, prescaler, max_bo);
+        tty_set_rts(br.tty_fd, 0);
+        br.lbt = 1;
+        br.keyed = 1;
+    }
+    if (tdma_opt)
+    {
+        // Keyed with no slot of our own until the master's beacon says otherwise
+        tdma_init(&tdma, tdma_id, tdma_want, TDMA_SLOTS, tdma_slot_ms, TDMA_GUARD_MS, now_ns());
+        radio_set_tdma(&radio, tdma_slot_ms * 1000, TDMA_SLOTS, TDMA_GUARD_MS * 500, 0);
+        tty_set_rts(br.tty_fd, 0);
+        br.tdma = &tdma;
+        br.keyed = 1;
+    }
+    if (fhss_opt)
+    {
+        // Home for a start, which also has the firmware calibrate the grid;
+        // the master sweeps once to pick its first sequence
+        fhss_init(&fhss, strcmp(fhss_role, "master") == 0, fhss_dwell_ms, now_ns());
+        radio_set_hops(&radio, 0, 0, 0, 0);
+        if (fhss.master)
+        {
+            radio_scan(&radio);
+            br.fhss_start_ns = now_ns() + FHSS_SWEEP_WAIT_MS * 1000000ULL;
+        }
+        br.fhss = &fhss;
+    }
+    if (mesh_opt)
+    {
+        uint8_t prefix[3] = { (uint8_t)net[0], (uint8_t)net[1], (uint8_t)net[2] };
+
+        mesh_init(&mesh, mesh_id, prefix, mesh_gateway, baud, now_ns());
+        br.mesh = &mesh;
+    }
+    if (bond_opt)
+    {
+        // The hold for a gap is bounded by one frame on the slowest link
+        bond_init(&bond, nlinks, bond_baud, agg_size > 0 ? agg_size : BRIDGE_BUF_SIZE / 2, now_ns());
+        br.bond = &bond;
+    }
+    if (div_opt)
+    {
+        // The TX radio idles in RX on our channel and is keyed per frame
+        div_init(&div, nlinks);
+        if (nlinks > 1)
+        {
+            radio_set_diversity(&radio, 1);
+            tty_set_rts(br.tty_fd, 0);
+            br.keyed = 1;
+        }
+        br.div = &div;
+    }
+
+    // Nothing checks the room in front of a packet on the way out
+    if (bridge_headroom(&br) > BRIDGE_HEADROOM)
+    {
+        fprintf(stderr, "error: %d bytes of headers in front of a packet, more than BRIDGE_HEADROOM (%d)\n",
+                bridge_headroom(&br), BRIDGE_HEADROOM);
+        return 1;
+    }
+    if (fair)
+    {
+        cls_link link = bridge_cls_link(&br);
+
+        fq_init(&fq, bridge_line_rate(&br));
+        fq_set_class(&fq, CLS_CONTROL, 1, 1);
+        fq_set_class(&fq, CLS_INTERACTIVE, 1, 1);
+        fq_set_class(&fq, CLS_DEFAULT, 0, CLS_WEIGHT_DEFAULT);
+        fq_set_class(&fq, CLS_BULK, 0, CLS_WEIGHT_BULK);
+        cls_shaper_init(&br.shaper, share, &link, now_ns());
+        br.fq = &fq;
+        br.cls = &cls;
+    }
+    if (metrics_port > 0 && (metrics_fd = metrics_listen(metrics_port)) < 0)
+        return 1;
+
+    printf("Bridging %s <-> %s @ %d baud\n", iface, tty, baud);
+    for (int i = 1; br.bond && i < nlinks; i++)
+        printf("Bonded with %s @ %d baud\n", bond_tty[i], bond_baud[i]);
+    if (br.div && nlinks > 1)
+        printf("Receive diversity on %s\n", div_opt);
+    if (br.pf)
+        printf("Filter: %d rules from %s\n", pf.nrules, filter);
+
+    for (int i = 0; i < nlinks; i++)
+        deframer_init(&d[i]);
+    br.d = &d[0];
+
+    struct pollfd fds[3 + BOND_MAX_LINKS];
+    int nfds = 3 + nlinks;
+    fds[0].fd = br.tun_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = br.tty_fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = br.radio ? br.radio->fd : -1;
+    fds[2].events = POLLIN;
+    fds[3].fd = metrics_fd;
+    fds[3].events = POLLIN;
+    for (int i = 1; i < nlinks; i++)
+    {
+        fds[3 + i].fd = br.link_fd[i];
+        fds[3 + i].events = POLLIN;
+    }
+
+    while (running)
+    {
+        if (dump_stats)
+        {
+            dump_stats = 0;
+            bridge_print_stats(&br, stdout);
+        }
+        if (reload && br.pf)
+        {
+            if (pf_load(br.pf, filter, &line) == 0)
+                printf("Filter: %d rules from %s\n", br.pf->nrules, filter);
+            else if (line)
+                fprintf(stderr, "error: %s:%d: bad filter rule, the rules in force stay\n", filter, line);
+            else
+                fprintf(stderr, "error: cannot read the filter rules %s, the rules in force stay\n", filter);
+        }
+        reload = 0;
+
+        int timeout = bridge_air_service(&br);
+        int arq_timeout = bridge_arq_service(&br);
+        if (arq_timeout < timeout)
+            timeout = arq_timeout;
+        int agg_timeout = bridge_agg_service(&br);
+        if (agg_timeout < timeout)
+            timeout = agg_timeout;
+        int rate_timeout = bridge_rate_service(&br);
+        if (rate_timeout < timeout)
+            timeout = rate_timeout;
+        int scan_timeout = bridge_scan_service(&br);
+        if (scan_timeout < timeout)
+            timeout = scan_timeout;
+        int tdma_timeout = bridge_tdma_service(&br);
+        if (tdma_timeout < timeout)
+            timeout = tdma_timeout;
+        int fhss_timeout = bridge_fhss_service(&br);
+        if (fhss_timeout < timeout)
+            timeout = fhss_timeout;
+        int mesh_timeout = bridge_mesh_service(&br);
+        if (mesh_timeout < timeout)
+            timeout = mesh_timeout;
+        int bond_timeout = bridge_bond_service(&br);
+        if (bond_timeout < timeout)
+            timeout = bond_timeout;
+        int div_timeout = bridge_div_service(&br);
+        if (div_timeout < timeout)
+            timeout = div_timeout;
+        int telemetry_timeout = bridge_telemetry_service(&br);
+        if (telemetry_timeout < timeout)
+            timeout = telemetry_timeout;
+        int fq_timeout = bridge_fq_service(&br);
+        if (fq_timeout < timeout)
+            timeout = fq_timeout;
+
+        // The fair queues take packets whatever the TX path is doing
+        fds[0].events = br.fq || bridge_can_send(&br) ? POLLIN : 0;
+
+        if (poll(fds, nfds, timeout) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN)
+            bridge_tun_event(&br);
+        if (fds[1].revents & POLLIN)
+            bridge_tty_event(&br, 0, &d[0]);
+        if (fds[2].revents & POLLIN)
+            bridge_radio_event(&br);
+        if (fds[3].revents & POLLIN)
+            bridge_metrics_event(&br, metrics_fd);
+        for (int i = 1; i < nlinks; i++)
+            if (fds[3 + i].revents & POLLIN)
+                bridge_tty_event(&br, i, &d[i]);
+    }
+
+    printf("\nTerminating...\n");
+    bridge_print_stats(&br, stdout);
+
+    close(br.tun_fd);
+    close(br.tty_fd);
+    for (int i = 1; i < nlinks; i++)
+        close(br.link_fd[i]);
+    if (br.radio)
+        close(br.radio->fd);
+    if (metrics_fd >= 0)
+        close(metrics_fd);
+    if (nsym > 0)
+        fec_free(&fec);
+
+    return 0;
+}
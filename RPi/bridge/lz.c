@@ -0,0 +1,417 @@
+/*
+    LZ payload compression stage with a shared dictionary
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame.h"
+#include "lz.h"
+
+#define LZ_TYPE         0xFC
+#define LZ_MIN_MATCH    4
+#define LZ_TAIL         5       // the last bytes of a packet are always literals
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+    return (read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint64_t lz_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lz_init(lz_ctx *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int lz_set_dict(lz_ctx *ctx, const uint8_t *dict, int len)
+{
+    if (len < 0 || len > LZ_MAX_DICT)
+        return -1;
+
+    memcpy(ctx->dict, dict, len);
+    ctx->dict_len = len;
+    ctx->dict_id  = crc8(dict, len);
+
+    // Later positions win, they are the most useful ones after training
+    memset(ctx->dict_table, 0, sizeof(ctx->dict_table));
+    for (int i = 0; i + LZ_MIN_MATCH <= len; i++)
+        ctx->dict_table[lz_hash(dict + i)] = (uint16_t)(i + 1);
+
+    return 0;
+}
+
+int lz_load_dict(lz_ctx *ctx, const char *path)
+{
+    static uint8_t dict[LZ_MAX_DICT];
+    FILE *f = fopen(path, "rb");
+
+    if (!f)
+        return -1;
+
+    int len = (int)fread(dict, 1, sizeof(dict), f);
+    fclose(f);
+
+    return lz_set_dict(ctx, dict, len);
+}
+
+static int lz_put_len(uint8_t *dst, int n, int cap, int len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (n >= cap)
+            return -1;
+        dst[n++] = 255;
+    }
+    if (n >= cap)
+        return -1;
+    dst[n++] = (uint8_t)len;
+
+    return n;
+}
+
+static int lz_emit(uint8_t *dst, int n, int cap, const uint8_t *lit, int litlen, int off, int mlen)
+{
+    int ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+
+    if (n >= cap)
+        return -1;
+    dst[n++] = (uint8_t)(((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15));
+
+    if (litlen >= 15 && (n = lz_put_len(dst, n, cap, litlen - 15)) < 0)
+        return -1;
+    if (n + litlen > cap)
+        return -1;
+    memcpy(dst + n, lit, litlen);
+    n += litlen;
+
+    if (!mlen)
+        return n;
+
+    if (n + 2 > cap)
+        return -1;
+    dst[n++] = (uint8_t)off;
+    dst[n++] = (uint8_t)(off >> 8);
+
+    if (ml >= 15 && (n = lz_put_len(dst, n, cap, ml - 15)) < 0)
+        return -1;
+
+    return n;
+}
+
+int lz_compress_block(lz_ctx *ctx, const uint8_t *src, int len, uint8_t *dst, int cap)
+{
+    const uint8_t *dict = ctx->dict;
+    int dlen = ctx->dict_len;
+    int anchor = 0;
+    int n = 0;
+    int i = 0;
+
+    // Invalidate the packet hash table by bumping its generation
+    if (++ctx->gen == 0)
+    {
+        memset(ctx->pkt_table, 0, sizeof(ctx->pkt_table));
+        ctx->gen = 1;
+    }
+
+    while (i + LZ_MIN_MATCH + LZ_TAIL <= len)
+    {
+        uint32_t h = lz_hash(src + i);
+        uint32_t e = ctx->pkt_table[h];
+        int limit = len - LZ_TAIL;
+        int best = 0;
+        int off = 0;
+
+        ctx->pkt_table[h] = ((uint32_t)ctx->gen << 16) | (uint32_t)i;
+
+        if ((e >> 16) == ctx->gen)
+        {
+            int p = e & 0xFFFF;
+            int m = 0;
+            while (i + m < limit && src[p + m] == src[i + m])
+                m++;
+            if (m >= LZ_MIN_MATCH)
+            {
+                best = m;
+                off = i - p;
+            }
+        }
+
+        if (ctx->dict_table[h])
+        {
+            int p = ctx->dict_table[h] - 1;
+            int m = 0;
+            while (i + m < limit && p + m < dlen && dict[p + m] == src[i + m])
+                m++;
+            if (m >= LZ_MIN_MATCH && m > best)
+            {
+                best = m;
+                off = i + dlen - p;
+            }
+        }
+
+        if (!best)
+        {
+            i++;
+            continue;
+        }
+
+        if ((n = lz_emit(dst, n, cap, src + anchor, i - anchor, off, best)) < 0)
+            return -1;
+
+        // Keep the table warm inside the match, cheaply
+        for (int k = i + 1; k < i + best && k + LZ_MIN_MATCH <= len; k += 2)
+            ctx->pkt_table[lz_hash(src + k)] = ((uint32_t)ctx->gen << 16) | (uint32_t)k;
+
+        i += best;
+        anchor = i;
+    }
+
+    return lz_emit(dst, n, cap, src + anchor, len - anchor, 0, 0);
+}
+
+static int lz_get_len(const uint8_t *src, int *ip, int len, int *value)
+{
+    uint8_t b;
+
+    do
+    {
+        if (*ip >= len)
+            return -1;
+        b = src[(*ip)++];
+        *value += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+int lz_decompress_block(const lz_ctx *ctx, const uint8_t *src, int len, uint8_t *dst, int cap)
+{
+    int dlen = ctx->dict_len;
+    int ip = 0;
+    int op = 0;
+
+    while (ip < len)
+    {
+        uint8_t token = src[ip++];
+        int litlen = token >> 4;
+        int mlen = (token & 0x0F) + LZ_MIN_MATCH;
+
+        if (litlen == 15 && lz_get_len(src, &ip, len, &litlen) < 0)
+            return -1;
+        if (ip + litlen > len || op + litlen > cap)
+            return -1;
+        memcpy(dst + op, src + ip, litlen);
+        ip += litlen;
+        op += litlen;
+
+        if (ip == len)
+            break;
+
+        if (ip + 2 > len)
+            return -1;
+        int off = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+
+        if ((token & 0x0F) == 15 && lz_get_len(src, &ip, len, &mlen) < 0)
+            return -1;
+        if (off == 0 || off > op + dlen || op + mlen > cap)
+            return -1;
+
+        // The window is the dictionary followed by the packet itself
+        for (int k = 0; k < mlen; k++, op++)
+            dst[op] = op - off >= 0 ? dst[op - off] : ctx->dict[dlen + op - off];
+    }
+
+    return op;
+}
+
+int lz_train(const uint8_t *const *samples, const int *lens, int count, uint8_t *dict, int cap)
+{
+    enum { K = 6, SEG = 32, STEP = 16 };
+    typedef struct { uint64_t score; int sample; int off; int len; } segment;
+
+    uint32_t *freq  = calloc(1 << 16, sizeof(uint32_t));
+    uint32_t *stamp = calloc(1 << 16, sizeof(uint32_t));
+    segment *segs = 0;
+    int nsegs = 0;
+    int used = 0;
+
+    if (!freq || !stamp)
+        goto out;
+
+    // Document frequency of every k-mer: how many packets contain it
+    for (int s = 0; s < count; s++)
+    {
+        for (int i = 0; i + K <= lens[s]; i++)
+        {
+            uint32_t h = (uint32_t)(crc16_ccitt(samples[s] + i, K));
+            if (stamp[h] != (uint32_t)s + 1)
+            {
+                stamp[h] = s + 1;
+                freq[h]++;
+            }
+        }
+        nsegs += lens[s] / STEP + 1;
+    }
+
+    segs = calloc(nsegs, sizeof(segment));
+    if (!segs)
+        goto out;
+    nsegs = 0;
+
+    for (int s = 0; s < count; s++)
+    {
+        for (int off = 0; off + K <= lens[s]; off += STEP)
+        {
+            segment g = { 0, s, off, lens[s] - off < SEG ? lens[s] - off : SEG };
+            for (int i = 0; i + K <= g.len; i++)
+            {
+                uint32_t f = freq[crc16_ccitt(samples[s] + off + i, K)];
+                g.score += f > 1 ? f : 0;
+            }
+            if (g.score)
+                segs[nsegs++] = g;
+        }
+    }
+
+    // Highest score first (insertion into a sorted prefix is fine for a trainer)
+    for (int a = 1; a < nsegs; a++)
+    {
+        segment g = segs[a];
+        int b = a;
+        while (b > 0 && segs[b - 1].score < g.score)
+        {
+            segs[b] = segs[b - 1];
+            b--;
+        }
+        segs[b] = g;
+    }
+
+    // Greedy cover: take a segment, then forget the k-mers it covers. The
+    // best segments end up at the end of the dictionary.
+    for (int a = 0; a < nsegs && used < cap; a++)
+    {
+        const uint8_t *p = samples[segs[a].sample] + segs[a].off;
+        uint64_t score = 0;
+
+        for (int i = 0; i + K <= segs[a].len; i++)
+        {
+            uint32_t f = freq[crc16_ccitt(p + i, K)];
+            score += f > 1 ? f : 0;
+        }
+        if (score * 2 < segs[a].score)
+            continue;
+
+        int len = segs[a].len < cap - used ? segs[a].len : cap - used;
+        memcpy(dict + cap - used - len, p, len);
+        used += len;
+
+        for (int i = 0; i + K <= segs[a].len; i++)
+            freq[crc16_ccitt(p + i, K)] = 0;
+    }
+
+    memmove(dict, dict + cap - used, used);
+
+out:
+    free(freq);
+    free(stamp);
+    free(segs);
+    return used;
+}
+
+void lz_print_stats(void *ctx, FILE *out)
+{
+    lz_ctx *lz = (lz_ctx *)ctx;
+    lz_stats *s = &lz->stats;
+
+    fprintf(out, "lz: dict=%d bytes (id %02X) packets=%llu compressed=%llu stored=%llu ratio=%.1f%% "
+                 "tx=%.0f ns/pkt rx=%llu (%.0f ns/pkt) errors=%llu dict_mismatch=%llu\n",
+            lz->dict_len, lz->dict_id,
+            (unsigned long long)s->packets_in, (unsigned long long)s->compressed,
+            (unsigned long long)s->stored,
+            s->bytes_in ? 100.0 * s->bytes_out / s->bytes_in : 0.0,
+            s->packets_in ? (double)s->tx_ns / s->packets_in : 0.0,
+            (unsigned long long)s->decompressed,
+            s->decompressed ? (double)s->rx_ns / s->decompressed : 0.0,
+            (unsigned long long)s->errors, (unsigned long long)s->dict_mismatch);
+}
+
+static int lz_stage_tx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    lz_ctx *lz = (lz_ctx *)ctx;
+    uint64_t t0 = lz_now_ns();
+    int n = -1;
+
+    lz->stats.packets_in++;
+    lz->stats.bytes_in += len;
+
+    if (len >= LZ_MIN_LEN)
+        n = lz_compress_block(lz, buf, len, lz->scratch + 2, len - 3);
+
+    // Incompressible: out unchanged
+    if (n < 0 || n + 2 >= len || n + 2 > cap)
+    {
+        lz->stats.stored++;
+        lz->stats.bytes_out += len;
+        lz->stats.tx_ns += lz_now_ns() - t0;
+        return len;
+    }
+
+    lz->scratch[0] = LZ_TYPE;
+    lz->scratch[1] = lz->dict_id;
+    memcpy(buf, lz->scratch, n + 2);
+
+    lz->stats.compressed++;
+    lz->stats.bytes_out += n + 2;
+    lz->stats.tx_ns += lz_now_ns() - t0;
+
+    return n + 2;
+}
+
+static int lz_stage_rx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    lz_ctx *lz = (lz_ctx *)ctx;
+
+    if (len < 2 || buf[0] != LZ_TYPE)
+        return len;
+
+    if (buf[1] != lz->dict_id)
+    {
+        lz->stats.dict_mismatch++;
+        return -1;
+    }
+
+    uint64_t t0 = lz_now_ns();
+    int n = lz_decompress_block(lz, buf + 2, len - 2, lz->scratch, cap < BRIDGE_BUF_SIZE ? cap : BRIDGE_BUF_SIZE);
+    if (n < 0)
+    {
+        lz->stats.errors++;
+        return -1;
+    }
+
+    memcpy(buf, lz->scratch, n);
+    lz->stats.decompressed++;
+    lz->stats.rx_ns += lz_now_ns() - t0;
+
+    return n;
+}
+
+stage lz_stage(lz_ctx *ctx)
+{
+    stage s = { "lz", lz_stage_tx, lz_stage_rx, lz_print_stats, ctx, 0 };
+    return s;
+}
@@ -0,0 +1,69 @@
+/*
+    LZ payload compression stage with a shared dictionary
+
+    Small packets compress poorly on their own, so both ends load the same
+    pre-trained dictionary (bridge_bench lztrain builds one from a capture)
+    and matches may point back into it. The format is LZ4-like:
+
+        0xFC dict_id { token [litlen+] literals [offset(2, LE) [matchlen+]] }
+
+    A packet that does not shrink goes out unchanged: the bridge only
+    carries IP packets and header compression types, none start with 0xFC.
+    Everything lives in the context, there are no allocations per packet.
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define LZ_MAX_DICT     32768
+#define LZ_HASH_BITS    12
+#define LZ_MIN_LEN      12
+
+typedef struct lz_stats {
+    uint64_t packets_in;
+    uint64_t compressed;
+    uint64_t stored;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t tx_ns;
+    uint64_t decompressed;
+    uint64_t rx_ns;
+    uint64_t errors;
+    uint64_t dict_mismatch;
+} lz_stats;
+
+typedef struct lz_ctx {
+    uint8_t dict[LZ_MAX_DICT];
+    int dict_len;
+    uint8_t dict_id;
+
+    uint16_t dict_table[1 << LZ_HASH_BITS];     // dictionary position + 1
+    uint32_t pkt_table[1 << LZ_HASH_BITS];      // generation << 16 | position
+    uint16_t gen;
+
+    uint8_t scratch[BRIDGE_BUF_SIZE];
+
+    lz_stats stats;
+} lz_ctx;
+
+void lz_init(lz_ctx *ctx);
+
+int  lz_set_dict(lz_ctx *ctx, const uint8_t *dict, int len);
+int  lz_load_dict(lz_ctx *ctx, const char *path);
+
+// Raw block codec, returns the output length or -1 if it does not fit
+int  lz_compress_block(lz_ctx *ctx, const uint8_t *src, int len, uint8_t *dst, int cap);
+int  lz_decompress_block(const lz_ctx *ctx, const uint8_t *src, int len, uint8_t *dst, int cap);
+
+// Builds a dictionary of at most 'cap' bytes from sample packets
+int  lz_train(const uint8_t *const *samples, const int *lens, int count, uint8_t *dict, int cap);
+
+void lz_print_stats(void *ctx, FILE *out);
+
+stage lz_stage(lz_ctx *ctx);
+
+#endif
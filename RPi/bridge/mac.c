@@ -0,0 +1,170 @@
+/*
+    Shared-channel MAC simulator
+*/
+
+#include <string.h>
+
+#include "frame.h"
+#include "chan.h"
+#include "mac.h"
+
+#define MAC_STEP_US     50
+
+// The SPIRIT1 data rate is ~2.16x the tty rate, see the firmware profiles
+#define MAC_CHIP_RATE(baud)     ((baud) * 2.16)
+
+typedef enum { NODE_IDLE, NODE_CCA, NODE_BACKOFF, NODE_KEY, NODE_TX } node_state;
+
+typedef struct mac_node {
+    node_state state;
+    uint64_t until_us;
+    int nb;
+    int busy_seen;
+    int collided;
+    uint64_t q[MAC_QUEUE];  // arrival times
+    int head;
+    int count;
+} mac_node;
+
+static uint64_t mac_rng(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static double mac_uniform(uint64_t *s)
+{
+    return (mac_rng(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void mac_params_default(mac_params *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->nodes = 5;
+    p->baud = 9600;
+    p->len = 100;
+    p->load = 0.5;
+    p->cca_ms = 64 * 1000.0 / MAC_CHIP_RATE(p->baud);
+    p->unit_ms = (CHAN_PREAMBLE + FRAME_HDR_LEN + p->len) * 10 * 1000.0 / p->baud / 8;
+    p->max_bo = 4;
+    p->turnaround_ms = 1.0;
+    p->seconds = 120;
+    p->seed = 0x9E3779B97F4A7C15ULL;
+}
+
+void mac_simulate(const mac_params *p, mac_result *r)
+{
+    static mac_node nodes[MAC_MAX_NODES];
+    int n = p->nodes < MAC_MAX_NODES ? p->nodes : MAC_MAX_NODES;
+    uint64_t rng = p->seed;
+    double delay_sum = 0;
+
+    memset(r, 0, sizeof(*r));
+    memset(nodes, 0, sizeof(nodes));
+
+    // Preamble, sync and header go on air too, 10 bits per byte
+    uint64_t air_us = (uint64_t)((CHAN_PREAMBLE + FRAME_HDR_LEN + p->len) * 10 * 1e6 / p->baud);
+    uint64_t cca_us = (uint64_t)(p->cca_ms * 1000);
+    uint64_t unit_us = (uint64_t)(p->unit_ms * 1000);
+    uint64_t turn_us = (uint64_t)(p->turnaround_ms * 1000);
+    uint64_t end_us = (uint64_t)(p->seconds * 1e6);
+    double arrival = p->load / n * MAC_STEP_US / (double)air_us;
+    int carriers = 0;
+    uint64_t on_air_us = 0;
+
+    for (uint64_t t = 0; t < end_us; t += MAC_STEP_US)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            mac_node *nd = &nodes[i];
+
+            if (mac_uniform(&rng) < arrival)
+            {
+                r->offered++;
+                if (nd->count == MAC_QUEUE)
+                    r->overflows++;
+                else
+                    nd->q[(nd->head + nd->count++) % MAC_QUEUE] = t;
+            }
+
+            switch (nd->state)
+            {
+                case NODE_IDLE:
+                    if (nd->count == 0)
+                        break;
+                    nd->nb = 0;
+                    nd->busy_seen = 0;
+                    nd->state = p->csma ? NODE_CCA : NODE_KEY;
+                    nd->until_us = t + (p->csma ? cca_us : turn_us);
+                    break;
+
+                case NODE_CCA:
+                    if (carriers > 0)
+                        nd->busy_seen = 1;
+                    if (t < nd->until_us)
+                        break;
+                    if (!nd->busy_seen)
+                    {
+                        nd->state = NODE_KEY;
+                        nd->until_us = t + turn_us;
+                        break;
+                    }
+                    r->backoffs++;
+                    if (++nd->nb > p->max_bo)
+                    {
+                        r->busy++;
+                        nd->head = (nd->head + 1) % MAC_QUEUE;
+                        nd->count--;
+                        nd->state = NODE_IDLE;
+                        break;
+                    }
+                    nd->state = NODE_BACKOFF;
+                    nd->until_us = t + (mac_rng(&rng) % (1u << nd->nb)) * unit_us;
+                    break;
+
+                case NODE_BACKOFF:
+                    if (t < nd->until_us)
+                        break;
+                    nd->busy_seen = 0;
+                    nd->state = NODE_CCA;
+                    nd->until_us = t + cca_us;
+                    break;
+
+                case NODE_KEY:
+                    if (t < nd->until_us)
+                        break;
+                    // Everything on air now, this one included, is lost
+                    nd->collided = carriers > 0;
+                    for (int j = 0; carriers > 0 && j < n; j++)
+                        if (nodes[j].state == NODE_TX)
+                            nodes[j].collided = 1;
+                    carriers++;
+                    nd->state = NODE_TX;
+                    nd->until_us = t + air_us;
+                    break;
+
+                case NODE_TX:
+                    if (t < nd->until_us)
+                        break;
+                    carriers--;
+                    if (nd->collided)
+                        r->collided++;
+                    else
+                    {
+                        r->delivered++;
+                        on_air_us += air_us;
+                        delay_sum += (t - nd->q[nd->head]) / 1000.0;
+                    }
+                    nd->head = (nd->head + 1) % MAC_QUEUE;
+                    nd->count--;
+                    nd->state = NODE_IDLE;
+                    break;
+            }
+        }
+    }
+
+    r->throughput = (double)on_air_us / end_us;
+    r->delay_ms = r->delivered ? delay_sum / r->delivered : 0;
+}
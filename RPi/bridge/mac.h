@@ -0,0 +1,58 @@
+/*
+    Shared-channel MAC simulator
+
+    N nodes on one channel, all in range of each other, with Poisson
+    traffic. A frame gets through when no other carrier is up at any time
+    during it. Two ways to get on air:
+
+    ALOHA   key the transmitter as soon as a frame is queued; this is what
+            keyed (non-persistent) TX without CCA would do
+    CSMA    the SPIRIT1 engine the firmware enables with M 1 ...: a CCA
+            of cca_ms, and while it finds a carrier a random backoff of
+            0 .. 2^NB - 1 units, NB counting the busy CCAs; after max_bo
+            of them the frame is given up (CTS never comes)
+
+    Either way the carrier comes up turnaround_ms after the decision, the
+    window in which two nodes that both found the channel clear collide.
+*/
+
+#ifndef MAC_H
+#define MAC_H
+
+#include <stdint.h>
+
+#define MAC_MAX_NODES   32
+#define MAC_QUEUE       32
+
+typedef struct mac_params {
+    int nodes;
+    int baud;
+    int len;                // frame body bytes
+    double load;            // offered frames per frame airtime, all nodes
+    int csma;
+    double cca_ms;
+    double unit_ms;         // backoff unit
+    int max_bo;
+    double turnaround_ms;
+    double seconds;
+    uint64_t seed;
+} mac_params;
+
+typedef struct mac_result {
+    uint64_t offered;
+    uint64_t delivered;
+    uint64_t collided;
+    uint64_t busy;          // dropped after max_bo busy CCAs
+    uint64_t overflows;     // node queue full
+    uint64_t backoffs;
+    double throughput;      // delivered airtime / time
+    double delay_ms;        // mean arrival to delivery
+} mac_result;
+
+// 9600 baud, 100 byte frames, CCA of 64 bit periods at the chip data rate,
+// a backoff unit of an eighth of the frame airtime
+void mac_params_default(mac_params *p);
+
+void mac_simulate(const mac_params *p, mac_result *r);
+
+#endif
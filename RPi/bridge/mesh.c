@@ -0,0 +1,405 @@
+/*
+    Mesh forwarding
+*/
+
+#include <string.h>
+
+#include "mesh.h"
+#include "frame.h"
+
+#define MS(x) ((uint64_t)(x) * 1000000ULL)
+
+static uint64_t mesh_rng(mesh_ctx *ctx)
+{
+    ctx->rng ^= ctx->rng << 13;
+    ctx->rng ^= ctx->rng >> 7;
+    ctx->rng ^= ctx->rng << 17;
+    return ctx->rng;
+}
+
+static int mesh_count(uint32_t bits)
+{
+    int n = 0;
+
+    for (; bits; bits &= bits - 1)
+        n++;
+    return n;
+}
+
+// A period of 3/4 to 5/4 MESH_HELLO_MS, so that neighbours drift apart
+static void mesh_schedule(mesh_ctx *ctx, uint64_t now_ns)
+{
+    ctx->next_hello_ns = now_ns + MS(MESH_HELLO_MS) * 3 / 4 + mesh_rng(ctx) % (MS(MESH_HELLO_MS) / 2);
+}
+
+void mesh_init(mesh_ctx *ctx, int id, const uint8_t *net, int gateway, int baud, uint64_t now_ns)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->id = id;
+    ctx->baud = baud;
+    memcpy(ctx->net, net, 3);
+    ctx->gateway = gateway;
+    ctx->rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)(id + 1) << 32) ^ now_ns;
+    if (ctx->rng == 0)
+        ctx->rng = 1;
+
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+    {
+        ctx->route[d].metric = MESH_INFINITY;
+        ctx->route[d].via = MESH_NONE;
+        ctx->nb[d].cost = MESH_INFINITY;
+        for (int e = 0; e < MESH_MAX_NODES; e++)
+            ctx->nb[d].adv[e] = MESH_INFINITY;
+    }
+    ctx->route[id].metric = 0;
+    ctx->route[id].via = (uint8_t)id;
+
+    // The first HELLO soon, but not all nodes at once
+    ctx->next_hello_ns = now_ns + mesh_rng(ctx) % MS(MESH_TRIGGER_MS);
+}
+
+void mesh_set_turnaround(mesh_ctx *ctx, uint64_t turn_ns)
+{
+    ctx->turn_ns = turn_ns;
+}
+
+int mesh_ip_dst(const mesh_ctx *ctx, const uint8_t *pkt, int len)
+{
+    if (len >= 20 && (pkt[0] >> 4) == 4 && memcmp(pkt + 16, ctx->net, 3) == 0)
+        return pkt[19] < MESH_MAX_NODES ? pkt[19] : -1;
+    return ctx->gateway;
+}
+
+// Delivery ratio of the last MESH_WINDOW HELLOs, out of 255. A new
+// neighbour counts over at least MESH_WINDOW / 4, one HELLO that made it
+// through is not a good link yet.
+static int mesh_heard(const mesh_neighbor *n)
+{
+    int window = n->expected < MESH_WINDOW / 4 ? MESH_WINDOW / 4 : n->expected;
+
+    return mesh_count(n->seen & (uint32_t)((1ull << window) - 1)) * 255 / window;
+}
+
+static uint16_t mesh_link_cost(const mesh_ctx *ctx, const mesh_neighbor *n)
+{
+    int baud = n->baud > 0 && n->baud < ctx->baud ? n->baud : ctx->baud;
+    int df = mesh_heard(n);
+
+    if (!n->heard || df == 0 || n->rev == 0 || baud <= 0)
+        return MESH_INFINITY;
+
+    double air_ms = (double)(FRAME_HDR_LEN + MESH_PROBE_LEN) * 10 * 1000 / baud + ctx->turn_ns / 1e6;
+    double cost = air_ms * 255 * 255 / ((double)df * n->rev);
+
+    return cost >= MESH_INFINITY - 1 ? MESH_INFINITY - 1 : cost < 1 ? 1 : (uint16_t)(cost + 0.5);
+}
+
+// Best next hop for one destination, over the neighbours alone
+static void mesh_update_route(mesh_ctx *ctx, int d)
+{
+    mesh_route *r = &ctx->route[d];
+    uint32_t best = MESH_INFINITY, metric = MESH_INFINITY;
+    int via = MESH_NONE, hops = 0;
+
+    if (d == ctx->id)
+        return;
+
+    ctx->stats.recomputed++;
+    for (int k = 0; k < MESH_MAX_NODES; k++)
+    {
+        const mesh_neighbor *n = &ctx->nb[k];
+
+        if (!n->heard || n->cost == MESH_INFINITY || n->adv[d] == MESH_INFINITY || n->adv_hops[d] + 1 > MESH_TTL)
+            continue;
+
+        // The next hop in use keeps the route unless another one is
+        // MESH_HYSTERESIS percent better, the ratios are noisy
+        uint32_t m = (uint32_t)n->cost + n->adv[d];
+        uint32_t score = k == r->via ? m * (100 - MESH_HYSTERESIS) / 100 : m;
+        if (score < best)
+        {
+            best = score;
+            metric = m;
+            via = k;
+            hops = n->adv_hops[d] + 1;
+        }
+    }
+
+    if (metric >= MESH_INFINITY)
+    {
+        metric = MESH_INFINITY;
+        via = MESH_NONE;
+        hops = 0;
+    }
+    if (metric != r->metric || via != r->via || hops != r->hops)
+    {
+        // Only a new next hop or reachability is worth a HELLO before its time
+        if (via != r->via)
+        {
+            ctx->triggered = 1;
+            ctx->stats.route_changes++;
+        }
+        r->metric = (uint16_t)metric;
+        r->via = (uint8_t)via;
+        r->hops = (uint8_t)hops;
+    }
+}
+
+// Every destination that goes, or could go, through neighbour 'k'
+static void mesh_update_through(mesh_ctx *ctx, int k)
+{
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+        if (ctx->nb[k].adv[d] != MESH_INFINITY || ctx->route[d].via == k)
+            mesh_update_route(ctx, d);
+}
+
+static void mesh_lose(mesh_ctx *ctx, int k)
+{
+    mesh_neighbor *n = &ctx->nb[k];
+    uint16_t adv[MESH_MAX_NODES];
+
+    memcpy(adv, n->adv, sizeof(adv));
+    n->heard = 0;
+    n->cost = MESH_INFINITY;
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+        n->adv[d] = MESH_INFINITY;
+
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+        if (adv[d] != MESH_INFINITY || ctx->route[d].via == k)
+            mesh_update_route(ctx, d);
+}
+
+static void mesh_hello_rx(mesh_ctx *ctx, const uint8_t *msg, int len, uint64_t now_ns)
+{
+    int k = msg[2];
+    int nn = len >= 7 ? msg[6] : 0;
+    int nr_at = 7 + 2 * nn;
+
+    if (k == ctx->id || k >= MESH_MAX_NODES || len < nr_at + 1 || len < nr_at + 1 + 5 * msg[nr_at])
+        return;
+
+    mesh_neighbor *n = &ctx->nb[k];
+    // The window survives a lost neighbour, the HELLOs it missed count
+    uint8_t gap = n->expected ? (uint8_t)(msg[3] - n->seq) : MESH_WINDOW;
+
+    // A repeat, or a neighbour that restarted
+    if (gap == 0 || gap > 128)
+        gap = MESH_WINDOW;
+
+    n->seen = gap >= MESH_WINDOW ? 1 : (n->seen << gap) | 1;
+    n->expected = gap >= MESH_WINDOW ? 1 : n->expected + gap;
+    if (n->expected > MESH_WINDOW)
+        n->expected = MESH_WINDOW;
+    n->seq = msg[3];
+    n->baud = ((msg[4] << 8) | msg[5]) * 100;
+    n->last_ns = now_ns;
+    n->heard = 1;
+
+    n->rev = 0;
+    for (int i = 0; i < nn; i++)
+        if (msg[7 + 2 * i] == ctx->id)
+            n->rev = msg[7 + 2 * i + 1];
+
+    uint16_t cost = mesh_link_cost(ctx, n);
+    int cost_changed = cost != n->cost;
+    n->cost = cost;
+
+    // Its routes, less those through us; itself at 0
+    uint16_t adv[MESH_MAX_NODES];
+    uint8_t hops[MESH_MAX_NODES];
+
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+    {
+        adv[d] = MESH_INFINITY;
+        hops[d] = 0;
+    }
+    adv[k] = 0;
+    for (int i = 0; i < msg[nr_at]; i++)
+    {
+        const uint8_t *e = msg + nr_at + 1 + 5 * i;
+
+        if (e[0] < MESH_MAX_NODES && e[0] != k && e[4] != ctx->id)
+        {
+            adv[e[0]] = (uint16_t)((e[1] << 8) | e[2]);
+            hops[e[0]] = e[3];
+        }
+    }
+
+    if (cost_changed)
+    {
+        memcpy(n->adv, adv, sizeof(adv));
+        memcpy(n->adv_hops, hops, sizeof(hops));
+        mesh_update_through(ctx, k);
+        return;
+    }
+
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+        if (adv[d] != n->adv[d] || hops[d] != n->adv_hops[d])
+        {
+            n->adv[d] = adv[d];
+            n->adv_hops[d] = hops[d];
+            mesh_update_route(ctx, d);
+        }
+}
+
+int mesh_encap(mesh_ctx *ctx, uint8_t **buf, int len, int dst)
+{
+    if (dst < 0 || dst >= MESH_MAX_NODES || dst == ctx->id || ctx->route[dst].via == MESH_NONE)
+    {
+        ctx->stats.no_route++;
+        return -1;
+    }
+
+    uint8_t *h = *buf -= MESH_HDR_LEN;
+
+    h[0] = MESH_TYPE;
+    h[1] = MESH_MSG_DATA;
+    h[2] = ctx->route[dst].via;
+    h[3] = (uint8_t)dst;
+    h[4] = (uint8_t)ctx->id;
+    h[5] = MESH_TTL;
+
+    ctx->stats.originated++;
+    return len + MESH_HDR_LEN;
+}
+
+mesh_action mesh_receive(mesh_ctx *ctx, uint8_t *buf, int len, uint64_t now_ns)
+{
+    if (len < 2 || buf[0] != MESH_TYPE)
+        return MESH_NOT_MESH;
+
+    if (buf[1] == MESH_MSG_HELLO)
+    {
+        ctx->stats.hellos_rx++;
+        mesh_hello_rx(ctx, buf, len, now_ns);
+        return MESH_CONSUMED;
+    }
+    if (buf[1] != MESH_MSG_DATA || len < MESH_HDR_LEN)
+        return MESH_CONSUMED;
+
+    if (buf[2] != ctx->id)
+    {
+        ctx->stats.overheard++;
+        return MESH_CONSUMED;
+    }
+    if (buf[3] == ctx->id)
+    {
+        ctx->stats.delivered++;
+        return MESH_DELIVER;
+    }
+
+    if (--buf[5] == 0)
+    {
+        ctx->stats.ttl_expired++;
+        return MESH_CONSUMED;
+    }
+    if (buf[3] >= MESH_MAX_NODES || ctx->route[buf[3]].via == MESH_NONE)
+    {
+        ctx->stats.no_route++;
+        return MESH_CONSUMED;
+    }
+
+    buf[2] = ctx->route[buf[3]].via;
+    ctx->stats.forwarded++;
+    return MESH_FORWARD;
+}
+
+static int mesh_hello(mesh_ctx *ctx, uint8_t *out)
+{
+    int baud = ctx->baud / 100;
+    int len = 7, nn = 0, nr = 0;
+
+    out[0] = MESH_TYPE;
+    out[1] = MESH_MSG_HELLO;
+    out[2] = (uint8_t)ctx->id;
+    out[3] = ++ctx->seq;
+    out[4] = (uint8_t)(baud >> 8);
+    out[5] = (uint8_t)baud;
+
+    for (int k = 0; k < MESH_MAX_NODES; k++)
+        if (ctx->nb[k].heard)
+        {
+            out[len++] = (uint8_t)k;
+            out[len++] = (uint8_t)mesh_heard(&ctx->nb[k]);
+            nn++;
+        }
+    out[6] = (uint8_t)nn;
+
+    int nr_at = len++;
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+    {
+        const mesh_route *r = &ctx->route[d];
+
+        if (d == ctx->id || r->via == MESH_NONE)
+            continue;
+        out[len++] = (uint8_t)d;
+        out[len++] = (uint8_t)(r->metric >> 8);
+        out[len++] = (uint8_t)r->metric;
+        out[len++] = r->hops;
+        out[len++] = r->via;
+        nr++;
+    }
+    out[nr_at] = (uint8_t)nr;
+
+    ctx->stats.hellos_tx++;
+    return len;
+}
+
+int mesh_poll(mesh_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns)
+{
+    for (int k = 0; k < MESH_MAX_NODES; k++)
+        if (ctx->nb[k].heard && now_ns > ctx->nb[k].last_ns + MESH_LOST_HELLOS * MS(MESH_HELLO_MS))
+            mesh_lose(ctx, k);
+
+    if (cap < MESH_HELLO_MAX)
+        return 0;
+
+    int due = now_ns >= ctx->next_hello_ns ||
+              (ctx->triggered && now_ns >= ctx->last_hello_ns + MS(MESH_TRIGGER_MS));
+    if (!due)
+        return 0;
+
+    ctx->triggered = 0;
+    ctx->last_hello_ns = now_ns;
+    mesh_schedule(ctx, now_ns);
+    return mesh_hello(ctx, out);
+}
+
+int64_t mesh_time_left(const mesh_ctx *ctx, uint64_t now_ns)
+{
+    uint64_t next = ctx->next_hello_ns;
+
+    if (ctx->triggered && ctx->last_hello_ns + MS(MESH_TRIGGER_MS) < next)
+        next = ctx->last_hello_ns + MS(MESH_TRIGGER_MS);
+    for (int k = 0; k < MESH_MAX_NODES; k++)
+        if (ctx->nb[k].heard && ctx->nb[k].last_ns + MESH_LOST_HELLOS * MS(MESH_HELLO_MS) + 1 < next)
+            next = ctx->nb[k].last_ns + MESH_LOST_HELLOS * MS(MESH_HELLO_MS) + 1;
+
+    return next > now_ns ? (int64_t)(next - now_ns) : 0;
+}
+
+void mesh_print_stats(mesh_ctx *ctx, FILE *out)
+{
+    mesh_stats *s = &ctx->stats;
+
+    fprintf(out, "mesh: node=%d hellos_tx=%llu hellos_rx=%llu originated=%llu delivered=%llu forwarded=%llu "
+                 "overheard=%llu no_route=%llu ttl_expired=%llu route_changes=%llu recomputed=%llu\n",
+            ctx->id, (unsigned long long)s->hellos_tx, (unsigned long long)s->hellos_rx,
+            (unsigned long long)s->originated, (unsigned long long)s->delivered,
+            (unsigned long long)s->forwarded, (unsigned long long)s->overheard,
+            (unsigned long long)s->no_route, (unsigned long long)s->ttl_expired,
+            (unsigned long long)s->route_changes, (unsigned long long)s->recomputed);
+
+    fprintf(out, "mesh: neighbours");
+    for (int k = 0; k < MESH_MAX_NODES; k++)
+        if (ctx->nb[k].heard)
+            fprintf(out, " [%d df=%d%% dr=%d%% cost=%ums]", k, mesh_heard(&ctx->nb[k]) * 100 / 255,
+                    ctx->nb[k].rev * 100 / 255, (unsigned)ctx->nb[k].cost);
+    fprintf(out, "\nmesh: routes");
+    for (int d = 0; d < MESH_MAX_NODES; d++)
+        if (d != ctx->id && ctx->route[d].via != MESH_NONE)
+            fprintf(out, " [%d via %d %u hops %ums]", d, ctx->route[d].via, ctx->route[d].hops,
+                    (unsigned)ctx->route[d].metric);
+    fprintf(out, "\n");
+}
@@ -0,0 +1,142 @@
+/*
+    Mesh forwarding
+
+    Nodes that cannot hear each other reach one another, and the gateway,
+    through the nodes in between. Node N owns address net.N (a /24 shared
+    by the mesh); everything outside the /24 goes to the gateway node.
+
+    Every node broadcasts a HELLO every MESH_HELLO_MS, earlier when one of
+    its routes changed:
+
+        0xF6 2 id seq baud/100(2) nn { id heard } [nn] nr { dst metric(2) hops via } [nr]
+
+    'heard' is how many of the last MESH_WINDOW HELLOs of that neighbour
+    came in, out of 255. Together with how many of the neighbour's this
+    node heard it gives the delivery ratio both ways, and with the link
+    rate the airtime metric of the link, as in 802.11s:
+
+        cost = (turnaround + airtime of a MESH_PROBE_LEN frame) / (df * dr)   ms
+
+    The routes are a distance vector over those costs. A HELLO only
+    touches the destinations whose advertised metric changed, or all of
+    those through the neighbour if its link cost changed, and each of them
+    is recomputed over the neighbours on its own; the next hop only
+    changes for one MESH_HYSTERESIS percent better. Routes a neighbour has
+    through this node are ignored (split horizon), routes longer than
+    MESH_TTL hops are not taken, and a neighbour not heard for
+    MESH_LOST_HELLOS periods is dropped with everything through it.
+
+    Data packets, after the packet stages, carry
+
+        0xF6 1 next dst src ttl
+
+    A node that is 'next' and not 'dst' rewrites 'next' and 'ttl' and
+    sends the packet on straight from the receive path, it never goes
+    up to the TUN.
+*/
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define MESH_TYPE           0xF6
+#define MESH_MSG_DATA       1
+#define MESH_MSG_HELLO      2
+
+#define MESH_MAX_NODES      32
+#define MESH_HDR_LEN        6
+#define MESH_TTL            8
+#define MESH_HELLO_MS       10000
+#define MESH_TRIGGER_MS     1000    // triggered HELLOs at most this often
+#define MESH_LOST_HELLOS    4
+#define MESH_WINDOW         32
+#define MESH_PROBE_LEN      100
+#define MESH_HYSTERESIS     15      // percent a new next hop has to be better by
+#define MESH_INFINITY       0xFFFF
+#define MESH_NONE           0xFF
+#define MESH_HELLO_MAX      (6 + 2 * MESH_MAX_NODES + 5 * MESH_MAX_NODES + 2)
+
+typedef enum mesh_action {
+    MESH_NOT_MESH = 0,
+    MESH_CONSUMED,          // a HELLO, or dropped
+    MESH_DELIVER,           // for us, the packet follows the header
+    MESH_FORWARD            // header rewritten, send it on
+} mesh_action;
+
+typedef struct mesh_neighbor {
+    int heard;              // not lost
+    uint8_t seq;
+    uint32_t seen;          // last MESH_WINDOW HELLOs, bit 0 the latest
+    int expected;           // HELLOs the window covers so far
+    uint8_t rev;            // how many of ours it hears, out of 255
+    int baud;
+    uint64_t last_ns;
+    uint16_t cost;          // ms, MESH_INFINITY not usable
+    uint16_t adv[MESH_MAX_NODES];       // its metrics, MESH_INFINITY none
+    uint8_t adv_hops[MESH_MAX_NODES];
+} mesh_neighbor;
+
+typedef struct mesh_route {
+    uint16_t metric;        // MESH_INFINITY none
+    uint8_t via;            // next hop
+    uint8_t hops;
+} mesh_route;
+
+typedef struct mesh_stats {
+    uint64_t hellos_tx;
+    uint64_t hellos_rx;
+    uint64_t originated;
+    uint64_t delivered;
+    uint64_t forwarded;
+    uint64_t overheard;     // data for another next hop
+    uint64_t no_route;
+    uint64_t ttl_expired;
+    uint64_t route_changes;
+    uint64_t recomputed;    // route entries recomputed
+} mesh_stats;
+
+typedef struct mesh_ctx {
+    int id;
+    int baud;
+    uint64_t turn_ns;       // channel access and turnaround per frame
+    uint8_t net[3];
+    int gateway;            // -1 none
+
+    uint8_t seq;
+    uint64_t next_hello_ns;
+    uint64_t last_hello_ns;
+    int triggered;          // a route changed since the last HELLO
+
+    mesh_neighbor nb[MESH_MAX_NODES];
+    mesh_route route[MESH_MAX_NODES];
+    uint64_t rng;
+
+    mesh_stats stats;
+} mesh_ctx;
+
+// Node 'id' in net.0/24, 'gateway' the node for the rest, -1 none
+void mesh_init(mesh_ctx *ctx, int id, const uint8_t *net, int gateway, int baud, uint64_t now_ns);
+
+void mesh_set_turnaround(mesh_ctx *ctx, uint64_t turn_ns);
+
+// Node an IP packet is for, -1 if none
+int  mesh_ip_dst(const mesh_ctx *ctx, const uint8_t *pkt, int len);
+
+// Puts the header in front of a packet for 'dst', in the MESH_HDR_LEN
+// bytes before '*buf', which moves back to it. Returns the new length,
+// -1 without a route.
+int  mesh_encap(mesh_ctx *ctx, uint8_t **buf, int len, int dst);
+
+// What to do with a received packet
+mesh_action mesh_receive(mesh_ctx *ctx, uint8_t *buf, int len, uint64_t now_ns);
+
+// HELLO to send, 0 if none is due
+int  mesh_poll(mesh_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns);
+
+int64_t mesh_time_left(const mesh_ctx *ctx, uint64_t now_ns);
+
+void mesh_print_stats(mesh_ctx *ctx, FILE *out);
+
+#endif
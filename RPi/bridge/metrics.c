@@ -0,0 +1,173 @@
+/*
+    Metrics export
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+
+void metrics_init(metrics *m, char *buf, int cap)
+{
+    m->buf = buf;
+    m->cap = cap;
+    m->len = 0;
+    m->family = 0;
+    buf[0] = '\0';
+}
+
+static void metrics_printf(metrics *m, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (m->len >= m->cap - 1)
+        return;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(m->buf + m->len, m->cap - m->len, fmt, ap);
+    va_end(ap);
+
+    // Truncated output stops at the buffer end
+    m->len += n < m->cap - m->len ? n : m->cap - m->len - 1;
+}
+
+static void metrics_family(metrics *m, const char *name, const char *type, const char *help)
+{
+    if (m->family && strcmp(m->family, name) == 0)
+        return;
+
+    metrics_printf(m, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    m->family = name;
+}
+
+static void metrics_sample(metrics *m, const char *name, const char *suffix,
+                           const char *labels, const char *extra, const char *value)
+{
+    int braces = (labels && *labels) || extra;
+
+    metrics_printf(m, "%s%s%s%s%s%s%s %s\n", name, suffix,
+                   braces ? "{" : "",
+                   labels ? labels : "",
+                   labels && *labels && extra ? "," : "",
+                   extra ? extra : "",
+                   braces ? "}" : "",
+                   value);
+}
+
+void metrics_gauge(metrics *m, const char *name, const char *help, const char *labels, double value)
+{
+    char v[32];
+
+    metrics_family(m, name, "gauge", help);
+    snprintf(v, sizeof(v), "%.6g", value);
+    metrics_sample(m, name, "", labels, 0, v);
+}
+
+void metrics_counter(metrics *m, const char *name, const char *help, const char *labels, uint64_t value)
+{
+    char v[32];
+
+    metrics_family(m, name, "counter", help);
+    snprintf(v, sizeof(v), "%llu", (unsigned long long)value);
+    metrics_sample(m, name, "", labels, 0, v);
+}
+
+void metrics_histogram(metrics *m, const char *name, const char *help, const char *labels,
+                       const double *bounds, const uint64_t *counts, int nbuckets,
+                       uint64_t count, double sum)
+{
+    char le[32], v[32];
+
+    metrics_family(m, name, "histogram", help);
+
+    for (int i = 0; i < nbuckets; i++)
+    {
+        snprintf(le, sizeof(le), "le=\"%g\"", bounds[i]);
+        snprintf(v, sizeof(v), "%llu", (unsigned long long)counts[i]);
+        metrics_sample(m, name, "_bucket", labels, le, v);
+    }
+
+    snprintf(v, sizeof(v), "%llu", (unsigned long long)count);
+    metrics_sample(m, name, "_bucket", labels, "le=\"+Inf\"", v);
+    metrics_sample(m, name, "_count", labels, 0, v);
+
+    snprintf(v, sizeof(v), "%.6g", sum);
+    metrics_sample(m, name, "_sum", labels, 0, v);
+}
+
+int metrics_listen(int port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "error: socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        fprintf(stderr, "error: metrics port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+void metrics_serve(int listen_fd, const metrics *m)
+{
+    char head[128];
+    char request[512];
+
+    int fd = accept(listen_fd, 0, 0);
+    if (fd < 0)
+        return;
+
+    // Whatever was asked for gets the metrics; a scrape is one small
+    // request, so a single read with a short timeout is enough and a
+    // silent client can not hold up the bridge.
+    struct timeval tv = { 0, 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (read(fd, request, sizeof(request)) < 0)
+    {
+        close(fd);
+        return;
+    }
+
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %d\r\n\r\n", m->len);
+
+    if (write(fd, head, n) == n)
+    {
+        for (int off = 0; off < m->len; )
+        {
+            int w = write(fd, m->buf + off, m->len - off);
+            if (w <= 0)
+                break;
+            off += w;
+        }
+    }
+
+    close(fd);
+}
@@ -0,0 +1,43 @@
+/*
+    Metrics export
+
+    A plain HTTP endpoint on a local port that answers every request with
+    the Prometheus text format, so a Prometheus server, node_exporter's
+    textfile relay or curl can scrape the bridge:
+
+        curl http://127.0.0.1:9170/metrics
+
+    The body is built into a caller-supplied buffer; HELP and TYPE lines are
+    written once per metric family, samples of a family must be consecutive.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+typedef struct metrics {
+    char *buf;
+    int cap;
+    int len;
+    const char *family;     // last HELP/TYPE written
+} metrics;
+
+void metrics_init(metrics *m, char *buf, int cap);
+
+// 'labels' is the inside of the braces, e.g. "radio=\"rx\"", or 0
+void metrics_gauge(metrics *m, const char *name, const char *help, const char *labels, double value);
+void metrics_counter(metrics *m, const char *name, const char *help, const char *labels, uint64_t value);
+
+// Cumulative buckets: counts[i] observations with value <= bounds[i]
+void metrics_histogram(metrics *m, const char *name, const char *help, const char *labels,
+                       const double *bounds, const uint64_t *counts, int nbuckets,
+                       uint64_t count, double sum);
+
+// Listening socket on 127.0.0.1:port, -1 on error
+int  metrics_listen(int port);
+
+// Accepts one connection and answers it with the body
+void metrics_serve(int listen_fd, const metrics *m);
+
+#endif
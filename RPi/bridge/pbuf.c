@@ -0,0 +1,85 @@
+/*
+    Packet buffers
+*/
+
+#include <string.h>
+
+#include "pbuf.h"
+
+void pbuf_pool_init(pbuf_pool *p)
+{
+    memset(p, 0, sizeof(*p));
+
+    for (int i = PBUF_POOL_SIZE - 1; i >= 0; i--)
+    {
+        p->bufs[i].next = p->free;
+        p->free = &p->bufs[i];
+    }
+}
+
+pbuf *pbuf_alloc(pbuf_pool *p)
+{
+    pbuf *b = p->free;
+
+    if (!b)
+    {
+        p->exhausted++;
+        return 0;
+    }
+
+    p->free = b->next;
+    b->next = 0;
+    b->data = b->mem + BRIDGE_HEADROOM;
+    b->len = 0;
+    b->refs = 1;
+
+    p->allocs++;
+    if (++p->in_use > p->high_water)
+        p->high_water = p->in_use;
+    return b;
+}
+
+void pbuf_ref(pbuf *b)
+{
+    b->refs++;
+}
+
+void pbuf_unref(pbuf_pool *p, pbuf *b)
+{
+    if (!b || --b->refs > 0)
+        return;
+
+    b->next = p->free;
+    p->free = b;
+    p->in_use--;
+}
+
+int pbuf_headroom(const pbuf *b)
+{
+    return (int)(b->data - b->mem);
+}
+
+int pbuf_cap(const pbuf *b)
+{
+    return (int)(b->mem + sizeof(b->mem) - b->data);
+}
+
+uint8_t *pbuf_push(pbuf *b, int n)
+{
+    if (n > pbuf_headroom(b))
+        return 0;
+
+    b->data -= n;
+    b->len += n;
+    return b->data;
+}
+
+uint8_t *pbuf_pull(pbuf *b, int n)
+{
+    if (n > b->len)
+        return 0;
+
+    b->data += n;
+    b->len -= n;
+    return b->data;
+}
@@ -0,0 +1,70 @@
+/*
+    Packet buffers
+
+    A packet on the TX path stays where the TUN read put it. Its buffer
+    keeps BRIDGE_HEADROOM bytes free in front, and the headers go there
+    one after the other as the packet moves down: mesh, ARQ, bond or
+    diversity, the link stages' (stage.h) and last the frame header. The
+    preamble goes out from a constant of its own next to it, one
+    writev() for the lot, and nothing is moved up for a header or copied
+    into an air buffer. Tailroom is what is left of BRIDGE_BUF_SIZE, for
+    the CRC, the FEC parity and the AES tag.
+
+    The buffers come from a fixed pool and carry a reference count. A
+    frame that has to wait for its TDMA slot or the next dwell keeps its
+    buffer with a reference of its own, it is not copied aside; the
+    buffer goes back to the pool when the last reference is dropped.
+    'in_use' and 'high_water' say how many are out, 'exhausted' how often
+    none was left, the packet is dropped then.
+
+    What is copied still: the ARQ keeps a copy of every frame for
+    retransmission, the stages after it change the frame in place; the
+    aggregation packs packets into one frame; header compression and LZ
+    rewrite the packet; and a relayed mesh packet moves from the RX
+    buffer into one of these.
+*/
+
+#ifndef PBUF_H
+#define PBUF_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define PBUF_POOL_SIZE  8
+
+typedef struct pbuf {
+    uint8_t *data;
+    int len;
+    int refs;
+    struct pbuf *next;      // on the free list
+    uint8_t mem[BRIDGE_HEADROOM + BRIDGE_BUF_SIZE];
+} pbuf;
+
+typedef struct pbuf_pool {
+    pbuf bufs[PBUF_POOL_SIZE];
+    pbuf *free;
+
+    int in_use;
+    int high_water;
+    uint64_t allocs;
+    uint64_t exhausted;
+} pbuf_pool;
+
+void pbuf_pool_init(pbuf_pool *p);
+
+// An empty buffer, BRIDGE_HEADROOM in front of 'data', with one
+// reference; NULL if the pool is empty
+pbuf *pbuf_alloc(pbuf_pool *p);
+void  pbuf_ref(pbuf *b);
+void  pbuf_unref(pbuf_pool *p, pbuf *b);
+
+// Room in front of 'data', and from 'data' to the end
+int   pbuf_headroom(const pbuf *b);
+int   pbuf_cap(const pbuf *b);
+
+// 'n' bytes more in front, NULL without the headroom; 'n' bytes less
+uint8_t *pbuf_push(pbuf *b, int n);
+uint8_t *pbuf_pull(pbuf *b, int n);
+
+#endif
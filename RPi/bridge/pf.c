@@ -0,0 +1,326 @@
+/*
+    Packet filter
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pf.h"
+
+static const struct { const char *name; int proto; } pf_protos[] = {
+    { "icmp", 1 }, { "igmp", 2 }, { "tcp", 6 }, { "udp", 17 }, { "icmp6", 58 },
+};
+
+static const char *pf_dst_names[PF_DSTS] = { "unicast", "broadcast", "multicast" };
+
+void pf_init(pf_ctx *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    memset(ctx->proto, PF_NONE, sizeof(ctx->proto));
+    memset(ctx->port, PF_NONE, sizeof(ctx->port));
+    memset(ctx->type, PF_NONE, sizeof(ctx->type));
+}
+
+// A rule from the words of a line; -1 if it is not one
+static int pf_parse_rule(pf_rule *r, char *line)
+{
+    char *save = 0, *w, *end;
+    long v;
+
+    memset(r, 0, sizeof(*r));
+    r->proto = r->port = r->dst = -1;
+
+    if (!(w = strtok_r(line, " \t", &save)))
+        return -1;
+    if (!strcmp(w, "pass"))
+        r->action = PF_PASS;
+    else if (!strcmp(w, "drop"))
+        r->action = PF_DROP;
+    else if (!strcmp(w, "limit"))
+    {
+        unsigned count, seconds;
+
+        if (!(w = strtok_r(0, " \t", &save)) || sscanf(w, "%u/%u", &count, &seconds) != 2 || count < 1 ||
+            seconds < 1)
+            return -1;
+        r->action = PF_LIMIT;
+        r->count = (int)count;
+        r->period_ns = seconds * 1000000000ULL;
+    }
+    else
+        return -1;
+
+    if (!(w = strtok_r(0, " \t", &save)))
+        return -1;
+    if (strcmp(w, "any"))
+    {
+        for (unsigned i = 0; i < sizeof(pf_protos) / sizeof(pf_protos[0]); i++)
+            if (!strcmp(w, pf_protos[i].name))
+                r->proto = pf_protos[i].proto;
+        if (r->proto < 0 && ((v = strtol(w, &end, 10)) < 0 || v > 255 || *end || end == w))
+            return -1;
+        if (r->proto < 0)
+            r->proto = (int)v;
+    }
+
+    while ((w = strtok_r(0, " \t", &save)))
+    {
+        char *arg = strtok_r(0, " \t", &save);
+
+        if (!arg)
+            return -1;
+        if (!strcmp(w, "dport") && (r->proto == 6 || r->proto == 17))
+        {
+            if ((v = strtol(arg, &end, 10)) < 0 || v > 65535 || *end || end == arg)
+                return -1;
+            r->port = (int)v;
+        }
+        else if (!strcmp(w, "type") && (r->proto == 1 || r->proto == 58))
+        {
+            if ((v = strtol(arg, &end, 10)) < 0 || v > 255 || *end || end == arg)
+                return -1;
+            r->port = (int)v;
+        }
+        else if (!strcmp(w, "dst"))
+        {
+            for (int d = 0; d < PF_DSTS; d++)
+                if (!strcmp(arg, pf_dst_names[d]))
+                    r->dst = d;
+            if (r->dst < 0)
+                return -1;
+        }
+        else
+            return -1;
+    }
+    return 0;
+}
+
+// Rule 'i' into every entry of the tables it matches that no earlier
+// rule has
+static void pf_compile(pf_ctx *ctx, int i)
+{
+    const pf_rule *r = &ctx->rule[i];
+
+    for (int d = 0; d < PF_DSTS; d++)
+    {
+        if (r->dst >= 0 && r->dst != d)
+            continue;
+        for (int p = 0; p < 256; p++)
+        {
+            if (r->proto >= 0 && r->proto != p)
+                continue;
+            if (r->port < 0 && ctx->proto[d][p] == PF_NONE)
+                ctx->proto[d][p] = (uint8_t)i;
+
+            uint8_t *t = p == 6 || p == 17 ? ctx->port[d][p == 17] : p == 1 || p == 58 ? ctx->type[d][p == 58] : 0;
+            int n = p == 6 || p == 17 ? 65536 : 256;
+
+            for (int k = 0; t && k < n; k++)
+                if ((r->port < 0 || r->port == k) && t[k] == PF_NONE)
+                    t[k] = (uint8_t)i;
+        }
+    }
+}
+
+int pf_load(pf_ctx *ctx, const char *path, int *line)
+{
+    char buf[256];
+    FILE *f = fopen(path, "r");
+    pf_ctx *next;
+
+    *line = 0;
+    if (!f)
+        return -1;
+    if (!(next = malloc(sizeof(*next))))
+    {
+        fclose(f);
+        return -1;
+    }
+    pf_init(next);
+
+    while (fgets(buf, sizeof(buf), f))
+    {
+        char *hash = strchr(buf, '#'), *w = buf;
+        int n;
+
+        ++*line;
+        if (hash)
+            *hash = 0;
+        buf[strcspn(buf, "\r\n")] = 0;
+        while (*w == ' ' || *w == '\t')
+            w++;
+        for (n = (int)strlen(w); n > 0 && (w[n - 1] == ' ' || w[n - 1] == '\t'); n--)
+            w[n - 1] = 0;
+        if (!*w)
+            continue;
+
+        pf_rule *r = &next->rule[next->nrules];
+        char text[PF_TEXT_MAX];
+        int t = 0;
+
+        // The words one space apart, for the stats and the metrics labels
+        for (const char *c = w; *c && t < PF_TEXT_MAX - 1; c++)
+            if ((*c != ' ' && *c != '\t') || (c[1] != ' ' && c[1] != '\t'))
+                text[t++] = *c == '\t' ? ' ' : *c;
+        text[t] = 0;
+        if (next->nrules == PF_RULES_MAX || pf_parse_rule(r, w) < 0)
+        {
+            fclose(f);
+            free(next);
+            return -1;
+        }
+        memcpy(r->text, text, sizeof(text));
+        pf_compile(next, next->nrules++);
+    }
+    fclose(f);
+
+    // A rule that is still there, written the same, carries on where it
+    // was: its counts and, for a limit, its credit
+    uint8_t kept[PF_RULES_MAX] = { 0 };
+
+    for (int i = 0; i < next->nrules; i++)
+        for (int j = 0; j < ctx->nrules; j++)
+        {
+            pf_rule *r = &next->rule[i];
+            const pf_rule *o = &ctx->rule[j];
+
+            if (kept[j] || strcmp(r->text, o->text))
+                continue;
+            kept[j] = 1;
+            r->hits = o->hits;
+            r->drops = o->drops;
+            r->credit_ns = o->credit_ns;
+            r->last_ns = o->last_ns;
+            break;
+        }
+    next->passed = ctx->passed;
+    next->dropped = ctx->dropped;
+    next->unmatched = ctx->unmatched;
+
+    *ctx = *next;
+    free(next);
+    *line = 0;
+    return 0;
+}
+
+// Protocol, destination port or ICMP type (-1 without) and destination
+// kind of an IP packet; -1 if it is not one
+static int pf_parse_packet(const uint8_t *pkt, int len, int *proto, int *port, int *dst)
+{
+    int l4;
+
+    *port = -1;
+    if (len >= 20 && pkt[0] >> 4 == 4)
+    {
+        *proto = pkt[9];
+        l4 = (pkt[0] & 0x0F) * 4;
+        if (((pkt[6] & 0x1F) << 8) | pkt[7])
+            l4 = len;           // not the first fragment
+        if (pkt[16] >= 224 && pkt[16] < 240)
+            *dst = PF_MULTICAST;
+        else if (pkt[19] == 255)
+            *dst = PF_BROADCAST;
+        else
+            *dst = PF_UNICAST;
+    }
+    else if (len >= 40 && pkt[0] >> 4 == 6)
+    {
+        *proto = pkt[6];
+        l4 = 40;
+        *dst = pkt[24] == 0xFF ? PF_MULTICAST : PF_UNICAST;
+    }
+    else
+        return -1;
+
+    if ((*proto == 6 || *proto == 17) && l4 + 4 <= len)
+        *port = (pkt[l4 + 2] << 8) | pkt[l4 + 3];
+    else if ((*proto == 1 || *proto == 58) && l4 + 1 <= len)
+        *port = pkt[l4];
+    return 0;
+}
+
+int pf_lookup(const pf_ctx *ctx, const uint8_t *pkt, int len)
+{
+    int proto, port, dst;
+    uint8_t i;
+
+    if (pf_parse_packet(pkt, len, &proto, &port, &dst) < 0)
+        return -1;
+
+    if (port >= 0 && (proto == 6 || proto == 17))
+        i = ctx->port[dst][proto == 17][port];
+    else if (port >= 0)
+        i = ctx->type[dst][proto == 58][port];
+    else
+        i = ctx->proto[dst][proto];
+    return i == PF_NONE ? -1 : i;
+}
+
+int pf_lookup_linear(const pf_ctx *ctx, const uint8_t *pkt, int len)
+{
+    int proto, port, dst;
+
+    if (pf_parse_packet(pkt, len, &proto, &port, &dst) < 0)
+        return -1;
+
+    for (int i = 0; i < ctx->nrules; i++)
+    {
+        const pf_rule *r = &ctx->rule[i];
+
+        if ((r->proto < 0 || r->proto == proto) && (r->port < 0 || r->port == port) &&
+            (r->dst < 0 || r->dst == dst))
+            return i;
+    }
+    return -1;
+}
+
+int pf_filter(pf_ctx *ctx, const uint8_t *pkt, int len, uint64_t now_ns)
+{
+    int i = pf_lookup(ctx, pkt, len);
+    pf_rule *r;
+    int pass;
+
+    if (i < 0)
+    {
+        ctx->unmatched++;
+        ctx->passed++;
+        return 1;
+    }
+
+    r = &ctx->rule[i];
+    r->hits++;
+    if (r->action == PF_LIMIT)
+    {
+        uint64_t cost = r->period_ns / r->count;
+
+        // Full to start with, and never more than a period's worth
+        r->credit_ns = r->hits == 1 ? r->period_ns : r->credit_ns + (now_ns > r->last_ns ? now_ns - r->last_ns : 0);
+        if (r->credit_ns > r->period_ns)
+            r->credit_ns = r->period_ns;
+        r->last_ns = now_ns;
+
+        pass = r->credit_ns >= cost;
+        if (pass)
+            r->credit_ns -= cost;
+    }
+    else
+        pass = r->action == PF_PASS;
+
+    if (pass)
+        ctx->passed++;
+    else
+    {
+        r->drops++;
+        ctx->dropped++;
+    }
+    return pass;
+}
+
+void pf_print_stats(pf_ctx *ctx, FILE *out)
+{
+    fprintf(out, "filter: rules=%d passed=%llu dropped=%llu unmatched=%llu\n", ctx->nrules,
+            (unsigned long long)ctx->passed, (unsigned long long)ctx->dropped, (unsigned long long)ctx->unmatched);
+    for (int i = 0; i < ctx->nrules; i++)
+        fprintf(out, "filter: %-40s hits=%llu drops=%llu\n", ctx->rule[i].text,
+                (unsigned long long)ctx->rule[i].hits, (unsigned long long)ctx->rule[i].drops);
+}
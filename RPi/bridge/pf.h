@@ -0,0 +1,108 @@
+/*
+    Packet filter
+
+    With proxyarp and a default route, as the pppd setup had them, the
+    link sits on a LAN and the hosts there chatter: mDNS, SSDP, NTP
+    broadcasts, IPv6 router solicitations, each of them airtime on a line
+    of a few hundred bytes a second. With -X the packets the TUN gives
+    the bridge go through a set of rules first, and what they drop costs
+    nothing. ARP does not get this far, the TUN is a layer 3 interface
+    and proxy ARP is answered on the LAN.
+
+    The rules are read from a file, one a line, # starts a comment:
+
+        drop  udp dport 5353                    # mDNS
+        drop  udp dport 1900                    # SSDP
+        limit 2/60 udp dport 123 dst broadcast  # NTP broadcasts
+        drop  icmp6 type 133                    # IPv6 router solicitations
+        drop  any dst multicast
+
+    An action, then what a packet must have to match:
+
+        pass | drop | limit n/s     limit lets n packets through every s
+                                    seconds and drops the rest
+        tcp | udp | icmp | icmp6 | igmp | <number> | any
+        dport <port>                tcp and udp only
+        type <type>                 icmp and icmp6 only
+        dst unicast | broadcast | multicast
+                                    broadcast is 255.255.255.255 or an
+                                    address ending in .255
+
+    The first rule that matches decides, a packet no rule matches passes.
+    For IPv6 the protocol is the next header of the fixed header, a
+    packet with extension headers only matches by it.
+
+    The rules are compiled into flat tables: the first rule for every
+    destination kind and protocol, and for every destination port of TCP
+    and UDP and every ICMP type. A packet takes one lookup however many
+    rules there are (bridge_bench pf). SIGHUP reads the file again; when
+    it has an error, the rules in force stay.
+
+    Every rule counts the packets it matched and the ones it dropped. A
+    reload keeps the totals, and a rule written the same in the new file
+    keeps its counts and what is left of its limit.
+*/
+
+#ifndef PF_H
+#define PF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PF_RULES_MAX    254
+#define PF_NONE         0xFF
+#define PF_TEXT_MAX     64
+
+typedef enum { PF_PASS, PF_DROP, PF_LIMIT } pf_action;
+typedef enum { PF_UNICAST, PF_BROADCAST, PF_MULTICAST, PF_DSTS } pf_dst;
+
+typedef struct pf_rule {
+    pf_action action;
+    int proto;              // -1 any
+    int port;               // destination port or ICMP type, -1 any
+    int dst;                // pf_dst, -1 any
+    char text[PF_TEXT_MAX]; // as written, without the comment
+
+    // limit: a packet costs period_ns / count of credit
+    int count;
+    uint64_t period_ns;
+    uint64_t credit_ns;
+    uint64_t last_ns;
+
+    uint64_t hits;
+    uint64_t drops;
+} pf_rule;
+
+typedef struct pf_ctx {
+    pf_rule rule[PF_RULES_MAX];
+    int nrules;
+
+    // The first matching rule, or PF_NONE
+    uint8_t proto[PF_DSTS][256];
+    uint8_t port[PF_DSTS][2][65536];    // tcp, udp
+    uint8_t type[PF_DSTS][2][256];      // icmp, icmp6
+
+    uint64_t passed;
+    uint64_t dropped;
+    uint64_t unmatched;
+} pf_ctx;
+
+// No rules, everything passes
+void pf_init(pf_ctx *ctx);
+
+// Reads and compiles the rules in 'path' over those in 'ctx', keeping the
+// counts; -1 if it cannot be read, with '*line' 0, or on the first bad
+// line, and 'ctx' is left as it was
+int  pf_load(pf_ctx *ctx, const char *path, int *line);
+
+// The rule a packet matches, -1 for none: through the tables, and rule
+// by rule as the reference
+int  pf_lookup(const pf_ctx *ctx, const uint8_t *pkt, int len);
+int  pf_lookup_linear(const pf_ctx *ctx, const uint8_t *pkt, int len);
+
+// 1 if the packet may go on, 0 if it is dropped
+int  pf_filter(pf_ctx *ctx, const uint8_t *pkt, int len, uint64_t now_ns);
+
+void pf_print_stats(pf_ctx *ctx, FILE *out);
+
+#endif
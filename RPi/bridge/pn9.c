@@ -0,0 +1,291 @@
+/*
+    PN9 bit error rate tester and whitening
+*/
+
+#include <string.h>
+
+#include "pn9.h"
+
+#define PN9_SEED    0x1FF
+
+static int tables_ready;
+static uint64_t words[PN9_PERIOD];
+static int16_t phase_of[512];       // 9 bits of the sequence, the first in the MSB
+static uint8_t whitening[2 * PN9_PERIOD];   // twice over, any 511 in a row
+
+static int pn9_step(uint16_t *state)
+{
+    int bit = *state & 1;
+
+    *state = (uint16_t)((*state >> 1) | (((*state ^ (*state >> 5)) & 1) << 8));
+    return bit;
+}
+
+uint64_t pn9_bits(uint16_t *state, int nbits)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < nbits; i++)
+        v = (v << 1) | (uint64_t)pn9_step(state);
+    return v;
+}
+
+static void pn9_tables(void)
+{
+    uint8_t seq[PN9_PERIOD + 64];
+    uint16_t state = PN9_SEED;
+
+    if (tables_ready)
+        return;
+
+    for (int i = 0; i < PN9_PERIOD; i++)
+        seq[i] = (uint8_t)pn9_step(&state);
+    for (int i = PN9_PERIOD; i < PN9_PERIOD + 64; i++)
+        seq[i] = seq[i - PN9_PERIOD];
+
+    memset(phase_of, 0xFF, sizeof(phase_of));
+    for (int p = 0; p < PN9_PERIOD; p++)
+    {
+        uint64_t w = 0;
+
+        for (int i = 0; i < 64; i++)
+            w = (w << 1) | seq[p + i];
+        words[p] = w;
+        phase_of[w >> 55] = (int16_t)p;
+    }
+
+    state = PN9_SEED;
+    for (int i = 0; i < PN9_PERIOD; i++)
+    {
+        whitening[i] = whitening[i + PN9_PERIOD] = (uint8_t)state;
+        pn9_bits(&state, 8);
+    }
+
+    tables_ready = 1;
+}
+
+uint64_t pn9_word(int phase)
+{
+    pn9_tables();
+    return words[phase % PN9_PERIOD];
+}
+
+void pn9_ber_init(pn9_ber *b)
+{
+    pn9_tables();
+    memset(b, 0, sizeof(*b));
+    b->gap = PN9_BURST_GAP;
+}
+
+static void pn9_burst_end(pn9_ber *b)
+{
+    int bin = 0;
+
+    if (!b->in_burst)
+        return;
+
+    while (bin < PN9_BURST_BINS - 1 && (2 << bin) <= b->burst_len)
+        bin++;
+    b->bursts[bin]++;
+    if (b->burst_len > b->max_burst)
+        b->max_burst = b->burst_len;
+    b->in_burst = 0;
+}
+
+static void pn9_good(pn9_ber *b, int n)
+{
+    b->gap += n;
+    if (b->gap >= PN9_BURST_GAP)
+    {
+        pn9_burst_end(b);
+        b->gap = PN9_BURST_GAP;
+    }
+}
+
+static void pn9_error(pn9_ber *b)
+{
+    if (b->in_burst)
+        b->burst_len += b->gap + 1;
+    else
+    {
+        b->in_burst = 1;
+        b->burst_len = 1;
+    }
+    b->gap = 0;
+}
+
+// Only a block with errors is looked at bit by bit, and only at the errors
+static void pn9_commit(pn9_ber *b, int errors)
+{
+    b->bits += 64 * PN9_BLOCK_WORDS;
+    b->errors += errors;
+    b->good_blocks++;
+
+    for (int i = 0; i < PN9_BLOCK_WORDS; i++)
+    {
+        uint64_t e = b->block[i];
+        int left = 64;
+
+        while (e)
+        {
+            int z = __builtin_clzll(e);
+
+            pn9_good(b, z);
+            pn9_error(b);
+            e = (e << z) << 1;
+            left -= z + 1;
+        }
+        pn9_good(b, left);
+    }
+}
+
+static void pn9_judge(pn9_ber *b)
+{
+    int errors = 0;
+
+    for (int i = 0; i < PN9_BLOCK_WORDS; i++)
+        errors += __builtin_popcountll(b->block[i]);
+    b->nblock = 0;
+
+    if (errors <= PN9_LOSS_ERRORS)
+    {
+        pn9_commit(b, errors);
+        return;
+    }
+
+    // Out of step: a slip after good blocks, or a bad acquisition
+    b->dropped_bits += 64 * PN9_BLOCK_WORDS;
+    if (b->good_blocks > 0)
+        b->sync_losses++;
+    b->sync = 0;
+    pn9_burst_end(b);
+    b->gap = PN9_BURST_GAP;
+}
+
+void pn9_ber_push(pn9_ber *b, const uint64_t *w, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (b->sync)
+        {
+            b->block[b->nblock++] = w[i] ^ words[b->phase];
+            b->phase = (b->phase + 64) % PN9_PERIOD;
+            if (b->nblock == PN9_BLOCK_WORDS)
+                pn9_judge(b);
+            continue;
+        }
+
+        // The last 9 bits give the phase, all zeros is no signal
+        b->dropped_bits += 64;
+        if ((w[i] & 0x1FF) == 0)
+            continue;
+        b->phase = (phase_of[w[i] & 0x1FF] + 9) % PN9_PERIOD;
+        b->sync = 1;
+        b->good_blocks = 0;
+        b->nblock = 0;
+        b->acquisitions++;
+    }
+}
+
+void pn9_ber_push_bytes(pn9_ber *b, const uint8_t *buf, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        b->partial = (b->partial << 8) | buf[i];
+        b->partial_bits += 8;
+        if (b->partial_bits == 64)
+        {
+            pn9_ber_push(b, &b->partial, 1);
+            b->partial = 0;
+            b->partial_bits = 0;
+        }
+    }
+}
+
+void pn9_ber_print(const pn9_ber *b, FILE *out)
+{
+    fprintf(out, "pn9: bits=%llu errors=%llu ber=%.3e acquisitions=%llu sync_losses=%llu dropped_bits=%llu "
+                 "max_burst=%d\n",
+            (unsigned long long)b->bits, (unsigned long long)b->errors,
+            b->bits ? (double)b->errors / b->bits : 0.0,
+            (unsigned long long)b->acquisitions, (unsigned long long)b->sync_losses,
+            (unsigned long long)b->dropped_bits, b->max_burst);
+
+    // Bursts by length, from the bin's shortest
+    fprintf(out, "pn9: bursts");
+    for (int i = 0; i < PN9_BURST_BINS; i++)
+        fprintf(out, " %d=%llu", 1 << i, (unsigned long long)b->bursts[i]);
+    fprintf(out, "\n");
+}
+
+void pn9_whiten(uint8_t *buf, int len)
+{
+    int off = 0;
+
+    pn9_tables();
+
+    while (len > 0)
+    {
+        int n = len < PN9_PERIOD ? len : PN9_PERIOD;
+        const uint8_t *t = whitening + off;
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8)
+        {
+            uint64_t a, b;
+
+            memcpy(&a, buf + i, 8);
+            memcpy(&b, t + i, 8);
+            a ^= b;
+            memcpy(buf + i, &a, 8);
+        }
+        for (; i < n; i++)
+            buf[i] ^= t[i];
+
+        buf += n;
+        len -= n;
+        off = (off + n) % PN9_PERIOD;
+    }
+}
+
+uint8_t pn9_whitening_byte(int i)
+{
+    pn9_tables();
+    return whitening[i % PN9_PERIOD];
+}
+
+static int pn9_stage_tx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    pn9_whitener *w = (pn9_whitener *)ctx;
+    (void)cap;
+
+    pn9_whiten(buf, len);
+    w->tx_frames++;
+    w->bytes += len;
+    return len;
+}
+
+static int pn9_stage_rx(void *ctx, uint8_t *buf, int len, int cap)
+{
+    pn9_whitener *w = (pn9_whitener *)ctx;
+    (void)cap;
+
+    pn9_whiten(buf, len);
+    w->rx_frames++;
+    w->bytes += len;
+    return len;
+}
+
+static void pn9_print_stats(void *ctx, FILE *out)
+{
+    pn9_whitener *w = (pn9_whitener *)ctx;
+
+    fprintf(out, "whiten: tx_frames=%llu rx_frames=%llu bytes=%llu\n",
+            (unsigned long long)w->tx_frames, (unsigned long long)w->rx_frames, (unsigned long long)w->bytes);
+}
+
+stage pn9_stage(pn9_whitener *w)
+{
+    stage s = { "whiten", pn9_stage_tx, pn9_stage_rx, pn9_print_stats, w, 0 };
+    return s;
+}
@@ -0,0 +1,97 @@
+/*
+    PN9 bit error rate tester and whitening
+
+    The SPIRIT1 sends PN9 (x^9 + x^5 + 1, period 511) with PCKTCTRL1 at
+    0x0C, see SPIRIT/main.cpp. The tester takes the received bitstream,
+    64 bits at a time with the first bit in the MSB, and needs no start
+    of sequence: the last 9 bits of a word give the position in the
+    sequence, from then on every word is XORed with the 64 bits expected
+    there and the set bits of the result are the errors.
+
+    The words are judged PN9_BLOCK_WORDS at a time. A block with more than
+    PN9_LOSS_ERRORS errors means the tester has lost the sequence, a bit
+    slipped or the signal is gone, and does not count; the tester syncs
+    again on the next word. Errors separated by fewer than PN9_BURST_GAP
+    good bits make one burst, the bursts are binned by length in powers
+    of two.
+
+    The firmware has the same engine on 32-bit words for the sampled RX
+    pin, bridge_bench pn9 runs this one on recorded captures.
+
+    Whitening is the SPIRIT1's of packet mode, which direct mode goes
+    without: the bytes are XORed with the sequence from the seed, eight
+    bits of it a byte with the first in the LSB (FF E1 1D 9A ED 85 ...),
+    over again for every frame. 8 and 511 have no common factor, so the
+    bytes repeat every 511 and a table of them does a word at a time. As
+    the last link stage it whitens the body of the air frame, after the
+    FEC, and leaves the preamble and sync as they are.
+*/
+
+#ifndef PN9_H
+#define PN9_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "stage.h"
+
+#define PN9_PERIOD          511
+#define PN9_BLOCK_WORDS     4       // 256 bits
+#define PN9_LOSS_ERRORS     64      // in a block, 25%
+#define PN9_BURST_GAP       8
+#define PN9_BURST_BINS      8       // 1, 2-3, 4-7, ... 128 and longer
+
+typedef struct pn9_ber {
+    int sync;
+    int phase;                      // of the next bit
+    int good_blocks;                // since the last sync
+    uint64_t block[PN9_BLOCK_WORDS];    // error words
+    int nblock;
+
+    // Bytes of a capture short of a word
+    uint64_t partial;
+    int partial_bits;
+
+    int in_burst;
+    int burst_len;
+    int gap;
+
+    uint64_t bits;                  // in sync
+    uint64_t errors;
+    uint64_t acquisitions;
+    uint64_t sync_losses;           // after at least one good block
+    uint64_t dropped_bits;          // out of sync
+    uint64_t bursts[PN9_BURST_BINS];
+    int max_burst;
+} pn9_ber;
+
+// Bits 'phase' to 'phase' + 63 of the sequence, the first in the MSB
+uint64_t pn9_word(int phase);
+
+// The next 'nbits' bits, up to 64, from LFSR state 'state' (1..511);
+// the state moves on
+uint64_t pn9_bits(uint16_t *state, int nbits);
+
+void pn9_ber_init(pn9_ber *b);
+void pn9_ber_push(pn9_ber *b, const uint64_t *words, int n);
+
+// A capture as bytes, the first bit in the MSB of the first byte
+void pn9_ber_push_bytes(pn9_ber *b, const uint8_t *buf, int len);
+
+void pn9_ber_print(const pn9_ber *b, FILE *out);
+
+typedef struct pn9_whitener {
+    uint64_t tx_frames;
+    uint64_t rx_frames;
+    uint64_t bytes;
+} pn9_whitener;
+
+// Whitens 'len' bytes from the start of the sequence, or undoes it
+void pn9_whiten(uint8_t *buf, int len);
+
+// Byte 'i' of the whitening sequence
+uint8_t pn9_whitening_byte(int i);
+
+stage pn9_stage(pn9_whitener *w);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+    Radio control link
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tty.h"
+#include "radio.h"
+
+int radio_open(radio_link *r, const char *path, int baud)
+{
+    memset(r, 0, sizeof(*r));
+    r->profile = -1;
+
+    if ((r->fd = tty_open(path, baud)) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int radio_command(radio_link *r, const char *cmd)
+{
+    int len = strlen(cmd);
+
+    return write(r->fd, cmd, len) == len ? 0 : -1;
+}
+
+int radio_set_profile(radio_link *r, int profile)
+{
+    char cmd[16];
+
+    snprintf(cmd, sizeof(cmd), "P %d\n", profile);
+    return radio_command(r, cmd);
+}
+
+int radio_query(radio_link *r)
+{
+    return radio_command(r, "Q\n");
+}
+
+int radio_request_telemetry(radio_link *r)
+{
+    return radio_command(r, "T\n");
+}
+
+int radio_scan(radio_link *r)
+{
+    return radio_command(r, "S\n");
+}
+
+int radio_set_shift(radio_link *r, int shift)
+{
+    char cmd[16];
+
+    snprintf(cmd, sizeof(cmd), "F %d\n", shift);
+    return radio_command(r, cmd);
+}
+
+int radio_set_mac(radio_link *r, int csma, int rssi_th, int prescaler, int max_bo)
+{
+    char cmd[32];
+
+    snprintf(cmd, sizeof(cmd), "M %d %d %d %d\n", csma, rssi_th, prescaler, max_bo);
+    return radio_command(r, cmd);
+}
+
+int radio_request_counters(radio_link *r)
+{
+    return radio_command(r, "C\n");
+}
+
+int radio_set_tdma(radio_link *r, int slot_us, int nslots, int guard_us, uint32_t mask)
+{
+    char cmd[64];
+
+    snprintf(cmd, sizeof(cmd), "D %d %d %d %u\n", slot_us, nslots, guard_us, (unsigned)mask);
+    return radio_command(r, cmd);
+}
+
+int radio_sync_tdma(radio_link *r, int age_us)
+{
+    char cmd[32];
+
+    snprintf(cmd, sizeof(cmd), "Y %d\n", age_us);
+    return radio_command(r, cmd);
+}
+
+int radio_set_hops(radio_link *r, int dwell_us, uint32_t from, int n, const int8_t *shift)
+{
+    char cmd[160];
+    int len;
+
+    if (dwell_us == 0)
+        return radio_command(r, "H 0\n");
+
+    len = snprintf(cmd, sizeof(cmd), "H %d %u %d", dwell_us, (unsigned)from, n);
+    for (int i = 0; i < n && len < (int)sizeof(cmd) - 8; i++)
+        len += snprintf(cmd + len, sizeof(cmd) - len, " %d", shift[i]);
+    snprintf(cmd + len, sizeof(cmd) - len, "\n");
+    return radio_command(r, cmd);
+}
+
+int radio_sync_hops(radio_link *r, uint32_t index, int age_us)
+{
+    char cmd[40];
+
+    snprintf(cmd, sizeof(cmd), "J %u %d\n", (unsigned)index, age_us);
+    return radio_command(r, cmd);
+}
+
+int radio_set_diversity(radio_link *r, int on)
+{
+    char cmd[16];
+
+    snprintf(cmd, sizeof(cmd), "V %d\n", on);
+    return radio_command(r, cmd);
+}
+
+int radio_set_afc(radio_link *r, int on)
+{
+    char cmd[16];
+
+    snprintf(cmd, sizeof(cmd), "A %d\n", on);
+    return radio_command(r, cmd);
+}
+
+int radio_request_drift(radio_link *r)
+{
+    return radio_command(r, "O\n");
+}
+
+int radio_request_pools(radio_link *r)
+{
+    return radio_command(r, "U 0\n");
+}
+
+static void radio_scan_line(radio_link *r, const char *line)
+{
+    scan_map *m = &r->scan;
+    int used;
+
+    if (sscanf(line, "S %d %d %d %d %d%n", &m->ms, &m->n, &m->step_hz, &m->rx_ch, &m->tx_ch, &used) != 5)
+        return;
+    if (m->n > SCAN_MAX_CHANNELS)
+        m->n = SCAN_MAX_CHANNELS;
+
+    const char *p = line + used;
+    for (int ch = 0; ch < m->n; ch++)
+    {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p)
+        {
+            m->n = ch;
+            break;
+        }
+        m->rssi[ch] = (uint8_t)v;
+        p = end;
+    }
+
+    r->scan_ready = 1;
+    r->replies++;
+}
+
+static void radio_telemetry_line(radio_link *r, const char *line)
+{
+    char name[4];
+    unsigned long n, rssi_sum, lqi_sum, pqi_sum, sqi_sum, errors;
+    unsigned rssi_min, rssi_max, lqi_min, lqi_max, state;
+    int afc_min, afc_max;
+    long afc_sum;
+    int used;
+
+    if (sscanf(line, "T %3s %lu %u %lu %u %u %lu %u %lu %lu %d %ld %d %u %lu%n",
+               name, &n, &rssi_min, &rssi_sum, &rssi_max, &lqi_min, &lqi_sum, &lqi_max,
+               &pqi_sum, &sqi_sum, &afc_min, &afc_sum, &afc_max, &state, &errors, &used) != 15)
+        return;
+
+    radio_telemetry *t = &r->tel[strcmp(name, "tx") == 0];
+
+    t->windows++;
+    t->mc_state = state;
+    t->state_errors += errors;
+    r->replies++;
+
+    if (n == 0)
+        return;
+
+    // RSSI_LEVEL is in half dB steps from -130 dBm
+    t->samples  += n;
+    t->rssi_min  = rssi_min / 2.0 - 130;
+    t->rssi_avg  = (double)rssi_sum / n / 2.0 - 130;
+    t->rssi_max  = rssi_max / 2.0 - 130;
+    t->rssi_sum += rssi_sum / 2.0 - 130.0 * n;
+    t->lqi_min   = lqi_min;
+    t->lqi_avg   = (double)lqi_sum / n;
+    t->lqi_max   = lqi_max;
+    t->pqi_avg   = (double)pqi_sum / n;
+    t->sqi_avg   = (double)sqi_sum / n;
+    t->afc_min   = afc_min;
+    t->afc_avg   = (double)afc_sum / n;
+    t->afc_max   = afc_max;
+
+    const char *p = line + used;
+    for (int b = 0; b < RADIO_HIST_BINS; b++)
+    {
+        char *end;
+        unsigned long v = strtoul(p, &end, 10);
+        if (end == p)
+            break;
+        t->rssi_hist[b] += v;
+        p = end;
+    }
+}
+
+static int radio_line(radio_link *r)
+{
+    int a, b;
+
+    if (r->line[0] == 'T')
+    {
+        radio_telemetry_line(r, r->line);
+        return 0;
+    }
+    if (r->line[0] == 'S')
+    {
+        radio_scan_line(r, r->line);
+        return 0;
+    }
+
+    if (sscanf(r->line, "Q %d %d", &a, &b) == 2)
+    {
+        // RSSI_LEVEL is in half dB steps from -130 dBm
+        r->rssi_dbm = a / 2 - 130;
+        r->lqi = b;
+        r->replies++;
+        return 1;
+    }
+
+    if (sscanf(r->line, "P %d", &a) == 1)
+    {
+        r->profile = a;
+        r->replies++;
+    }
+
+    // Firmware without TDMA sends four
+    if (sscanf(r->line, "C %u %u %u %u %u %u", &r->lbt[0], &r->lbt[1], &r->lbt[2], &r->lbt[3],
+               &r->lbt[4], &r->lbt[5]) >= 4)
+        r->replies++;
+
+    if (sscanf(r->line, "F %d", &a) == 1)
+    {
+        r->shift = a;
+        r->replies++;
+    }
+
+    if (sscanf(r->line, "A %d %d", &a, &b) == 2)
+    {
+        r->drift.on = a;
+        r->drift.fc_offset = b;
+        r->replies++;
+    }
+
+    // The entries follow the O line
+    radio_drift *d = &r->drift;
+    if (sscanf(r->line, "O %d %d %u %u %*d", &d->on, &d->fc_offset, &d->trims, &d->reversals) == 4)
+    {
+        d->n = 0;
+        r->replies++;
+    }
+
+    radio_drift_entry e;
+    int afc_x10;
+    if (sscanf(r->line, "o %d %d %d %d", &e.age_s, &e.fc_offset, &afc_x10, &e.samples) == 4 &&
+        d->n < RADIO_DRIFT_MAX)
+    {
+        e.afc_avg = afc_x10 / 10.0;
+        d->e[d->n++] = e;
+    }
+
+    // And the pools the U line
+    if (sscanf(r->line, "U %*u %*u %*u %*u %d", &a) == 1)
+    {
+        r->npools = 0;
+        r->replies++;
+    }
+
+    radio_pool pl;
+    if (sscanf(r->line, "u %15s %d %d %u %u %u %u", pl.name, &pl.block_size, &pl.blocks, &pl.in_use,
+               &pl.high_water, &pl.allocs, &pl.exhausted) == 7 && r->npools < RADIO_POOL_MAX)
+        r->pool[r->npools++] = pl;
+
+    return 0;
+}
+
+int radio_read(radio_link *r)
+{
+    char chunk[64];
+    int fresh = 0;
+
+    int n = read(r->fd, chunk, sizeof(chunk));
+    for (int i = 0; i < n; i++)
+    {
+        char c = chunk[i];
+
+        if (c == '\r' || c == '\n')
+        {
+            r->line[r->line_len] = '\0';
+            if (r->line_len > 0)
+                fresh |= radio_line(r);
+            r->line_len = 0;
+        }
+        else if (r->line_len < (int)sizeof(r->line) - 1)
+            r->line[r->line_len++] = c;
+    }
+
+    return fresh;
+}
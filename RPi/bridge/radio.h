@@ -0,0 +1,179 @@
+/*
+    Radio control link
+
+    The STM32 stdio UART is a second serial port next to the data tty.
+    The firmware reads whitespace separated commands from it, the same way
+    as SpiritShell, and answers on a line of its own:
+
+        P <n>   switch both radios to profile n     ->  P <n>
+        Q       read the receiver                   ->  Q <rssi_level> <lqi>
+        T       telemetry windows                   ->  T rx ... / T tx ...
+        S       sweep the band (~0.25 s)            ->  S ms n step_hz rx_ch tx_ch rssi[n]
+        F <n>   move the duplex pair n channels     ->  F <n>
+        M <csma> <rssi_th> <prescaler> <max_bo>     ->  M ...
+                persistent TX or listen before talk, keyed over RTS/CTS;
+                ERR mac with diversity or TDMA on, or csma 1 while hopping
+        C       listen-before-talk counters         ->  C requests granted busy timeouts
+                                                        overruns turnaround_us
+        D <slot_us> <nslots> <guard_us> <mask>      ->  D ...
+                TDMA slots, keyed over RTS/CTS only inside the ones in 'mask';
+                nslots 1..32, guard_us under half a slot, D 0 0 0 0 off;
+                ERR tdma otherwise, with diversity or while hopping
+        Y <age_us>  the TDMA superframe started age_us ago, no answer
+        H <dwell_us> <from> <n> <shift>[n]          ->  H dwell_us from n
+                hop table from dwell 'from' on, n 1..12, H 0 back to home;
+                ERR hop table with diversity, listen before talk or TDMA
+        J <index> <age_us>  hop dwell 'index' started age_us ago, no answer
+        V <on>                                      ->  V <on>
+                receive diversity: the TX radio listens on the RX radio's
+                channel and is keyed over RTS/CTS for our frames only
+        A <on>                                      ->  A <on> <fc_offset>
+                FC_OFFSET tracking of the RX radio, on from the start
+        O       drift history                       ->  O on fc_offset trims reversals n
+                                                        o age_s fc_offset afc_x10 samples  (n lines)
+        G <bps> <pn9>                               ->  G bps pn9 ppm
+                timer and DMA clocked bit modem on the direct mode pins,
+                pn9 1 sends PN9; ppm is the timer's rate error, G 0 stops
+        K       bit modem counters                  ->  K bps ppm rx_halves tx_halves overruns
+                                                        bits transitions timing_x100 syncs
+                the clock recovery's (cdr.h) on the modem's samples: timing
+                error in hundredths of a sample, frames found by sync word
+        Z <hex> <bits> <errors>                     ->  Z hex bits errors
+                that sync word, the bridge's 0x2D 0xD4 on air (5A457 20 1)
+                to start with
+        B <bps>                                     ->  B <bps>
+                PN9 bit error rate test on the RX radio's data out, off the
+                bit modem at bps, B 0 stops
+        E       bit error counts since the last B   ->  E bps bits errors acquisitions
+                                                        sync_losses dropped overruns
+                                                        max_burst bursts[8]
+        W       whitening check                     ->  W received matches b0..b7
+                a packet of 64 zeros from the TX radio, whitened by the
+                chip, as the RX radio takes it in packet mode: 64 64 and
+                FF E1 1D 9A ED 85 33 24 is pn9_whiten()'s sequence;
+                ERR while hopping, under a MAC or with diversity
+        X <n>   AES engine of the TX radio          ->  X known_answer blocks us
+                the FIPS-197 block through the SPIRIT1's AES-128 (1 when it
+                comes out right), then n counter blocks, the time they took
+        U <n>   buffer pools                        ->  U cycles isr_cycles clashes us n
+                                                        u name size blocks in_use high_water
+                                                          allocs exhausted  (n lines)
+                the firmware's fixed block pools, taken from interrupts and
+                threads alike; n > 0 first takes and gives back blocks n
+                times against a timer interrupt doing the same, clashes is
+                how often a block was out twice (0); ERR with blocks out
+
+    The firmware samples RSSI, LQI, PQI/SQI, AFC_CORR and MC_STATE of both
+    radios every 100 ms; T returns min/sum/max and an RSSI histogram since
+    the previous T and starts a new window. The AFC_CORR of the RX radio
+    also trims its FC_OFFSET, in steps of about 100 Hz, every 10 s; O
+    returns one entry a minute of that over the last hour or so.
+
+    G, K, Z, B and E are for the bench, with the far end sending PN9 (G <bps>
+    1) instead of the bridge: bridge_bench pn9 (pn9.h) reads the same counts off a recorded
+    capture. Bursts are binned by length, 1, 2-3, 4-7 ... 128 and longer.
+
+    Everything else the firmware prints is ignored.
+*/
+
+#ifndef RADIO_H
+#define RADIO_H
+
+#include <stdint.h>
+
+#include "scan.h"
+
+#define RADIO_HIST_BINS     16      // 8 dB each from -130 dBm
+#define RADIO_DRIFT_MAX     64
+#define RADIO_FC_STEP_HZ    99.2    // FC_OFFSET step, fXO / 2^18
+#define RADIO_POOL_MAX      4
+
+typedef struct radio_telemetry {
+    // Last window
+    double rssi_min, rssi_avg, rssi_max;        // dBm
+    double lqi_min, lqi_avg, lqi_max;
+    double pqi_avg;
+    double sqi_avg;
+    double afc_min, afc_avg, afc_max;           // AFC_CORR units
+    int mc_state;
+
+    // Since start
+    uint64_t windows;
+    uint64_t samples;
+    uint64_t state_errors;
+    uint64_t rssi_hist[RADIO_HIST_BINS];
+    double rssi_sum;                            // dBm
+} radio_telemetry;
+
+typedef struct radio_drift_entry {
+    int age_s;
+    int fc_offset;
+    double afc_avg;         // AFC_CORR over the entry's minute
+    int samples;            // with a carrier
+} radio_drift_entry;
+
+typedef struct radio_drift {
+    int on;
+    int fc_offset;          // FC_OFFSET steps
+    uint32_t trims;
+    uint32_t reversals;     // direction of AFC_CORR against FC_OFFSET relearnt
+    int n;                  // entries, oldest first
+    radio_drift_entry e[RADIO_DRIFT_MAX];
+} radio_drift;
+
+typedef struct radio_pool {
+    char name[16];
+    int block_size;
+    int blocks;
+    uint32_t in_use;
+    uint32_t high_water;    // since the firmware started
+    uint32_t allocs;
+    uint32_t exhausted;     // allocations refused, none left
+} radio_pool;
+
+typedef struct radio_link {
+    int fd;
+    char line[256];
+    int line_len;
+
+    int rssi_dbm;
+    int lqi;
+    int profile;            // last one confirmed, -1 before
+    radio_telemetry tel[2]; // 0 RX radio, 1 TX radio
+    scan_map scan;          // last sweep
+    int scan_ready;         // set when a sweep arrives, cleared by the reader
+    int shift;              // last one confirmed
+    uint32_t lbt[6];        // C: requests, granted, busy, timeouts, TDMA overruns and
+                            // turnaround in microseconds
+    radio_drift drift;      // last O
+    int npools;             // last U
+    radio_pool pool[RADIO_POOL_MAX];
+    uint64_t replies;
+} radio_link;
+
+int  radio_open(radio_link *r, const char *path, int baud);
+
+int  radio_set_profile(radio_link *r, int profile);
+int  radio_query(radio_link *r);
+int  radio_request_telemetry(radio_link *r);
+int  radio_scan(radio_link *r);
+int  radio_set_shift(radio_link *r, int shift);
+int  radio_set_mac(radio_link *r, int csma, int rssi_th, int prescaler, int max_bo);
+int  radio_request_counters(radio_link *r);
+int  radio_set_tdma(radio_link *r, int slot_us, int nslots, int guard_us, uint32_t mask);
+int  radio_sync_tdma(radio_link *r, int age_us);
+
+// Hop table, dwell_us 0 stops hopping; and the hop dwell clock
+int  radio_set_hops(radio_link *r, int dwell_us, uint32_t from, int n, const int8_t *shift);
+int  radio_sync_hops(radio_link *r, uint32_t index, int age_us);
+
+int  radio_set_diversity(radio_link *r, int on);
+
+int  radio_set_afc(radio_link *r, int on);
+int  radio_request_drift(radio_link *r);
+int  radio_request_pools(radio_link *r);
+
+// Reads what has arrived, returns 1 if it completed a Q reading
+int  radio_read(radio_link *r);
+
+#endif
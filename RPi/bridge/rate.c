@@ -0,0 +1,301 @@
+/*
+    Link-rate adaptation
+*/
+
+#include <string.h>
+
+#include "rate.h"
+
+#define MS(x) ((uint64_t)(x) * 1000000ULL)
+
+// Same order as 'profiles' in Mbed/FullDuplex_151MHz_17kHZ_Chan.cpp
+const rate_profile rate_profiles[] = {
+    {  1200, -115, "1200 baud, 3.0 kHz filter" },
+    {  2400, -112, "2400 baud, 6.1 kHz filter" },
+    {  4800, -109, "4800 baud, 6.1 kHz filter" },
+    {  9600, -106, "9600 baud, 6.1 kHz filter" },
+    { 19200, -100, "19200 baud, 12.1 kHz filter" },
+};
+
+const int rate_nprofiles = sizeof(rate_profiles) / sizeof(rate_profiles[0]);
+
+void rate_init(rate_ctx *ctx, int master, int profile, uint64_t now_ns)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->master = master;
+    ctx->profile = profile;
+    ctx->change = -1;
+    ctx->target = -1;
+    ctx->ack_profile = -1;
+    ctx->rssi = RATE_RSSI_UNKNOWN;
+    ctx->lqi = -1;
+    ctx->rssi_peer = RATE_RSSI_UNKNOWN;
+    ctx->lqi_peer = -1;
+    ctx->peer_seq = -1;
+    ctx->last_rx_ns = now_ns;
+    ctx->report_ns = now_ns + MS(RATE_REPORT_MS);
+}
+
+void rate_rx_frame(rate_ctx *ctx, int ok, uint64_t now_ns)
+{
+    if (ok)
+    {
+        ctx->rx_ok++;
+        ctx->last_rx_ns = now_ns;
+    }
+    else
+        ctx->rx_bad++;
+}
+
+void rate_set_radio(rate_ctx *ctx, int rssi_dbm, int lqi)
+{
+    ctx->rssi = rssi_dbm;
+    ctx->lqi = lqi;
+}
+
+static void rate_switch(rate_ctx *ctx, int profile, uint64_t now_ns)
+{
+    if (profile > ctx->profile)
+        ctx->stats.steps_up++;
+    else if (profile < ctx->profile)
+        ctx->stats.steps_down++;
+
+    if (profile != ctx->profile)
+        ctx->change = profile;
+
+    // Measurements of the old profile say nothing about the new one
+    ctx->profile = profile;
+    ctx->target = -1;
+    ctx->good = 0;
+    ctx->fer_local = 0;
+    ctx->fer_peer = 0;
+    ctx->rx_ok = 0;
+    ctx->rx_bad = 0;
+    ctx->peer_seq = -1;
+    ctx->last_rx_ns = now_ns;
+}
+
+static void rate_start_switch(rate_ctx *ctx, int profile)
+{
+    ctx->target = profile;
+    ctx->epoch++;
+    ctx->tries = 0;
+    ctx->switch_ns = 0;
+    ctx->good = 0;
+}
+
+static int rate_min_known(int a, int b)
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    return a < b ? a : b;
+}
+
+// Master only, after each report from the slave
+static void rate_decide(rate_ctx *ctx)
+{
+    double fer = ctx->fer_local > ctx->fer_peer ? ctx->fer_local : ctx->fer_peer;
+    int rssi = ctx->rssi < ctx->rssi_peer ? ctx->rssi : ctx->rssi_peer;
+    int lqi = rate_min_known(ctx->lqi, ctx->lqi_peer);
+    int p = ctx->profile;
+    int down = p;
+
+    if (ctx->target >= 0)
+        return;
+
+    while (down > 0 && rssi != RATE_RSSI_UNKNOWN && rssi < rate_profiles[down].rssi_min)
+        down--;
+    if (down == p && p > 0 && fer > RATE_FER_DOWN)
+        down = p - 1;
+
+    if (down < p)
+    {
+        rate_start_switch(ctx, down);
+        return;
+    }
+
+    if (p + 1 < rate_nprofiles && fer < RATE_FER_UP &&
+        (rssi == RATE_RSSI_UNKNOWN || rssi >= rate_profiles[p + 1].rssi_min + RATE_MARGIN_DB) &&
+        (lqi < 0 || lqi >= RATE_LQI_UP))
+    {
+        if (++ctx->good >= RATE_UP_REPORTS)
+            rate_start_switch(ctx, p + 1);
+    }
+    else
+        ctx->good = 0;
+}
+
+static void rate_report(rate_ctx *ctx, const uint8_t *msg)
+{
+    uint8_t seq = msg[2];
+    int lost = 0;
+
+    ctx->stats.reports_rx++;
+
+    if (ctx->peer_seq >= 0)
+    {
+        lost = (uint8_t)(seq - ctx->peer_seq);
+        if (lost >= 128)
+            lost = 0;
+        ctx->stats.reports_lost += lost;
+    }
+    ctx->peer_seq = (uint8_t)(seq + 1);
+
+    // Sent before the last switch
+    if (msg[3] != ctx->profile)
+        return;
+
+    // A lost report is a lost frame the peer cannot count itself
+    uint32_t ok  = (msg[6] << 8) | msg[7];
+    uint32_t bad = ((msg[8] << 8) | msg[9]) + lost;
+    if (ok + bad > 0)
+        ctx->fer_peer = 0.5 * ctx->fer_peer + 0.5 * (double)bad / (ok + bad);
+
+    ctx->rssi_peer = (int8_t)msg[4];
+    ctx->lqi_peer = msg[5] == 0xFF ? -1 : msg[5];
+
+    if (ctx->master)
+        rate_decide(ctx);
+}
+
+int rate_receive(rate_ctx *ctx, const uint8_t *msg, int len, uint64_t now_ns)
+{
+    if (len < 4 || msg[0] != RATE_TYPE)
+        return 0;
+
+    switch (msg[1])
+    {
+        case RATE_MSG_REPORT:
+            if (len >= 10)
+                rate_report(ctx, msg);
+            break;
+
+        case RATE_MSG_SWITCH:
+            if (!ctx->master && msg[3] < rate_nprofiles)
+            {
+                ctx->ack_epoch = msg[2];
+                ctx->ack_profile = msg[3];
+            }
+            break;
+
+        case RATE_MSG_SWITCH_ACK:
+            if (ctx->master && ctx->target >= 0 && msg[2] == ctx->epoch && msg[3] == ctx->target)
+                rate_switch(ctx, ctx->target, now_ns);
+            break;
+    }
+
+    return 1;
+}
+
+int rate_poll(rate_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns)
+{
+    if (cap < 10)
+        return 0;
+
+    // Answer on the old profile, then follow
+    if (ctx->ack_profile >= 0)
+    {
+        out[0] = RATE_TYPE;
+        out[1] = RATE_MSG_SWITCH_ACK;
+        out[2] = ctx->ack_epoch;
+        out[3] = (uint8_t)ctx->ack_profile;
+        rate_switch(ctx, ctx->ack_profile, now_ns);
+        ctx->ack_profile = -1;
+        return 4;
+    }
+
+    if (ctx->target >= 0 && now_ns >= ctx->switch_ns)
+    {
+        if (ctx->tries == RATE_SWITCH_TRIES)
+        {
+            // The answers may be what got lost: go, the silence fallback
+            // brings both ends back together if the slave never heard us
+            ctx->stats.switch_timeouts++;
+            rate_switch(ctx, ctx->target, now_ns);
+        }
+        else
+        {
+            ctx->tries++;
+            ctx->switch_ns = now_ns + MS(RATE_SWITCH_MS);
+            out[0] = RATE_TYPE;
+            out[1] = RATE_MSG_SWITCH;
+            out[2] = ctx->epoch;
+            out[3] = (uint8_t)ctx->target;
+            return 4;
+        }
+    }
+
+    if (ctx->profile > 0 && now_ns >= ctx->last_rx_ns + MS(RATE_LOST_MS))
+    {
+        ctx->stats.fallbacks++;
+        rate_switch(ctx, 0, now_ns);
+    }
+
+    if (now_ns >= ctx->report_ns)
+    {
+        uint32_t total = ctx->rx_ok + ctx->rx_bad;
+        uint32_t ok = ctx->rx_ok > 0xFFFF ? 0xFFFF : ctx->rx_ok;
+        uint32_t bad = ctx->rx_bad > 0xFFFF ? 0xFFFF : ctx->rx_bad;
+
+        if (total > 0)
+            ctx->fer_local = 0.5 * ctx->fer_local + 0.5 * (double)ctx->rx_bad / total;
+
+        out[0] = RATE_TYPE;
+        out[1] = RATE_MSG_REPORT;
+        out[2] = ctx->report_seq++;
+        out[3] = (uint8_t)ctx->profile;
+        out[4] = (uint8_t)(int8_t)(ctx->rssi == RATE_RSSI_UNKNOWN ? RATE_RSSI_UNKNOWN : ctx->rssi);
+        out[5] = ctx->lqi < 0 ? 0xFF : (uint8_t)ctx->lqi;
+        out[6] = (uint8_t)(ok >> 8);
+        out[7] = (uint8_t)ok;
+        out[8] = (uint8_t)(bad >> 8);
+        out[9] = (uint8_t)bad;
+
+        ctx->rx_ok = 0;
+        ctx->rx_bad = 0;
+        ctx->report_ns = now_ns + MS(RATE_REPORT_MS);
+        ctx->stats.reports_tx++;
+        return 10;
+    }
+
+    return 0;
+}
+
+int rate_take_change(rate_ctx *ctx)
+{
+    int change = ctx->change;
+
+    ctx->change = -1;
+    return change;
+}
+
+int64_t rate_time_left(const rate_ctx *ctx, uint64_t now_ns)
+{
+    uint64_t next = ctx->report_ns;
+
+    if (ctx->ack_profile >= 0)
+        return 0;
+    if (ctx->target >= 0 && ctx->switch_ns < next)
+        next = ctx->switch_ns;
+    if (ctx->profile > 0 && ctx->last_rx_ns + MS(RATE_LOST_MS) < next)
+        next = ctx->last_rx_ns + MS(RATE_LOST_MS);
+
+    return next > now_ns ? (int64_t)(next - now_ns) : 0;
+}
+
+void rate_print_stats(rate_ctx *ctx, FILE *out)
+{
+    rate_stats *s = &ctx->stats;
+
+    fprintf(out, "rate: %s profile=%d (%s) rssi=%d/%d dBm lqi=%d/%d fer=%.3f/%.3f up=%llu down=%llu "
+                 "fallbacks=%llu switch_timeouts=%llu reports tx=%llu rx=%llu lost=%llu\n",
+            ctx->master ? "master" : "slave", ctx->profile, rate_profiles[ctx->profile].name,
+            ctx->rssi, ctx->rssi_peer, ctx->lqi, ctx->lqi_peer, ctx->fer_local, ctx->fer_peer,
+            (unsigned long long)s->steps_up, (unsigned long long)s->steps_down,
+            (unsigned long long)s->fallbacks, (unsigned long long)s->switch_timeouts,
+            (unsigned long long)s->reports_tx, (unsigned long long)s->reports_rx,
+            (unsigned long long)s->reports_lost);
+}
@@ -0,0 +1,124 @@
+/*
+    Link-rate adaptation
+
+    Both ends walk the same ladder of radio profiles (tty rate, MOD1/MOD0,
+    FDEV0, channel filter; the registers live in the firmware, the table
+    below must match its 'profiles'). Every RATE_REPORT_MS each end tells
+    the other how it hears it:
+
+        0xFA 1 seq profile rssi lqi rx_ok(2) rx_bad(2)
+
+    The master combines both directions: it steps down at once when the
+    frame error rate or the RSSI says the profile no longer holds, and up
+    one step after RATE_UP_REPORTS good reports with RSSI margin to spare.
+    A switch is a handshake on the old profile:
+
+        master  0xFA 2 epoch profile       (repeated until answered)
+        slave   0xFA 3 epoch profile       then switches
+        master  switches on the answer, or after the last retry
+
+    If either end hears nothing for RATE_LOST_MS it drops to profile 0,
+    where the other end ends up too: a lost handshake or a link that faded
+    below the current profile never leaves the two ends apart for good.
+    Messages travel as packets, so they get compressed, aggregated and
+    retransmitted like any other.
+*/
+
+#ifndef RATE_H
+#define RATE_H
+
+#include <stdint.h>
+
+#include "stage.h"
+
+#define RATE_TYPE           0xFA
+#define RATE_MSG_REPORT     1
+#define RATE_MSG_SWITCH     2
+#define RATE_MSG_SWITCH_ACK 3
+
+#define RATE_REPORT_MS      2000
+#define RATE_LOST_MS        10000
+#define RATE_SWITCH_MS      1000
+#define RATE_SWITCH_TRIES   4
+#define RATE_UP_REPORTS     3
+#define RATE_FER_UP         0.02
+#define RATE_FER_DOWN       0.25
+#define RATE_MARGIN_DB      3
+#define RATE_LQI_UP         4
+#define RATE_RSSI_UNKNOWN   127
+
+typedef struct rate_profile {
+    int baud;
+    int rssi_min;           // dBm, below this the profile stops working
+    const char *name;
+} rate_profile;
+
+extern const rate_profile rate_profiles[];
+extern const int rate_nprofiles;
+
+typedef struct rate_stats {
+    uint64_t reports_tx;
+    uint64_t reports_rx;
+    uint64_t reports_lost;
+    uint64_t steps_up;
+    uint64_t steps_down;
+    uint64_t fallbacks;
+    uint64_t switch_timeouts;
+} rate_stats;
+
+typedef struct rate_ctx {
+    int master;
+    int profile;
+    int change;             // profile the bridge must apply, -1 if none
+
+    // Switch handshake
+    int target;             // master: profile being negotiated, -1 if none
+    uint8_t epoch;
+    int tries;
+    uint64_t switch_ns;
+    int ack_profile;        // slave: answer to send, then switch
+    uint8_t ack_epoch;
+
+    // Local receive quality since the last report
+    uint32_t rx_ok;
+    uint32_t rx_bad;
+    int rssi;
+    int lqi;
+    uint64_t last_rx_ns;
+    uint64_t report_ns;
+    uint8_t report_seq;
+
+    // Both directions, as seen by the master
+    double fer_local;
+    double fer_peer;
+    int rssi_peer;
+    int lqi_peer;
+    int peer_seq;           // next report sequence expected, -1 before the first
+    int good;
+
+    rate_stats stats;
+} rate_ctx;
+
+void rate_init(rate_ctx *ctx, int master, int profile, uint64_t now_ns);
+
+// Every frame that made it through the deframer, intact or not
+void rate_rx_frame(rate_ctx *ctx, int ok, uint64_t now_ns);
+
+// Latest readings of the local receiver
+void rate_set_radio(rate_ctx *ctx, int rssi_dbm, int lqi);
+
+// A control message from the peer, 0 if it is not one
+int  rate_receive(rate_ctx *ctx, const uint8_t *msg, int len, uint64_t now_ns);
+
+// Next control message to send, 0 if there is none
+int  rate_poll(rate_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns);
+
+// Profile to switch to once everything queued is on air, -1 if none
+int  rate_take_change(rate_ctx *ctx);
+
+// Nanoseconds until rate_poll() has something to do
+int64_t rate_time_left(const rate_ctx *ctx, uint64_t now_ns);
+
+void rate_print_stats(rate_ctx *ctx, FILE *out);
+
+#endif
@@ -0,0 +1,365 @@
+/*
+    Channel selection
+*/
+
+#include <string.h>
+
+#include "scan.h"
+
+#define MS(x) ((uint64_t)(x) * 1000000ULL)
+
+void scan_init(scan_ctx *ctx, int master, int period_ms, uint64_t now_ns)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->master = master;
+    ctx->change = SCAN_NO_CHANGE;
+    ctx->target = SCAN_NO_CHANGE;
+    ctx->ack_shift = SCAN_NO_CHANGE;
+    ctx->period_ns = MS(period_ms);
+    ctx->next_round_ns = now_ns + MS(SCAN_MAP_MS);
+    ctx->last_rx_ns = now_ns;
+}
+
+void scan_rx_frame(scan_ctx *ctx, uint64_t now_ns)
+{
+    ctx->last_rx_ns = now_ns;
+}
+
+int scan_take_sweep(scan_ctx *ctx)
+{
+    int sweep = ctx->sweep;
+
+    ctx->sweep = 0;
+    return sweep;
+}
+
+static int scan_on_grid(const scan_map *m, int ch)
+{
+    return ch >= 0 && ch < m->n;
+}
+
+int scan_move_cost(const scan_map *a, const scan_map *b, int move)
+{
+    const scan_map *maps[2] = { a, b };
+    int cost = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        const scan_map *m = maps[i];
+
+        if (!m)
+            continue;
+        if (!scan_on_grid(m, m->rx_ch + move) || !scan_on_grid(m, m->tx_ch + move))
+            return -1;
+        if (m->rssi[m->rx_ch + move] > cost)
+            cost = m->rssi[m->rx_ch + move];
+    }
+
+    return cost;
+}
+
+int scan_best_move(const scan_map *a, const scan_map *b, int *cost)
+{
+    int best = 0;
+    int best_cost = scan_move_cost(a, b, 0);
+
+    for (int move = -a->n; move <= a->n; move++)
+    {
+        int c = scan_move_cost(a, b, move);
+        int dist = move < 0 ? -move : move;
+        int best_dist = best < 0 ? -best : best;
+
+        // Ties go to the smaller move
+        if (c >= 0 && (best_cost < 0 || c < best_cost || (c == best_cost && dist < best_dist)))
+        {
+            best = move;
+            best_cost = c;
+        }
+    }
+
+    *cost = best_cost;
+    return best;
+}
+
+int scan_hop_set(const scan_map *a, const scan_map *b, int count, int gap, int *out)
+{
+    uint8_t level[SCAN_MAX_CHANNELS];
+    uint8_t used[SCAN_MAX_CHANNELS];
+    int n = a->n;
+    int found = 0;
+
+    for (int ch = 0; ch < n; ch++)
+    {
+        level[ch] = a->rssi[ch];
+        if (b && ch < b->n && b->rssi[ch] > level[ch])
+            level[ch] = b->rssi[ch];
+    }
+    memset(used, 0, sizeof(used));
+
+    while (found < count)
+    {
+        int best = -1;
+
+        for (int ch = 0; ch < n; ch++)
+            if (!used[ch] && (best < 0 || level[ch] < level[best]))
+                best = ch;
+        if (best < 0)
+            break;
+
+        out[found++] = best;
+        for (int ch = best - gap + 1; ch < best + gap; ch++)
+            if (ch >= 0 && ch < n)
+                used[ch] = 1;
+    }
+
+    // Channel order
+    for (int i = 1; i < found; i++)
+        for (int j = i; j > 0 && out[j - 1] > out[j]; j--)
+        {
+            int t = out[j];
+            out[j] = out[j - 1];
+            out[j - 1] = t;
+        }
+
+    return found;
+}
+
+static void scan_switch(scan_ctx *ctx, int shift, uint64_t now_ns)
+{
+    if (shift != ctx->shift)
+    {
+        ctx->change = shift;
+        ctx->stats.moves++;
+    }
+
+    ctx->shift = shift;
+    ctx->target = SCAN_NO_CHANGE;
+    ctx->last_rx_ns = now_ns;
+}
+
+// Master only, once both sweeps of a round are in
+static void scan_decide(scan_ctx *ctx)
+{
+    int cost;
+
+    ctx->have_local = 0;
+    ctx->have_peer = 0;
+    ctx->map_due_ns = 0;
+
+    if (ctx->target != SCAN_NO_CHANGE)
+        return;
+
+    int now_cost = scan_move_cost(&ctx->local, &ctx->peer, 0);
+    int move = scan_best_move(&ctx->local, &ctx->peer, &cost);
+
+    if (move != 0 && cost >= 0 && (now_cost < 0 || cost + SCAN_MARGIN <= now_cost))
+    {
+        ctx->target = ctx->shift + move;
+        ctx->epoch++;
+        ctx->tries = 0;
+        ctx->switch_ns = 0;
+    }
+}
+
+void scan_set_local(scan_ctx *ctx, const scan_map *map, uint64_t now_ns)
+{
+    (void)now_ns;
+
+    ctx->local = *map;
+    ctx->have_local = 1;
+
+    if (ctx->master && ctx->have_peer)
+        scan_decide(ctx);
+}
+
+int scan_receive(scan_ctx *ctx, const uint8_t *msg, int len, uint64_t now_ns)
+{
+    if (len < 3 || msg[0] != SCAN_TYPE)
+        return 0;
+
+    switch (msg[1])
+    {
+        case SCAN_MSG_REQUEST:
+            if (!ctx->master)
+            {
+                ctx->round = msg[2];
+                ctx->sweep = 1;
+                ctx->map_pending = 1;
+                ctx->have_local = 0;
+            }
+            break;
+
+        case SCAN_MSG_MAP:
+            if (ctx->master && ctx->map_due_ns && msg[2] == ctx->round &&
+                len >= 6 && msg[5] <= SCAN_MAX_CHANNELS && len >= 6 + msg[5])
+            {
+                memset(&ctx->peer, 0, sizeof(ctx->peer));
+                ctx->peer.rx_ch = msg[3];
+                ctx->peer.tx_ch = msg[4];
+                ctx->peer.n = msg[5];
+                memcpy(ctx->peer.rssi, msg + 6, msg[5]);
+                ctx->have_peer = 1;
+                ctx->stats.maps_rx++;
+
+                if (ctx->have_local)
+                    scan_decide(ctx);
+            }
+            break;
+
+        case SCAN_MSG_SHIFT:
+            if (!ctx->master && len >= 4)
+            {
+                ctx->ack_epoch = msg[2];
+                ctx->ack_shift = (int8_t)msg[3];
+            }
+            break;
+
+        case SCAN_MSG_SHIFT_ACK:
+            if (ctx->master && len >= 4 && ctx->target != SCAN_NO_CHANGE &&
+                msg[2] == ctx->epoch && (int8_t)msg[3] == ctx->target)
+                scan_switch(ctx, ctx->target, now_ns);
+            break;
+    }
+
+    return 1;
+}
+
+int scan_poll(scan_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns)
+{
+    if (cap < 6 + SCAN_MAX_CHANNELS)
+        return 0;
+
+    // Answer on the old channels, then follow
+    if (ctx->ack_shift != SCAN_NO_CHANGE)
+    {
+        out[0] = SCAN_TYPE;
+        out[1] = SCAN_MSG_SHIFT_ACK;
+        out[2] = ctx->ack_epoch;
+        out[3] = (uint8_t)(int8_t)ctx->ack_shift;
+        scan_switch(ctx, ctx->ack_shift, now_ns);
+        ctx->ack_shift = SCAN_NO_CHANGE;
+        return 4;
+    }
+
+    if (ctx->map_pending && ctx->have_local)
+    {
+        out[0] = SCAN_TYPE;
+        out[1] = SCAN_MSG_MAP;
+        out[2] = ctx->round;
+        out[3] = (uint8_t)ctx->local.rx_ch;
+        out[4] = (uint8_t)ctx->local.tx_ch;
+        out[5] = (uint8_t)ctx->local.n;
+        memcpy(out + 6, ctx->local.rssi, ctx->local.n);
+        ctx->map_pending = 0;
+        return 6 + ctx->local.n;
+    }
+
+    if (ctx->target != SCAN_NO_CHANGE && now_ns >= ctx->switch_ns)
+    {
+        if (ctx->tries == SCAN_SWITCH_TRIES)
+        {
+            // Same reasoning as the rate switch: go, the silence fallback
+            // brings both ends back to shift 0 if the slave never heard us
+            ctx->stats.switch_timeouts++;
+            scan_switch(ctx, ctx->target, now_ns);
+        }
+        else
+        {
+            ctx->tries++;
+            ctx->switch_ns = now_ns + MS(SCAN_SWITCH_MS);
+            out[0] = SCAN_TYPE;
+            out[1] = SCAN_MSG_SHIFT;
+            out[2] = ctx->epoch;
+            out[3] = (uint8_t)(int8_t)ctx->target;
+            return 4;
+        }
+    }
+
+    if (ctx->shift != 0 && now_ns >= ctx->last_rx_ns + MS(SCAN_LOST_MS))
+    {
+        ctx->stats.fallbacks++;
+        scan_switch(ctx, 0, now_ns);
+    }
+
+    if (ctx->map_due_ns && now_ns >= ctx->map_due_ns)
+    {
+        ctx->stats.maps_lost++;
+        ctx->map_due_ns = 0;
+        ctx->have_local = 0;
+        ctx->have_peer = 0;
+    }
+
+    if (ctx->master && ctx->period_ns && now_ns >= ctx->next_round_ns &&
+        !ctx->map_due_ns && ctx->target == SCAN_NO_CHANGE)
+    {
+        // The request goes out before this end drops its carrier
+        ctx->round++;
+        ctx->sweep = 1;
+        ctx->have_local = 0;
+        ctx->have_peer = 0;
+        ctx->map_due_ns = now_ns + MS(SCAN_MAP_MS);
+        ctx->next_round_ns = now_ns + ctx->period_ns;
+        ctx->stats.rounds++;
+
+        out[0] = SCAN_TYPE;
+        out[1] = SCAN_MSG_REQUEST;
+        out[2] = ctx->round;
+        return 3;
+    }
+
+    return 0;
+}
+
+int scan_take_change(scan_ctx *ctx)
+{
+    int change = ctx->change;
+
+    ctx->change = SCAN_NO_CHANGE;
+    return change;
+}
+
+int64_t scan_time_left(const scan_ctx *ctx, uint64_t now_ns)
+{
+    uint64_t next = now_ns + MS(1000);
+
+    if (ctx->ack_shift != SCAN_NO_CHANGE || ctx->sweep || (ctx->map_pending && ctx->have_local))
+        return 0;
+    if (ctx->target != SCAN_NO_CHANGE && ctx->switch_ns < next)
+        next = ctx->switch_ns;
+    if (ctx->shift != 0 && ctx->last_rx_ns + MS(SCAN_LOST_MS) < next)
+        next = ctx->last_rx_ns + MS(SCAN_LOST_MS);
+    if (ctx->map_due_ns && ctx->map_due_ns < next)
+        next = ctx->map_due_ns;
+    if (ctx->master && ctx->period_ns && !ctx->map_due_ns && ctx->next_round_ns < next)
+        next = ctx->next_round_ns;
+
+    return next > now_ns ? (int64_t)(next - now_ns) : 0;
+}
+
+void scan_print_map(const scan_map *map, FILE *out)
+{
+    // One character per channel, 8 dB per step above the -130 dBm floor
+    static const char shades[] = " .:-=+*#%@";
+
+    fprintf(out, "scan: %d x %d Hz in %d ms, rx %d tx %d |", map->n, map->step_hz, map->ms,
+            map->rx_ch, map->tx_ch);
+    for (int ch = 0; ch < map->n; ch++)
+    {
+        int shade = map->rssi[ch] / 16;
+        fputc(shades[shade < 9 ? shade : 9], out);
+    }
+    fprintf(out, "|\n");
+}
+
+void scan_print_stats(scan_ctx *ctx, FILE *out)
+{
+    scan_stats *s = &ctx->stats;
+
+    fprintf(out, "scan: %s shift=%d rounds=%llu maps_rx=%llu maps_lost=%llu moves=%llu "
+                 "switch_timeouts=%llu fallbacks=%llu\n",
+            ctx->master ? "master" : "slave", ctx->shift,
+            (unsigned long long)s->rounds, (unsigned long long)s->maps_rx,
+            (unsigned long long)s->maps_lost, (unsigned long long)s->moves,
+            (unsigned long long)s->switch_timeouts, (unsigned long long)s->fallbacks);
+}
@@ -0,0 +1,133 @@
+/*
+    Channel selection
+
+    The firmware sweeps a grid of channels around 151.47 MHz with its own
+    carrier off and reports a max-hold RSSI_LEVEL per channel (radio.h,
+    command S). Freq A and freq B are both on the grid, the duplex pair
+    can move along it as a whole (command F), so a move is a single shift
+    both ends apply.
+
+    Every period the master asks for a scan; both ends sweep at the same
+    time, so neither sees the other's carrier, and the slave sends its map:
+
+        master  0xF9 1 round                           then scans
+        slave   scans, then 0xF9 2 round rx_ch tx_ch n rssi[n]
+
+    The master scores every shift by the louder of the two channels the
+    receivers would sit on and moves the pair when the best one is
+    SCAN_MARGIN quieter than where it is now, with the same handshake as
+    the rate adaptation:
+
+        master  0xF9 3 epoch shift       (repeated until answered)
+        slave   0xF9 4 epoch shift       then moves
+        master  moves on the answer, or after the last retry
+
+    With nothing heard for SCAN_LOST_MS both ends go back to shift 0.
+    scan_hop_set() picks the quietest channels for a hopping pattern.
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define SCAN_TYPE           0xF9
+#define SCAN_MSG_REQUEST    1
+#define SCAN_MSG_MAP        2
+#define SCAN_MSG_SHIFT      3
+#define SCAN_MSG_SHIFT_ACK  4
+
+#define SCAN_MAX_CHANNELS   64
+#define SCAN_MAP_MS         5000    // master gives up on a round after this
+#define SCAN_SWITCH_MS      1000
+#define SCAN_SWITCH_TRIES   4
+#define SCAN_LOST_MS        15000
+#define SCAN_MARGIN         12      // RSSI_LEVEL units, 0.5 dB each
+#define SCAN_NO_CHANGE      0x7FFF
+
+typedef struct scan_map {
+    int n;
+    int step_hz;
+    int rx_ch;              // where the receiver sat during the sweep
+    int tx_ch;
+    int ms;                 // sweep time
+    uint8_t rssi[SCAN_MAX_CHANNELS];
+} scan_map;
+
+typedef struct scan_stats {
+    uint64_t rounds;
+    uint64_t maps_rx;
+    uint64_t maps_lost;
+    uint64_t moves;
+    uint64_t switch_timeouts;
+    uint64_t fallbacks;
+} scan_stats;
+
+typedef struct scan_ctx {
+    int master;
+    int shift;              // channels both frequencies are moved by
+    int change;             // shift the bridge must apply, SCAN_NO_CHANGE if none
+    int sweep;              // the bridge must sweep the band
+
+    // Scan rounds
+    uint64_t period_ns;
+    uint64_t next_round_ns;
+    uint8_t round;
+    int map_pending;        // slave: send the map once the sweep is back
+    uint64_t map_due_ns;    // master: waiting for the slave's map until then
+    scan_map local;
+    scan_map peer;
+    int have_local;
+    int have_peer;
+
+    // Shift handshake
+    int target;             // master: shift being negotiated, SCAN_NO_CHANGE if none
+    uint8_t epoch;
+    int tries;
+    uint64_t switch_ns;
+    int ack_shift;          // slave: answer to send, then move
+    uint8_t ack_epoch;
+
+    uint64_t last_rx_ns;
+
+    scan_stats stats;
+} scan_ctx;
+
+void scan_init(scan_ctx *ctx, int master, int period_ms, uint64_t now_ns);
+
+// Every intact frame
+void scan_rx_frame(scan_ctx *ctx, uint64_t now_ns);
+
+// 1 once the bridge must drain the tty and sweep the band
+int  scan_take_sweep(scan_ctx *ctx);
+
+// The local sweep came back
+void scan_set_local(scan_ctx *ctx, const scan_map *map, uint64_t now_ns);
+
+// A control message from the peer, 0 if it is not one
+int  scan_receive(scan_ctx *ctx, const uint8_t *msg, int len, uint64_t now_ns);
+
+// Next control message to send, 0 if there is none
+int  scan_poll(scan_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns);
+
+// Shift to apply once everything queued is on air, SCAN_NO_CHANGE if none
+int  scan_take_change(scan_ctx *ctx);
+
+// Nanoseconds until scan_poll() has something to do
+int64_t scan_time_left(const scan_ctx *ctx, uint64_t now_ns);
+
+// Change of shift with the quietest worst receiver, 'cost' gets its RSSI_LEVEL
+int  scan_best_move(const scan_map *a, const scan_map *b, int *cost);
+
+// Louder of the two receivers after moving by 'move', -1 if off the grid
+int  scan_move_cost(const scan_map *a, const scan_map *b, int move);
+
+// 'count' quietest channels of both maps at least 'gap' apart, in channel
+// order; returns how many were found
+int  scan_hop_set(const scan_map *a, const scan_map *b, int count, int gap, int *out);
+
+void scan_print_map(const scan_map *map, FILE *out);
+void scan_print_stats(scan_ctx *ctx, FILE *out);
+
+#endif
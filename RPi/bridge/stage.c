@@ -0,0 +1,62 @@
+/*
+    InverseG bridge - pipeline stage interface
+*/
+
+#include "stage.h"
+
+int pipeline_add(pipeline *p, stage s)
+{
+    if (p->nstages >= PIPELINE_MAX_STAGES)
+        return -1;
+
+    p->stages[p->nstages++] = s;
+    return 0;
+}
+
+int pipeline_tx(pipeline *p, uint8_t **buf, int len, int cap)
+{
+    for (int i = 0; i < p->nstages && len > 0; i++)
+    {
+        const stage *s = &p->stages[i];
+
+        *buf -= s->head;
+        len = s->tx(s->ctx, *buf, len + s->head, cap + s->head);
+        cap += s->head;
+    }
+
+    return len;
+}
+
+int pipeline_rx(pipeline *p, uint8_t **buf, int len, int cap)
+{
+    for (int i = p->nstages - 1; i >= 0 && len > 0; i--)
+    {
+        const stage *s = &p->stages[i];
+
+        len = s->rx(s->ctx, *buf, len, cap);
+        if (len >= 0 && s->head)
+        {
+            *buf += s->head;
+            cap -= s->head;
+        }
+    }
+
+    return len;
+}
+
+int pipeline_headroom(const pipeline *p)
+{
+    int head = 0;
+
+    for (int i = 0; i < p->nstages; i++)
+        head += p->stages[i].head;
+
+    return head;
+}
+
+void pipeline_print_stats(pipeline *p, FILE *out)
+{
+    for (int i = 0; i < p->nstages; i++)
+        if (p->stages[i].stats)
+            p->stages[i].stats(p->stages[i].ctx, out);
+}
@@ -0,0 +1,55 @@
+/*
+    InverseG bridge - pipeline stage interface
+
+    Every transform between the TUN interface and the radio (CRC, FEC, ...)
+    is a stage. On TX the stages run in order, on RX in reverse order.
+    Stages work in place on a buffer of 'cap' bytes and return the new
+    length, or a negative value to drop the packet.
+
+    A stage that puts a header in front of the packet says how long it is
+    in 'head' and does not move the packet for it: on TX the pipeline
+    steps back that many bytes and the stage finds them free at the start
+    of 'buf', on RX it finds its header there and returns the length after
+    it, and the pipeline steps over it. Buffers on the TX path keep
+    BRIDGE_HEADROOM bytes free in front for these headers, the ARQ, bond,
+    diversity and mesh ones and the frame header, see pbuf.h. The stages
+    do not check it, the bridge refuses to start when the headers of the
+    stages and options in use add up to more.
+*/
+
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define BRIDGE_BUF_SIZE     4096
+#define PIPELINE_MAX_STAGES 8
+#define BRIDGE_HEADROOM     64
+
+typedef struct stage {
+    const char *name;
+    int  (*tx)(void *ctx, uint8_t *buf, int len, int cap);
+    int  (*rx)(void *ctx, uint8_t *buf, int len, int cap);
+    void (*stats)(void *ctx, FILE *out);
+    void *ctx;
+    int head;               // header bytes in front of the packet
+} stage;
+
+typedef struct pipeline {
+    stage stages[PIPELINE_MAX_STAGES];
+    int nstages;
+} pipeline;
+
+int  pipeline_add(pipeline *p, stage s);
+
+// '*buf' moves back over the stage headers on TX and on over them on RX;
+// 'cap' is the room from '*buf' on
+int  pipeline_tx(pipeline *p, uint8_t **buf, int len, int cap);
+int  pipeline_rx(pipeline *p, uint8_t **buf, int len, int cap);
+
+// The headers the stages put in front, at most
+int  pipeline_headroom(const pipeline *p);
+void pipeline_print_stats(pipeline *p, FILE *out);
+
+#endif
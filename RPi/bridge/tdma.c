@@ -0,0 +1,393 @@
+/*
+    TDMA
+*/
+
+#include <string.h>
+
+#include "tdma.h"
+
+#define MS(x) ((uint64_t)(x) * 1000000ULL)
+
+static uint64_t tdma_rng(tdma_ctx *ctx)
+{
+    ctx->rng ^= ctx->rng << 13;
+    ctx->rng ^= ctx->rng >> 7;
+    ctx->rng ^= ctx->rng << 17;
+    return ctx->rng;
+}
+
+static int tdma_count(uint32_t mask)
+{
+    int n = 0;
+
+    for (; mask; mask &= mask - 1)
+        n++;
+    return n;
+}
+
+static uint64_t tdma_frame_len(const tdma_ctx *ctx)
+{
+    return ctx->slot_ns * ctx->nslots;
+}
+
+// Slots this node owns, and whether the firmware has to hear about it
+static void tdma_update_mask(tdma_ctx *ctx)
+{
+    uint32_t mask = 0;
+
+    for (int s = 0; s < ctx->nslots; s++)
+        if (ctx->owner[s] == ctx->id)
+            mask |= 1u << s;
+
+    if (mask != ctx->mask)
+        ctx->mask_changed = 1;
+    ctx->mask = mask;
+}
+
+void tdma_init(tdma_ctx *ctx, int id, int want, int nslots, int slot_ms, int guard_ms, uint64_t now_ns)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->id = id;
+    ctx->want = want > 0 ? want : 1;
+    ctx->rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)(id + 1) << 32) ^ now_ns;
+    if (ctx->rng == 0)
+        ctx->rng = 1;
+
+    if (id != TDMA_MASTER)
+        return;
+
+    ctx->nslots = nslots < 3 ? 3 : nslots > TDMA_MAX_SLOTS ? TDMA_MAX_SLOTS : nslots;
+    ctx->slot_ns = MS(slot_ms);
+    ctx->base_guard_ns = MS(guard_ms);
+    ctx->guard_ns = ctx->base_guard_ns;
+    ctx->frame_ns = now_ns;
+    ctx->synced = 1;
+    ctx->synced_now = 1;
+    ctx->beacon_due = 1;
+
+    memset(ctx->owner, TDMA_SLOT_FREE, sizeof(ctx->owner));
+    ctx->owner[0] = TDMA_MASTER;
+    ctx->owner[1] = TDMA_SLOT_CONTENTION;
+    tdma_update_mask(ctx);
+}
+
+void tdma_set_turnaround(tdma_ctx *ctx, uint64_t turn_ns)
+{
+    if (turn_ns > ctx->turn_ns)
+        ctx->turn_ns = turn_ns;
+}
+
+int tdma_slot(const tdma_ctx *ctx, uint64_t now_ns)
+{
+    if (!ctx->synced || ctx->nslots == 0)
+        return -1;
+
+    int64_t len = tdma_frame_len(ctx);
+    int64_t pos = (int64_t)(now_ns - ctx->frame_ns) % len;
+
+    if (pos < 0)
+        pos += len;
+    return (int)(pos / ctx->slot_ns);
+}
+
+// Time since the start of the slot now_ns falls in
+static uint64_t tdma_offset(const tdma_ctx *ctx, uint64_t now_ns)
+{
+    int64_t pos = (int64_t)(now_ns - ctx->frame_ns) % (int64_t)ctx->slot_ns;
+
+    return (uint64_t)(pos < 0 ? pos + (int64_t)ctx->slot_ns : pos);
+}
+
+static void tdma_advance(tdma_ctx *ctx, uint64_t now_ns)
+{
+    uint64_t len = tdma_frame_len(ctx);
+
+    if (!ctx->synced || len == 0 || now_ns < ctx->frame_ns + len)
+        return;
+
+    uint64_t n = (now_ns - ctx->frame_ns) / len;
+    ctx->frame_ns += n * len;
+    ctx->stats.frames += n;
+    if (ctx->id == TDMA_MASTER)
+        ctx->beacon_due = 1;
+}
+
+// Master only: drop silent owners, then hand out what is free
+static void tdma_reclaim(tdma_ctx *ctx, uint64_t now_ns)
+{
+    uint64_t idle = TDMA_IDLE_FRAMES * tdma_frame_len(ctx);
+
+    for (int s = 2; s < ctx->nslots; s++)
+        if (ctx->owner[s] != TDMA_SLOT_FREE && now_ns > ctx->heard_ns[s] + idle)
+        {
+            ctx->owner[s] = TDMA_SLOT_FREE;
+            ctx->stats.reclaims++;
+        }
+}
+
+static void tdma_grant(tdma_ctx *ctx, int node, int want, uint64_t now_ns)
+{
+    int have = 0;
+
+    for (int s = 2; s < ctx->nslots; s++)
+        if (ctx->owner[s] == node)
+        {
+            ctx->heard_ns[s] = now_ns;
+            have++;
+        }
+
+    for (int s = 2; s < ctx->nslots && have < want; s++)
+        if (ctx->owner[s] == TDMA_SLOT_FREE)
+        {
+            ctx->owner[s] = node;
+            ctx->heard_ns[s] = now_ns;
+            ctx->stats.grants++;
+            have++;
+        }
+
+    if (have < want)
+        ctx->stats.denied++;
+}
+
+int tdma_receive(tdma_ctx *ctx, const uint8_t *msg, int len, uint64_t start_ns, uint64_t now_ns)
+{
+    if (len < 2 || msg[0] != TDMA_TYPE)
+        return 0;
+
+    switch (msg[1])
+    {
+        case TDMA_MSG_BEACON:
+        {
+            int n = len >= 8 ? msg[3] : 0;
+            uint64_t slot_ns = MS((msg[4] << 8) | msg[5]);
+            uint64_t guard_ns = MS(msg[6]);
+
+            if (ctx->id == TDMA_MASTER || n < 3 || n > TDMA_MAX_SLOTS || len < 8 + n ||
+                slot_ns <= 2 * guard_ns)
+                break;
+
+            if (n != ctx->nslots || slot_ns != ctx->slot_ns || guard_ns != ctx->guard_ns)
+                ctx->mask_changed = 1;
+
+            ctx->seq = msg[2];
+            ctx->nslots = n;
+            ctx->slot_ns = slot_ns;
+            ctx->guard_ns = guard_ns;
+            ctx->frame_ns = start_ns - guard_ns - MS(msg[7]);
+            memcpy(ctx->owner, msg + 8, n);
+            tdma_update_mask(ctx);
+
+            ctx->synced = 1;
+            ctx->synced_now = 1;
+            ctx->last_beacon_ns = now_ns;
+            ctx->stats.beacons_rx++;
+            break;
+        }
+
+        case TDMA_MSG_REQUEST:
+            if (ctx->id == TDMA_MASTER && len >= 5 && msg[2] != TDMA_MASTER && msg[2] < TDMA_SLOT_CONTENTION)
+            {
+                ctx->stats.requests_rx++;
+                tdma_set_turnaround(ctx, MS(msg[4]));
+                tdma_grant(ctx, msg[2], msg[3], now_ns);
+            }
+            break;
+    }
+
+    return 1;
+}
+
+static int tdma_beacon(tdma_ctx *ctx, uint8_t *out, uint64_t late_ns)
+{
+    uint64_t guard_ms = (ctx->base_guard_ns + ctx->turn_ns + 999999) / 1000000;
+    uint64_t late_ms = late_ns / 1000000;
+
+    if (guard_ms > 255)
+        guard_ms = 255;
+    if (MS(guard_ms) != ctx->guard_ns)
+    {
+        ctx->guard_ns = MS(guard_ms);
+        ctx->mask_changed = 1;
+    }
+
+    out[0] = TDMA_TYPE;
+    out[1] = TDMA_MSG_BEACON;
+    out[2] = ++ctx->seq;
+    out[3] = (uint8_t)ctx->nslots;
+    out[4] = (uint8_t)((ctx->slot_ns / 1000000) >> 8);
+    out[5] = (uint8_t)(ctx->slot_ns / 1000000);
+    out[6] = (uint8_t)guard_ms;
+    out[7] = (uint8_t)(late_ms < 255 ? late_ms : 255);
+    memcpy(out + 8, ctx->owner, ctx->nslots);
+
+    ctx->beacon_due = 0;
+    ctx->synced_now = 1;
+    ctx->stats.beacons_tx++;
+    return 8 + ctx->nslots;
+}
+
+int tdma_poll(tdma_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns)
+{
+    if (cap < TDMA_BEACON_LEN)
+        return 0;
+
+    tdma_advance(ctx, now_ns);
+
+    int slot = tdma_slot(ctx, now_ns);
+    uint64_t off = slot >= 0 ? tdma_offset(ctx, now_ns) : 0;
+
+    if (ctx->id == TDMA_MASTER)
+    {
+        if (!ctx->beacon_due || off < ctx->guard_ns)
+            return 0;
+
+        // Too late to be any use, the nodes run on until the next one
+        if (slot != 0 || off > ctx->guard_ns + MS(255))
+        {
+            ctx->beacon_due = 0;
+            return 0;
+        }
+
+        tdma_reclaim(ctx, now_ns);
+        tdma_update_mask(ctx);
+        return tdma_beacon(ctx, out, off - ctx->guard_ns);
+    }
+
+    if (ctx->synced && now_ns > ctx->last_beacon_ns + TDMA_LOST_BEACONS * tdma_frame_len(ctx))
+    {
+        ctx->synced = 0;
+        ctx->mask = 0;
+        ctx->mask_changed = 1;
+        ctx->stats.sync_losses++;
+        return 0;
+    }
+
+    // One try per superframe, at a random point of the first half of the
+    // contention slot so that several askers rarely collide
+    if (ctx->synced && ctx->demand && tdma_count(ctx->mask) < ctx->want &&
+        ctx->owner[slot] == TDMA_SLOT_CONTENTION && off < ctx->slot_ns - ctx->guard_ns &&
+        ctx->asked_frame != ctx->stats.frames + 1)
+    {
+        if (ctx->ask_ns == 0)
+            ctx->ask_ns = ctx->guard_ns + 1 + tdma_rng(ctx) % ((ctx->slot_ns - 2 * ctx->guard_ns) / 2);
+        if (off < ctx->ask_ns)
+            return 0;
+
+        ctx->asked_frame = ctx->stats.frames + 1;
+        ctx->ask_ns = 0;
+
+        uint64_t turn_ms = (ctx->turn_ns + 999999) / 1000000;
+
+        ctx->demand = 0;
+        ctx->stats.requests_tx++;
+        out[0] = TDMA_TYPE;
+        out[1] = TDMA_MSG_REQUEST;
+        out[2] = (uint8_t)ctx->id;
+        out[3] = (uint8_t)ctx->want;
+        out[4] = (uint8_t)(turn_ms < 255 ? turn_ms : 255);
+        return 5;
+    }
+
+    return 0;
+}
+
+int tdma_may_send(tdma_ctx *ctx, uint64_t air_ns, uint64_t now_ns)
+{
+    int slot = tdma_slot(ctx, now_ns);
+
+    if (slot < 0)
+        return 0;
+
+    if (ctx->owner[slot] != ctx->id || (ctx->id == TDMA_MASTER && ctx->beacon_due))
+    {
+        if (tdma_count(ctx->mask) < ctx->want)
+            ctx->demand = 1;
+        return 0;
+    }
+
+    uint64_t off = tdma_offset(ctx, now_ns);
+    return off >= ctx->guard_ns && off + air_ns + ctx->guard_ns <= ctx->slot_ns;
+}
+
+void tdma_sent(tdma_ctx *ctx, uint64_t air_ns, uint64_t now_ns)
+{
+    int slot = tdma_slot(ctx, now_ns);
+
+    ctx->stats.tx_frames++;
+    if (slot >= 0)
+        ctx->stats.busy_ns[slot] += air_ns;
+}
+
+void tdma_heard(tdma_ctx *ctx, uint64_t air_ns, uint64_t start_ns)
+{
+    int slot = tdma_slot(ctx, start_ns);
+
+    if (slot < 0)
+        return;
+
+    ctx->stats.busy_ns[slot] += air_ns;
+    if (ctx->id == TDMA_MASTER)
+        ctx->heard_ns[slot] = start_ns;
+}
+
+int64_t tdma_time_left(const tdma_ctx *ctx, uint64_t now_ns)
+{
+    if (tdma_slot(ctx, now_ns) < 0)
+        return MS(1000);
+
+    uint64_t off = tdma_offset(ctx, now_ns);
+
+    if (ctx->ask_ns > off)
+        return ctx->ask_ns - off;
+    if (off < ctx->guard_ns)
+        return ctx->guard_ns - off;
+    return ctx->slot_ns - off + ctx->guard_ns;
+}
+
+double tdma_slot_utilization(const tdma_ctx *ctx, int slot)
+{
+    uint64_t frames = ctx->stats.frames ? ctx->stats.frames : 1;
+
+    if (slot < 0 || slot >= ctx->nslots || ctx->slot_ns == 0)
+        return 0;
+    return (double)ctx->stats.busy_ns[slot] / (frames * ctx->slot_ns);
+}
+
+double tdma_utilization(const tdma_ctx *ctx)
+{
+    double sum = 0;
+
+    for (int s = 0; s < ctx->nslots; s++)
+        sum += tdma_slot_utilization(ctx, s);
+    return ctx->nslots ? sum / ctx->nslots : 0;
+}
+
+void tdma_print_stats(tdma_ctx *ctx, FILE *out)
+{
+    tdma_stats *s = &ctx->stats;
+
+    fprintf(out, "tdma: node=%d %s slots=%d slot=%llums guard=%llums mask=0x%x frames=%llu "
+                 "beacons_tx=%llu beacons_rx=%llu requests_tx=%llu requests_rx=%llu grants=%llu "
+                 "denied=%llu reclaims=%llu sync_losses=%llu tx_frames=%llu utilization=%.1f%%\n",
+            ctx->id, ctx->synced ? "synced" : "unsynced", ctx->nslots,
+            (unsigned long long)(ctx->slot_ns / 1000000), (unsigned long long)(ctx->guard_ns / 1000000),
+            (unsigned)ctx->mask, (unsigned long long)s->frames,
+            (unsigned long long)s->beacons_tx, (unsigned long long)s->beacons_rx,
+            (unsigned long long)s->requests_tx, (unsigned long long)s->requests_rx,
+            (unsigned long long)s->grants, (unsigned long long)s->denied,
+            (unsigned long long)s->reclaims, (unsigned long long)s->sync_losses,
+            (unsigned long long)s->tx_frames, 100 * tdma_utilization(ctx));
+
+    fprintf(out, "tdma: slots");
+    for (int i = 0; i < ctx->nslots; i++)
+    {
+        if (ctx->owner[i] == TDMA_SLOT_FREE)
+            fprintf(out, " [%d free %.0f%%]", i, 100 * tdma_slot_utilization(ctx, i));
+        else if (ctx->owner[i] == TDMA_SLOT_CONTENTION)
+            fprintf(out, " [%d contention %.0f%%]", i, 100 * tdma_slot_utilization(ctx, i));
+        else
+            fprintf(out, " [%d node %d %.0f%%]", i, ctx->owner[i], 100 * tdma_slot_utilization(ctx, i));
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,130 @@
+/*
+    TDMA
+
+    Several nodes on one frequency take turns. The master (node 0) opens
+    every superframe of nslots slots with a beacon that says who owns
+    which slot:
+
+        master  0xF8 1 seq nslots slot_ms(2, BE) guard_ms late_ms owner[nslots]
+
+    Slot 0 is the master's, slot 1 is for contention (TDMA_SLOT_CONTENTION),
+    the rest are handed out. A node that has traffic and fewer slots than
+    it wants asks in the contention slot, at a random point of it so that
+    two askers do not collide every time:
+
+        node    0xF8 2 id want turnaround_ms
+
+    The master gives it free slots in the next beacon and takes a slot
+    back after TDMA_IDLE_FRAMES superframes in which nothing was heard in
+    it. The guard at both ends of every slot is the configured one plus
+    the longest TX turnaround any node reported, so a late start still
+    ends before the next owner keys up.
+
+    A node takes the superframe start from the beacon: it began on air
+    a guard plus late_ms after the start of slot 0. After
+    TDMA_LOST_BEACONS missed beacons it stops sending until it hears one
+    again.
+
+    The firmware keeps the slot clock as well (radio.h, D and Y) and
+    starts and cuts off the carrier on it; this side only decides which
+    frames fit in the window that is left.
+*/
+
+#ifndef TDMA_H
+#define TDMA_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TDMA_TYPE               0xF8
+#define TDMA_MSG_BEACON         1
+#define TDMA_MSG_REQUEST        2
+
+#define TDMA_MAX_SLOTS          16
+#define TDMA_BEACON_LEN         (8 + TDMA_MAX_SLOTS)
+#define TDMA_SLOT_FREE          0xFF
+#define TDMA_SLOT_CONTENTION    0xFE
+#define TDMA_MASTER             0
+#define TDMA_LOST_BEACONS       4
+#define TDMA_IDLE_FRAMES        8
+
+typedef struct tdma_stats {
+    uint64_t frames;            // superframes since start
+    uint64_t beacons_tx;
+    uint64_t beacons_rx;
+    uint64_t requests_tx;
+    uint64_t requests_rx;
+    uint64_t grants;            // slots handed out
+    uint64_t denied;            // requests with no slot free
+    uint64_t reclaims;          // slots taken back from silent nodes
+    uint64_t sync_losses;
+    uint64_t tx_frames;
+    uint64_t busy_ns[TDMA_MAX_SLOTS];   // airtime sent or heard per slot
+} tdma_stats;
+
+typedef struct tdma_ctx {
+    int id;
+    int want;                   // slots to ask for
+
+    // Superframe, set by the master or learnt from its beacon
+    int nslots;
+    uint64_t slot_ns;
+    uint64_t guard_ns;
+    uint8_t owner[TDMA_MAX_SLOTS];
+    uint64_t frame_ns;          // start of the current superframe
+    int synced;
+    uint8_t seq;
+    uint64_t last_beacon_ns;
+    uint32_t mask;              // slots this node owns
+    int mask_changed;           // the bridge must tell the firmware
+    int synced_now;             // a beacon went out or came in, ditto
+
+    // Master
+    uint64_t base_guard_ns;
+    uint64_t turn_ns;           // longest turnaround reported
+    uint64_t heard_ns[TDMA_MAX_SLOTS];
+    int beacon_due;
+
+    // Node
+    int demand;                 // a frame found no slot of ours
+    uint64_t asked_frame;       // superframe of the last request, +1
+    uint64_t ask_ns;            // when in the contention slot to ask, 0 not drawn yet
+    uint64_t rng;
+
+    tdma_stats stats;
+} tdma_ctx;
+
+// The master sets up nslots slots of slot_ms with guard_ms at both ends,
+// the other nodes take all of it from the beacon
+void tdma_init(tdma_ctx *ctx, int id, int want, int nslots, int slot_ms, int guard_ms, uint64_t now_ns);
+
+// This node's measured TX turnaround, reported with its requests
+void tdma_set_turnaround(tdma_ctx *ctx, uint64_t turn_ns);
+
+// A control message from another node, 0 if it is not one. 'start_ns' is
+// when the frame that carried it started on air.
+int  tdma_receive(tdma_ctx *ctx, const uint8_t *msg, int len, uint64_t start_ns, uint64_t now_ns);
+
+// Next control message to send, 0 if there is none
+int  tdma_poll(tdma_ctx *ctx, uint8_t *out, int cap, uint64_t now_ns);
+
+// 1 if a frame of 'air_ns' fits in our slot from now on
+int  tdma_may_send(tdma_ctx *ctx, uint64_t air_ns, uint64_t now_ns);
+
+// Occupancy: a frame sent, or heard starting at 'start_ns'
+void tdma_sent(tdma_ctx *ctx, uint64_t air_ns, uint64_t now_ns);
+void tdma_heard(tdma_ctx *ctx, uint64_t air_ns, uint64_t start_ns);
+
+// Slot 'now_ns' falls in, -1 out of sync
+int  tdma_slot(const tdma_ctx *ctx, uint64_t now_ns);
+
+// Nanoseconds until the next slot opens
+int64_t tdma_time_left(const tdma_ctx *ctx, uint64_t now_ns);
+
+// Share of the superframe airtime used, per slot and over all of them
+double tdma_slot_utilization(const tdma_ctx *ctx, int slot);
+double tdma_utilization(const tdma_ctx *ctx);
+
+void tdma_print_stats(tdma_ctx *ctx, FILE *out);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+    InverseG bridge - serial ports
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tty.h"
+
+static speed_t tty_speed(int baud)
+{
+    switch (baud)
+    {
+        case 600:    return B600;
+        case 1200:   return B1200;
+        case 2400:   return B2400;
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+        default:     return B0;
+    }
+}
+
+// Same as "stty -F <tty> raw <baud>"
+int tty_open(const char *name, int baud)
+{
+    struct termios tio;
+    speed_t speed = tty_speed(baud);
+    int fd;
+
+    if (speed == B0)
+    {
+        fprintf(stderr, "error: unsupported baud rate %d\n", baud);
+        return -1;
+    }
+
+    if (( fd = open(name, O_RDWR | O_NOCTTY) ) < 0)
+    {
+        fprintf(stderr, "error: open(%s): %s\n", name, strerror(errno));
+        return fd;
+    }
+
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    {
+        fprintf(stderr, "error: tcsetattr(%s): %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int tty_pending(int fd)
+{
+    int n = 0;
+
+    if (ioctl(fd, TIOCOUTQ, &n) < 0)
+        return 0;
+
+    return n;
+}
+
+// Waits for the queued bytes to leave, then changes the rate
+int tty_set_baud(int fd, int baud)
+{
+    struct termios tio;
+    speed_t speed = tty_speed(baud);
+
+    if (speed == B0)
+    {
+        fprintf(stderr, "error: unsupported baud rate %d\n", baud);
+        return -1;
+    }
+
+    tcdrain(fd);
+    tcgetattr(fd, &tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    {
+        fprintf(stderr, "error: tcsetattr: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void tty_drain(int fd)
+{
+    tcdrain(fd);
+}
+
+void tty_set_rts(int fd, int on)
+{
+    int bits = TIOCM_RTS;
+
+    ioctl(fd, on ? TIOCMBIS : TIOCMBIC, &bits);
+}
+
+int tty_cts(int fd)
+{
+    int bits = 0;
+
+    if (ioctl(fd, TIOCMGET, &bits) < 0)
+        return 0;
+
+    return (bits & TIOCM_CTS) != 0;
+}
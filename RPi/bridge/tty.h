@@ -0,0 +1,22 @@
+/*
+    InverseG bridge - serial ports
+*/
+
+#ifndef TTY_H
+#define TTY_H
+
+// Raw mode, no flow control
+int  tty_open(const char *name, int baud);
+int  tty_set_baud(int fd, int baud);
+
+// Blocks until everything written is on air
+void tty_drain(int fd);
+
+// Modem control lines, the listen-before-talk handshake with the firmware
+void tty_set_rts(int fd, int on);
+int  tty_cts(int fd);
+
+// Bytes still waiting in the tty driver, i.e. the radio is busy sending
+int  tty_pending(int fd);
+
+#endif